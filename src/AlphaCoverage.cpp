@@ -0,0 +1,135 @@
+// AlphaCoverage.cpp
+
+#include "AlphaCoverage.h"
+#include "BlockCompression.h"
+#include "DdsFile.h"
+#include "MipGenerator.h"
+#include <cstring>
+#include <stdio.h>
+
+namespace Vnm
+{
+    float CalcAlphaCoverage(const uint8_t* rgba, uint32_t width, uint32_t height, size_t rowPitch, float cutoff)
+    {
+        size_t passing = 0;
+        for (uint32_t y = 0; y < height; ++y)
+        {
+            const uint8_t* row = rgba + y * rowPitch;
+            for (uint32_t x = 0; x < width; ++x)
+            {
+                passing += row[4 * x + 3] >= cutoff * 255.0f ? 1 : 0;
+            }
+        }
+        return static_cast<float>(passing) / (static_cast<float>(width) * height);
+    }
+
+    std::string FormatCoverageReport(const CoverageReport& report)
+    {
+        char line[160];
+        snprintf(line, sizeof(line), "Alpha coverage at %.2f of %s\n  mip        size    source     error   rebuilt     error\n",
+            report.mCutoff, report.mName.c_str());
+        std::string text = line;
+
+        const float target = report.mMips.empty() ? 0.0f : report.mMips[0].mSourceCoverage;
+        for (size_t mip = 0; mip < report.mMips.size(); ++mip)
+        {
+            const MipCoverage& coverage = report.mMips[mip];
+            snprintf(line, sizeof(line), "  %3zu %5ux%-5u %9.4f %+9.4f %9.4f %+9.4f\n", mip, coverage.mWidth, coverage.mHeight,
+                coverage.mSourceCoverage, coverage.mSourceCoverage - target, coverage.mCoverage, coverage.mCoverage - target);
+            text += line;
+        }
+        return text;
+    }
+
+    static bool IsRgba8(uint32_t format)
+    {
+        return format == 28 || format == 29 || format == 87 || format == 91;  // R8G8B8A8 and B8G8R8A8, UNORM and SRGB
+    }
+
+    static bool IsBc1(uint32_t format)
+    {
+        return format >= 70 && format <= 72;
+    }
+
+    static bool IsBc3(uint32_t format)
+    {
+        return format >= 76 && format <= 78;
+    }
+
+    // RGBA8 pixels of a subresource, rows packed
+    static void DecodeSubresource(const uint8_t* data, const DdsSubresource& subresource, uint32_t format, std::vector<uint8_t>* rgba)
+    {
+        rgba->resize(static_cast<size_t>(subresource.mWidth) * subresource.mHeight * 4);
+        const uint8_t* src = data + subresource.mOffset;
+        if (IsRgba8(format))
+        {
+            const size_t rowSize = static_cast<size_t>(subresource.mWidth) * 4;
+            for (uint32_t y = 0; y < subresource.mHeight; ++y)
+            {
+                memcpy(rgba->data() + y * rowSize, src + y * subresource.mRowPitch, rowSize);
+            }
+        }
+        else
+        {
+            DecompressImage(src, subresource.mWidth, subresource.mHeight, IsBc1(format) ? BlockFormat::BC1 : BlockFormat::BC3, rgba->data());
+        }
+    }
+
+    bool PreserveDdsAlphaCoverage(const uint8_t* data, size_t size, float cutoff, ThreadPool* pool, std::vector<uint8_t>* output, CoverageReport* report)
+    {
+        DdsLayout layout;
+        if (!ParseDds(data, size, &layout) || layout.mDimension != DdsDimension::Texture2D || layout.mArraySize != 1 ||
+            !(IsRgba8(layout.mFormat) || IsBc1(layout.mFormat) || IsBc3(layout.mFormat)))
+        {
+            return false;
+        }
+
+        report->mCutoff = cutoff;
+        report->mMips.clear();
+        std::vector<uint8_t> pixels;
+        for (const DdsSubresource& subresource : layout.mSubresources)
+        {
+            DecodeSubresource(data, subresource, layout.mFormat, &pixels);
+            MipCoverage coverage;
+            coverage.mWidth = subresource.mWidth;
+            coverage.mHeight = subresource.mHeight;
+            coverage.mSourceCoverage = CalcAlphaCoverage(pixels.data(), subresource.mWidth, subresource.mHeight, static_cast<size_t>(subresource.mWidth) * 4, cutoff);
+            report->mMips.push_back(coverage);
+        }
+
+        MipGenParams params;
+        params.mAlphaCutoff = cutoff;
+        params.mMaxMips = layout.mMipCount;
+        MipChain chain;
+        DecodeSubresource(data, layout.mSubresources[0], layout.mFormat, &pixels);
+        GenerateMips(pixels.data(), layout.mWidth, layout.mHeight, static_cast<size_t>(layout.mWidth) * 4, params, pool, &chain);
+
+        // BC1 to BC3 of the same type, typeless, UNORM or SRGB
+        const uint32_t format = IsBc1(layout.mFormat) ? layout.mFormat + 6 : layout.mFormat;
+        output->clear();
+        AppendDdsHeader(format, layout.mWidth, layout.mHeight, layout.mMipCount, output);
+        for (size_t mip = 0; mip < chain.mLevels.size(); ++mip)
+        {
+            const MipLevel& level = chain.mLevels[mip];
+            const uint8_t* levelPixels = chain.mData.data() + level.mOffset;
+            const size_t offset = output->size();
+            if (IsRgba8(format))
+            {
+                output->insert(output->end(), levelPixels, levelPixels + level.mRowPitch * level.mHeight);
+            }
+            else
+            {
+                output->resize(offset + CalcCompressedSize(level.mWidth, level.mHeight, BlockFormat::BC3));
+                CompressImage(levelPixels, level.mWidth, level.mHeight, BlockFormat::BC3, output->data() + offset, pool);
+            }
+
+            // Coverage as the shader sees it, after block compression
+            DdsSubresource subresource = layout.mSubresources[mip];
+            subresource.mOffset = offset;
+            subresource.mRowPitch = level.mRowPitch;
+            DecodeSubresource(output->data(), subresource, format, &pixels);
+            report->mMips[mip].mCoverage = CalcAlphaCoverage(pixels.data(), level.mWidth, level.mHeight, level.mRowPitch, cutoff);
+        }
+        return true;
+    }
+}
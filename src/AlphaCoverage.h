@@ -0,0 +1,46 @@
+// AlphaCoverage.h
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace Vnm
+{
+    class ThreadPool;
+
+    // AlphaTestThreshold of shaders.hlsl, below which pixels are clipped
+    constexpr float kAlphaTestThreshold = 0.1f;
+
+    // Fraction of the pixels of an RGBA8 image that pass an alpha test at cutoff
+    float CalcAlphaCoverage(const uint8_t* rgba, uint32_t width, uint32_t height, size_t rowPitch, float cutoff);
+
+    // Coverage of one mip as the file had it and as rebuilt
+    class MipCoverage
+    {
+    public:
+        uint32_t mWidth = 0;
+        uint32_t mHeight = 0;
+        float    mSourceCoverage = 0.0f;
+        float    mCoverage = 0.0f;
+    };
+
+    class CoverageReport
+    {
+    public:
+        std::string              mName;
+        float                    mCutoff = 0.0f;
+        std::vector<MipCoverage> mMips;     // Mip 0 is the coverage the others aim for
+    };
+
+    // Table of the coverage of each mip and its difference to mip 0, before and after
+    std::string FormatCoverageReport(const CoverageReport& report);
+
+    // Rebuilds the mips of a 2D DDS file from its mip 0 so that each mip passes the alpha test at
+    // cutoff for as many pixels as mip 0 does, see MipGenParams::mAlphaCutoff. RGBA8 and BC3 files
+    // keep their format, BC1 files become BC3 as the scaled alpha needs more than one bit. Returns
+    // false for files of other formats or shapes, and for files ParseDds rejects.
+    bool PreserveDdsAlphaCoverage(const uint8_t* data, size_t size, float cutoff, ThreadPool* pool, std::vector<uint8_t>* output, CoverageReport* report);
+}
@@ -1,6 +1,9 @@
 // Application.cpp
 
 #include "Application.h"
+#include "D3d12Memory.h"
+#include "Profiler.h"
+#include <stdio.h>
 
 namespace Vnm
 {
@@ -13,10 +16,12 @@ namespace Vnm
     constexpr uint32_t StrafeLeftBit  = 1 << 6;
     constexpr uint32_t StrafeRightBit = 1 << 7;
 
-    static void HandleMovement(uint32_t key, Camera& camera)
+    static void HandleMovement(uint32_t key, float elapsedSeconds, Camera& camera)
     {
-        const float rotationScale = 0.01f;
-        const float forwardScale = 0.1f;
+        const float rotationSpeed = 0.6f;       // Half turns per second
+        const float moveSpeed = 6.0f;           // Units per second
+        const float rotationScale = rotationSpeed * elapsedSeconds;
+        const float forwardScale = moveSpeed * elapsedSeconds;
 
         if (key & MoveForwardBit)
         {
@@ -52,7 +57,9 @@ namespace Vnm
         }
     }
 
-    static void HandleMouse(const MouseState& mouseState, Camera& camera)
+    // Mouse look follows the pointer rather than time, so it turns both cameras the frame is
+    // interpolated between
+    static void HandleMouse(const MouseState& mouseState, Camera& camera, Camera& prevCamera)
     {
         static int prevMouseX = mouseState.mMouseX;
         static int prevMouseY = mouseState.mMouseY;
@@ -64,14 +71,55 @@ namespace Vnm
             float deltaX = ((float)mouseState.mMouseX - (float)prevMouseX) * rotationSpeedFactor;
             camera.Pitch(deltaY);
             camera.Yaw(deltaX);
+            prevCamera.Pitch(deltaY);
+            prevCamera.Yaw(deltaX);
         }
 
         prevMouseX = mouseState.mMouseX;
         prevMouseY = mouseState.mMouseY;
     }
 
+    // Keeps the camera at eye height above the terrain under it
+    static void FollowTerrain(const D3dContext& context, Camera& camera)
+    {
+        const float eyeHeight = 1.7f;
+        DirectX::XMVECTOR position = camera.GetPosition();
+        float height;
+        if (context.GetTerrainHeight(DirectX::XMVectorGetX(position), DirectX::XMVectorGetZ(position), &height))
+        {
+            camera.SetPosition(DirectX::XMVectorSetY(position, height + eyeHeight));
+        }
+    }
+
+    static Float3 ToFloat3(const DirectX::XMVECTOR& v)
+    {
+        DirectX::XMFLOAT3 result;
+        DirectX::XMStoreFloat3(&result, v);
+        return { result.x, result.y, result.z };
+    }
+
+    static CameraState GetCameraState(const Camera& camera)
+    {
+        CameraState state;
+        state.mPosition = ToFloat3(camera.GetPosition());
+        state.mForward = ToFloat3(camera.GetForward());
+        state.mUp = ToFloat3(camera.GetUp());
+        state.mRight = ToFloat3(camera.GetRight());
+        return state;
+    }
+
+    static Camera MakeCamera(const CameraState& state)
+    {
+        return Camera(
+            DirectX::XMVectorSet(state.mPosition.x, state.mPosition.y, state.mPosition.z, 1.0f),
+            DirectX::XMVectorSet(state.mForward.x, state.mForward.y, state.mForward.z, 0.0f),
+            DirectX::XMVectorSet(state.mUp.x, state.mUp.y, state.mUp.z, 0.0f),
+            DirectX::XMVectorSet(state.mRight.x, state.mRight.y, state.mRight.z, 0.0f));
+    }
+
     void Application::Startup(HINSTANCE instance, int cmdShow)
     {
+        SetProfilerThreadName("Main");
         // Create main window and device
         Window::WindowDesc winDesc;
         winDesc.mWidth = 2560;
@@ -79,22 +127,187 @@ namespace Vnm
         winDesc.mParentApplication = this;
         mWindow.Create(instance, cmdShow, winDesc);
 
-        mContext.Init(mWindow.GetHandle());
+        {
+            PROFILE_ZONE("D3dContext::Init");
+            uint64_t initTicks = GetClockTicks();
+            mContext.Init(mWindow.GetHandle());
+
+            // Compare with a start without shaders.cache and pipelines.cache in the working directory
+            char text[64];
+            snprintf(text, sizeof(text), "Startup: D3dContext::Init in %.1f ms\n", TicksToSeconds(GetClockTicks() - initTicks) * 1000.0);
+            OutputDebugStringA(text);
+        }
         mCamera.SetPosition(DirectX::XMVectorSet(0.0f, 0.0f, -10.0f, 0.0f));
+        mPrevCamera = mCamera;
+
+        // Events from startup are soon overwritten by frames, so they get a trace of their own
+        WriteChromeTrace("startup_trace.json");
+        ReportMemory();
     }
 
     void Application::Mainloop()
     {
-        HandleMovement(mMoveState, mCamera);
-        HandleMouse(mMouseState, mCamera);
+        PROFILE_ZONE("Frame");
+
+        if (mReplayPlayer.IsPlaying())
+        {
+            ReplayFrame();
+            return;
+        }
+
+        uint64_t now = GetClockTicks();
+        double frameSeconds = 0.0;
+        if (mLastFrameTicks != 0)
+        {
+            frameSeconds = TicksToSeconds(now - mLastFrameTicks);
+            mFrameTimes.Add(frameSeconds);
+        }
+        mLastFrameTicks = now;
+
+        HandleMouse(mMouseState, mCamera, mPrevCamera);
+
+        uint32_t steps = mTimestep.Advance(frameSeconds);
+        for (uint32_t i = 0; i < steps; ++i)
+        {
+            mPrevCamera = mCamera;
+            HandleMovement(mMoveState, static_cast<float>(mTimestep.GetStep()), mCamera);
+            if (mFollowTerrain)
+            {
+                FollowTerrain(mContext, mCamera);
+            }
+            if (mRecording)
+            {
+                mRecordedPath.AddFrame(GetCameraState(mCamera));
+            }
+        }
+
+        Camera camera = Camera::Lerp(mPrevCamera, mCamera, mTimestep.GetAlpha());
+        mContext.Update(camera.CalcLookAt(), static_cast<float>(frameSeconds));
+        mContext.Render();
+    }
+
+    void Application::ReportFrameTimes() const
+    {
+        FrameTimeStats stats;
+        mFrameTimes.CalcStats(&stats);
+
+        char message[192];
+        snprintf(message, sizeof(message), "Frame times over %zu frames: average %.2f ms, p50 %.2f ms, p95 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+            stats.mFrames, stats.mAverage * 1000.0, stats.mP50 * 1000.0, stats.mP95 * 1000.0, stats.mP99 * 1000.0, stats.mMax * 1000.0);
+        OutputDebugStringA(message);
+
+        const RenderQueueStats& queueStats = mContext.mQueueStats;
+        snprintf(message, sizeof(message), "  Last frame: %zu draws, %zu pipeline, %zu material and %zu mesh changes\n",
+            queueStats.mDraws, queueStats.mPipelineChanges, queueStats.mMaterialChanges, queueStats.mMeshChanges);
+        OutputDebugStringA(message);
+
+        const OverdrawStats& overdrawStats = mContext.mOverdrawEstimator.GetStats();
+        snprintf(message, sizeof(message), "  Estimated depth complexity %.2f, shaded overdraw %.2f\n",
+            overdrawStats.GetDepthComplexity(), overdrawStats.GetShadedOverdraw());
+        OutputDebugStringA(message);
+
+        for (const GpuZoneStats& zone : mContext.mGpuTimer.GetStats())
+        {
+            zone.mHistory.CalcStats(&stats);
+            snprintf(message, sizeof(message), "  GPU %s: last %.3f ms, p50 %.3f ms, p95 %.3f ms, p99 %.3f ms\n",
+                zone.mName, zone.mLastMs, stats.mP50 * 1000.0, stats.mP95 * 1000.0, stats.mP99 * 1000.0);
+            OutputDebugStringA(message);
+        }
+    }
+
+    void Application::ReportMemory() const
+    {
+        OutputDebugStringA(FormatMemoryReport().c_str());
+        OutputDebugStringA(FormatVideoMemoryInfo(mContext.mDevice.Get()).c_str());
+    }
+
+    bool Application::StartReplay(const char* pathFileName, const char* csvFileName)
+    {
+        if (!mReplayPath.Load(pathFileName))
+        {
+            return false;
+        }
+
+        static const char* const columns[] = { "frame", "update_ms", "render_ms", "draw_calls", "pipeline_changes", "material_changes", "mesh_changes",
+            "depth_complexity", "shaded_overdraw", "hiz_visible" };
+        mReplayLog.SetColumns(columns, sizeof(columns) / sizeof(columns[0]));
+        mReplayCsvFileName = csvFileName;
+        mFrameTimes.Clear();
+        mReplayPlayer.Start(&mReplayPath);
+        return true;
+    }
+
+    // Replay runs one recorded step per frame whatever the frame takes, so every run renders the same
+    // views. Render includes the wait for the previous frame on the GPU.
+    void Application::ReplayFrame()
+    {
+        CameraState state;
+        const InputEvent* events = nullptr;
+        size_t numEvents = 0;
+        size_t frame = mReplayPlayer.GetFrame();
+        if (!mReplayPlayer.Advance(&state, &events, &numEvents))
+        {
+            if (!mReplayLog.WriteCsv(mReplayCsvFileName.c_str()))
+            {
+                OutputDebugStringA("Failed to write replay timings\n");
+            }
+            ReportFrameTimes();
+            PostQuitMessage(0);
+            return;
+        }
+
+        for (size_t i = 0; i < numEvents; ++i)
+        {
+            if (events[i].mType == keyDownEvent)
+            {
+                OnKeyDown(events[i].mKey);
+            }
+            else
+            {
+                OnKeyUp(events[i].mKey);
+            }
+        }
 
-        static uint32_t lastTime = GetTickCount();
-        uint32_t elapsedTime = GetTickCount() - lastTime;
-        lastTime = GetTickCount();
-        float elapsedSeconds = static_cast<float>(elapsedTime) * 0.001f;
+        mCamera = MakeCamera(state);
+        mPrevCamera = mCamera;
 
-        mContext.Update(mCamera.CalcLookAt(), elapsedSeconds);
+        uint64_t startTicks = GetClockTicks();
+        mContext.Update(mCamera.CalcLookAt(), static_cast<float>(mReplayPath.GetStep()));
+        uint64_t updateTicks = GetClockTicks();
         mContext.Render();
+        uint64_t renderTicks = GetClockTicks();
+
+        mFrameTimes.Add(TicksToSeconds(renderTicks - startTicks));
+        double row[] =
+        {
+            static_cast<double>(frame),
+            TicksToSeconds(updateTicks - startTicks) * 1000.0,
+            TicksToSeconds(renderTicks - updateTicks) * 1000.0,
+            static_cast<double>(mContext.mQueueStats.mDraws),
+            static_cast<double>(mContext.mQueueStats.mPipelineChanges),
+            static_cast<double>(mContext.mQueueStats.mMaterialChanges),
+            static_cast<double>(mContext.mQueueStats.mMeshChanges),
+            mContext.mOverdrawEstimator.GetStats().GetDepthComplexity(),
+            mContext.mOverdrawEstimator.GetStats().GetShadedOverdraw(),
+            static_cast<double>(mContext.mHiZVisibleCount)
+        };
+        mReplayLog.AddRow(row);
+    }
+
+    void Application::ToggleRecording()
+    {
+        const char* fileName = "camera_path.vcam";
+        mRecording = !mRecording;
+        if (mRecording)
+        {
+            mRecordedPath.Clear(mTimestep.GetStep());
+            return;
+        }
+
+        char message[128];
+        bool saved = mRecordedPath.Save(fileName);
+        snprintf(message, sizeof(message), saved ? "Recorded %zu frames to %s\n" : "Failed to write %zu frames to %s\n", mRecordedPath.GetFrameCount(), fileName);
+        OutputDebugStringA(message);
     }
 
     void Application::Shutdown()
@@ -104,6 +317,11 @@ namespace Vnm
 
     void Application::OnKeyUp(UINT8 key)
     {
+        if (mRecording && key != 'R')
+        {
+            mRecordedPath.AddEvent(keyUpEvent, key);
+        }
+
         switch (key)
         {
         case VK_SPACE:
@@ -138,10 +356,45 @@ namespace Vnm
 
     void Application::OnKeyDown(UINT8 key)
     {
+        if (mRecording && key != 'R')
+        {
+            mRecordedPath.AddEvent(keyDownEvent, key);
+        }
+
         switch (key)
         {
         case VK_TAB:
             break;
+        case 'P':
+            mContext.mDepthPrepass = !mContext.mDepthPrepass;
+            break;
+        case 'O':
+            mContext.mOcclusionCulling = !mContext.mOcclusionCulling;
+            break;
+        case 'H':
+            mContext.mHiZCulling = !mContext.mHiZCulling;
+            break;
+        case 'I':
+            mContext.mIndirectDraws = !mContext.mIndirectDraws;
+            break;
+        case 'G':
+            mFollowTerrain = !mFollowTerrain;
+            break;
+        case 'F':
+            ReportFrameTimes();
+            break;
+        case 'M':
+            ReportMemory();
+            break;
+        case 'T':
+            OutputDebugStringA(WriteChromeTrace("trace.json") ? "Wrote trace.json\n" : "Failed to write trace.json\n");
+            break;
+        case 'R':
+            if (!mReplayPlayer.IsPlaying())
+            {
+                ToggleRecording();
+            }
+            break;
         case VK_SPACE:
         case 'W':
             mMoveState |= MoveForwardBit;
@@ -187,6 +440,15 @@ namespace Vnm
         if (buttonMask & RightMouseButtonBit)
         {
             mMouseState.mRightButtonDown = true;
+
+            SceneHit hit;
+            Float3 position;
+            if (mContext.Pick(mCamera, mMouseState.mMouseX, mMouseState.mMouseY, &hit, &position))
+            {
+                char message[128];
+                snprintf(message, sizeof(message), "Picked instance %u mesh %u triangle %u at %.2f %.2f %.2f\n", hit.mInstance, hit.mMesh, hit.mTriangle, position.x, position.y, position.z);
+                OutputDebugStringA(message);
+            }
         }
     }
 
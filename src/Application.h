@@ -4,7 +4,9 @@
 
 #include "Window.h"
 #include "Camera.h"
+#include "CameraPath.h"
 #include "D3d12Context.h"
+#include "FrameTimer.h"
 
 namespace Vnm
 {
@@ -37,17 +39,44 @@ namespace Vnm
         void Mainloop();
         void Shutdown();
 
+        // Plays a recorded camera path one step per frame as fast as possible, writes the CPU time of
+        // every frame to csvFileName and quits at the end
+        bool StartReplay(const char* pathFileName, const char* csvFileName);
+
         void OnKeyUp(UINT8 key);
         void OnKeyDown(UINT8 key);
         void OnMouseDown(uint32_t buttonMask);
         void OnMouseUp(uint32_t buttonMask);
         void OnMouseMove(int x, int y);
 
+        const FrameTimeHistory& GetFrameTimes() const { return mFrameTimes; }
+
     private:
+        void ReportFrameTimes() const;
+        void ReportMemory() const;
+        void ReplayFrame();
+        void ToggleRecording();
+
+        static constexpr double kTimestep = 1.0 / 120.0;
+        static constexpr uint32_t kMaxStepsPerFrame = 30;
+
         Window     mWindow;
         D3dContext mContext;
         Camera     mCamera;
+        Camera     mPrevCamera;                         // Camera before the last fixed step
         MouseState mMouseState;
         uint32_t   mMoveState = 0;
+        bool       mFollowTerrain = false;
+
+        FixedTimestep    mTimestep = FixedTimestep(kTimestep, kMaxStepsPerFrame);
+        FrameTimeHistory mFrameTimes;
+        uint64_t         mLastFrameTicks = 0;
+
+        CameraPath       mRecordedPath;
+        bool             mRecording = false;
+        CameraPath       mReplayPath;
+        CameraPathPlayer mReplayPlayer;
+        FrameLog         mReplayLog;
+        std::string      mReplayCsvFileName;
     };
 }
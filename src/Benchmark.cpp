@@ -0,0 +1,3135 @@
+// Benchmark.cpp
+
+#include "Benchmark.h"
+#include "AlphaCoverage.h"
+#include "BlockCompression.h"
+#include "CameraPath.h"
+#include "DescriptorAllocator.h"
+#include "DdsFile.h"
+#include "DdsFuzz.h"
+#include "DdsUpload.h"
+#include "FrameTimer.h"
+#include "GpuTimer.h"
+#include "HiZCulling.h"
+#include "HiZPyramid.h"
+#include "ImageDecoder.h"
+#include "IndirectArgs.h"
+#include "MappedFile.h"
+#include "Material.h"
+#include "MemoryTracker.h"
+#include "MipGenerator.h"
+#include "Overdraw.h"
+#include "Profiler.h"
+#include "RenderQueue.h"
+#include "SceneBvh.h"
+#include "ShaderCache.h"
+#include "SoftwareOcclusion.h"
+#include "TextureStreaming.h"
+#include "TexturePacker.h"
+#include "ThreadPool.h"
+#include "TreePlacement.h"
+#include "TriangleBvh.h"
+#include "UploadRing.h"
+#include "stb_image_write.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <random>
+
+namespace Vnm
+{
+    class BenchmarkTimer
+    {
+    public:
+        BenchmarkTimer() : mStart(GetClockTicks()) {}
+
+        double ElapsedMs() const
+        {
+            return TicksToSeconds(GetClockTicks() - mStart) * 1000.0;
+        }
+
+    private:
+        uint64_t mStart;
+    };
+
+    static void BenchmarkMaterials(FILE* out)
+    {
+        size_t errors = 0;
+        MaterialLibrary library;
+
+        // Files are deduplicated by name when added
+        const uint32_t barkFile = library.AddTextureFile("bark.dds");
+        const uint32_t leafFile = library.AddTextureFile("leaf.dds");
+        const uint32_t copyFile = library.AddTextureFile("leaf_copy.dds");
+        errors += library.AddTextureFile("bark.dds") != barkFile;
+        errors += barkFile == leafFile || leafFile == copyFile;
+
+        // Embedded images by content, including their size
+        std::vector<uint8_t> pixels(16 * 16 * 4);
+        for (size_t i = 0; i < pixels.size(); ++i)
+        {
+            pixels[i] = static_cast<uint8_t>(i * 7);
+        }
+        std::vector<uint8_t> samePixels = pixels;
+        std::vector<uint8_t> otherPixels = pixels;
+        otherPixels[100] ^= 1;
+        const uint32_t image = library.AddTexturePixels(pixels.data(), 16, 16);
+        errors += library.AddTexturePixels(samePixels.data(), 16, 16) != image;
+        errors += library.AddTexturePixels(otherPixels.data(), 16, 16) == image;
+        errors += library.AddTexturePixels(pixels.data(), 32, 8) == image;
+
+        const uint32_t barkMaterial = library.AddMaterial({ barkFile, false });
+        const uint32_t leafMaterial = library.AddMaterial({ leafFile, true });
+        const uint32_t copyMaterial = library.AddMaterial({ copyFile, true });
+        errors += library.AddMaterial({ barkFile, false }) != barkMaterial;
+        errors += library.AddMaterial({ barkFile, true }) == barkMaterial;
+        errors += library.GetMaterialTexture(library.AddMaterial({ InvalidIndex, false })) != InvalidIndex;
+
+        // Files by content once loaded, the later one maps to the earlier
+        const size_t uniqueBefore = library.GetUniqueTextureCount();
+        errors += library.ResolveTextureContent(barkFile, 1) != barkFile;
+        errors += library.ResolveTextureContent(leafFile, 2) != leafFile;
+        errors += library.ResolveTextureContent(copyFile, 2) != leafFile;
+        errors += library.GetUniqueTextureCount() != uniqueBefore - 1;
+        errors += library.GetCanonicalTexture(copyFile) != leafFile;
+        errors += library.GetMaterialTexture(copyMaterial) != leafFile || library.GetMaterialTexture(leafMaterial) != leafFile;
+        errors += library.GetMaterialTexture(barkMaterial) != barkFile;
+        errors += library.Report().find("duplicate of") == std::string::npos;
+
+        // A scene's worth of file textures with a quarter of the content unique
+        const uint32_t fileCount = 2000;
+        const uint32_t contentCount = fileCount / 4;
+        MaterialLibrary scene;
+        BenchmarkTimer timer;
+        for (uint32_t i = 0; i < fileCount; ++i)
+        {
+            const uint32_t texture = scene.AddTextureFile("texture_" + std::to_string(i) + ".dds");
+            const uint32_t canonical = scene.ResolveTextureContent(texture, HashBytes(&i, sizeof(i)) % contentCount + 1);
+            errors += scene.GetCanonicalTexture(texture) != canonical;
+            scene.AddMaterial({ texture, (i & 1) != 0 });
+        }
+        const double ms = timer.ElapsedMs();
+        std::vector<uint32_t> firstOfContent(contentCount + 1, InvalidIndex);
+        for (uint32_t i = 0; i < fileCount; ++i)
+        {
+            uint32_t& first = firstOfContent[HashBytes(&i, sizeof(i)) % contentCount + 1];
+            first = first == InvalidIndex ? i : first;
+            errors += scene.GetCanonicalTexture(i) != first;
+        }
+        const size_t unique = static_cast<size_t>(std::count_if(firstOfContent.begin(), firstOfContent.end(), [](uint32_t first) { return first != InvalidIndex; }));
+        errors += scene.GetUniqueTextureCount() != unique;
+        fprintf(out, "  %u textures, %zu unique, %zu materials in %.2f ms\n", fileCount, scene.GetUniqueTextureCount(), scene.GetMaterialCount(), ms);
+
+        if (errors > 0)
+        {
+            fprintf(out, "  ERROR: %zu material library errors\n", errors);
+        }
+    }
+
+    // Counts state changes without touching a device
+    class CountingBackend : public RenderQueueBackend
+    {
+    public:
+        void SetPipeline(uint32_t) override {}
+        void SetMaterial(uint32_t) override {}
+        void SetMesh(uint32_t) override {}
+        void Draw(uint32_t mesh, uint32_t instance) override { mChecksum += mesh ^ instance; }
+
+        uint64_t mChecksum = 0;
+    };
+
+    static void BenchmarkRenderQueue(FILE* out)
+    {
+        const size_t numItems = 100000;
+        const int numIterations = 100;
+
+        std::mt19937 rng(1234);
+        std::uniform_int_distribution<uint32_t> pipelineDist(0, 3);
+        std::uniform_int_distribution<uint32_t> materialDist(0, 63);
+        std::uniform_int_distribution<uint32_t> meshDist(0, 255);
+        std::uniform_int_distribution<uint32_t> depthDist(0, (1u << SortKeyDepthBits) - 1);
+
+        std::vector<uint64_t> keys(numItems);
+        for (auto& key : keys)
+        {
+            key = MakeSortKey(pipelineDist(rng), materialDist(rng), meshDist(rng), depthDist(rng));
+        }
+
+        RenderQueue queue;
+        queue.Reserve(numItems);
+        CountingBackend backend;
+
+        // Unsorted submission for comparison
+        for (size_t i = 0; i < numItems; ++i)
+        {
+            queue.Add(keys[i], static_cast<uint32_t>(i));
+        }
+        RenderQueueStats unsortedStats = queue.Submit(backend);
+
+        double buildMs = 0.0;
+        double sortMs = 0.0;
+        double submitMs = 0.0;
+        RenderQueueStats sortedStats;
+
+        for (int iteration = 0; iteration < numIterations; ++iteration)
+        {
+            BenchmarkTimer buildTimer;
+            queue.Clear();
+            for (size_t i = 0; i < numItems; ++i)
+            {
+                queue.Add(keys[i], static_cast<uint32_t>(i));
+            }
+            buildMs += buildTimer.ElapsedMs();
+
+            BenchmarkTimer sortTimer;
+            queue.Sort();
+            sortMs += sortTimer.ElapsedMs();
+
+            BenchmarkTimer submitTimer;
+            sortedStats = queue.Submit(backend);
+            submitMs += submitTimer.ElapsedMs();
+        }
+
+        for (size_t i = 1; i < queue.GetCount(); ++i)
+        {
+            if (queue.GetItems()[i - 1].mSortKey > queue.GetItems()[i].mSortKey)
+            {
+                fprintf(out, "  ERROR: queue not sorted at item %zu\n", i);
+                break;
+            }
+        }
+
+        fprintf(out, "  %zu items, %d iterations\n", numItems, numIterations);
+        fprintf(out, "  build %.3f ms, sort %.3f ms, submit %.3f ms per frame\n", buildMs / numIterations, sortMs / numIterations, submitMs / numIterations);
+        fprintf(out, "  unsorted: %zu pipeline, %zu material, %zu mesh changes\n", unsortedStats.mPipelineChanges, unsortedStats.mMaterialChanges, unsortedStats.mMeshChanges);
+        fprintf(out, "  sorted:   %zu pipeline, %zu material, %zu mesh changes\n", sortedStats.mPipelineChanges, sortedStats.mMaterialChanges, sortedStats.mMeshChanges);
+    }
+
+    // A hand-checked layout of full screen, quarter screen and depth-only draws, then random draws
+    // in front to back and back to front order
+    static void BenchmarkOverdraw(FILE* out)
+    {
+        size_t errors = 0;
+        OverdrawEstimator estimator;
+        estimator.Begin(10, 10);
+        estimator.AddDraw(0.0f, 0.0f, 1.0f, 1.0f, 1.0f, 2.0f, OverdrawWritesDepth);        // 100 covered, 100 shaded
+        estimator.AddDraw(0.0f, 0.0f, 1.0f, 1.0f, 5.0f, 6.0f, OverdrawWritesDepth);        // 100 covered, hidden
+        estimator.AddDraw(0.0f, 0.0f, 0.5f, 0.5f, 0.5f, 0.6f, OverdrawWritesDepth);        // 25 covered, 25 shaded
+        estimator.AddDraw(0.5f, 0.0f, 1.0f, 1.0f, 0.2f, 0.3f, OverdrawDepthOnly | OverdrawWritesDepth);
+        estimator.AddDraw(0.0f, 0.0f, 1.0f, 1.0f, 0.35f, 0.4f, 0);                         // 100 covered, left half shaded
+        estimator.AddDraw(1.5f, 0.0f, 2.0f, 1.0f, 0.1f, 0.2f, OverdrawWritesDepth);        // Off screen
+        const OverdrawStats& stats = estimator.GetStats();
+        errors += stats.mScreenTiles != 100 || stats.mCoveredFragments != 325 || stats.mShadedFragments != 175;
+        errors += stats.GetDepthComplexity() != 3.25f || stats.GetShadedOverdraw() != 1.75f;
+
+        // Tree-sized draws over a 1600p screen in 40 pixel tiles, like the viewer
+        const size_t numDraws = 2000;
+        std::mt19937 rng(28);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        std::vector<Float4> draws(numDraws);
+        for (Float4& draw : draws)
+        {
+            draw = { unit(rng), unit(rng), 0.02f + 0.05f * unit(rng), 1.0f + 100.0f * unit(rng) };
+        }
+        auto estimate = [&](float* depthComplexity, float* shadedOverdraw)
+        {
+            estimator.Begin(64, 40);
+            for (const Float4& draw : draws)
+            {
+                estimator.AddDraw(draw.x - draw.z, draw.y - draw.z, draw.x + draw.z, draw.y + draw.z, draw.w, draw.w + 1.0f, OverdrawWritesDepth);
+            }
+            *depthComplexity = estimator.GetStats().GetDepthComplexity();
+            *shadedOverdraw = estimator.GetStats().GetShadedOverdraw();
+        };
+
+        std::sort(draws.begin(), draws.end(), [](const Float4& a, const Float4& b) { return a.w > b.w; });
+        float backToFrontComplexity = 0.0f;
+        float backToFront = 0.0f;
+        estimate(&backToFrontComplexity, &backToFront);
+
+        std::reverse(draws.begin(), draws.end());
+        float frontToBackComplexity = 0.0f;
+        float frontToBack = 0.0f;
+        BenchmarkTimer timer;
+        estimate(&frontToBackComplexity, &frontToBack);
+        const double ms = timer.ElapsedMs();
+
+        // Order changes what is shaded but not what is covered, and the nearest layer is always shaded
+        errors += frontToBackComplexity != backToFrontComplexity;
+        errors += frontToBack > backToFront || frontToBack < 1.0f || backToFront > backToFrontComplexity;
+        fprintf(out, "  %zu draws in %.2f ms, depth complexity %.2f, shaded overdraw %.2f front to back, %.2f back to front\n",
+            numDraws, ms, frontToBackComplexity, frontToBack, backToFront);
+
+        if (errors > 0)
+        {
+            fprintf(out, "  ERROR: %zu overdraw errors\n", errors);
+        }
+    }
+
+    static float SyntheticTerrainHeight(float x, float z)
+    {
+        return 6.0f * sinf(x * 0.15f) * cosf(z * 0.12f) + 3.0f * sinf(x * 0.05f + z * 0.08f);
+    }
+
+    static void BuildSyntheticTerrain(int gridSize, float terrainExtent, OccluderMesh* terrainOut)
+    {
+        OccluderMesh& terrain = *terrainOut;
+        terrain.mPositions.clear();
+        terrain.mIndices.clear();
+        for (int z = 0; z <= gridSize; ++z)
+        {
+            for (int x = 0; x <= gridSize; ++x)
+            {
+                float worldX = (static_cast<float>(x) / gridSize - 0.5f) * terrainExtent;
+                float worldZ = (static_cast<float>(z) / gridSize - 0.5f) * terrainExtent;
+                terrain.mPositions.push_back(worldX);
+                terrain.mPositions.push_back(SyntheticTerrainHeight(worldX, worldZ));
+                terrain.mPositions.push_back(worldZ);
+            }
+        }
+        for (int z = 0; z < gridSize; ++z)
+        {
+            for (int x = 0; x < gridSize; ++x)
+            {
+                uint32_t i = z * (gridSize + 1) + x;
+                uint32_t quad[6] = { i, i + gridSize + 1, i + 1, i + 1, i + gridSize + 1, i + gridSize + 2 };
+                terrain.mIndices.insert(terrain.mIndices.end(), quad, quad + 6);
+            }
+        }
+    }
+
+    // One orbit close to the ground of the synthetic terrain, looking across it
+    static void BuildOrbitPath(int numFrames, CameraPath* path)
+    {
+        path->Clear(1.0 / 60.0);
+        for (int frame = 0; frame < numFrames; ++frame)
+        {
+            float angle = static_cast<float>(frame) / numFrames * 6.2831853f;
+            Float3 eye = { 30.0f * cosf(angle), 0.0f, 30.0f * sinf(angle) };
+            eye.y = SyntheticTerrainHeight(eye.x, eye.z) + 2.0f;
+            Float3 target = { -eye.x, eye.y - 4.0f, -eye.z };
+
+            CameraState state;
+            state.mPosition = eye;
+            state.mForward = Normalize(target - eye);
+            state.mRight = Normalize(Cross({ 0.0f, 1.0f, 0.0f }, state.mForward));
+            state.mUp = Cross(state.mForward, state.mRight);
+            path->AddFrame(state);
+        }
+    }
+
+    // Straightforward depth raster at pixel centers, the reference the occlusion buffer is checked against
+    static void RasterizeReferenceDepth(const OccluderMesh& mesh, const Float4x4& viewProj, uint32_t width, uint32_t height, std::vector<float>* depth)
+    {
+        depth->assign(size_t(width) * height, 1.0f);
+        for (size_t index = 0; index + 2 < mesh.mIndices.size(); index += 3)
+        {
+            Float4 clip[3];
+            for (int i = 0; i < 3; ++i)
+            {
+                const float* position = &mesh.mPositions[mesh.mIndices[index + i] * 3];
+                clip[i] = TransformPoint({ position[0], position[1], position[2] }, viewProj);
+            }
+
+            Float4 clipped[4];
+            int numClipped = 0;
+            for (int i = 0; i < 3; ++i)
+            {
+                const Float4& a = clip[i];
+                const Float4& b = clip[(i + 1) % 3];
+                if (a.z >= 0.0f)
+                {
+                    clipped[numClipped++] = a;
+                }
+                if ((a.z >= 0.0f) != (b.z >= 0.0f))
+                {
+                    const float t = a.z / (a.z - b.z);
+                    clipped[numClipped++] = { a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t, a.z + (b.z - a.z) * t, a.w + (b.w - a.w) * t };
+                }
+            }
+
+            Float3 screen[4];
+            for (int i = 0; i < numClipped; ++i)
+            {
+                screen[i] = { (clipped[i].x / clipped[i].w * 0.5f + 0.5f) * width, (0.5f - clipped[i].y / clipped[i].w * 0.5f) * height, clipped[i].z / clipped[i].w };
+            }
+
+            for (int triangle = 0; triangle + 2 < numClipped; ++triangle)
+            {
+                const Float3& p0 = screen[0];
+                const Float3& p1 = screen[triangle + 1];
+                const Float3& p2 = screen[triangle + 2];
+                const float area = (p1.x - p0.x) * (p2.y - p0.y) - (p2.x - p0.x) * (p1.y - p0.y);
+                if (fabsf(area) < 1e-6f)
+                {
+                    continue;
+                }
+
+                const int minX = (std::max)(0, static_cast<int>(floorf((std::min)({ p0.x, p1.x, p2.x }))));
+                const int maxX = (std::min)(static_cast<int>(width) - 1, static_cast<int>((std::max)({ p0.x, p1.x, p2.x })));
+                const int minY = (std::max)(0, static_cast<int>(floorf((std::min)({ p0.y, p1.y, p2.y }))));
+                const int maxY = (std::min)(static_cast<int>(height) - 1, static_cast<int>((std::max)({ p0.y, p1.y, p2.y })));
+                for (int y = minY; y <= maxY; ++y)
+                {
+                    for (int x = minX; x <= maxX; ++x)
+                    {
+                        const float px = x + 0.5f;
+                        const float py = y + 0.5f;
+                        const float w0 = ((p1.x - px) * (p2.y - py) - (p2.x - px) * (p1.y - py)) / area;
+                        const float w1 = ((p2.x - px) * (p0.y - py) - (p0.x - px) * (p2.y - py)) / area;
+                        const float w2 = 1.0f - w0 - w1;
+                        if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+                        {
+                            continue;
+                        }
+                        float& pixel = (*depth)[size_t(y) * width + x];
+                        pixel = (std::min)(pixel, w0 * p0.z + w1 * p1.z + w2 * p2.z);
+                    }
+                }
+            }
+        }
+    }
+
+    // Whether any reference pixel under the screen rectangle of the box is not in front of its nearest corner
+    static bool IsBoxVisibleInReference(const Aabb& box, const Float4x4& worldViewProj, const std::vector<float>& depth, uint32_t width, uint32_t height)
+    {
+        float minX = 1e30f;
+        float minY = 1e30f;
+        float maxX = -1e30f;
+        float maxY = -1e30f;
+        float minZ = 1.0f;
+        for (int i = 0; i < 8; ++i)
+        {
+            Float3 corner = { (i & 1) ? box.mMax.x : box.mMin.x, (i & 2) ? box.mMax.y : box.mMin.y, (i & 4) ? box.mMax.z : box.mMin.z };
+            Float4 clip = TransformPoint(corner, worldViewProj);
+            if (clip.z < 0.0f || clip.w <= 0.0f)
+            {
+                return true;
+            }
+            minX = (std::min)(minX, (clip.x / clip.w * 0.5f + 0.5f) * width);
+            maxX = (std::max)(maxX, (clip.x / clip.w * 0.5f + 0.5f) * width);
+            minY = (std::min)(minY, (0.5f - clip.y / clip.w * 0.5f) * height);
+            maxY = (std::max)(maxY, (0.5f - clip.y / clip.w * 0.5f) * height);
+            minZ = (std::min)(minZ, clip.z / clip.w);
+        }
+
+        const int x0 = (std::max)(0, static_cast<int>(floorf(minX)));
+        const int x1 = (std::min)(static_cast<int>(width) - 1, static_cast<int>(floorf(maxX)));
+        const int y0 = (std::max)(0, static_cast<int>(floorf(minY)));
+        const int y1 = (std::min)(static_cast<int>(height) - 1, static_cast<int>(floorf(maxY)));
+        for (int y = y0; y <= y1; ++y)
+        {
+            for (int x = x0; x <= x1; ++x)
+            {
+                if (minZ <= depth[size_t(y) * width + x])
+                {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    // Rolling hills with trees scattered over them, viewed along a camera path orbiting close to the
+    // ground. The path goes through a file and back like a recording would, and the time of every
+    // frame is written to occlusion_frames.csv. On some frames every instance culled as occluded is
+    // checked against a full resolution depth raster.
+    static void BenchmarkOcclusion(FILE* out)
+    {
+        const int gridSize = 128;
+        const float terrainExtent = 100.0f;
+        const size_t numTrees = 4096;
+        const int numFrames = 120;
+
+        OccluderMesh terrain;
+        BuildSyntheticTerrain(gridSize, terrainExtent, &terrain);
+
+        Aabb treeBounds;
+        treeBounds.mMin = { -1.0f, 0.0f, -1.0f };
+        treeBounds.mMax = { 1.0f, 5.0f, 1.0f };
+
+        std::mt19937 rng(1234);
+        std::uniform_real_distribution<float> positionDist(-0.5f * terrainExtent, 0.5f * terrainExtent);
+        std::uniform_real_distribution<float> scaleDist(0.5f, 1.5f);
+        std::vector<Float4x4> treeWorld(numTrees);
+        for (auto& world : treeWorld)
+        {
+            float x = positionDist(rng);
+            float z = positionDist(rng);
+            float scale = scaleDist(rng);
+            world =
+            {{
+                { scale, 0.0f, 0.0f, 0.0f },
+                { 0.0f, scale, 0.0f, 0.0f },
+                { 0.0f, 0.0f, scale, 0.0f },
+                { x, SyntheticTerrainHeight(x, z), z, 1.0f }
+            }};
+        }
+
+        const Float4x4 proj = PerspectiveFovLH(1.0f, 2560.0f / 1600.0f, 0.1f, 100.0f);
+        OcclusionBuffer buffer;
+        OcclusionStats totals;
+        double rasterMs = 0.0;
+        double testMs = 0.0;
+
+        CameraPath recordedPath;
+        BuildOrbitPath(numFrames, &recordedPath);
+        CameraPath path;
+        if (!recordedPath.Save("occlusion_path.vcam") || !path.Load("occlusion_path.vcam") ||
+            path.GetFrameCount() != recordedPath.GetFrameCount() ||
+            memcmp(&path.GetFrame(0), &recordedPath.GetFrame(0), numFrames * sizeof(CameraState)) != 0)
+        {
+            fprintf(out, "  ERROR: camera path does not survive a save and load\n");
+            return;
+        }
+
+        // Frame and event counts that do not match the file size are rejected before allocating
+        std::vector<char> pathData;
+        {
+            MappedFile file;
+            if (file.Open("occlusion_path.vcam"))
+            {
+                pathData.assign(file.GetData(), file.GetData() + file.GetSize());
+            }
+        }
+        const size_t countOffsets[] = { 16, 20 };
+        for (size_t offset : countOffsets)
+        {
+            std::vector<char> damaged = pathData;
+            const uint32_t hugeCount = 0xfffffff0u;
+            memcpy(damaged.data() + offset, &hugeCount, sizeof(hugeCount));
+            std::ofstream("occlusion_damaged.vcam", std::ios::out | std::ios::binary | std::ios::trunc).write(damaged.data(), damaged.size());
+            CameraPath damagedPath;
+            if (damagedPath.Load("occlusion_damaged.vcam") || damagedPath.GetFrameCount() != 0)
+            {
+                fprintf(out, "  ERROR: camera path with a damaged count loaded\n");
+            }
+        }
+        std::ofstream("occlusion_damaged.vcam", std::ios::out | std::ios::binary | std::ios::trunc).write(pathData.data(), pathData.size() - 1);
+        CameraPath truncatedPath;
+        if (truncatedPath.Load("occlusion_damaged.vcam"))
+        {
+            fprintf(out, "  ERROR: truncated camera path loaded\n");
+        }
+        std::remove("occlusion_damaged.vcam");
+
+        static const char* const columns[] = { "frame", "rasterize_ms", "test_ms", "occluded" };
+        FrameLog frameLog;
+        frameLog.SetColumns(columns, sizeof(columns) / sizeof(columns[0]));
+        FrameTimeHistory frameTimes;
+
+        const uint32_t referenceWidth = 2560;
+        const uint32_t referenceHeight = 1600;
+        const size_t referenceFrameInterval = 10;
+        std::vector<float> referenceDepth;
+        std::vector<OcclusionResult> results(numTrees);
+        size_t referenceChecks = 0;
+        size_t referenceErrors = 0;
+
+        CameraPathPlayer player;
+        player.Start(&path);
+        CameraState camera;
+        const InputEvent* events = nullptr;
+        size_t numEvents = 0;
+        while (player.Advance(&camera, &events, &numEvents))
+        {
+            Float4x4 viewProj = Multiply(LookAtLH(camera.mPosition, camera.mPosition + camera.mForward, camera.mUp), proj);
+
+            BenchmarkTimer rasterTimer;
+            buffer.Clear();
+            buffer.RasterizeMesh(terrain, viewProj);
+            buffer.BuildHierarchy();
+            double frameRasterMs = rasterTimer.ElapsedMs();
+            rasterMs += frameRasterMs;
+
+            BenchmarkTimer testTimer;
+            for (size_t i = 0; i < numTrees; ++i)
+            {
+                results[i] = buffer.TestBox(treeBounds, Multiply(treeWorld[i], viewProj));
+            }
+            double frameTestMs = testTimer.ElapsedMs();
+            testMs += frameTestMs;
+
+            if ((player.GetFrame() - 1) % referenceFrameInterval == 0)
+            {
+                RasterizeReferenceDepth(terrain, viewProj, referenceWidth, referenceHeight, &referenceDepth);
+                for (size_t i = 0; i < numTrees; ++i)
+                {
+                    if (results[i] == OcclusionResult::Occluded)
+                    {
+                        referenceChecks++;
+                        referenceErrors += IsBoxVisibleInReference(treeBounds, Multiply(treeWorld[i], viewProj), referenceDepth, referenceWidth, referenceHeight);
+                    }
+                }
+            }
+
+            const OcclusionStats& stats = buffer.GetStats();
+            double row[] = { static_cast<double>(player.GetFrame() - 1), frameRasterMs, frameTestMs, static_cast<double>(stats.mOccluded) };
+            frameLog.AddRow(row);
+            frameTimes.Add((frameRasterMs + frameTestMs) * 1e-3);
+
+            totals.mOccluderTriangles += stats.mOccluderTriangles;
+            totals.mTested += stats.mTested;
+            totals.mOutsideFrustum += stats.mOutsideFrustum;
+            totals.mOccluded += stats.mOccluded;
+        }
+
+        fprintf(out, "  %zu occluder triangles, %zu instances, %d frames, %ux%u buffer\n", terrain.mIndices.size() / 3, numTrees, numFrames, OcclusionBuffer::kWidth, OcclusionBuffer::kHeight);
+        fprintf(out, "  rasterize %.3f ms, test %.3f ms per frame\n", rasterMs / numFrames, testMs / numFrames);
+        fprintf(out, "  outside frustum %.1f%%, occluded %.1f%%, culled %.1f%%\n",
+            100.0 * totals.mOutsideFrustum / totals.mTested, 100.0 * totals.mOccluded / totals.mTested, 100.0 * totals.GetCulledRatio());
+
+        FrameTimeStats frameStats;
+        frameTimes.CalcStats(&frameStats);
+        fprintf(out, "  frame p50 %.3f ms, p95 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+            frameStats.mP50 * 1000.0, frameStats.mP95 * 1000.0, frameStats.mP99 * 1000.0, frameStats.mMax * 1000.0);
+        fprintf(out, "  %zu occluded instances checked against a %ux%u reference\n", referenceChecks, referenceWidth, referenceHeight);
+        if (referenceErrors > 0)
+        {
+            fprintf(out, "  ERROR: %zu instances culled that the reference sees\n", referenceErrors);
+        }
+        if (!frameLog.WriteCsv("occlusion_frames.csv") || frameLog.GetRowCount() != static_cast<size_t>(numFrames))
+        {
+            fprintf(out, "  ERROR: failed to write occlusion_frames.csv\n");
+        }
+    }
+
+    // Synthetic depth buffer with a near ridge across the lower half of the screen, tested against
+    // random spheres. Every sphere the pyramid culls is checked against the full resolution depth.
+    static void BenchmarkHiZ(FILE* out)
+    {
+        const uint32_t width = 2560;
+        const uint32_t height = 1600;
+        const size_t numSpheres = 100000;
+        const float nearZ = 0.1f;
+        const float farZ = 100.0f;
+
+        const Float4x4 proj = PerspectiveFovLH(1.0f, static_cast<float>(width) / height, nearZ, farZ);
+        HiZProjection projection;
+        projection.mScaleX = proj.m[0][0];
+        projection.mScaleY = proj.m[1][1];
+        projection.mZScale = proj.m[2][2];
+        projection.mZOffset = proj.m[3][2];
+        projection.mNearZ = nearZ;
+
+        std::vector<float> depth(size_t(width) * height);
+        for (uint32_t y = 0; y < height; ++y)
+        {
+            for (uint32_t x = 0; x < width; ++x)
+            {
+                float ridge = 0.55f + 0.1f * sinf(x * 0.01f);
+                float viewZ = 20.0f + 10.0f * sinf(x * 0.003f);
+                depth[y * width + x] = static_cast<float>(y) / height > ridge ? projection.mZScale + projection.mZOffset / viewZ : 1.0f;
+            }
+        }
+
+        HiZPyramid pyramid;
+        BenchmarkTimer buildTimer;
+        pyramid.Build(depth.data(), width, height);
+        double buildMs = buildTimer.ElapsedMs();
+
+        std::mt19937 rng(1234);
+        std::uniform_real_distribution<float> zDist(1.0f, 80.0f);
+        std::uniform_real_distribution<float> xyDist(-1.0f, 1.0f);
+        std::uniform_real_distribution<float> radiusDist(0.1f, 3.0f);
+        std::vector<Float4> spheres(numSpheres);
+        for (auto& sphere : spheres)
+        {
+            sphere.z = zDist(rng);
+            sphere.x = xyDist(rng) * sphere.z / projection.mScaleX;
+            sphere.y = xyDist(rng) * sphere.z / projection.mScaleY;
+            sphere.w = radiusDist(rng);
+        }
+
+        size_t culled = 0;
+        std::vector<uint8_t> visible(numSpheres);
+        BenchmarkTimer testTimer;
+        for (size_t i = 0; i < numSpheres; ++i)
+        {
+            visible[i] = pyramid.TestSphere({ spheres[i].x, spheres[i].y, spheres[i].z }, spheres[i].w, projection);
+            culled += visible[i] ? 0 : 1;
+        }
+        double testMs = testTimer.ElapsedMs();
+
+        // Reference test at full resolution over the same rectangle, on a subset since it is slow
+        const size_t numReferenceSpheres = numSpheres / 20;
+        size_t referenceCulled = 0;
+        size_t exactCulled = 0;
+        size_t errors = 0;
+        for (size_t i = 0; i < numReferenceSpheres; ++i)
+        {
+            float minU;
+            float minV;
+            float maxU;
+            float maxV;
+            float nearestDepth;
+            bool exactVisible = true;
+            if (HiZProjectSphere(spheres[i].x, spheres[i].y, spheres[i].z, spheres[i].w,
+                projection.mScaleX, projection.mScaleY, projection.mZScale, projection.mZOffset, projection.mNearZ,
+                minU, minV, maxU, maxV, nearestDepth))
+            {
+                exactVisible = !HiZRectOffscreen(minU, minV, maxU, maxV);
+                if (exactVisible)
+                {
+                    float maxDepth = 0.0f;
+                    for (uint32_t y = HiZTexelCoord(minV, height); y <= HiZTexelCoord(maxV, height); ++y)
+                    {
+                        for (uint32_t x = HiZTexelCoord(minU, width); x <= HiZTexelCoord(maxU, width); ++x)
+                        {
+                            maxDepth = (std::max)(maxDepth, depth[y * width + x]);
+                        }
+                    }
+                    exactVisible = nearestDepth <= maxDepth;
+                }
+            }
+
+            referenceCulled += visible[i] ? 0 : 1;
+            exactCulled += exactVisible ? 0 : 1;
+            if (exactVisible && !visible[i])
+            {
+                errors++;
+            }
+        }
+
+        // The projected rectangle must contain the projection of the sphere surface
+        size_t boundsErrors = 0;
+        std::uniform_real_distribution<float> directionDist(-1.0f, 1.0f);
+        for (size_t i = 0; i < 1000; ++i)
+        {
+            const Float4& sphere = spheres[i];
+            float minU;
+            float minV;
+            float maxU;
+            float maxV;
+            float nearestDepth;
+            if (!HiZProjectSphere(sphere.x, sphere.y, sphere.z, sphere.w,
+                projection.mScaleX, projection.mScaleY, projection.mZScale, projection.mZOffset, projection.mNearZ,
+                minU, minV, maxU, maxV, nearestDepth))
+            {
+                continue;
+            }
+
+            for (int j = 0; j < 64; ++j)
+            {
+                Float3 direction = Normalize({ directionDist(rng), directionDist(rng), directionDist(rng) });
+                Float3 point = Float3{ sphere.x, sphere.y, sphere.z } + direction * sphere.w;
+                float u = 0.5f + 0.5f * projection.mScaleX * point.x / point.z;
+                float v = 0.5f - 0.5f * projection.mScaleY * point.y / point.z;
+                float pointDepth = projection.mZScale + projection.mZOffset / point.z;
+                const float epsilon = 1e-4f;
+                if (u < minU - epsilon || u > maxU + epsilon || v < minV - epsilon || v > maxV + epsilon || pointDepth < nearestDepth - epsilon)
+                {
+                    boundsErrors++;
+                }
+            }
+        }
+
+        fprintf(out, "  %ux%u depth, %u levels, %zu spheres\n", width, height, pyramid.GetLevelCount(), numSpheres);
+        fprintf(out, "  build %.3f ms, test %.3f ms (%.1f ns per sphere)\n", buildMs, testMs, testMs * 1e6 / numSpheres);
+        fprintf(out, "  culled %.1f%%\n", 100.0 * culled / numSpheres);
+        fprintf(out, "  first %zu spheres: culled %.1f%%, full resolution reference %.1f%%\n", numReferenceSpheres,
+            100.0 * referenceCulled / numReferenceSpheres, 100.0 * exactCulled / numReferenceSpheres);
+        if (errors > 0 || boundsErrors > 0)
+        {
+            fprintf(out, "  ERROR: %zu visible spheres culled, %zu surface points outside bounds\n", errors, boundsErrors);
+        }
+    }
+
+    // Compacts indirect draws for a scene shaped like the viewer's (terrain, two instanced tree
+    // models with opaque and alpha-tested meshes) and validates the argument buffer format
+    static void BenchmarkIndirect(FILE* out)
+    {
+        const uint32_t numInstances = 100000;
+        const int numIterations = 100;
+        enum { opaque, alphaTestDepth, alphaTestedEqual, numPipelines };
+
+        // Signature layout must match IndirectDrawCommand
+        CommandSignatureBuilder signature = MakeIndirectDrawSignature(2);
+        std::string error;
+        bool layoutOk = signature.Validate(&error) &&
+            signature.GetByteStride() == sizeof(IndirectDrawCommand) &&
+            signature.GetArguments()[0].mOffset == offsetof(IndirectDrawCommand, mInstanceOffset) &&
+            signature.GetArguments()[1].mOffset == offsetof(IndirectDrawCommand, mVertexBuffer) &&
+            signature.GetArguments()[2].mOffset == offsetof(IndirectDrawCommand, mIndexBuffer) &&
+            signature.GetArguments()[3].mOffset == offsetof(IndirectDrawCommand, mDraw);
+        if (!layoutOk)
+        {
+            fprintf(out, "  ERROR: indirect draw signature does not match IndirectDrawCommand %s\n", error.c_str());
+        }
+
+        CommandSignatureBuilder badSignature;
+        badSignature.AddDrawIndexed().AddVertexBufferView(0);
+        if (badSignature.Validate(nullptr))
+        {
+            fprintf(out, "  ERROR: signature with draw before the last argument passed validation\n");
+        }
+
+        const IndirectModelRange models[] = { { 0, 1 }, { 1, numInstances / 2 }, { numInstances / 2, numInstances } };
+        const uint32_t meshModels[] = { 0, 1, 1, 1, 1, 2, 2 };
+        const bool meshAlphaTested[] = { false, false, false, true, true, false, true };
+        const uint32_t numModels = sizeof(models) / sizeof(models[0]);
+        const uint32_t numMeshes = sizeof(meshModels) / sizeof(meshModels[0]);
+
+        std::vector<IndirectDrawCommand> templates;
+        std::vector<IndirectCommandInfo> infos;
+        for (uint32_t pipeline = 0; pipeline < numPipelines; ++pipeline)
+        {
+            uint32_t regionBase = static_cast<uint32_t>(templates.size());
+            for (uint32_t mesh = 0; mesh < numMeshes; ++mesh)
+            {
+                if (meshAlphaTested[mesh] != (pipeline != opaque))
+                {
+                    continue;
+                }
+
+                IndirectDrawCommand command = {};
+                command.mInstanceOffset = models[meshModels[mesh]].mFirstInstance;
+                command.mMaterial = mesh;
+                command.mDraw.mIndexCountPerInstance = 3 * (mesh + 1);
+                templates.push_back(command);
+
+                IndirectCommandInfo info;
+                info.mModel = meshModels[mesh];
+                info.mPipeline = pipeline;
+                info.mRegionBase = regionBase;
+                infos.push_back(info);
+            }
+        }
+
+        IndirectDrawCompactor compactor;
+        compactor.Init(templates.data(), infos.data(), templates.size(), models, numModels, numPipelines);
+
+        std::mt19937 rng(1234);
+        std::vector<uint32_t> visible;
+        for (uint32_t i = 0; i < numInstances; ++i)
+        {
+            if (rng() % 10 < 6)
+            {
+                visible.push_back(i);
+            }
+        }
+        std::shuffle(visible.begin(), visible.end(), rng);
+
+        BenchmarkTimer compactTimer;
+        for (int iteration = 0; iteration < numIterations; ++iteration)
+        {
+            compactor.Compact(visible.data(), static_cast<uint32_t>(visible.size()));
+        }
+        double compactMs = compactTimer.ElapsedMs();
+
+        if (!compactor.Validate(visible.data(), static_cast<uint32_t>(visible.size()), &error))
+        {
+            fprintf(out, "  ERROR: %s\n", error.c_str());
+        }
+
+        // A model with no visible instances drops its commands
+        std::vector<uint32_t> treesOnly;
+        for (uint32_t instance : visible)
+        {
+            if (instance >= models[1].mFirstInstance && instance < models[1].mEndInstance)
+            {
+                treesOnly.push_back(instance);
+            }
+        }
+        compactor.Compact(treesOnly.data(), static_cast<uint32_t>(treesOnly.size()));
+        if (!compactor.Validate(treesOnly.data(), static_cast<uint32_t>(treesOnly.size()), &error) || compactor.GetPipelineCounts()[opaque] != 2)
+        {
+            fprintf(out, "  ERROR: compaction with empty models %s\n", error.c_str());
+        }
+
+        // Validation must catch a dropped instance
+        std::vector<uint32_t> missing = treesOnly;
+        missing.push_back(models[2].mFirstInstance);
+        if (compactor.Validate(missing.data(), static_cast<uint32_t>(missing.size()), nullptr))
+        {
+            fprintf(out, "  ERROR: validation missed an undrawn instance\n");
+        }
+
+        fprintf(out, "  %u instances, %zu visible, %zu templates, %u byte stride\n", numInstances, visible.size(), templates.size(), signature.GetByteStride());
+        fprintf(out, "  compact %.3f ms per frame\n", compactMs / numIterations);
+    }
+
+    // Counts point pairs closer than minDistance in xz with a brute force bucket search
+    static size_t CountCloserPairs(const std::vector<Float3>& points, float minDistance)
+    {
+        std::vector<std::pair<int64_t, uint32_t>> buckets;
+        for (uint32_t i = 0; i < points.size(); ++i)
+        {
+            int64_t x = static_cast<int64_t>(floorf(points[i].x / minDistance));
+            int64_t z = static_cast<int64_t>(floorf(points[i].z / minDistance));
+            buckets.push_back({ (x << 32) ^ (z & 0xffffffff), i });
+        }
+        std::sort(buckets.begin(), buckets.end());
+
+        size_t closer = 0;
+        for (uint32_t i = 0; i < points.size(); ++i)
+        {
+            int64_t x = static_cast<int64_t>(floorf(points[i].x / minDistance));
+            int64_t z = static_cast<int64_t>(floorf(points[i].z / minDistance));
+            for (int64_t dz = -1; dz <= 1; ++dz)
+            {
+                for (int64_t dx = -1; dx <= 1; ++dx)
+                {
+                    int64_t key = ((x + dx) << 32) ^ ((z + dz) & 0xffffffff);
+                    auto it = std::lower_bound(buckets.begin(), buckets.end(), std::make_pair(key, 0u));
+                    for (; it != buckets.end() && it->first == key; ++it)
+                    {
+                        const Float3& q = points[it->second];
+                        float distX = points[i].x - q.x;
+                        float distZ = points[i].z - q.z;
+                        closer += it->second > i && distX * distX + distZ * distZ < minDistance * minDistance ? 1 : 0;
+                    }
+                }
+            }
+        }
+        return closer;
+    }
+
+    // Places trees on a finely tessellated synthetic terrain with one thread and with every hardware
+    // thread, the results must be identical and respect the distance, height and slope masks
+    static void BenchmarkPlacement(FILE* out)
+    {
+        OccluderMesh terrain;
+        BuildSyntheticTerrain(512, 100.0f, &terrain);
+
+        TreePlacementParams params;
+        params.mSeed = 42;
+        params.mMinDistance = 0.1f;
+        params.mMinHeight = -4.0f;
+        params.mMaxSlopeDegrees = 35.0f;
+
+        ThreadPool serialPool(1);
+        ThreadPool pool;
+        TreePlacement serial;
+        TreePlacement parallel;
+
+        BenchmarkTimer serialTimer;
+        serial.Place(&terrain, 1, params, &serialPool);
+        double serialMs = serialTimer.ElapsedMs();
+
+        const int numIterations = 2;
+        BenchmarkTimer parallelTimer;
+        for (int i = 0; i < numIterations; ++i)
+        {
+            parallel.Place(&terrain, 1, params, &pool);
+        }
+        double parallelMs = parallelTimer.ElapsedMs() / numIterations;
+
+        const TreePlacementStats& stats = parallel.GetStats();
+        fprintf(out, "  %zu triangles (%zu too steep), %zu candidates, %zu masked, %zu too close, %zu accepted\n",
+            stats.mTriangles, stats.mSlopeRejectedTriangles, stats.mCandidates, stats.mMaskRejected, stats.mDistanceRejected, stats.mAccepted);
+        fprintf(out, "  1 thread %.1f ms, %u threads %.1f ms, %.1f M candidates/s\n",
+            serialMs, pool.GetThreadCount(), parallelMs, stats.mCandidates / parallelMs * 1e-3);
+
+        const std::vector<Float3>& points = parallel.GetPoints();
+        if (serial.GetPoints().size() != points.size() ||
+            memcmp(serial.GetPoints().data(), points.data(), points.size() * sizeof(Float3)) != 0)
+        {
+            fprintf(out, "  ERROR: placement depends on the thread count\n");
+        }
+
+        size_t closer = CountCloserPairs(points, params.mMinDistance);
+        size_t belowMinHeight = 0;
+        for (const Float3& p : points)
+        {
+            belowMinHeight += p.y < params.mMinHeight ? 1 : 0;
+        }
+        if (closer > 0 || belowMinHeight > 0)
+        {
+            fprintf(out, "  ERROR: %zu pairs closer than the minimum distance, %zu points below the minimum height\n", closer, belowMinHeight);
+        }
+
+        // A different seed gives a different placement, a point limit keeps a prefix
+        params.mSeed = 43;
+        params.mMaxPoints = 1000;
+        serial.Place(&terrain, 1, params, &serialPool);
+        if (serial.GetPoints().size() != 1000 || memcmp(serial.GetPoints().data(), points.data(), sizeof(Float3)) == 0)
+        {
+            fprintf(out, "  ERROR: seed or point limit ignored\n");
+        }
+    }
+
+    // Reference closest hit against every triangle
+    static float BruteForceRaycast(const OccluderMesh* meshes, size_t numMeshes, const Ray& ray)
+    {
+        float closest = ray.mMaxDistance;
+        for (size_t iMesh = 0; iMesh < numMeshes; ++iMesh)
+        {
+            const OccluderMesh& mesh = meshes[iMesh];
+            for (size_t i = 0; i < mesh.mIndices.size(); i += 3)
+            {
+                const float* a = &mesh.mPositions[3 * mesh.mIndices[i + 0]];
+                const float* b = &mesh.mPositions[3 * mesh.mIndices[i + 1]];
+                const float* c = &mesh.mPositions[3 * mesh.mIndices[i + 2]];
+                Float3 vertex = { a[0], a[1], a[2] };
+                Float3 edge1 = Float3{ b[0], b[1], b[2] } - vertex;
+                Float3 edge2 = Float3{ c[0], c[1], c[2] } - vertex;
+
+                Float3 p = Cross(ray.mDirection, edge2);
+                float det = Dot(edge1, p);
+                if (det == 0.0f)
+                {
+                    continue;
+                }
+                Float3 s = ray.mOrigin - vertex;
+                float u = Dot(s, p) / det;
+                Float3 q = Cross(s, edge1);
+                float v = Dot(ray.mDirection, q) / det;
+                float t = Dot(edge2, q) / det;
+                if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t > ray.mMinDistance && t < closest)
+                {
+                    closest = t;
+                }
+            }
+        }
+        return closest;
+    }
+
+    // Ray queries against a finely tessellated synthetic terrain split over two meshes: picking rays
+    // from above, height snapping and line of sight between points just above the ground
+    static void BenchmarkRaycast(FILE* out)
+    {
+        const float terrainExtent = 100.0f;
+        const size_t numRays = 1 << 20;
+
+        OccluderMesh terrain[2];
+        BuildSyntheticTerrain(512, terrainExtent, &terrain[0]);
+        terrain[1].mPositions = terrain[0].mPositions;
+        terrain[1].mIndices.assign(terrain[0].mIndices.begin() + terrain[0].mIndices.size() / 2, terrain[0].mIndices.end());
+        terrain[0].mIndices.resize(terrain[0].mIndices.size() / 2);
+
+        ThreadPool serialPool(1);
+        ThreadPool pool;
+        TriangleBvh serialBvh;
+        TriangleBvh bvh;
+
+        BenchmarkTimer serialBuildTimer;
+        serialBvh.Build(terrain, 2, &serialPool);
+        double serialBuildMs = serialBuildTimer.ElapsedMs();
+        BenchmarkTimer buildTimer;
+        bvh.Build(terrain, 2, &pool);
+        double buildMs = buildTimer.ElapsedMs();
+
+        const TriangleBvhStats& stats = bvh.GetStats();
+        fprintf(out, "  %zu triangles, %zu nodes, %zu leaves, %zu packets, depth %u\n",
+            stats.mTriangles, stats.mNodes, stats.mLeaves, stats.mPackets, stats.mMaxDepth);
+        fprintf(out, "  build: 1 thread %.1f ms, %u threads %.1f ms\n", serialBuildMs, pool.GetThreadCount(), buildMs);
+
+        std::mt19937 rng(77);
+        std::uniform_real_distribution<float> positionDist(-0.45f * terrainExtent, 0.45f * terrainExtent);
+        std::uniform_real_distribution<float> heightDist(12.0f, 25.0f);
+
+        // Picking rays from cameras above the terrain towards points around the ground
+        std::vector<Ray> rays(numRays);
+        for (Ray& ray : rays)
+        {
+            ray.mOrigin = { positionDist(rng), heightDist(rng), positionDist(rng) };
+            Float3 target = { positionDist(rng), 0.0f, positionDist(rng) };
+            ray.mDirection = Normalize(target - ray.mOrigin);
+        }
+
+        std::vector<RayHit> hits(numRays);
+        std::vector<RayHit> serialHits(numRays);
+        BenchmarkTimer serialPickTimer;
+        serialBvh.Raycast(rays.data(), serialHits.data(), numRays, &serialPool);
+        double serialPickMs = serialPickTimer.ElapsedMs();
+        BenchmarkTimer pickTimer;
+        bvh.Raycast(rays.data(), hits.data(), numRays, &pool);
+        double pickMs = pickTimer.ElapsedMs();
+
+        size_t numHits = 0;
+        for (const RayHit& hit : hits)
+        {
+            numHits += hit.IsHit() ? 1 : 0;
+        }
+        fprintf(out, "  pick: %zu of %zu rays hit, 1 thread %.2f M rays/s, %u threads %.2f M rays/s\n",
+            numHits, numRays, numRays / serialPickMs * 1e-3, pool.GetThreadCount(), numRays / pickMs * 1e-3);
+
+        if (memcmp(hits.data(), serialHits.data(), numRays * sizeof(RayHit)) != 0)
+        {
+            fprintf(out, "  ERROR: hits depend on the thread count the bvh was built and queried with\n");
+        }
+
+        size_t mismatches = 0;
+        for (size_t i = 0; i < 64; ++i)
+        {
+            const Ray& ray = rays[i * (numRays / 64)];
+            const RayHit& hit = hits[i * (numRays / 64)];
+            float reference = BruteForceRaycast(terrain, 2, ray);
+            float distance = hit.IsHit() ? hit.mDistance : ray.mMaxDistance;
+            mismatches += fabsf(distance - reference) > 1e-4f * (std::max)(reference, 1.0f) ? 1 : 0;
+        }
+        for (size_t i = 0; i < numRays; ++i)
+        {
+            if (hits[i].IsHit())
+            {
+                const OccluderMesh& mesh = terrain[hits[i].mMesh];
+                const float* a = &mesh.mPositions[3 * mesh.mIndices[3 * hits[i].mTriangle]];
+                Float3 position = rays[i].mOrigin + rays[i].mDirection * hits[i].mDistance;
+                mismatches += fabsf(position.x - a[0]) > 1.0f || fabsf(position.z - a[2]) > 1.0f ? 1 : 0;
+            }
+        }
+        if (mismatches > 0)
+        {
+            fprintf(out, "  ERROR: %zu hits differ from the reference\n", mismatches);
+        }
+
+        // Height snap, the terrain interpolates its height function closely at this tessellation
+        std::vector<Float3> points(numRays);
+        std::vector<uint8_t> snapped(numRays);
+        for (Float3& point : points)
+        {
+            point = { positionDist(rng), 0.0f, positionDist(rng) };
+        }
+        BenchmarkTimer snapTimer;
+        size_t numSnapped = bvh.SnapToSurface(points.data(), snapped.data(), numRays, &pool);
+        double snapMs = snapTimer.ElapsedMs();
+
+        float maxHeightError = 0.0f;
+        for (const Float3& point : points)
+        {
+            maxHeightError = (std::max)(maxHeightError, fabsf(point.y - SyntheticTerrainHeight(point.x, point.z)));
+        }
+        fprintf(out, "  snap: %zu of %zu points, %.2f M rays/s, max height error %.4f\n", numSnapped, numRays, numRays / snapMs * 1e-3, maxHeightError);
+        if (numSnapped != numRays || maxHeightError > 0.01f)
+        {
+            fprintf(out, "  ERROR: snapped heights do not match the terrain\n");
+        }
+
+        // Line of sight between pairs of snapped points raised above the ground
+        std::vector<Float3> from(numRays);
+        std::vector<Float3> to(numRays);
+        for (size_t i = 0; i < numRays; ++i)
+        {
+            from[i] = points[i] + Float3{ 0.0f, 1.5f, 0.0f };
+            to[i] = points[(i * 7919) % numRays] + Float3{ 0.0f, 1.5f, 0.0f };
+        }
+        std::vector<uint8_t> visible(numRays);
+        BenchmarkTimer sightTimer;
+        bvh.LineOfSight(from.data(), to.data(), visible.data(), numRays, &pool);
+        double sightMs = sightTimer.ElapsedMs();
+
+        size_t numVisible = 0;
+        size_t sightMismatches = 0;
+        for (size_t i = 0; i < numRays; ++i)
+        {
+            numVisible += visible[i];
+            if (i % (numRays / 64) == 0)
+            {
+                Ray ray;
+                ray.mOrigin = from[i];
+                ray.mDirection = to[i] - from[i];
+                ray.mMinDistance = 1e-4f;
+                ray.mMaxDistance = 1.0f - 1e-4f;
+                bool referenceVisible = BruteForceRaycast(terrain, 2, ray) >= ray.mMaxDistance;
+                sightMismatches += referenceVisible != (visible[i] != 0) ? 1 : 0;
+            }
+        }
+        fprintf(out, "  line of sight: %zu of %zu visible, %.2f M rays/s\n", numVisible, numRays, numRays / sightMs * 1e-3);
+        if (sightMismatches > 0)
+        {
+            fprintf(out, "  ERROR: %zu line of sight results differ from the reference\n", sightMismatches);
+        }
+    }
+
+    // Trunk cylinder under a cone, about 3 units tall, segments around
+    static void BuildSyntheticTree(int segments, OccluderMesh* treeOut)
+    {
+        OccluderMesh& tree = *treeOut;
+        tree.mPositions.clear();
+        tree.mIndices.clear();
+
+        const float trunkRadius = 0.1f;
+        const float crownRadius = 0.6f;
+        for (int i = 0; i < segments; ++i)
+        {
+            float angle = 6.2831853f * i / segments;
+            float c = cosf(angle);
+            float s = sinf(angle);
+            float ring[4][3] =
+            {
+                { trunkRadius * c, 0.0f, trunkRadius * s },
+                { trunkRadius * c, 1.0f, trunkRadius * s },
+                { crownRadius * c, 0.8f, crownRadius * s },
+                { 0.0f, 3.0f, 0.0f }
+            };
+            for (const auto& position : ring)
+            {
+                tree.mPositions.insert(tree.mPositions.end(), position, position + 3);
+            }
+        }
+
+        for (int i = 0; i < segments; ++i)
+        {
+            uint32_t a = 4 * i;
+            uint32_t b = 4 * ((i + 1) % segments);
+            uint32_t triangles[12] =
+            {
+                a, a + 1, b,  b, a + 1, b + 1,      // Trunk
+                a + 2, a + 3, b + 2,                // Crown
+                a + 2, b + 2, 2                     // Crown base, fanned from the first crown vertex
+            };
+            tree.mIndices.insert(tree.mIndices.end(), triangles, triangles + 12);
+        }
+    }
+
+    static Float4x4 MakeInstanceWorld(float rotation, float scale, const Float3& position)
+    {
+        float c = cosf(rotation) * scale;
+        float s = sinf(rotation) * scale;
+        return
+        {{
+            { c, 0.0f, -s, 0.0f },
+            { 0.0f, scale, 0.0f, 0.0f },
+            { s, 0.0f, c, 0.0f },
+            { position.x, position.y, position.z, 1.0f }
+        }};
+    }
+
+    // Picking against a terrain and 100k trees of two kinds on it through a two level BVH, with a
+    // brute force check over every instance for some of the rays
+    static void BenchmarkScenePick(FILE* out)
+    {
+        const float terrainExtent = 400.0f;
+        const size_t numTrees = 100000;
+        const size_t numRays = 1 << 14;
+
+        OccluderMesh terrain;
+        OccluderMesh trees[2];
+        BuildSyntheticTerrain(256, terrainExtent, &terrain);
+        BuildSyntheticTree(24, &trees[0]);
+        BuildSyntheticTree(8, &trees[1]);
+
+        ThreadPool pool;
+        TriangleBvh meshBvhs[3];
+        meshBvhs[0].Build(&terrain, 1, &pool);
+        meshBvhs[1].Build(&trees[0], 1, &pool);
+        meshBvhs[2].Build(&trees[1], 1, &pool);
+        const TriangleBvh* meshes[3] = { &meshBvhs[0], &meshBvhs[1], &meshBvhs[2] };
+
+        // Trees stand on the terrain
+        std::mt19937 rng(99);
+        std::uniform_real_distribution<float> positionDist(-0.48f * terrainExtent, 0.48f * terrainExtent);
+        std::uniform_real_distribution<float> unitDist(0.0f, 1.0f);
+        std::vector<Float3> positions(numTrees);
+        for (Float3& position : positions)
+        {
+            position = { positionDist(rng), 0.0f, positionDist(rng) };
+        }
+        std::vector<uint8_t> snapped(numTrees);
+        meshBvhs[0].SnapToSurface(positions.data(), snapped.data(), numTrees, &pool);
+
+        std::vector<SceneInstance> instances(numTrees + 1);
+        instances[0] = { MakeInstanceWorld(0.0f, 1.0f, { 0.0f, 0.0f, 0.0f }), 0 };
+        for (size_t i = 0; i < numTrees; ++i)
+        {
+            float scale = 0.5f + unitDist(rng);
+            instances[i + 1] = { MakeInstanceWorld(unitDist(rng) * 6.2831853f, scale, positions[i]), 1 + static_cast<uint32_t>(i & 1) };
+        }
+
+        SceneBvh scene;
+        BenchmarkTimer buildTimer;
+        scene.Build(meshes, 3, instances.data(), instances.size(), &pool);
+        double buildMs = buildTimer.ElapsedMs();
+
+        const SceneBvhStats& stats = scene.GetStats();
+        fprintf(out, "  %zu instances, %zu nodes, depth %u, build %.1f ms on %u threads\n", stats.mInstances, stats.mNodes, stats.mMaxDepth, buildMs, pool.GetThreadCount());
+
+        // Mouse picks from eye height looking across the forest
+        std::vector<Ray> rays(numRays);
+        for (Ray& ray : rays)
+        {
+            Float3 eye = { positionDist(rng), 0.0f, positionDist(rng) };
+            Float3 target = { eye.x + (unitDist(rng) - 0.5f) * 100.0f, 0.0f, eye.z + (unitDist(rng) - 0.5f) * 100.0f };
+            ray.mOrigin = eye + Float3{ 0.0f, SyntheticTerrainHeight(eye.x, eye.z) + 2.0f, 0.0f };
+            ray.mDirection = Normalize(target - ray.mOrigin);
+        }
+
+        std::vector<SceneHit> hits(numRays);
+        double worstMs = 0.0;
+        size_t numTreeHits = 0;
+        BenchmarkTimer pickTimer;
+        for (size_t i = 0; i < numRays; ++i)
+        {
+            BenchmarkTimer rayTimer;
+            scene.Raycast(rays[i], &hits[i]);
+            worstMs = (std::max)(worstMs, rayTimer.ElapsedMs());
+            numTreeHits += hits[i].IsHit() && hits[i].mInstance > 0 ? 1 : 0;
+        }
+        double pickMs = pickTimer.ElapsedMs();
+        fprintf(out, "  pick: %zu rays, %zu on trees, %.2f us average, %.3f ms worst, %.2f M rays/s\n",
+            numRays, numTreeHits, pickMs * 1e3 / numRays, worstMs, numRays / pickMs * 1e-3);
+
+        std::vector<SceneHit> batchHits(numRays);
+        BenchmarkTimer batchTimer;
+        scene.Raycast(rays.data(), batchHits.data(), numRays, &pool);
+        double batchMs = batchTimer.ElapsedMs();
+        fprintf(out, "  batched on %u threads: %.2f M rays/s\n", pool.GetThreadCount(), numRays / batchMs * 1e-3);
+
+        if (memcmp(hits.data(), batchHits.data(), numRays * sizeof(SceneHit)) != 0)
+        {
+            fprintf(out, "  ERROR: batched picks differ from single ones\n");
+        }
+
+        size_t mismatches = 0;
+        for (size_t i = 0; i < numRays; i += numRays / 32)
+        {
+            SceneHit reference;
+            for (size_t iInstance = 0; iInstance < instances.size(); ++iInstance)
+            {
+                Float4x4 worldToObject = InverseAffine(instances[iInstance].mWorld);
+                Float4 origin = TransformPoint(rays[i].mOrigin, worldToObject);
+                Ray objectRay;
+                objectRay.mOrigin = { origin.x, origin.y, origin.z };
+                objectRay.mDirection = TransformVector(rays[i].mDirection, worldToObject);
+                objectRay.mMaxDistance = reference.mDistance;
+
+                RayHit meshHit;
+                if (meshes[instances[iInstance].mMesh]->Raycast(objectRay, &meshHit))
+                {
+                    reference.mDistance = meshHit.mDistance;
+                    reference.mInstance = static_cast<uint32_t>(iInstance);
+                    reference.mTriangle = meshHit.mTriangle;
+                }
+            }
+            mismatches += reference.mInstance != hits[i].mInstance || reference.mTriangle != hits[i].mTriangle ? 1 : 0;
+        }
+        if (mismatches > 0)
+        {
+            fprintf(out, "  ERROR: %zu picks differ from testing every instance\n", mismatches);
+        }
+    }
+
+    static void BenchmarkFrameTiming(FILE* out)
+    {
+        // Clock cost and resolution
+        const int numReads = 1000000;
+        uint64_t minDelta = UINT64_MAX;
+        uint64_t previous = GetClockTicks();
+        BenchmarkTimer readTimer;
+        for (int i = 0; i < numReads; ++i)
+        {
+            uint64_t ticks = GetClockTicks();
+            if (ticks != previous)
+            {
+                minDelta = (std::min)(minDelta, ticks - previous);
+            }
+            previous = ticks;
+        }
+        double readMs = readTimer.ElapsedMs();
+        fprintf(out, "  clock: %.1f ns per read, %.1f ns resolution, %llu Hz\n",
+            readMs * 1e6 / numReads, TicksToSeconds(minDelta) * 1e9, static_cast<unsigned long long>(GetClockFrequency()));
+
+        // Simulated time has to follow real time at any frame rate: whole steps plus the fraction
+        // being interpolated add up to the elapsed time
+        const double step = 1.0 / 120.0;
+        const double frameRates[] = { 24.0, 60.0, 144.0, 1000.0 };
+        std::mt19937 rng(7);
+        std::uniform_real_distribution<double> jitterDist(0.5, 1.5);
+        for (double frameRate : frameRates)
+        {
+            FixedTimestep timestep(step, 30);
+            uint64_t totalSteps = 0;
+            double totalSeconds = 0.0;
+            for (int frame = 0; frame < 10000; ++frame)
+            {
+                double frameSeconds = jitterDist(rng) / frameRate;
+                totalSteps += timestep.Advance(frameSeconds);
+                totalSeconds += frameSeconds;
+            }
+
+            double simulatedSeconds = (totalSteps + timestep.GetAlpha()) * step;
+            fprintf(out, "  %.0f fps: %.1f s in %llu steps\n", frameRate, totalSeconds, static_cast<unsigned long long>(totalSteps));
+            if (fabs(simulatedSeconds - totalSeconds) > 1e-6 * totalSeconds)
+            {
+                fprintf(out, "  ERROR: %.6f s simulated of %.6f s at %.0f fps\n", simulatedSeconds, totalSeconds, frameRate);
+            }
+        }
+
+        FixedTimestep stalled(step, 30);
+        uint32_t stallSteps = stalled.Advance(2.0);
+        if (stallSteps != 30 || stalled.GetAlpha() >= 1.0f)
+        {
+            fprintf(out, "  ERROR: a 2 s stall ran %u steps with alpha %.3f\n", stallSteps, stalled.GetAlpha());
+        }
+
+        // The history keeps the last kCapacity frames
+        const size_t numFrames = FrameTimeHistory::kCapacity * 3 + 17;
+        std::exponential_distribution<double> frameDist(60.0);
+        std::vector<double> frameTimes(numFrames);
+        FrameTimeHistory history;
+        for (size_t i = 0; i < numFrames; ++i)
+        {
+            frameTimes[i] = frameDist(rng);
+            history.Add(frameTimes[i]);
+        }
+
+        FrameTimeStats stats;
+        BenchmarkTimer statsTimer;
+        history.CalcStats(&stats);
+        double statsMs = statsTimer.ElapsedMs();
+        fprintf(out, "  history: %zu frames, average %.2f ms, p50 %.2f ms, p95 %.2f ms, p99 %.2f ms, max %.2f ms, stats in %.3f ms\n",
+            stats.mFrames, stats.mAverage * 1000.0, stats.mP50 * 1000.0, stats.mP95 * 1000.0, stats.mP99 * 1000.0, stats.mMax * 1000.0, statsMs);
+
+        std::vector<double> recent(frameTimes.end() - FrameTimeHistory::kCapacity, frameTimes.end());
+        std::sort(recent.begin(), recent.end());
+        const size_t n = recent.size();
+        if (stats.mFrames != n || stats.mP50 != recent[n / 2 - 1] || stats.mP95 != recent[(n * 95 + 99) / 100 - 1] ||
+            stats.mP99 != recent[(n * 99 + 99) / 100 - 1] || stats.mMax != recent.back())
+        {
+            fprintf(out, "  ERROR: percentiles do not match the last %zu frames\n", n);
+        }
+    }
+
+    // Zone cost on one thread, then nested zones on every pool thread checked against the order and
+    // nesting they were recorded in
+    static void BenchmarkProfiler(FILE* out)
+    {
+        ClearProfileEvents();
+
+        const int numZones = 1000000;
+        BenchmarkTimer zoneTimer;
+        for (int i = 0; i < numZones; ++i)
+        {
+            PROFILE_ZONE("Empty");
+        }
+        double zoneMs = zoneTimer.ElapsedMs();
+        fprintf(out, "  %.1f ns per zone\n", zoneMs * 1e6 / numZones);
+
+        ClearProfileEvents();
+        ThreadPool pool;
+        const size_t numTasks = 256;
+        const int numInner = 64;
+        ParallelFor(&pool, numTasks, 1, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                PROFILE_ZONE("Outer");
+                for (int j = 0; j < numInner; ++j)
+                {
+                    PROFILE_ZONE("Inner");
+                }
+            }
+        });
+
+        std::vector<ProfileEvent> events;
+        CollectProfileEvents(&events);
+
+        // Per thread, the inner zones of a task end before the outer zone that follows them
+        size_t outerZones = 0;
+        size_t errors = 0;
+        for (size_t i = 0; i < events.size(); ++i)
+        {
+            if (strcmp(events[i].mName, "Outer") == 0)
+            {
+                outerZones++;
+                size_t inner = 0;
+                for (size_t j = i; j > 0 && events[j - 1].mThread == events[i].mThread && strcmp(events[j - 1].mName, "Inner") == 0; --j)
+                {
+                    const ProfileEvent& event = events[j - 1];
+                    errors += event.mStart < events[i].mStart || event.mEnd > events[i].mEnd || event.mStart > event.mEnd;
+                    inner++;
+                }
+                errors += inner != static_cast<size_t>(numInner);
+            }
+        }
+
+        const bool written = WriteChromeTrace("profiler_trace.json");
+        fprintf(out, "  %zu events from %u threads, %zu outer zones\n", events.size(), pool.GetThreadCount(), outerZones);
+        if (outerZones != numTasks || errors > 0 || !written)
+        {
+            fprintf(out, "  ERROR: %zu of %zu outer zones, %zu misnested zones, trace %s\n", outerZones, numTasks, errors, written ? "written" : "not written");
+        }
+    }
+
+    // Timestamps from a counter the test advances as if the GPU did work. Checks that every query
+    // read back was written and resolved in one frame, and that none is overwritten before it is read.
+    class MockGpuTimerBackend : public GpuTimerBackend
+    {
+    public:
+        MockGpuTimerBackend() : mQueries(GpuTimer::kQueryCount), mReadback(GpuTimer::kQueryCount) {}
+
+        void WriteTimestamp(uint32_t query) override
+        {
+            if (query >= mQueries.size() || mReadback[query].mPending)
+            {
+                mErrors++;
+                return;
+            }
+            mQueries[query] = { mClock, mFrame, false };
+            mClock++;
+        }
+
+        void ResolveQueries(uint32_t first, uint32_t count) override
+        {
+            mResolves++;
+            for (uint32_t i = first; i < first + count; ++i)
+            {
+                mErrors += mQueries[i].mFrame != mFrame;
+                mReadback[i] = mQueries[i];
+                mReadback[i].mPending = true;
+            }
+        }
+
+        void ReadQueries(uint32_t first, uint32_t count, uint64_t* timestamps) override
+        {
+            for (uint32_t i = first; i < first + count; ++i)
+            {
+                mErrors += !mReadback[i].mPending || mReadback[i].mFrame != mReadback[first].mFrame;
+                mReadback[i].mPending = false;
+                timestamps[i - first] = mReadback[i].mTicks;
+            }
+        }
+
+        uint64_t GetFrequency() override { return 1000000; }
+
+        bool GetCalibration(uint64_t* gpuTicks, uint64_t* cpuTicks) override
+        {
+            *gpuTicks = mClock;
+            *cpuTicks = GetClockTicks();
+            return true;
+        }
+
+        void Work(uint64_t ticks) { mClock += ticks; }
+
+        class Query
+        {
+        public:
+            uint64_t mTicks = 0;
+            uint64_t mFrame = UINT64_MAX;
+            bool     mPending = false;
+        };
+
+        std::vector<Query> mQueries;
+        std::vector<Query> mReadback;
+        uint64_t           mClock = 0;
+        uint64_t           mFrame = 0;
+        size_t             mResolves = 0;
+        size_t             mErrors = 0;
+    };
+
+    static void BenchmarkGpuTimer(FILE* out)
+    {
+        ClearProfileEvents();
+        ProfileTrack* track = CreateProfileTrack("GPU");
+
+        MockGpuTimerBackend backend;
+        GpuTimer timer;
+        timer.SetProfileTrack(track);
+
+        // Draw takes 100 + frame ticks of 1 us, every tenth frame has more zones than fit
+        const uint64_t numFrames = 1000;
+        BenchmarkTimer cpuTimer;
+        for (uint64_t frame = 0; frame < numFrames; ++frame)
+        {
+            backend.mFrame = frame;
+            timer.BeginFrame(&backend);
+            {
+                GpuZone frameZone(timer, "Frame");
+                {
+                    GpuZone cullZone(timer, "Cull");
+                    backend.Work(10);
+                }
+                {
+                    GpuZone drawZone(timer, "Draw");
+                    backend.Work(100 + frame);
+                }
+                if (frame % 10 == 0)
+                {
+                    for (uint32_t i = 0; i < GpuTimer::kMaxZonesPerFrame; ++i)
+                    {
+                        GpuZone extraZone(timer, "Extra");
+                    }
+                }
+            }
+            timer.EndFrame();
+        }
+        double cpuMs = cpuTimer.ElapsedMs();
+
+        // Results arrive kFramesInFlight frames late
+        const uint64_t numResults = numFrames - GpuTimer::kFramesInFlight;
+        const uint64_t lastResult = numResults - 1;
+        size_t errors = backend.mErrors;
+        for (const GpuZoneStats& stats : timer.GetStats())
+        {
+            FrameTimeStats history;
+            stats.mHistory.CalcStats(&history);
+            fprintf(out, "  %-6s last %.3f ms, p50 %.3f ms, max %.3f ms over %zu frames\n", stats.mName, stats.mLastMs, history.mP50 * 1000.0, history.mMax * 1000.0, history.mFrames);
+
+            if (strcmp(stats.mName, "Draw") == 0)
+            {
+                // Writing a timestamp advances the mock clock by one tick
+                errors += fabs(stats.mLastMs - (101 + lastResult) * 1e-3) > 1e-9 || history.mFrames != (std::min)(numResults, static_cast<uint64_t>(FrameTimeHistory::kCapacity));
+            }
+            if (strcmp(stats.mName, "Frame") == 0)
+            {
+                errors += stats.mLastMs < (110 + lastResult) * 1e-3;
+            }
+        }
+
+        std::vector<ProfileEvent> events;
+        CollectProfileEvents(&events);
+        size_t trackDraws = 0;
+        for (const ProfileEvent& event : events)
+        {
+            trackDraws += strcmp(event.mName, "Draw") == 0 && event.mEnd - event.mStart > 0;
+        }
+
+        fprintf(out, "  %llu frames, %zu resolves, %.3f us CPU per frame\n", static_cast<unsigned long long>(numFrames), backend.mResolves, cpuMs * 1000.0 / numFrames);
+        if (errors > 0 || timer.GetStats().size() != 4 || trackDraws != numResults)
+        {
+            fprintf(out, "  ERROR: %zu query or timing errors, %zu zones, %zu of %llu draws on the profiler track\n",
+                errors, timer.GetStats().size(), trackDraws, static_cast<unsigned long long>(numResults));
+        }
+    }
+
+    static void BenchmarkMemory(FILE* out)
+    {
+        // Counters are global, so everything is checked against the usage before the benchmark
+        const MemoryUsage baseTextures = GetMemoryUsage(MemoryCategory::Textures);
+        const MemoryUsage baseAssets = GetMemoryUsage(MemoryCategory::AssetData);
+        const MemoryUsage baseTotal = GetTotalMemoryUsage();
+        size_t errors = 0;
+
+        // Peaks follow the highest sum at any one time, not the sum of all allocations
+        const uint64_t kMiB = 1024 * 1024;
+        ResetMemoryPeaks();
+        {
+            TrackedAllocation a(MemoryCategory::Textures, 1 * kMiB);
+            TrackedAllocation b(MemoryCategory::Textures, 2 * kMiB);
+            a.Release();
+            TrackedAllocation c(MemoryCategory::Textures, kMiB / 2);
+
+            std::vector<TrackedAllocation> moved;
+            moved.push_back(std::move(c));
+            moved.emplace_back(MemoryCategory::Textures, kMiB / 2);
+
+            MemoryUsage usage = GetMemoryUsage(MemoryCategory::Textures);
+            errors += usage.mCurrent != baseTextures.mCurrent + 3 * kMiB || usage.mAllocations != baseTextures.mAllocations + 3;
+            errors += usage.mPeak != baseTextures.mCurrent + 3 * kMiB;
+            errors += c.GetSize() != 0;
+
+            SetMemoryBudget(MemoryCategory::Textures, 2 * kMiB);
+            std::string report = FormatMemoryReport();
+            errors += report.find("EXCEEDED") == std::string::npos;
+            fprintf(out, "%s", report.c_str());
+            SetMemoryBudget(MemoryCategory::Textures, baseTextures.mBudget);
+        }
+        errors += GetMemoryUsage(MemoryCategory::Textures).mCurrent != baseTextures.mCurrent;
+
+        // Allocations from many threads at once, each freed by the thread that made it
+        ThreadPool pool;
+        const size_t numAllocations = 100000;
+        BenchmarkTimer trackTimer;
+        ParallelFor(&pool, numAllocations, 256, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                TrackedAllocation allocation(MemoryCategory::AssetData, (i % 64 + 1) * 1024);
+            }
+        });
+        double trackMs = trackTimer.ElapsedMs();
+
+        MemoryUsage assets = GetMemoryUsage(MemoryCategory::AssetData);
+        errors += assets.mCurrent != baseAssets.mCurrent || assets.mAllocations != baseAssets.mAllocations;
+        errors += assets.mPeak < baseAssets.mCurrent + 64 * 1024;
+        errors += GetTotalMemoryUsage().mCurrent != baseTotal.mCurrent;
+
+        // Acceleration structures report what they hold
+        OccluderMesh terrain;
+        BuildSyntheticTerrain(256, 1000.0f, &terrain);
+        TriangleBvh bvh;
+        bvh.Build(&terrain, 1, &pool);
+        const uint64_t meshBytes = GetVectorBytes(terrain.mPositions) + GetVectorBytes(terrain.mIndices);
+        const uint64_t bvhBytes = bvh.GetMemorySize();
+        errors += bvhBytes < GetVectorBytes(terrain.mIndices) / 3;
+
+        fprintf(out, "  %.1f ns per tracked allocation and free from %u threads\n", trackMs * 1e6 / numAllocations, pool.GetThreadCount());
+        fprintf(out, "  terrain mesh %.2f MiB, BVH %.2f MiB\n", static_cast<double>(meshBytes) / kMiB, static_cast<double>(bvhBytes) / kMiB);
+        if (errors > 0)
+        {
+            fprintf(out, "  ERROR: %zu accounting errors\n", errors);
+        }
+    }
+
+    static void BenchmarkStreaming(FILE* out)
+    {
+        // Textures of 2048 x 2048 RGBA8 spread over a line the camera flies along
+        const uint32_t numTextures = 256;
+        const uint32_t kSize = 2048;
+        const uint32_t mipCount = 12;
+        uint64_t mipSizes[mipCount];
+        for (uint32_t mip = 0; mip < mipCount; ++mip)
+        {
+            uint64_t side = (std::max)(kSize >> mip, 1u);
+            mipSizes[mip] = side * side * 4;
+        }
+
+        TextureStreamingParams params;
+        params.mBudget = 128ull << 20;
+        params.mScreenScale = 1000.0f;
+        TextureResidency residency;
+        residency.Init(params);
+        for (uint32_t i = 0; i < numTextures; ++i)
+        {
+            residency.AddTexture(kSize, kSize, mipSizes, mipCount);
+        }
+
+        std::mt19937 rng(7);
+        std::uniform_real_distribution<float> positionDist(0.0f, 1000.0f);
+        std::vector<float> positions(numTextures);
+        for (float& position : positions)
+        {
+            position = positionDist(rng);
+        }
+
+        // Loads finish the frame after they start, one in ten fails
+        const size_t numFrames = 2000;
+        std::vector<StreamingRequest> loads;
+        std::vector<StreamingRequest> evictions;
+        std::vector<StreamingRequest> pending;
+        size_t errors = 0;
+        size_t numLoads = 0;
+        size_t numEvictions = 0;
+        double updateMs = 0.0;
+        for (size_t frame = 0; frame < numFrames; ++frame)
+        {
+            for (const StreamingRequest& load : pending)
+            {
+                residency.CompleteLoad(load, (load.mTexture + load.mMip) % 10 != 0 || frame > numFrames / 2);
+            }
+
+            // The camera stops halfway, so residency can settle
+            const float camera = (std::min)(static_cast<float>(frame), numFrames * 0.4f) * 0.5f;
+            residency.BeginFrame();
+            for (uint32_t i = 0; i < numTextures; ++i)
+            {
+                residency.AddUse(i, fabsf(positions[i] - camera), 10.0f);
+            }
+
+            BenchmarkTimer updateTimer;
+            residency.Update(&loads, &evictions);
+            updateMs += updateTimer.ElapsedMs();
+
+            errors += residency.GetResidentBytes() + residency.GetLoadingBytes() > params.mBudget;
+            errors += loads.size() > params.mMaxLoadsInFlight;
+            for (const StreamingRequest& eviction : evictions)
+            {
+                errors += residency.GetResidentMip(eviction.mTexture) != eviction.mMip;
+            }
+            numLoads += loads.size();
+            numEvictions += evictions.size();
+            pending = loads;
+        }
+
+        // Once settled, the closest texture has all the detail it needs
+        const float camera = numFrames * 0.2f;
+        uint32_t closest = 0;
+        for (uint32_t i = 1; i < numTextures; ++i)
+        {
+            if (fabsf(positions[i] - camera) < fabsf(positions[closest] - camera))
+            {
+                closest = i;
+            }
+        }
+        errors += residency.GetResidentMip(closest) > residency.GetWantedMip(closest);
+
+        size_t refined = 0;
+        for (uint32_t i = 0; i < numTextures; ++i)
+        {
+            refined += residency.GetResidentMip(i) < residency.GetTailMip(i);
+        }
+
+        fprintf(out, "  %u textures, %zu frames, %.2f us per update\n", numTextures, numFrames, updateMs * 1000.0 / numFrames);
+        fprintf(out, "  %zu loads, %zu evictions, %zu textures above their tail, %.1f of %.1f MiB resident\n", numLoads, numEvictions, refined,
+            static_cast<double>(residency.GetResidentBytes()) / (1024.0 * 1024.0), static_cast<double>(params.mBudget) / (1024.0 * 1024.0));
+
+        // Reads on the I/O thread return the bytes of the file, in the order they were submitted
+        const char* fileName = "streaming_test.bin";
+        const uint32_t fileSize = 4 << 20;
+        {
+            std::vector<uint8_t> contents(fileSize);
+            for (uint32_t i = 0; i < fileSize; ++i)
+            {
+                contents[i] = static_cast<uint8_t>(i * 7 + (i >> 8));
+            }
+            std::ofstream file(fileName, std::ios::out | std::ios::binary);
+            file.write(reinterpret_cast<const char*>(contents.data()), contents.size());
+        }
+
+        const uint32_t numReads = 256;
+        const uint32_t readSize = 64 * 1024;
+        std::uniform_int_distribution<uint32_t> offsetDist(0, fileSize - readSize);
+        BenchmarkTimer readTimer;
+        {
+            StreamingIoThread ioThread;
+            for (uint32_t i = 0; i < numReads; ++i)
+            {
+                StreamingRead read;
+                read.mFileName = fileName;
+                read.mOffset = offsetDist(rng);
+                read.mSize = readSize;
+                read.mRequest = { i, 0 };
+                ioThread.Submit(std::move(read));
+            }
+
+            // Past the end of the file
+            StreamingRead badRead;
+            badRead.mFileName = fileName;
+            badRead.mOffset = fileSize - 16;
+            badRead.mSize = 32;
+            badRead.mRequest = { numReads, 0 };
+            ioThread.Submit(std::move(badRead));
+
+            uint32_t expected = 0;
+            StreamingRead read;
+            while (ioThread.Wait(&read))
+            {
+                errors += read.mRequest.mTexture != expected++;
+                if (read.mRequest.mTexture == numReads)
+                {
+                    errors += read.mSuccess;
+                    continue;
+                }
+
+                errors += !read.mSuccess || read.mData.size() != readSize;
+                for (uint32_t i = 0; i < read.mData.size(); i += 997)
+                {
+                    uint32_t position = static_cast<uint32_t>(read.mOffset) + i;
+                    errors += read.mData[i] != static_cast<uint8_t>(position * 7 + (position >> 8));
+                }
+            }
+            errors += expected != numReads + 1;
+        }
+        double readMs = readTimer.ElapsedMs();
+        std::remove(fileName);
+
+        fprintf(out, "  %u reads of %u KiB in %.2f ms\n", numReads, readSize / 1024, readMs);
+        if (errors > 0)
+        {
+            fprintf(out, "  ERROR: %zu streaming errors\n", errors);
+        }
+    }
+
+    // DDS file of a 2D texture or cube map with a full mip chain of BC1 or RGBA8 data
+    static std::vector<uint8_t> BuildSyntheticDds(uint32_t size, bool blockCompressed, bool cubeMap, bool dx10Header)
+    {
+        uint32_t mipCount = 1;
+        while ((size >> mipCount) > 0)
+        {
+            mipCount++;
+        }
+
+        uint32_t header[32 + 5] = {};
+        header[0] = 0x20534444;                             // "DDS "
+        header[1] = 124;
+        header[2] = 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000;     // Caps, height, width, pixel format, mip count
+        header[3] = size;
+        header[4] = size;
+        header[7] = mipCount;
+        header[19] = 32;
+        header[27] = 0x1000 | 0x400000 | 0x8;               // Texture, mipmap, complex
+        if (dx10Header)
+        {
+            header[20] = 0x4;
+            header[21] = 0x30315844;                        // "DX10"
+            header[32] = blockCompressed ? 71 : 28;
+            header[33] = 3;
+            header[34] = cubeMap ? 0x4 : 0;
+            header[35] = 1;
+        }
+        else if (blockCompressed)
+        {
+            header[20] = 0x4;
+            header[21] = 0x31545844;                        // "DXT1"
+        }
+        else
+        {
+            header[20] = 0x40 | 0x1;
+            header[22] = 32;
+            header[23] = 0x000000ff;
+            header[24] = 0x0000ff00;
+            header[25] = 0x00ff0000;
+            header[26] = 0xff000000;
+        }
+        if (cubeMap && !dx10Header)
+        {
+            header[28] = 0x200 | 0xFC00;
+        }
+
+        uint64_t dataSize = 0;
+        for (uint32_t mip = 0; mip < mipCount; ++mip)
+        {
+            uint64_t side = (std::max)(size >> mip, 1u);
+            dataSize += blockCompressed ? ((side + 3) / 4) * ((side + 3) / 4) * 8 : side * side * 4;
+        }
+        dataSize *= cubeMap ? 6 : 1;
+
+        const size_t headerSize = (dx10Header ? 37 : 32) * sizeof(uint32_t);
+        std::vector<uint8_t> dds(static_cast<size_t>(headerSize + dataSize));
+        memcpy(dds.data(), header, headerSize);
+        for (size_t i = headerSize; i < dds.size(); ++i)
+        {
+            dds[i] = static_cast<uint8_t>(i * 13);
+        }
+        return dds;
+    }
+
+    // Returns the file size
+    static uint64_t WriteSyntheticDds(const std::string& fileName, uint32_t size, bool blockCompressed, bool cubeMap, bool dx10Header)
+    {
+        std::vector<uint8_t> dds = BuildSyntheticDds(size, blockCompressed, cubeMap, dx10Header);
+        std::ofstream file(fileName, std::ios::out | std::ios::binary);
+        file.write(reinterpret_cast<const char*>(dds.data()), dds.size());
+        return dds.size();
+    }
+
+    static void BenchmarkDdsMapping(FILE* out)
+    {
+        const uint32_t numFiles = 24;
+        std::vector<uint64_t> fileSizes;
+        for (uint32_t i = 0; i < numFiles; ++i)
+        {
+            char fileName[64];
+            snprintf(fileName, sizeof(fileName), "./dds_benchmark_%02u.dds", i);
+            fileSizes.push_back(WriteSyntheticDds(fileName, i % 3 == 2 ? 256 : 1024, i % 2 == 0, i % 3 == 2, i % 4 < 2));
+        }
+
+        std::vector<std::string> files = ListFiles(".", ".dds");
+        files.erase(std::remove_if(files.begin(), files.end(), [](const std::string& file)
+        {
+            return file.find("dds_benchmark_") == std::string::npos;
+        }), files.end());
+        size_t errors = files.size() != numFiles;
+
+        // Parsing a mapped file only touches the pages of the header
+        const uint32_t numPasses = 20;
+        uint64_t numSubresources = 0;
+        BenchmarkTimer mappedTimer;
+        for (uint32_t pass = 0; pass < numPasses; ++pass)
+        {
+            for (size_t i = 0; i < files.size(); ++i)
+            {
+                MappedFile mappedFile;
+                DdsLayout layout;
+                if (!mappedFile.Open(files[i]) || !ParseDds(mappedFile.GetData(), static_cast<size_t>(mappedFile.GetSize()), &layout))
+                {
+                    errors++;
+                    continue;
+                }
+
+                const DdsSubresource& last = layout.mSubresources.back();
+                errors += mappedFile.GetSize() != fileSizes[i] || last.mOffset + last.mSize != fileSizes[i];
+                errors += layout.mSubresources.size() != layout.mMipCount * layout.mArraySize;
+                errors += layout.mCubeMap != (i % 3 == 2) || layout.mFormat != (i % 2 == 0 ? 71u : 28u);
+                numSubresources += layout.mSubresources.size();
+            }
+        }
+        double mappedMs = mappedTimer.ElapsedMs();
+
+        // Reading each file into a buffer first, as LoadDDSTextureFromFile does
+        uint64_t bytesRead = 0;
+        BenchmarkTimer readTimer;
+        for (uint32_t pass = 0; pass < numPasses; ++pass)
+        {
+            for (size_t i = 0; i < files.size(); ++i)
+            {
+                std::ifstream file(files[i], std::ios::in | std::ios::binary);
+                std::vector<uint8_t> data(static_cast<size_t>(fileSizes[i]));
+                file.read(reinterpret_cast<char*>(data.data()), data.size());
+                DdsLayout layout;
+                errors += !file || !ParseDds(data.data(), data.size(), &layout);
+                bytesRead += data.size();
+            }
+        }
+        double readMs = readTimer.ElapsedMs();
+
+        // Truncated files are rejected
+        {
+            MappedFile mappedFile;
+            DdsLayout layout;
+            errors += !mappedFile.Open(files[0]);
+            errors += ParseDds(mappedFile.GetData(), static_cast<size_t>(mappedFile.GetSize()) - 1, &layout);
+            errors += ParseDds(mappedFile.GetData(), 100, &layout);
+
+            MappedFile moved(std::move(mappedFile));
+            errors += mappedFile.IsOpen() || !moved.IsOpen();
+        }
+
+        for (const std::string& file : files)
+        {
+            std::remove(file.c_str());
+        }
+
+        const double numParsed = static_cast<double>(numPasses) * files.size();
+        fprintf(out, "  %zu files, %llu subresources located\n", files.size(), static_cast<unsigned long long>(numSubresources));
+        fprintf(out, "  mapped: %.2f us per file, %.0f files/s\n", mappedMs * 1000.0 / numParsed, numParsed * 1000.0 / mappedMs);
+        fprintf(out, "  read into a buffer: %.2f us per file, %.1f MiB/s\n", readMs * 1000.0 / numParsed, static_cast<double>(bytesRead) / (1024.0 * 1024.0) * 1000.0 / readMs);
+        if (errors > 0)
+        {
+            fprintf(out, "  ERROR: %zu DDS parsing errors\n", errors);
+        }
+    }
+
+    static void BenchmarkDdsUpload(FILE* out)
+    {
+        size_t errors = 0;
+
+        // Allocations of random size freed a few frames later never overlap live ones
+        const uint64_t ringSize = 16 << 20;
+        UploadRing ring;
+        ring.Init(ringSize);
+        std::mt19937 rng(11);
+        std::uniform_int_distribution<uint64_t> sizeDist(1, 1 << 20);
+        std::deque<std::pair<uint64_t, uint64_t>> live;
+        size_t numAllocations = 0;
+        size_t numFull = 0;
+        BenchmarkTimer ringTimer;
+        for (size_t frame = 0; frame < 20000; ++frame)
+        {
+            for (int i = 0; i < 4; ++i)
+            {
+                uint64_t size = sizeDist(rng);
+                uint64_t offset = 0;
+                if (!ring.Allocate(size, kUploadPlacementAlignment, &offset))
+                {
+                    numFull++;
+                    continue;
+                }
+
+                errors += offset % kUploadPlacementAlignment != 0 || offset + size > ringSize;
+                for (const auto& allocation : live)
+                {
+                    errors += offset < allocation.first + allocation.second && allocation.first < offset + size;
+                }
+                live.emplace_back(offset, size);
+                numAllocations++;
+            }
+
+            while (live.size() > 28)
+            {
+                ring.FreeOldest();
+                live.pop_front();
+            }
+            errors += ring.GetAllocationCount() != live.size() || ring.GetUsedBytes() > ringSize;
+        }
+        while (!live.empty())
+        {
+            ring.FreeOldest();
+            live.pop_front();
+        }
+        errors += ring.GetUsedBytes() != 0;
+        double ringMs = ringTimer.ElapsedMs();
+
+        // Files read straight into a heap backed stand-in for the upload buffer
+        const size_t numFiles = 3;
+        const char* fileNames[numFiles] = { "dds_upload_0.dds", "dds_upload_1.dds", "dds_upload_2.dds" };
+        uint64_t fileSizes[numFiles] =
+        {
+            WriteSyntheticDds(fileNames[0], 2048, false, false, true),
+            WriteSyntheticDds(fileNames[1], 1024, true, true, true),
+            WriteSyntheticDds(fileNames[2], 100, false, false, false)
+        };
+
+        const uint32_t numPasses = 10;
+        uint64_t bytesRead = 0;
+        double directMs = 0.0;
+        double bufferedMs = 0.0;
+        std::vector<uint8_t> upload(ringSize * 2);
+        for (size_t i = 0; i < numFiles; ++i)
+        {
+            uint8_t header[kDdsMaxHeaderSize];
+            std::ifstream file(fileNames[i], std::ios::in | std::ios::binary);
+            file.read(reinterpret_cast<char*>(header), sizeof(header));
+            DdsLayout layout;
+            if (!file || !ParseDdsHeader(header, sizeof(header), fileSizes[i], &layout))
+            {
+                errors++;
+                continue;
+            }
+
+            std::vector<DdsUploadFootprint> footprints;
+            const uint64_t uploadSize = CalcDdsUploadFootprints(layout, &footprints);
+            if (uploadSize > upload.size())
+            {
+                errors++;
+                continue;
+            }
+
+            for (uint32_t pass = 0; pass < numPasses; ++pass)
+            {
+                BenchmarkTimer directTimer;
+                errors += !ReadDdsSubresources(file, layout, footprints, upload.data());
+                directMs += directTimer.ElapsedMs();
+                bytesRead += fileSizes[i];
+
+                // The same through a buffer of the whole file, as the loader and UpdateSubresources do
+                BenchmarkTimer bufferedTimer;
+                std::vector<uint8_t> contents(static_cast<size_t>(fileSizes[i]));
+                file.seekg(0);
+                file.read(reinterpret_cast<char*>(contents.data()), contents.size());
+                std::vector<uint8_t> staging(static_cast<size_t>(uploadSize));
+                for (size_t s = 0; s < layout.mSubresources.size(); ++s)
+                {
+                    const DdsSubresource& subresource = layout.mSubresources[s];
+                    for (uint32_t row = 0; row < subresource.mNumRows * subresource.mDepth; ++row)
+                    {
+                        memcpy(staging.data() + footprints[s].mOffset + row * footprints[s].mRowPitch,
+                            contents.data() + subresource.mOffset + row * subresource.mRowPitch, static_cast<size_t>(subresource.mRowPitch));
+                    }
+                }
+                bufferedMs += bufferedTimer.ElapsedMs();
+
+                // Every row lands where the copy through a buffer puts it
+                for (size_t s = 0; s < layout.mSubresources.size(); ++s)
+                {
+                    const DdsUploadFootprint& footprint = footprints[s];
+                    for (uint32_t row = 0; row < footprint.mNumRows * footprint.mDepth; ++row)
+                    {
+                        const uint64_t offset = footprint.mOffset + row * footprint.mRowPitch;
+                        errors += memcmp(upload.data() + offset, staging.data() + offset, static_cast<size_t>(footprint.mRowSize)) != 0;
+                    }
+                }
+                file.clear();
+            }
+        }
+
+        for (const char* fileName : fileNames)
+        {
+            std::remove(fileName);
+        }
+
+        const double kMiB = 1024.0 * 1024.0;
+        fprintf(out, "  ring: %zu allocations, %zu full, %.1f ns per allocation\n", numAllocations, numFull, ringMs * 1e6 / (numAllocations + numFull));
+        fprintf(out, "  direct reads %.1f MiB/s, through a file buffer %.1f MiB/s\n",
+            static_cast<double>(bytesRead) / kMiB * 1000.0 / directMs, static_cast<double>(bytesRead) / kMiB * 1000.0 / bufferedMs);
+        if (errors > 0)
+        {
+            fprintf(out, "  ERROR: %zu upload errors\n", errors);
+        }
+    }
+
+    static void BenchmarkDdsParse(FILE* out)
+    {
+        size_t errors = 0;
+
+        // Header parsing and subresource layout of files already in memory
+        std::vector<std::vector<uint8_t>> files;
+        files.push_back(BuildSyntheticDds(2048, true, false, true));
+        files.push_back(BuildSyntheticDds(1024, true, true, true));
+        files.push_back(BuildSyntheticDds(1024, false, false, false));
+        files.push_back(BuildSyntheticDds(512, true, true, false));
+
+        const uint32_t numPasses = 50000;
+        size_t numSubresources = 0;
+        DdsLayout layout;
+        BenchmarkTimer parseTimer;
+        for (uint32_t pass = 0; pass < numPasses; ++pass)
+        {
+            const std::vector<uint8_t>& file = files[pass % files.size()];
+            errors += !ParseDds(file.data(), file.size(), &layout);
+            numSubresources += layout.mSubresources.size();
+        }
+        double parseMs = parseTimer.ElapsedMs();
+
+        // Mutated headers and truncated files, each copied to a buffer of exactly its size so
+        // sanitizers catch any read past the end
+        std::vector<std::vector<uint8_t>> seeds;
+        seeds.push_back(BuildSyntheticDds(64, true, false, true));
+        seeds.push_back(BuildSyntheticDds(32, false, false, false));
+        seeds.push_back(BuildSyntheticDds(16, true, true, true));
+        seeds.push_back(BuildSyntheticDds(8, true, true, false));
+
+        std::mt19937 rng(5);
+        const size_t numInputs = 200000;
+        size_t reasons[static_cast<size_t>(DdsError::Count)] = {};
+        BenchmarkTimer fuzzTimer;
+        for (size_t i = 0; i < numInputs; ++i)
+        {
+            std::vector<uint8_t> input = seeds[rng() % seeds.size()];
+            const uint32_t numMutations = 1 + rng() % 4;
+            for (uint32_t m = 0; m < numMutations; ++m)
+            {
+                // Mostly header fields, sometimes whole words of interesting values
+                const size_t position = rng() % (std::min)(input.size(), kDdsMaxHeaderSize + 8);
+                switch (rng() % 4)
+                {
+                case 0:
+                    input[position] ^= static_cast<uint8_t>(1u << (rng() % 8));
+                    break;
+                case 1:
+                    input[position] = static_cast<uint8_t>(rng());
+                    break;
+                default:
+                {
+                    static const uint32_t kValues[] = { 0, 1, 2, 3, 4, 6, 15, 16, 255, 2048, 16384, 16385, 0x7fffffff, 0xffffffff };
+                    const uint32_t value = kValues[rng() % (sizeof(kValues) / sizeof(kValues[0]))];
+                    const size_t word = (position & ~size_t(3)) + 4 <= input.size() ? (position & ~size_t(3)) : 0;
+                    memcpy(input.data() + word, &value, sizeof(value));
+                    break;
+                }
+                }
+            }
+            if (rng() % 8 == 0)
+            {
+                input.resize(rng() % (input.size() + 1));
+            }
+
+            std::unique_ptr<uint8_t[]> exact(new uint8_t[input.size() + (input.empty() ? 1 : 0)]);
+            memcpy(exact.get(), input.data(), input.size());
+            DdsError error = DdsError::None;
+            errors += !FuzzDdsOnce(exact.get(), input.size(), &error);
+            reasons[static_cast<size_t>(error)]++;
+        }
+        double fuzzMs = fuzzTimer.ElapsedMs();
+
+        fprintf(out, "  %.0f files/s, %.1f ns per subresource\n", numPasses * 1000.0 / parseMs, parseMs * 1e6 / numSubresources);
+        fprintf(out, "  %zu mutated inputs in %.1f ms:", numInputs, fuzzMs);
+        for (size_t i = 0; i < static_cast<size_t>(DdsError::Count); ++i)
+        {
+            fprintf(out, "%s %s %zu", i == 0 ? "" : ",", i == 0 ? "accepted" : GetDdsErrorName(static_cast<DdsError>(i)), reasons[i]);
+        }
+        fprintf(out, "\n");
+        if (errors > 0)
+        {
+            fprintf(out, "  ERROR: %zu DDS validation errors\n", errors);
+        }
+    }
+
+    // Smooth gradients with detail and noise on top, and with alpha a cutout of soft edged discs
+    // as foliage textures have
+    static std::vector<uint8_t> BuildSyntheticImage(uint32_t width, uint32_t height, bool alpha, uint32_t seed)
+    {
+        std::mt19937 rng(seed);
+        std::uniform_int_distribution<int> noise(-6, 6);
+        std::vector<uint8_t> pixels(static_cast<size_t>(width) * height * 4);
+        for (uint32_t y = 0; y < height; ++y)
+        {
+            for (uint32_t x = 0; x < width; ++x)
+            {
+                const float u = static_cast<float>(x) / width;
+                const float v = static_cast<float>(y) / height;
+                const float detail = 0.5f + 0.5f * sinf(40.0f * u + 25.0f * v) * cosf(30.0f * v);
+                const float channels[3] =
+                {
+                    60.0f + 120.0f * u + 40.0f * detail,
+                    90.0f + 100.0f * v * detail,
+                    40.0f + 80.0f * (1.0f - u) * v + 30.0f * detail
+                };
+
+                uint8_t* pixel = &pixels[(static_cast<size_t>(y) * width + x) * 4];
+                for (int c = 0; c < 3; ++c)
+                {
+                    pixel[c] = static_cast<uint8_t>((std::min)((std::max)(static_cast<int>(channels[c]) + noise(rng), 0), 255));
+                }
+
+                pixel[3] = 255;
+                if (alpha)
+                {
+                    const float cellU = fmodf(u * 8.0f, 1.0f) - 0.5f;
+                    const float cellV = fmodf(v * 8.0f, 1.0f) - 0.5f;
+                    const float distance = sqrtf(cellU * cellU + cellV * cellV);
+                    pixel[3] = static_cast<uint8_t>((std::min)((std::max)((0.45f - distance) * 2000.0f, 0.0f), 255.0f));
+                }
+            }
+        }
+        return pixels;
+    }
+
+    // Encoding speed on one and all threads, quality against the source, and DDS files with mips
+    // that the loader reads back
+    static void BenchmarkBlockCompression(FILE* out)
+    {
+        size_t errors = 0;
+        ThreadPool serialPool(1);
+        ThreadPool pool;
+
+        const uint32_t size = 2048;
+        const double megapixels = size * size * 1e-6;
+        for (int alpha = 0; alpha < 2; ++alpha)
+        {
+            const std::vector<uint8_t> image = BuildSyntheticImage(size, size, alpha != 0, 7);
+            const BlockFormat format = ChooseBlockFormat(image.data(), static_cast<size_t>(size) * size);
+            if (format != (alpha != 0 ? BlockFormat::BC3 : BlockFormat::BC1))
+            {
+                fprintf(out, "  ERROR: wrong block format chosen\n");
+            }
+
+            std::vector<uint8_t> serial(CalcCompressedSize(size, size, format));
+            BenchmarkTimer serialTimer;
+            CompressImage(image.data(), size, size, format, serial.data(), &serialPool);
+            const double serialMs = serialTimer.ElapsedMs();
+
+            std::vector<uint8_t> parallel(serial.size());
+            const int numIterations = 4;
+            BenchmarkTimer parallelTimer;
+            for (int i = 0; i < numIterations; ++i)
+            {
+                CompressImage(image.data(), size, size, format, parallel.data(), &pool);
+            }
+            const double parallelMs = parallelTimer.ElapsedMs() / numIterations;
+            errors += serial != parallel;
+
+            std::vector<uint8_t> decoded(image.size());
+            DecompressImage(parallel.data(), size, size, format, decoded.data());
+            double rgbPsnr = 0.0;
+            double alphaPsnr = 0.0;
+            CalcPsnr(image.data(), decoded.data(), static_cast<size_t>(size) * size, &rgbPsnr, &alphaPsnr);
+
+            fprintf(out, "  %s %ux%u: 1 thread %.1f MPix/s, %u threads %.1f MPix/s, RGB %.2f dB, alpha %.2f dB\n",
+                format == BlockFormat::BC1 ? "BC1" : "BC3", size, size, megapixels * 1000.0 / serialMs,
+                pool.GetThreadCount(), megapixels * 1000.0 / parallelMs, rgbPsnr, alphaPsnr);
+            if (rgbPsnr < 32.0 || (format == BlockFormat::BC3 && alphaPsnr < 32.0))
+            {
+                fprintf(out, "  ERROR: quality below 32 dB\n");
+            }
+        }
+
+        // A color 565 represents exactly is encoded without loss, also in partial edge blocks. Cut
+        // out pixels are transparent black in BC1.
+        std::vector<uint8_t> flat(37 * 21 * 4);
+        for (size_t i = 0; i < flat.size(); i += 4)
+        {
+            const bool opaque = i % 3 != 0;
+            flat[i + 0] = opaque ? 255 : 0;
+            flat[i + 1] = opaque ? 130 : 0;
+            flat[i + 2] = 0;
+            flat[i + 3] = opaque ? 255 : 0;
+        }
+        for (int f = 0; f < 2; ++f)
+        {
+            const BlockFormat format = f == 0 ? BlockFormat::BC1 : BlockFormat::BC3;
+            std::vector<uint8_t> compressed(CalcCompressedSize(37, 21, format));
+            std::vector<uint8_t> decoded(flat.size());
+            CompressImage(flat.data(), 37, 21, format, compressed.data(), &pool);
+            DecompressImage(compressed.data(), 37, 21, format, decoded.data());
+            double rgbPsnr = 0.0;
+            double alphaPsnr = 0.0;
+            CalcPsnr(flat.data(), decoded.data(), 37 * 21, &rgbPsnr, &alphaPsnr);
+            errors += rgbPsnr < 100.0 || alphaPsnr < 100.0;
+        }
+
+        // Files with full mip chains, checked by the same rules as the loader
+        const uint32_t ddsSize = 1024;
+        const std::vector<uint8_t> image = BuildSyntheticImage(ddsSize, ddsSize, true, 8);
+        const MipGenParams mipParams;
+        BenchmarkTimer ddsTimer;
+        const std::vector<uint8_t> dds = BuildCompressedDds(image.data(), ddsSize, ddsSize, BlockFormat::BC3, &mipParams, &pool);
+        const double ddsMs = ddsTimer.ElapsedMs();
+
+        DdsLayout layout;
+        DdsError error = DdsError::None;
+        if (!ParseDds(dds.data(), dds.size(), &layout, &error) || layout.mFormat != GetBlockDxgiFormat(BlockFormat::BC3) ||
+            layout.mMipCount != 11 || layout.mSubresources.back().mOffset + layout.mSubresources.back().mSize != dds.size())
+        {
+            fprintf(out, "  ERROR: compressed DDS rejected (%s)\n", GetDdsErrorName(error));
+        }
+        else
+        {
+            // The last mip is the average of the image, the alpha of mostly cut out discs
+            uint8_t block[64];
+            DecompressBlock(dds.data() + layout.mSubresources.back().mOffset, BlockFormat::BC3, block);
+            uint64_t alphaSum = 0;
+            for (size_t i = 3; i < image.size(); i += 4)
+            {
+                alphaSum += image[i];
+            }
+            errors += std::abs(static_cast<int>(block[3]) - static_cast<int>(alphaSum / (ddsSize * ddsSize))) > 8;
+        }
+
+        fprintf(out, "  BC3 %ux%u DDS with %u mips in %.1f ms, %zu bytes\n", ddsSize, ddsSize, layout.mMipCount, ddsMs, dds.size());
+
+        const std::vector<uint8_t> opaqueDds = BuildCompressedDds(image.data(), 256, 128, BlockFormat::BC1, &mipParams, &pool);
+        errors += !ParseDds(opaqueDds.data(), opaqueDds.size(), &layout) || layout.mMipCount != 9 || layout.mFormat != GetBlockDxgiFormat(BlockFormat::BC1);
+        if (errors > 0)
+        {
+            fprintf(out, "  ERROR: %zu block compression errors\n", errors);
+        }
+    }
+
+    static double CalcMipCoverage(const MipChain& chain, uint32_t mip, float cutoff)
+    {
+        const MipLevel& level = chain.mLevels[mip];
+        return CalcAlphaCoverage(chain.mData.data() + level.mOffset, level.mWidth, level.mHeight, level.mRowPitch, cutoff);
+    }
+
+    // Full chains of a 4K image with both filters on one and all threads, and the properties the
+    // filters promise: flat images stay flat, color averages in linear space, coverage is kept
+    static void BenchmarkMipGeneration(FILE* out)
+    {
+        size_t errors = 0;
+        ThreadPool serialPool(1);
+        ThreadPool pool;
+
+        const uint32_t size = 4096;
+        const std::vector<uint8_t> image = BuildSyntheticImage(size, size, true, 9);
+        const double megapixels = size * size * 1e-6;
+        MipChain serial;
+        MipChain parallel;
+        for (int filter = 0; filter < 2; ++filter)
+        {
+            MipGenParams params;
+            params.mFilter = filter == 0 ? MipFilter::Box : MipFilter::Kaiser;
+
+            BenchmarkTimer serialTimer;
+            GenerateMips(image.data(), size, size, size * 4, params, &serialPool, &serial);
+            const double serialMs = serialTimer.ElapsedMs();
+
+            BenchmarkTimer parallelTimer;
+            GenerateMips(image.data(), size, size, size * 4, params, &pool, &parallel);
+            const double parallelMs = parallelTimer.ElapsedMs();
+
+            fprintf(out, "  %s 4096x4096, %zu mips: 1 thread %.1f ms (%.0f MPix/s), %u threads %.1f ms (%.0f MPix/s)\n",
+                filter == 0 ? "box" : "Kaiser", parallel.mLevels.size(), serialMs, megapixels * 1000.0 / serialMs,
+                pool.GetThreadCount(), parallelMs, megapixels * 1000.0 / parallelMs);
+            errors += serial.mData != parallel.mData || parallel.mLevels.size() != 13;
+            errors += parallel.mLevels.back().mWidth != 1 || parallel.mLevels.back().mOffset + 4 != parallel.mData.size();
+        }
+
+        // Flat color stays within a step of rounding through every filter and an odd size
+        std::vector<uint8_t> flat(37 * 21 * 4);
+        for (size_t i = 0; i < flat.size(); i += 4)
+        {
+            flat[i + 0] = 200;
+            flat[i + 1] = 90;
+            flat[i + 2] = 7;
+            flat[i + 3] = 128;
+        }
+        for (int filter = 0; filter < 2; ++filter)
+        {
+            MipGenParams params;
+            params.mFilter = filter == 0 ? MipFilter::Box : MipFilter::Kaiser;
+            GenerateMips(flat.data(), 37, 21, 37 * 4, params, &pool, &parallel);
+            for (size_t i = 0; i < parallel.mData.size(); ++i)
+            {
+                errors += std::abs(static_cast<int>(parallel.mData[i]) - static_cast<int>(flat[i % 4])) > 1;
+            }
+        }
+
+        // A black and white checkerboard averages to half the light, not to half the sRGB value
+        std::vector<uint8_t> checker(64 * 64 * 4);
+        for (uint32_t y = 0; y < 64; ++y)
+        {
+            for (uint32_t x = 0; x < 64; ++x)
+            {
+                const uint8_t value = ((x ^ y) & 1) != 0 ? 255 : 0;
+                memset(&checker[(y * 64 + x) * 4], value, 3);
+                checker[(y * 64 + x) * 4 + 3] = 255;
+            }
+        }
+        MipGenParams srgbParams;
+        GenerateMips(checker.data(), 64, 64, 64 * 4, srgbParams, &pool, &parallel);
+        const uint8_t srgbGray = parallel.mData[parallel.mLevels[1].mOffset];
+        srgbParams.mSrgb = false;
+        GenerateMips(checker.data(), 64, 64, 64 * 4, srgbParams, &pool, &parallel);
+        const uint8_t unormGray = parallel.mData[parallel.mLevels[1].mOffset];
+        fprintf(out, "  checkerboard mip 1: sRGB %u, unorm %u\n", srgbGray, unormGray);
+        errors += srgbGray != 188 || (unormGray != 127 && unormGray != 128);
+
+        // Alpha coverage at the alpha test of the shaders, on mips large enough to resolve the discs
+        const float cutoff = 0.1f;
+        MipGenParams coverageParams;
+        coverageParams.mAlphaCutoff = cutoff;
+        GenerateMips(image.data(), size, size, size * 4, coverageParams, &pool, &parallel);
+        GenerateMips(image.data(), size, size, size * 4, MipGenParams(), &pool, &serial);
+        const double topCoverage = CalcMipCoverage(parallel, 0, cutoff);
+        double maxError = 0.0;
+        double maxPlainError = 0.0;
+        for (uint32_t mip = 1; parallel.mLevels[mip].mWidth >= 128; ++mip)
+        {
+            maxError = (std::max)(maxError, fabs(CalcMipCoverage(parallel, mip, cutoff) - topCoverage));
+            maxPlainError = (std::max)(maxPlainError, fabs(CalcMipCoverage(serial, mip, cutoff) - topCoverage));
+        }
+        fprintf(out, "  coverage %.3f at alpha %.1f, largest mip error %.4f preserved, %.4f plain\n", topCoverage, cutoff, maxError, maxPlainError);
+        errors += maxError > 0.005;
+
+        if (errors > 0)
+        {
+            fprintf(out, "  ERROR: %zu mip generation errors\n", errors);
+        }
+    }
+
+    // Leaves of a few texels on a transparent background, green with some variation
+    static std::vector<uint8_t> BuildSyntheticFoliage(uint32_t size, uint32_t seed)
+    {
+        std::mt19937 rng(seed);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        std::vector<uint8_t> pixels(static_cast<size_t>(size) * size * 4, 0);
+        const uint32_t numLeaves = size * size / 40;
+        for (uint32_t leaf = 0; leaf < numLeaves; ++leaf)
+        {
+            const float centerX = unit(rng) * size;
+            const float centerY = unit(rng) * size;
+            const float radius = 1.0f + 2.0f * unit(rng);
+            const uint8_t green = static_cast<uint8_t>(90 + 120 * unit(rng));
+            const int x0 = (std::max)(static_cast<int>(centerX - radius), 0);
+            const int x1 = (std::min)(static_cast<int>(centerX + radius), static_cast<int>(size) - 1);
+            const int y0 = (std::max)(static_cast<int>(centerY - radius), 0);
+            const int y1 = (std::min)(static_cast<int>(centerY + radius), static_cast<int>(size) - 1);
+            for (int y = y0; y <= y1; ++y)
+            {
+                for (int x = x0; x <= x1; ++x)
+                {
+                    // Edges fade out over a texel
+                    const float dx = x + 0.5f - centerX;
+                    const float dy = y + 0.5f - centerY;
+                    const float alpha = (std::min)(radius - sqrtf(dx * dx + dy * dy) + 0.5f, 1.0f);
+                    uint8_t* pixel = &pixels[(static_cast<size_t>(y) * size + x) * 4];
+                    if (alpha > 0.0f && alpha * 255.0f > pixel[3])
+                    {
+                        pixel[0] = static_cast<uint8_t>(green / 3);
+                        pixel[1] = green;
+                        pixel[2] = static_cast<uint8_t>(green / 4);
+                        pixel[3] = static_cast<uint8_t>(alpha * 255.0f);
+                    }
+                }
+            }
+        }
+        return pixels;
+    }
+
+    // Foliage files with plain mips, as texture tools write them, rebuilt to keep the coverage of
+    // the alpha test in every mip
+    static void BenchmarkAlphaCoverage(FILE* out)
+    {
+        size_t errors = 0;
+        ThreadPool pool;
+
+        const uint32_t size = 1024;
+        const std::vector<uint8_t> foliage = BuildSyntheticFoliage(size, 10);
+        const MipGenParams plainMips;
+        std::vector<std::vector<uint8_t>> files;
+        files.push_back(BuildCompressedDds(foliage.data(), size, size, BlockFormat::BC3, &plainMips, &pool));
+        files.push_back(BuildCompressedDds(foliage.data(), size, size, BlockFormat::BC1, &plainMips, &pool));
+
+        // Uncompressed, with the header of a DDS of the same size
+        MipChain chain;
+        GenerateMips(foliage.data(), size, size, size * 4, plainMips, &pool, &chain);
+        files.emplace_back();
+        AppendDdsHeader(28, size, size, static_cast<uint32_t>(chain.mLevels.size()), &files.back());
+        files.back().insert(files.back().end(), chain.mData.begin(), chain.mData.end());
+
+        const char* const names[] = { "BC3", "BC1", "RGBA8" };
+        const uint32_t outputFormats[] = { 77, 77, 28 };
+        for (size_t i = 0; i < files.size(); ++i)
+        {
+            std::vector<uint8_t> output;
+            CoverageReport report;
+            report.mName = names[i];
+            BenchmarkTimer timer;
+            const bool success = PreserveDdsAlphaCoverage(files[i].data(), files[i].size(), kAlphaTestThreshold, &pool, &output, &report);
+            const double ms = timer.ElapsedMs();
+
+            DdsLayout layout;
+            if (!success || !ParseDds(output.data(), output.size(), &layout) || layout.mFormat != outputFormats[i] || layout.mMipCount != 11)
+            {
+                errors++;
+                continue;
+            }
+
+            // Mips down to 64x64, below that a few texels cannot hold the fraction. Block compression
+            // moves alpha near the cutoff, and one bit alpha of BC1 leaves few alpha values to choose
+            // a cutoff between, both keep the result from matching exactly.
+            double maxSourceError = 0.0;
+            double maxError = 0.0;
+            for (const MipCoverage& coverage : report.mMips)
+            {
+                if (coverage.mWidth >= 64)
+                {
+                    maxSourceError = (std::max)(maxSourceError, fabs(static_cast<double>(coverage.mSourceCoverage - report.mMips[0].mSourceCoverage)));
+                    maxError = (std::max)(maxError, fabs(static_cast<double>(coverage.mCoverage - report.mMips[0].mSourceCoverage)));
+                }
+            }
+            fprintf(out, "  %s %ux%u in %.1f ms, largest coverage error %.4f plain, %.4f rebuilt\n", names[i], size, size, ms, maxSourceError, maxError);
+            if (i == 0)
+            {
+                fprintf(out, "%s", FormatCoverageReport(report).c_str());
+            }
+            errors += maxError > 0.05 || maxError * 4.0 >= maxSourceError;
+        }
+
+        // Cube maps are not foliage
+        const std::vector<uint8_t> cubeMap = BuildSyntheticDds(64, true, true, true);
+        std::vector<uint8_t> output;
+        CoverageReport report;
+        errors += PreserveDdsAlphaCoverage(cubeMap.data(), cubeMap.size(), kAlphaTestThreshold, &pool, &output, &report);
+
+        if (errors > 0)
+        {
+            fprintf(out, "  ERROR: %zu alpha coverage errors\n", errors);
+        }
+    }
+
+    static void AppendToVector(void* context, void* data, int size)
+    {
+        auto* bytes = static_cast<std::vector<uint8_t>*>(context);
+        bytes->insert(bytes->end(), static_cast<uint8_t*>(data), static_cast<uint8_t*>(data) + size);
+    }
+
+    static void BenchmarkImageDecode(FILE* out)
+    {
+        size_t errors = 0;
+        ThreadPool pool;
+
+        // PNGs of the sizes of glTF textures, with and without alpha, RGB files expand to opaque RGBA
+        const uint32_t sizes[] = { 1024, 1024, 512, 512, 512, 512, 256, 256 };
+        const size_t imageCount = sizeof(sizes) / sizeof(sizes[0]);
+        std::vector<std::vector<uint8_t>> sources(imageCount);
+        std::vector<EncodedImage> images(imageCount + 1);
+        for (size_t i = 0; i < imageCount; ++i)
+        {
+            const bool alpha = i % 2 == 0;
+            sources[i] = BuildSyntheticImage(sizes[i], sizes[i], alpha, static_cast<uint32_t>(i));
+            std::vector<uint8_t> rgb;
+            const uint8_t* pixels = sources[i].data();
+            int channels = 4;
+            if (!alpha)
+            {
+                for (size_t p = 0; p < sources[i].size(); p += 4)
+                {
+                    rgb.insert(rgb.end(), &sources[i][p], &sources[i][p] + 3);
+                }
+                pixels = rgb.data();
+                channels = 3;
+            }
+            stbi_write_png_to_func(AppendToVector, &images[i].mOwnedData, sizes[i], sizes[i], channels, pixels, sizes[i] * channels);
+            images[i].mpData = images[i].mOwnedData.data();
+            images[i].mSize = images[i].mOwnedData.size();
+        }
+
+        // Not an image, which fails without stopping the others
+        images[imageCount].mOwnedData.assign(256, 0x5a);
+        images[imageCount].mpData = images[imageCount].mOwnedData.data();
+        images[imageCount].mSize = images[imageCount].mOwnedData.size();
+
+        std::vector<DecodedImage> serial(images.size());
+        std::vector<DecodedImage> parallel(images.size());
+        ImageDecodeStats serialStats;
+        ImageDecodeStats parallelStats;
+        DecodeImages(images.data(), images.size(), nullptr, serial.data(), &serialStats);
+        DecodeImages(images.data(), images.size(), &pool, parallel.data(), &parallelStats);
+
+        fprintf(out, "  %zu images, %.2f MiB to %.2f MiB: serial %.1f ms, %u threads %.1f ms (%.1fx)\n", parallelStats.mImages,
+            parallelStats.mEncodedBytes / (1024.0 * 1024.0), parallelStats.mDecodedBytes / (1024.0 * 1024.0), serialStats.mMs,
+            pool.GetThreadCount(), parallelStats.mMs, serialStats.mMs / (std::max)(parallelStats.mMs, 1e-6));
+
+        for (size_t i = 0; i < imageCount; ++i)
+        {
+            errors += serial[i].mWidth != sizes[i] || serial[i].mHeight != sizes[i] || serial[i].mPixels != sources[i];
+            errors += parallel[i].mPixels != serial[i].mPixels;
+        }
+        errors += !parallel[imageCount].mPixels.empty() || serialStats.mFailed != 1 || parallelStats.mFailed != 1;
+
+        if (errors > 0)
+        {
+            fprintf(out, "  ERROR: %zu image decode errors\n", errors);
+        }
+    }
+
+    static void BenchmarkTexturePacking(FILE* out)
+    {
+        size_t errors = 0;
+        std::mt19937 rng(11);
+
+        // Leaves, bark and caps of a forest of species, two formats and a few sizes, terrain left out
+        const uint32_t formats[] = { 71, 77 };
+        const uint32_t sides[] = { 256, 512, 1024 };
+        const size_t textureCount = 96;
+        std::vector<TextureShape> shapes(textureCount);
+        for (size_t i = 0; i < textureCount; ++i)
+        {
+            const uint32_t side = sides[rng() % 3];
+            shapes[i].mFormat = formats[rng() % 2];
+            shapes[i].mWidth = side;
+            shapes[i].mHeight = side;
+            shapes[i].mMipCount = CalcMipCount(side, side);
+            if (i % 8 == 0)
+            {
+                shapes[i] = TextureShape();
+            }
+        }
+
+        TextureArrayPlan plan;
+        BenchmarkTimer planTimer;
+        PlanTextureArrays(shapes.data(), textureCount, 16, &plan);
+        const double planMs = planTimer.ElapsedMs();
+
+        size_t planned = 0;
+        for (size_t g = 0; g < plan.mGroups.size(); ++g)
+        {
+            const TextureArrayGroup& group = plan.mGroups[g];
+            errors += group.mTextures.empty() || group.mTextures.size() > 16;
+            for (size_t slice = 0; slice < group.mTextures.size(); ++slice)
+            {
+                const uint32_t texture = group.mTextures[slice];
+                errors += !(shapes[texture] == group.mShape);
+                errors += plan.mGroupOfTexture[texture] != g || plan.mSliceOfTexture[texture] != slice;
+            }
+            planned += group.mTextures.size();
+        }
+        for (size_t i = 0; i < textureCount; ++i)
+        {
+            errors += (i % 8 != 0) != (plan.mGroupOfTexture[i] != InvalidIndex);
+        }
+        fprintf(out, "  arrays: %zu of %zu textures in %zu arrays in %.3f ms\n", planned, textureCount, plan.mGroups.size(), planMs);
+
+        // Atlas of images of any size, padded for trilinear filtering down a few mips
+        const size_t imageCount = 200;
+        const uint32_t padding = 4;
+        std::vector<uint32_t> widths(imageCount);
+        std::vector<uint32_t> heights(imageCount);
+        std::uniform_int_distribution<uint32_t> sideDist(8, 256);
+        for (size_t i = 0; i < imageCount; ++i)
+        {
+            widths[i] = sideDist(rng);
+            heights[i] = i % 4 == 0 ? widths[i] : sideDist(rng);
+        }
+
+        AtlasLayout layout;
+        BenchmarkTimer packTimer;
+        const bool packed = PackAtlas(widths.data(), heights.data(), imageCount, padding, 8192, &layout);
+        const double packMs = packTimer.ElapsedMs();
+        fprintf(out, "  atlas: %zu images in %ux%u, %.1f%% occupied, packed in %.2f ms\n", imageCount, layout.mWidth, layout.mHeight,
+            layout.CalcOccupancy() * 100.0f, packMs);
+        if (!packed)
+        {
+            fprintf(out, "  ERROR: atlas packing failed\n");
+            return;
+        }
+
+        // Padded images stay apart and inside, and start on whole blocks
+        for (size_t i = 0; i < imageCount; ++i)
+        {
+            const AtlasRect& a = layout.mRects[i];
+            errors += a.mWidth != widths[i] || a.mHeight != heights[i] || a.mX % 4 != 0 || a.mY % 4 != 0;
+            errors += a.mX < padding || a.mY < padding || a.mX + a.mWidth + padding > layout.mWidth || a.mY + a.mHeight + padding > layout.mHeight;
+            for (size_t j = i + 1; j < imageCount; ++j)
+            {
+                const AtlasRect& b = layout.mRects[j];
+                errors += a.mX < b.mX + b.mWidth + 2 * padding && b.mX < a.mX + a.mWidth + 2 * padding &&
+                    a.mY < b.mY + b.mHeight + 2 * padding && b.mY < a.mY + a.mHeight + 2 * padding;
+            }
+        }
+
+        std::vector<std::vector<uint8_t>> images(imageCount);
+        std::vector<const uint8_t*> imagePointers(imageCount);
+        for (size_t i = 0; i < imageCount; ++i)
+        {
+            images[i] = BuildSyntheticImage(widths[i], heights[i], i % 2 == 0, static_cast<uint32_t>(i));
+            imagePointers[i] = images[i].data();
+        }
+        std::vector<uint8_t> atlas;
+        BenchmarkTimer buildTimer;
+        BuildAtlasImage(imagePointers.data(), layout, &atlas);
+        const double buildMs = buildTimer.ElapsedMs();
+        fprintf(out, "  atlas image: %.2f MiB in %.2f ms\n", atlas.size() / (1024.0 * 1024.0), buildMs);
+
+        // Texcoords of vertices laid out as LoadGltf interleaves them, position, normal, tangent, texcoord
+        const size_t vertexStride = 11 * sizeof(float);
+        const size_t texcoordOffset = 9 * sizeof(float);
+        const size_t vertexCount = 64;
+        std::uniform_real_distribution<float> unitDist(0.0f, 1.0f);
+        for (size_t i = 0; i < imageCount; ++i)
+        {
+            const AtlasRect& rect = layout.mRects[i];
+            const uint8_t* atlasCorner = atlas.data() + (static_cast<size_t>(rect.mY) * layout.mWidth + rect.mX) * 4;
+
+            // Padding repeats the edge texels
+            errors += memcmp(atlasCorner - padding * 4, images[i].data(), 4) != 0;
+            errors += memcmp(atlasCorner - static_cast<size_t>(padding) * layout.mWidth * 4, images[i].data(), 4) != 0;
+
+            std::vector<float> vertices(vertexCount * 11);
+            for (size_t v = 0; v < vertexCount; ++v)
+            {
+                vertices[v * 11 + 9] = (std::floor(unitDist(rng) * rect.mWidth) + 0.5f) / rect.mWidth;
+                vertices[v * 11 + 10] = (std::floor(unitDist(rng) * rect.mHeight) + 0.5f) / rect.mHeight;
+            }
+            std::vector<float> original = vertices;
+            if (!RemapTexcoords(reinterpret_cast<uint8_t*>(vertices.data()), vertexStride, texcoordOffset, vertexCount, layout, i))
+            {
+                errors++;
+                continue;
+            }
+
+            // The texel a remapped texcoord lands on is the one it pointed at in its own image
+            for (size_t v = 0; v < vertexCount; ++v)
+            {
+                const size_t atlasX = static_cast<size_t>(vertices[v * 11 + 9] * layout.mWidth);
+                const size_t atlasY = static_cast<size_t>(vertices[v * 11 + 10] * layout.mHeight);
+                const size_t imageX = static_cast<size_t>(original[v * 11 + 9] * rect.mWidth);
+                const size_t imageY = static_cast<size_t>(original[v * 11 + 10] * rect.mHeight);
+                errors += memcmp(&atlas[(atlasY * layout.mWidth + atlasX) * 4], &images[i][(imageY * rect.mWidth + imageX) * 4], 4) != 0;
+            }
+
+            // Wrapping texcoords leave the mesh as it was
+            vertices = original;
+            vertices[10 * 11 + 9] = 1.5f;
+            errors += RemapTexcoords(reinterpret_cast<uint8_t*>(vertices.data()), vertexStride, texcoordOffset, vertexCount, layout, i);
+            errors += memcmp(vertices.data(), original.data(), 10 * 11 * sizeof(float)) != 0;
+        }
+
+        // Images larger than the atlas do not fit
+        const uint32_t large = 300;
+        errors += PackAtlas(&large, &large, 1, padding, 256, &layout);
+
+        if (errors > 0)
+        {
+            fprintf(out, "  ERROR: %zu texture packing errors\n", errors);
+        }
+    }
+
+    // Churn of persistent ranges as textures stream in and out, mostly single views and some tables,
+    // with per-frame tables on top. With validate, every descriptor is tracked to catch overlaps and
+    // ranges reused before the GPU is done with them.
+    static size_t RunDescriptorChurn(DescriptorAllocator& allocator, uint32_t persistentCount, uint32_t frameCount, uint32_t descriptorsPerFrame,
+        size_t frames, bool validate, size_t* operations, size_t* failures)
+    {
+        enum DescriptorState : uint8_t { Free, Used, Pending };
+        std::vector<uint8_t> states(validate ? allocator.GetHeapSize() : 0, Free);
+        std::vector<std::vector<DescriptorRange>> pending(frameCount);
+        std::vector<DescriptorRange> live;
+        std::mt19937 rng(5);
+        size_t errors = 0;
+        *operations = 0;
+        *failures = 0;
+
+        auto mark = [&](const DescriptorRange& range, uint8_t expected, uint8_t state)
+        {
+            for (uint32_t i = range.mIndex; i < range.mIndex + range.mCount; ++i)
+            {
+                errors += states[i] != expected;
+                states[i] = state;
+            }
+        };
+
+        const size_t targetLive = persistentCount / 12;
+        for (size_t frame = 0; frame < frames; ++frame)
+        {
+            const uint32_t frameIndex = static_cast<uint32_t>(frame % frameCount);
+            allocator.BeginFrame(frameIndex);
+            if (validate)
+            {
+                for (const DescriptorRange& range : pending[frameIndex])
+                {
+                    mark(range, Pending, Free);
+                }
+                pending[frameIndex].clear();
+            }
+
+            for (int op = 0; op < 256; ++op)
+            {
+                const uint32_t sizeRoll = rng() % 100;
+                const uint32_t count = sizeRoll < 80 ? 1 : sizeRoll < 95 ? 2 + rng() % 7 : 16 + rng() % 113;
+                if (live.size() < targetLive / 2 || (live.size() < targetLive * 3 / 2 && rng() % 2 == 0))
+                {
+                    const DescriptorRange range = allocator.AllocatePersistent(count);
+                    if (!range.IsValid())
+                    {
+                        (*failures)++;
+                        continue;
+                    }
+                    errors += range.mCount != count || range.mIndex + range.mCount > persistentCount;
+                    if (validate)
+                    {
+                        mark(range, Free, Used);
+                    }
+                    live.push_back(range);
+                }
+                else if (!live.empty())
+                {
+                    const size_t victim = rng() % live.size();
+                    allocator.FreePersistent(live[victim]);
+                    if (validate)
+                    {
+                        mark(live[victim], Used, Pending);
+                        pending[frameIndex].push_back(live[victim]);
+                    }
+                    live[victim] = live.back();
+                    live.pop_back();
+                }
+                (*operations)++;
+            }
+
+            // Per-frame tables until the region is full
+            uint32_t frameUsed = 0;
+            for (;;)
+            {
+                const uint32_t count = 1 + rng() % 16;
+                const DescriptorRange range = allocator.AllocateFrame(count);
+                (*operations)++;
+                if (!range.IsValid())
+                {
+                    errors += frameUsed + count <= descriptorsPerFrame;
+                    break;
+                }
+                errors += range.mIndex != persistentCount + frameIndex * descriptorsPerFrame + frameUsed;
+                if (validate)
+                {
+                    mark(range, Free, Used);
+                    mark(range, Used, Free);
+                }
+                frameUsed += count;
+            }
+        }
+
+        // Everything freed comes back as one range once every frame has been retired
+        for (const DescriptorRange& range : live)
+        {
+            allocator.FreePersistent(range);
+        }
+        for (uint32_t i = 0; i <= frameCount; ++i)
+        {
+            allocator.BeginFrame((static_cast<uint32_t>(frames) + i) % frameCount);
+        }
+        DescriptorAllocatorStats stats;
+        allocator.CalcStats(&stats);
+        errors += stats.mPersistentUsed != 0 || stats.mPendingFree != 0 || stats.mFreeRanges != 1 || stats.mLargestFreeRange != persistentCount;
+        return errors;
+    }
+
+    static void BenchmarkDescriptorAllocator(FILE* out)
+    {
+        size_t errors = 0;
+        const uint32_t persistentCount = 1 << 16;
+        const uint32_t frameCount = 3;
+        const uint32_t descriptorsPerFrame = 1024;
+        const size_t frames = 4000;
+
+        DescriptorAllocator allocator;
+        allocator.Init(persistentCount, frameCount, descriptorsPerFrame);
+        errors += allocator.GetHeapSize() != persistentCount + frameCount * descriptorsPerFrame;
+
+        size_t operations = 0;
+        size_t failures = 0;
+        BenchmarkTimer timer;
+        errors += RunDescriptorChurn(allocator, persistentCount, frameCount, descriptorsPerFrame, frames, false, &operations, &failures);
+        const double ms = timer.ElapsedMs();
+        fprintf(out, "  %zu operations over %zu frames in %.1f ms, %.1f M/s, %zu failed allocations\n", operations, frames, ms,
+            operations / (ms * 1000.0), failures);
+
+        allocator.Init(persistentCount, frameCount, descriptorsPerFrame);
+        errors += RunDescriptorChurn(allocator, persistentCount, frameCount, descriptorsPerFrame, 200, true, &operations, &failures);
+
+        // Holes left by freeing every other range
+        allocator.Init(persistentCount, frameCount, descriptorsPerFrame);
+        std::mt19937 rng(9);
+        std::vector<DescriptorRange> live;
+        for (int i = 0; i < 20000; ++i)
+        {
+            live.push_back(allocator.AllocatePersistent(1 + rng() % 4));
+        }
+        for (size_t i = 0; i < live.size(); i += 2)
+        {
+            allocator.FreePersistent(live[i]);
+        }
+        DescriptorAllocatorStats stats;
+        allocator.CalcStats(&stats);
+        errors += stats.mPendingFree == 0 || stats.mFreeRanges != 1;
+        allocator.BeginFrame(1);
+        allocator.BeginFrame(0);
+        allocator.CalcStats(&stats);
+        fprintf(out, "  every other range freed: %u used, %u free in %u ranges, largest %u, fragmentation %.2f\n", stats.mPersistentUsed,
+            stats.mPersistentFree, stats.mFreeRanges, stats.mLargestFreeRange, stats.CalcFragmentation());
+        errors += stats.mPendingFree != 0 || stats.mFreeRanges != 10001;
+
+        // Small ranges fill the holes first, so the large free range at the end stays whole
+        const uint32_t largest = stats.mLargestFreeRange;
+        for (size_t i = 0; i < live.size(); i += 2)
+        {
+            errors += !allocator.AllocatePersistent(1).IsValid();
+        }
+        allocator.CalcStats(&stats);
+        errors += stats.mLargestFreeRange != largest;
+
+        errors += allocator.AllocatePersistent(persistentCount).IsValid();
+        errors += allocator.AllocatePersistent(0).IsValid();
+
+        if (errors > 0)
+        {
+            fprintf(out, "  ERROR: %zu descriptor allocator errors\n", errors);
+        }
+    }
+
+    static void WriteTextFile(const char* fileName, const char* text)
+    {
+        std::ofstream file(fileName, std::ios::out | std::ios::binary | std::ios::trunc);
+        file << text;
+    }
+
+    static void BenchmarkShaderCache(FILE* out)
+    {
+        size_t errors = 0;
+        const char* sourceName = "shader_cache_benchmark.hlsl";
+        const char* includeName = "shader_cache_benchmark.h";
+        const char* cacheName = "shader_cache_benchmark.cache";
+
+        // Source hash follows #include "..." and tolerates files including each other
+        WriteTextFile(includeName, "#include \"shader_cache_benchmark.hlsl\"\nstatic const float kScale = 1.0;\n");
+        WriteTextFile(sourceName, "  #include \"shader_cache_benchmark.h\"\nfloat4 PsMain() : SV_Target { return kScale; }\n");
+        uint64_t sourceHash = 0;
+        errors += !CalcShaderSourceHash(sourceName, &sourceHash);
+        WriteTextFile(includeName, "#include \"shader_cache_benchmark.hlsl\"\nstatic const float kScale = 2.0;\n");
+        uint64_t changedHash = 0;
+        errors += !CalcShaderSourceHash(sourceName, &changedHash);
+        errors += changedHash == sourceHash;
+        std::remove(includeName);
+        errors += CalcShaderSourceHash(sourceName, &changedHash);
+        std::remove(sourceName);
+
+        // Every input of a compile changes the key
+        const ShaderDefine defines[] = { { "INDIRECT", "1" }, { "MAX_TEXTURES", "64" } };
+        const ShaderDefine otherDefines[] = { { "INDIRECT", "1" }, { "MAX_TEXTURES", "65" } };
+        const uint64_t key = CalcShaderKey(sourceHash, "PsMain", "ps_5_1", defines, 2, 0, 47);
+        errors += key != CalcShaderKey(sourceHash, "PsMain", "ps_5_1", defines, 2, 0, 47);
+        const uint64_t otherKeys[] =
+        {
+            CalcShaderKey(changedHash, "PsMain", "ps_5_1", defines, 2, 0, 47),
+            CalcShaderKey(sourceHash, "PsOpaque", "ps_5_1", defines, 2, 0, 47),
+            CalcShaderKey(sourceHash, "PsMain", "ps_5_0", defines, 2, 0, 47),
+            CalcShaderKey(sourceHash, "PsMain", "ps_5_1", defines, 1, 0, 47),
+            CalcShaderKey(sourceHash, "PsMain", "ps_5_1", otherDefines, 2, 0, 47),
+            CalcShaderKey(sourceHash, "PsMain", "ps_5_1", defines, 2, 1, 47),
+            CalcShaderKey(sourceHash, "PsMain", "ps_5_1", defines, 2, 0, 46),
+            CalcShaderKey(sourceHash, "PsMai", "nps_5_1", defines, 2, 0, 47)
+        };
+        for (uint64_t otherKey : otherKeys)
+        {
+            errors += otherKey == key;
+        }
+
+        // Bytecode of the size the viewer's shaders have
+        const size_t shaderCount = 512;
+        std::mt19937 rng(5);
+        std::vector<std::vector<uint8_t>> shaders(shaderCount);
+        ShaderCache cache;
+        for (size_t i = 0; i < shaderCount; ++i)
+        {
+            shaders[i].resize(1024 + rng() % 16384);
+            for (uint8_t& byte : shaders[i])
+            {
+                byte = static_cast<uint8_t>(rng());
+            }
+            cache.Add(key + i, shaders[i].data(), shaders[i].size());
+        }
+
+        BenchmarkTimer timer;
+        errors += !cache.Save(cacheName);
+        const double saveMs = timer.ElapsedMs();
+        timer = BenchmarkTimer();
+        ShaderCache loaded;
+        errors += !loaded.Load(cacheName);
+        const double loadMs = timer.ElapsedMs();
+        errors += loaded.GetCount() != shaderCount;
+        for (size_t i = 0; i < shaderCount; ++i)
+        {
+            const std::vector<uint8_t>* bytecode = loaded.Find(key + i);
+            errors += bytecode == nullptr || *bytecode != shaders[i];
+        }
+        errors += loaded.Find(key - 1) != nullptr;
+        errors += loaded.GetStats().mHits != shaderCount || loaded.GetStats().mMisses != 1;
+
+        const size_t lookups = 1 << 20;
+        size_t found = 0;
+        timer = BenchmarkTimer();
+        for (size_t i = 0; i < lookups; ++i)
+        {
+            found += loaded.Find(key + i % (2 * shaderCount)) != nullptr;
+        }
+        const double lookupMs = timer.ElapsedMs();
+        errors += found != lookups / 2;
+
+        std::vector<char> data;
+        {
+            MappedFile file;
+            if (!file.Open(cacheName))
+            {
+                fprintf(out, "  ERROR: shader cache file missing\n");
+                return;
+            }
+            data.assign(file.GetData(), file.GetData() + file.GetSize());
+        }
+        fprintf(out, "  %zu shaders, %.1f MB: save %.2f ms, load %.2f ms, %.1f M lookups/s\n", shaderCount, data.size() / (1024.0 * 1024.0),
+            saveMs, loadMs, lookups / (lookupMs * 1000.0));
+
+        // Saving again without changes leaves the file alone
+        std::remove(cacheName);
+        errors += !loaded.Save(cacheName);
+        errors += std::ifstream(cacheName).good();
+
+        // Damaged and truncated files are ignored as a whole
+        const size_t damageOffsets[] = { 0, 4, 8, 16, 24, data.size() / 2, data.size() - 1 };
+        for (size_t offset : damageOffsets)
+        {
+            std::vector<char> damaged = data;
+            damaged[offset] ^= 0x10;
+            std::ofstream(cacheName, std::ios::out | std::ios::binary | std::ios::trunc).write(damaged.data(), damaged.size());
+            ShaderCache rejected;
+            errors += rejected.Load(cacheName) || rejected.GetCount() != 0;
+        }
+        std::ofstream(cacheName, std::ios::out | std::ios::binary | std::ios::trunc).write(data.data(), data.size() - 100);
+        ShaderCache truncated;
+        errors += truncated.Load(cacheName) || truncated.GetCount() != 0;
+        std::remove(cacheName);
+        errors += truncated.Load(cacheName);
+
+        if (errors > 0)
+        {
+            fprintf(out, "  ERROR: %zu shader cache errors\n", errors);
+        }
+    }
+
+    struct BenchmarkEntry
+    {
+        const char* mName;
+        void (*mFunction)(FILE* out);
+    };
+
+    static const BenchmarkEntry sBenchmarks[] =
+    {
+        { "materials", BenchmarkMaterials },
+        { "render_queue", BenchmarkRenderQueue },
+        { "overdraw", BenchmarkOverdraw },
+        { "occlusion", BenchmarkOcclusion },
+        { "hiz", BenchmarkHiZ },
+        { "indirect", BenchmarkIndirect },
+        { "placement", BenchmarkPlacement },
+        { "raycast", BenchmarkRaycast },
+        { "scene_pick", BenchmarkScenePick },
+        { "frame_timing", BenchmarkFrameTiming },
+        { "profiler", BenchmarkProfiler },
+        { "gpu_timer", BenchmarkGpuTimer },
+        { "memory", BenchmarkMemory },
+        { "streaming", BenchmarkStreaming },
+        { "dds_mapping", BenchmarkDdsMapping },
+        { "dds_upload", BenchmarkDdsUpload },
+        { "dds_parse", BenchmarkDdsParse },
+        { "block_compression", BenchmarkBlockCompression },
+        { "mip_generation", BenchmarkMipGeneration },
+        { "alpha_coverage", BenchmarkAlphaCoverage },
+        { "image_decode", BenchmarkImageDecode },
+        { "texture_packing", BenchmarkTexturePacking },
+        { "descriptor_allocator", BenchmarkDescriptorAllocator },
+        { "shader_cache", BenchmarkShaderCache },
+    };
+
+    void RunBenchmarks(const char* filter, FILE* out)
+    {
+        for (const auto& benchmark : sBenchmarks)
+        {
+            if (filter != nullptr && filter[0] != '\0' && strstr(benchmark.mName, filter) == nullptr)
+            {
+                continue;
+            }
+
+            fprintf(out, "%s\n", benchmark.mName);
+            BenchmarkTimer timer;
+            benchmark.mFunction(out);
+            fprintf(out, "  total %.1f ms\n", timer.ElapsedMs());
+            fflush(out);
+        }
+    }
+}
@@ -0,0 +1,12 @@
+// Benchmark.h
+
+#pragma once
+
+#include <stdio.h>
+
+namespace Vnm
+{
+    // Runs the CPU benchmarks whose name contains filter (all of them if filter is empty) and
+    // writes the results to out. Nothing here needs a window or a D3D12 device.
+    void RunBenchmarks(const char* filter, FILE* out);
+}
@@ -0,0 +1,661 @@
+// BlockCompression.cpp
+
+#include "BlockCompression.h"
+#include "DdsFile.h"
+#include "MipGenerator.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <emmintrin.h>
+
+namespace Vnm
+{
+    uint32_t GetBlockBytes(BlockFormat format)
+    {
+        return format == BlockFormat::BC1 ? 8 : 16;
+    }
+
+    uint32_t GetBlockDxgiFormat(BlockFormat format)
+    {
+        return format == BlockFormat::BC1 ? 71 : 77;
+    }
+
+    BlockFormat ChooseBlockFormat(const uint8_t* rgba, size_t pixelCount)
+    {
+        for (size_t i = 0; i < pixelCount; ++i)
+        {
+            if (rgba[4 * i + 3] != 255)
+            {
+                return BlockFormat::BC3;
+            }
+        }
+        return BlockFormat::BC1;
+    }
+
+    // Red, green and blue of the 16 pixels in separate arrays, so four pixels fill a register
+    class BlockColors
+    {
+    public:
+        alignas(16) float mChannels[3][16];
+    };
+
+    static void LoadBlockColors(const uint8_t* block, BlockColors* colors)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        for (int i = 0; i < 16; i += 4)
+        {
+            const __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 4 * i));
+            const __m128i low = _mm_unpacklo_epi8(pixels, zero);
+            const __m128i high = _mm_unpackhi_epi8(pixels, zero);
+            __m128 r = _mm_cvtepi32_ps(_mm_unpacklo_epi16(low, zero));
+            __m128 g = _mm_cvtepi32_ps(_mm_unpackhi_epi16(low, zero));
+            __m128 b = _mm_cvtepi32_ps(_mm_unpacklo_epi16(high, zero));
+            __m128 a = _mm_cvtepi32_ps(_mm_unpackhi_epi16(high, zero));
+            _MM_TRANSPOSE4_PS(r, g, b, a);
+            _mm_store_ps(colors->mChannels[0] + i, r);
+            _mm_store_ps(colors->mChannels[1] + i, g);
+            _mm_store_ps(colors->mChannels[2] + i, b);
+        }
+    }
+
+    static void Expand565(uint16_t color, int* rgb)
+    {
+        const int r = (color >> 11) & 31;
+        const int g = (color >> 5) & 63;
+        const int b = color & 31;
+        rgb[0] = (r << 3) | (r >> 2);
+        rgb[1] = (g << 2) | (g >> 4);
+        rgb[2] = (b << 3) | (b >> 2);
+    }
+
+    static int QuantizeChannel(float value, int maxValue)
+    {
+        const int quantized = static_cast<int>(value * static_cast<float>(maxValue) / 255.0f + 0.5f);
+        return (std::min)((std::max)(quantized, 0), maxValue);
+    }
+
+    static uint16_t Quantize565(const float* rgb)
+    {
+        return static_cast<uint16_t>((QuantizeChannel(rgb[0], 31) << 11) | (QuantizeChannel(rgb[1], 63) << 5) | QuantizeChannel(rgb[2], 31));
+    }
+
+    // Colors the indices select, as the decoder computes them. Three color mode has black in the
+    // last entry, which BC1 makes transparent.
+    static void BuildColorPalette(uint16_t color0, uint16_t color1, bool fourColors, int palette[4][3])
+    {
+        Expand565(color0, palette[0]);
+        Expand565(color1, palette[1]);
+        for (int c = 0; c < 3; ++c)
+        {
+            if (fourColors)
+            {
+                palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+                palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+            }
+            else
+            {
+                palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+                palette[3][c] = 0;
+            }
+        }
+    }
+
+    // Closest palette entry of each pixel as 2 bit indices, returns the summed squared error
+    static float FindColorIndices(const BlockColors& colors, const int palette[4][3], int numColors, uint32_t* indices)
+    {
+        __m128 error = _mm_setzero_ps();
+        uint32_t bits = 0;
+        for (int i = 0; i < 16; i += 4)
+        {
+            const __m128 r = _mm_load_ps(colors.mChannels[0] + i);
+            const __m128 g = _mm_load_ps(colors.mChannels[1] + i);
+            const __m128 b = _mm_load_ps(colors.mChannels[2] + i);
+
+            __m128 best = _mm_set1_ps(FLT_MAX);
+            __m128i bestIndex = _mm_setzero_si128();
+            for (int p = 0; p < numColors; ++p)
+            {
+                const __m128 dr = _mm_sub_ps(r, _mm_set1_ps(static_cast<float>(palette[p][0])));
+                const __m128 dg = _mm_sub_ps(g, _mm_set1_ps(static_cast<float>(palette[p][1])));
+                const __m128 db = _mm_sub_ps(b, _mm_set1_ps(static_cast<float>(palette[p][2])));
+                const __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)), _mm_mul_ps(db, db));
+                const __m128i closer = _mm_castps_si128(_mm_cmplt_ps(distance, best));
+                best = _mm_min_ps(distance, best);
+                bestIndex = _mm_or_si128(_mm_andnot_si128(closer, bestIndex), _mm_and_si128(closer, _mm_set1_epi32(p)));
+            }
+            error = _mm_add_ps(error, best);
+
+            // Pack the four 2 bit indices of lanes 0 to 3 into bits 0 to 7
+            bestIndex = _mm_or_si128(bestIndex, _mm_srli_epi64(bestIndex, 30));
+            const uint32_t packed = static_cast<uint32_t>(_mm_cvtsi128_si32(bestIndex)) & 0xF;
+            const uint32_t packedHigh = static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_srli_si128(bestIndex, 8))) & 0xF;
+            bits |= (packed | (packedHigh << 4)) << (2 * i);
+        }
+
+        alignas(16) float lanes[4];
+        _mm_store_ps(lanes, error);
+        *indices = bits;
+        return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+
+    // Ends of the colors along their principal axis, moved in a little as the ends are rarely hit
+    static void FitColorEndpoints(const BlockColors& colors, float* endpoint0, float* endpoint1)
+    {
+        float mean[3] = {};
+        for (int c = 0; c < 3; ++c)
+        {
+            for (int i = 0; i < 16; ++i)
+            {
+                mean[c] += colors.mChannels[c][i];
+            }
+            mean[c] *= 1.0f / 16.0f;
+        }
+
+        // Upper triangle of the covariance, xx xy xz yy yz zz
+        float covariance[6] = {};
+        for (int i = 0; i < 16; ++i)
+        {
+            const float r = colors.mChannels[0][i] - mean[0];
+            const float g = colors.mChannels[1][i] - mean[1];
+            const float b = colors.mChannels[2][i] - mean[2];
+            covariance[0] += r * r;
+            covariance[1] += r * g;
+            covariance[2] += r * b;
+            covariance[3] += g * g;
+            covariance[4] += g * b;
+            covariance[5] += b * b;
+        }
+
+        // Power iteration, starting from the row of the channel that varies most
+        const float rows[3][3] =
+        {
+            { covariance[0], covariance[1], covariance[2] },
+            { covariance[1], covariance[3], covariance[4] },
+            { covariance[2], covariance[4], covariance[5] }
+        };
+        int start = 0;
+        for (int c = 1; c < 3; ++c)
+        {
+            if (rows[c][c] > rows[start][start])
+            {
+                start = c;
+            }
+        }
+
+        float axis[3] = { rows[start][0], rows[start][1], rows[start][2] };
+        for (int iteration = 0; iteration < 4; ++iteration)
+        {
+            float next[3];
+            for (int c = 0; c < 3; ++c)
+            {
+                next[c] = rows[c][0] * axis[0] + rows[c][1] * axis[1] + rows[c][2] * axis[2];
+            }
+            const float scale = (std::max)((std::max)(fabsf(next[0]), fabsf(next[1])), fabsf(next[2]));
+            if (scale < 1e-12f)
+            {
+                break;
+            }
+            for (int c = 0; c < 3; ++c)
+            {
+                axis[c] = next[c] / scale;
+            }
+        }
+
+        const float lengthSq = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+        if (rows[start][start] < 1e-3f || lengthSq < 1e-12f)
+        {
+            // A flat block is its mean
+            for (int c = 0; c < 3; ++c)
+            {
+                endpoint0[c] = mean[c];
+                endpoint1[c] = mean[c];
+            }
+            return;
+        }
+
+        const float invLength = 1.0f / sqrtf(lengthSq);
+        for (int c = 0; c < 3; ++c)
+        {
+            axis[c] *= invLength;
+        }
+
+        float minT = FLT_MAX;
+        float maxT = -FLT_MAX;
+        for (int i = 0; i < 16; ++i)
+        {
+            const float t = (colors.mChannels[0][i] - mean[0]) * axis[0] + (colors.mChannels[1][i] - mean[1]) * axis[1] + (colors.mChannels[2][i] - mean[2]) * axis[2];
+            minT = (std::min)(minT, t);
+            maxT = (std::max)(maxT, t);
+        }
+
+        const float inset = (maxT - minT) / 16.0f;
+        for (int c = 0; c < 3; ++c)
+        {
+            endpoint0[c] = (std::min)((std::max)(mean[c] + axis[c] * (maxT - inset), 0.0f), 255.0f);
+            endpoint1[c] = (std::min)((std::max)(mean[c] + axis[c] * (minT + inset), 0.0f), 255.0f);
+        }
+    }
+
+    // Least squares endpoints for fixed indices, false if the indices do not pin both down
+    static bool RefineColorEndpoints(const BlockColors& colors, uint32_t indices, float* endpoint0, float* endpoint1)
+    {
+        static const float kWeights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+
+        float aa = 0.0f;
+        float ab = 0.0f;
+        float bb = 0.0f;
+        float ax[3] = {};
+        float bx[3] = {};
+        for (int i = 0; i < 16; ++i)
+        {
+            const float a = kWeights[(indices >> (2 * i)) & 3];
+            const float b = 1.0f - a;
+            aa += a * a;
+            ab += a * b;
+            bb += b * b;
+            for (int c = 0; c < 3; ++c)
+            {
+                ax[c] += a * colors.mChannels[c][i];
+                bx[c] += b * colors.mChannels[c][i];
+            }
+        }
+
+        const float determinant = aa * bb - ab * ab;
+        if (fabsf(determinant) < 1e-6f)
+        {
+            return false;
+        }
+
+        const float invDeterminant = 1.0f / determinant;
+        for (int c = 0; c < 3; ++c)
+        {
+            endpoint0[c] = (std::min)((std::max)((ax[c] * bb - bx[c] * ab) * invDeterminant, 0.0f), 255.0f);
+            endpoint1[c] = (std::min)((std::max)((bx[c] * aa - ax[c] * ab) * invDeterminant, 0.0f), 255.0f);
+        }
+        return true;
+    }
+
+    static void WriteUint16(uint8_t* output, uint16_t value)
+    {
+        output[0] = static_cast<uint8_t>(value);
+        output[1] = static_cast<uint8_t>(value >> 8);
+    }
+
+    // Four color mode block, which BC1 and BC3 share
+    static void CompressColorBlock(const BlockColors& colors, uint8_t* output)
+    {
+        float endpoint0[3];
+        float endpoint1[3];
+        FitColorEndpoints(colors, endpoint0, endpoint1);
+
+        uint16_t color0 = Quantize565(endpoint0);
+        uint16_t color1 = Quantize565(endpoint1);
+        int palette[4][3];
+        BuildColorPalette(color0, color1, true, palette);
+        uint32_t indices = 0;
+        float error = FindColorIndices(colors, palette, 4, &indices);
+
+        for (int iteration = 0; iteration < 2 && error > 0.0f; ++iteration)
+        {
+            if (!RefineColorEndpoints(colors, indices, endpoint0, endpoint1))
+            {
+                break;
+            }
+
+            const uint16_t refined0 = Quantize565(endpoint0);
+            const uint16_t refined1 = Quantize565(endpoint1);
+            if (refined0 == color0 && refined1 == color1)
+            {
+                break;
+            }
+
+            BuildColorPalette(refined0, refined1, true, palette);
+            uint32_t refinedIndices = 0;
+            const float refinedError = FindColorIndices(colors, palette, 4, &refinedIndices);
+            if (refinedError >= error)
+            {
+                break;
+            }
+            color0 = refined0;
+            color1 = refined1;
+            indices = refinedIndices;
+            error = refinedError;
+        }
+
+        // Four color mode needs color0 > color1. Swapping them swaps indices 0 with 1 and 2 with 3.
+        if (color0 < color1)
+        {
+            std::swap(color0, color1);
+            indices ^= 0x55555555;
+        }
+        else if (color0 == color1)
+        {
+            indices = 0;
+        }
+
+        WriteUint16(output, color0);
+        WriteUint16(output + 2, color1);
+        for (int i = 0; i < 4; ++i)
+        {
+            output[4 + i] = static_cast<uint8_t>(indices >> (8 * i));
+        }
+    }
+
+    // BC1 block with transparent pixels, in three color mode where index 3 is transparent black
+    static void CompressPunchThroughBlock(BlockColors& colors, uint32_t transparentMask, uint8_t* output)
+    {
+        // Transparent pixels move to the mean of the others, where they do not change the fit
+        float mean[3] = {};
+        int numOpaque = 0;
+        for (int i = 0; i < 16; ++i)
+        {
+            if ((transparentMask & (1u << i)) == 0)
+            {
+                for (int c = 0; c < 3; ++c)
+                {
+                    mean[c] += colors.mChannels[c][i];
+                }
+                numOpaque++;
+            }
+        }
+
+        uint16_t color0 = 0;
+        uint16_t color1 = 0;
+        uint32_t indices = 0xFFFFFFFF;
+        if (numOpaque > 0)
+        {
+            for (int i = 0; i < 16; ++i)
+            {
+                for (int c = 0; (transparentMask & (1u << i)) != 0 && c < 3; ++c)
+                {
+                    colors.mChannels[c][i] = mean[c] / numOpaque;
+                }
+            }
+
+            float endpoint0[3];
+            float endpoint1[3];
+            FitColorEndpoints(colors, endpoint0, endpoint1);
+
+            // Three color mode needs color0 <= color1
+            color0 = Quantize565(endpoint0);
+            color1 = Quantize565(endpoint1);
+            if (color0 > color1)
+            {
+                std::swap(color0, color1);
+            }
+
+            int palette[4][3];
+            BuildColorPalette(color0, color1, false, palette);
+            FindColorIndices(colors, palette, 3, &indices);
+            for (int i = 0; i < 16; ++i)
+            {
+                if ((transparentMask & (1u << i)) != 0)
+                {
+                    indices |= 3u << (2 * i);
+                }
+            }
+        }
+
+        WriteUint16(output, color0);
+        WriteUint16(output + 2, color1);
+        for (int i = 0; i < 4; ++i)
+        {
+            output[4 + i] = static_cast<uint8_t>(indices >> (8 * i));
+        }
+    }
+
+    static void DecompressColorBlock(const uint8_t* input, bool alwaysFourColors, uint8_t* block)
+    {
+        const uint16_t color0 = static_cast<uint16_t>(input[0] | (input[1] << 8));
+        const uint16_t color1 = static_cast<uint16_t>(input[2] | (input[3] << 8));
+        const uint32_t indices = input[4] | (input[5] << 8) | (input[6] << 16) | (static_cast<uint32_t>(input[7]) << 24);
+        const bool fourColors = alwaysFourColors || color0 > color1;
+
+        int palette[4][3];
+        BuildColorPalette(color0, color1, fourColors, palette);
+        for (int i = 0; i < 16; ++i)
+        {
+            const uint32_t index = (indices >> (2 * i)) & 3;
+            block[4 * i + 0] = static_cast<uint8_t>(palette[index][0]);
+            block[4 * i + 1] = static_cast<uint8_t>(palette[index][1]);
+            block[4 * i + 2] = static_cast<uint8_t>(palette[index][2]);
+            block[4 * i + 3] = (fourColors || index != 3) ? 255 : 0;
+        }
+    }
+
+    // Alpha of BC3, the largest and smallest alpha with six values evenly between them
+    static void CompressAlphaBlock(const uint8_t* block, uint8_t* output)
+    {
+        int minAlpha = 255;
+        int maxAlpha = 0;
+        for (int i = 0; i < 16; ++i)
+        {
+            minAlpha = (std::min)(minAlpha, static_cast<int>(block[4 * i + 3]));
+            maxAlpha = (std::max)(maxAlpha, static_cast<int>(block[4 * i + 3]));
+        }
+
+        output[0] = static_cast<uint8_t>(maxAlpha);
+        output[1] = static_cast<uint8_t>(minAlpha);
+
+        uint64_t bits = 0;
+        const int range = maxAlpha - minAlpha;
+        if (range > 0)
+        {
+            for (int i = 0; i < 16; ++i)
+            {
+                // Steps of 1/7 up from the smallest alpha. The largest is index 0, the smallest
+                // index 1, and indices 2 to 7 count down from the largest.
+                const int step = ((block[4 * i + 3] - minAlpha) * 7 + range / 2) / range;
+                const uint64_t index = step == 7 ? 0 : (step == 0 ? 1 : 8 - step);
+                bits |= index << (3 * i);
+            }
+        }
+
+        for (int i = 0; i < 6; ++i)
+        {
+            output[2 + i] = static_cast<uint8_t>(bits >> (8 * i));
+        }
+    }
+
+    static void DecompressAlphaBlock(const uint8_t* input, uint8_t* block)
+    {
+        const int alpha0 = input[0];
+        const int alpha1 = input[1];
+        int palette[8] = { alpha0, alpha1 };
+        if (alpha0 > alpha1)
+        {
+            for (int i = 1; i < 7; ++i)
+            {
+                palette[i + 1] = ((7 - i) * alpha0 + i * alpha1) / 7;
+            }
+        }
+        else
+        {
+            for (int i = 1; i < 5; ++i)
+            {
+                palette[i + 1] = ((5 - i) * alpha0 + i * alpha1) / 5;
+            }
+            palette[6] = 0;
+            palette[7] = 255;
+        }
+
+        uint64_t bits = 0;
+        for (int i = 0; i < 6; ++i)
+        {
+            bits |= static_cast<uint64_t>(input[2 + i]) << (8 * i);
+        }
+        for (int i = 0; i < 16; ++i)
+        {
+            block[4 * i + 3] = static_cast<uint8_t>(palette[(bits >> (3 * i)) & 7]);
+        }
+    }
+
+    void CompressBlock(const uint8_t* block, BlockFormat format, uint8_t* output)
+    {
+        BlockColors colors;
+        LoadBlockColors(block, &colors);
+        if (format == BlockFormat::BC3)
+        {
+            CompressAlphaBlock(block, output + 0);
+            CompressColorBlock(colors, output + 8);
+            return;
+        }
+
+        uint32_t transparentMask = 0;
+        for (int i = 0; i < 16; ++i)
+        {
+            transparentMask |= block[4 * i + 3] < 128 ? 1u << i : 0u;
+        }
+
+        if (transparentMask != 0)
+        {
+            CompressPunchThroughBlock(colors, transparentMask, output);
+        }
+        else
+        {
+            CompressColorBlock(colors, output);
+        }
+    }
+
+    void DecompressBlock(const uint8_t* input, BlockFormat format, uint8_t* block)
+    {
+        if (format == BlockFormat::BC3)
+        {
+            DecompressColorBlock(input + 8, true, block);
+            DecompressAlphaBlock(input, block);
+        }
+        else
+        {
+            DecompressColorBlock(input, false, block);
+        }
+    }
+
+    size_t CalcCompressedSize(uint32_t width, uint32_t height, BlockFormat format)
+    {
+        return static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) * GetBlockBytes(format);
+    }
+
+    void CompressImage(const uint8_t* rgba, uint32_t width, uint32_t height, BlockFormat format, uint8_t* output, ThreadPool* pool)
+    {
+        assert(width > 0 && height > 0);
+        const uint32_t blocksWide = (width + 3) / 4;
+        const uint32_t blocksHigh = (height + 3) / 4;
+        const uint32_t blockBytes = GetBlockBytes(format);
+
+        ParallelFor(pool, blocksHigh, 1, [&](size_t begin, size_t end)
+        {
+            alignas(16) uint8_t block[64];
+            for (size_t blockY = begin; blockY < end; ++blockY)
+            {
+                uint8_t* dst = output + blockY * blocksWide * blockBytes;
+                for (uint32_t blockX = 0; blockX < blocksWide; ++blockX)
+                {
+                    const uint32_t x = blockX * 4;
+                    for (uint32_t row = 0; row < 4; ++row)
+                    {
+                        const uint32_t y = (std::min)(static_cast<uint32_t>(blockY) * 4 + row, height - 1);
+                        const uint8_t* src = rgba + (static_cast<size_t>(y) * width + x) * 4;
+                        if (x + 4 <= width)
+                        {
+                            memcpy(block + row * 16, src, 16);
+                        }
+                        else
+                        {
+                            for (uint32_t column = 0; column < 4; ++column)
+                            {
+                                const uint32_t offset = (std::min)(column, width - 1 - x) * 4;
+                                memcpy(block + row * 16 + column * 4, src + offset, 4);
+                            }
+                        }
+                    }
+                    CompressBlock(block, format, dst);
+                    dst += blockBytes;
+                }
+            }
+        });
+    }
+
+    void DecompressImage(const uint8_t* input, uint32_t width, uint32_t height, BlockFormat format, uint8_t* rgba)
+    {
+        const uint32_t blockBytes = GetBlockBytes(format);
+        uint8_t block[64];
+        for (uint32_t y = 0; y < height; y += 4)
+        {
+            for (uint32_t x = 0; x < width; x += 4)
+            {
+                DecompressBlock(input, format, block);
+                input += blockBytes;
+
+                const uint32_t rows = (std::min)(4u, height - y);
+                const uint32_t columns = (std::min)(4u, width - x);
+                for (uint32_t row = 0; row < rows; ++row)
+                {
+                    memcpy(rgba + ((static_cast<size_t>(y) + row) * width + x) * 4, block + row * 16, columns * 4);
+                }
+            }
+        }
+    }
+
+    std::vector<uint8_t> BuildCompressedDds(const uint8_t* rgba, uint32_t width, uint32_t height, BlockFormat format, const MipGenParams* mipParams, ThreadPool* pool)
+    {
+        MipChain chain;
+        if (mipParams != nullptr)
+        {
+            GenerateMips(rgba, width, height, static_cast<size_t>(width) * 4, *mipParams, pool, &chain);
+        }
+        else
+        {
+            chain.mLevels.push_back({ 0, static_cast<size_t>(width) * 4, width, height });
+        }
+
+        size_t fileSize = kDdsMaxHeaderSize;
+        for (const MipLevel& level : chain.mLevels)
+        {
+            fileSize += CalcCompressedSize(level.mWidth, level.mHeight, format);
+        }
+
+        std::vector<uint8_t> dds;
+        dds.reserve(fileSize);
+        AppendDdsHeader(GetBlockDxgiFormat(format), width, height, static_cast<uint32_t>(chain.mLevels.size()), &dds);
+        for (const MipLevel& level : chain.mLevels)
+        {
+            const uint8_t* pixels = chain.mData.empty() ? rgba : chain.mData.data() + level.mOffset;
+            const size_t offset = dds.size();
+            dds.resize(offset + CalcCompressedSize(level.mWidth, level.mHeight, format));
+            CompressImage(pixels, level.mWidth, level.mHeight, format, dds.data() + offset, pool);
+        }
+        return dds;
+    }
+
+    void CalcPsnr(const uint8_t* reference, const uint8_t* rgba, size_t pixelCount, double* rgbPsnr, double* alphaPsnr)
+    {
+        uint64_t rgbError = 0;
+        uint64_t alphaError = 0;
+        for (size_t i = 0; i < 4 * pixelCount; i += 4)
+        {
+            for (size_t c = 0; c < 3; ++c)
+            {
+                const int difference = reference[i + c] - rgba[i + c];
+                rgbError += static_cast<uint64_t>(difference * difference);
+            }
+            const int difference = reference[i + 3] - rgba[i + 3];
+            alphaError += static_cast<uint64_t>(difference * difference);
+        }
+
+        // Identical images are reported as 100 dB
+        auto psnr = [](uint64_t error, size_t count)
+        {
+            if (error == 0 || count == 0)
+            {
+                return 100.0;
+            }
+            const double meanError = static_cast<double>(error) / static_cast<double>(count);
+            return 10.0 * log10(255.0 * 255.0 / meanError);
+        };
+        *rgbPsnr = psnr(rgbError, 3 * pixelCount);
+        *alphaPsnr = psnr(alphaError, pixelCount);
+    }
+}
@@ -0,0 +1,49 @@
+// BlockCompression.h
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace Vnm
+{
+    class MipGenParams;
+    class ThreadPool;
+
+    enum class BlockFormat
+    {
+        BC1,                                // RGB with alpha below 128 transparent, 8 bytes per block
+        BC3                                 // RGB with interpolated alpha, 16 bytes per block
+    };
+
+    uint32_t GetBlockBytes(BlockFormat format);
+    uint32_t GetBlockDxgiFormat(BlockFormat format);   // UNORM DXGI_FORMAT
+
+    // BC3 if any pixel is not opaque, else BC1
+    BlockFormat ChooseBlockFormat(const uint8_t* rgba, size_t pixelCount);
+
+    // D3D12 needs the top mip of a block compressed texture to be whole blocks
+    inline bool CanBlockCompress(uint32_t width, uint32_t height)
+    {
+        return width > 0 && height > 0 && width % 4 == 0 && height % 4 == 0;
+    }
+
+    // Encodes one 4x4 block of RGBA8 pixels, row by row. Endpoints follow the principal axis of the
+    // colors and are refined by least squares, indices are picked four pixels at a time with SSE.
+    void CompressBlock(const uint8_t* block, BlockFormat format, uint8_t* output);
+    void DecompressBlock(const uint8_t* input, BlockFormat format, uint8_t* block);
+
+    // Whole images with rows of blocks in parallel. Partial blocks at the right and bottom edges
+    // repeat the last column and row.
+    void CompressImage(const uint8_t* rgba, uint32_t width, uint32_t height, BlockFormat format, uint8_t* output, ThreadPool* pool);
+    void DecompressImage(const uint8_t* input, uint32_t width, uint32_t height, BlockFormat format, uint8_t* rgba);
+    size_t CalcCompressedSize(uint32_t width, uint32_t height, BlockFormat format);
+
+    // DDS file in memory of the image, and of its mips unless mipParams is null, as
+    // DirectX::LoadDDSTextureFromMemory reads it
+    std::vector<uint8_t> BuildCompressedDds(const uint8_t* rgba, uint32_t width, uint32_t height, BlockFormat format, const MipGenParams* mipParams, ThreadPool* pool);
+
+    // Peak signal to noise ratio in dB of the RGB and alpha channels of two images
+    void CalcPsnr(const uint8_t* reference, const uint8_t* rgba, size_t pixelCount, double* rgbPsnr, double* alphaPsnr);
+}
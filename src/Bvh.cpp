@@ -0,0 +1,271 @@
+// Bvh.cpp
+
+#include "Bvh.h"
+#include "ThreadPool.h"
+#include <algorithm>
+
+namespace Vnm
+{
+    static const uint32_t kBinCount = 16;
+    static const uint32_t kMaxSahDepth = 48;        // Deeper nodes split at the median, which bounds the depth
+    static const uint32_t kParallelDepth = 6;       // Up to 64 subtrees are built in parallel
+
+    static float GetAxis(const Float3& v, uint32_t axis)
+    {
+        return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+    }
+
+    static float HalfArea(const Aabb& box)
+    {
+        if (!box.IsValid())
+        {
+            return 0.0f;
+        }
+        Float3 extent = box.GetExtent();
+        return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+    }
+
+    // Finite for zero, so a box face in the plane of an axis aligned ray does not give 0 * inf
+    static float SafeInverse(float x)
+    {
+        const float kTiny = 1e-30f;
+        return 1.0f / (fabsf(x) > kTiny ? x : (x < 0.0f ? -kTiny : kTiny));
+    }
+
+    BvhRay::BvhRay(const Ray& ray)
+        : mOrigin(_mm_setr_ps(ray.mOrigin.x, ray.mOrigin.y, ray.mOrigin.z, 0.0f))
+        , mInvDirection(_mm_setr_ps(SafeInverse(ray.mDirection.x), SafeInverse(ray.mDirection.y), SafeInverse(ray.mDirection.z), 0.0f))
+        , mMinDistance(ray.mMinDistance)
+    {
+    }
+
+    class BvhBuilder
+    {
+    public:
+        class Task
+        {
+        public:
+            uint32_t mNode;
+            uint32_t mBegin;
+            uint32_t mEnd;
+            uint32_t mDepth;
+        };
+
+        BvhBuilder(const Aabb* bounds, const std::vector<Float3>& centroids, const BvhBuildParams& params, uint32_t* order)
+            : mpBounds(bounds)
+            , mCentroids(centroids)
+            , mParams(params)
+            , mpOrder(order)
+        {
+        }
+
+        uint32_t GroupCount(uint32_t items) const
+        {
+            return (items + mParams.mGroupSize - 1) / mParams.mGroupSize;
+        }
+
+        // Builds the node at nodeIndex from items begin to end of order. With deferred, nodes at
+        // kParallelDepth are left for a later BuildNode into a node array of their own.
+        uint32_t BuildNode(std::vector<BvhNode>& nodes, uint32_t nodeIndex, uint32_t begin, uint32_t end, uint32_t depth, std::vector<Task>* deferred) const
+        {
+            Aabb bounds;
+            Aabb centroidBounds;
+            for (uint32_t i = begin; i < end; ++i)
+            {
+                bounds.Extend(mpBounds[mpOrder[i]]);
+                centroidBounds.Extend(mCentroids[mpOrder[i]]);
+            }
+            nodes[nodeIndex].mMin = bounds.mMin;
+            nodes[nodeIndex].mMax = bounds.mMax;
+
+            const uint32_t count = end - begin;
+            if (count <= mParams.mGroupSize)
+            {
+                nodes[nodeIndex].mFirst = begin;
+                nodes[nodeIndex].mCount = count;
+                return depth;
+            }
+
+            if (deferred != nullptr && depth == kParallelDepth)
+            {
+                deferred->push_back({ nodeIndex, begin, end, depth });
+                nodes[nodeIndex].mCount = 0;
+                return depth;
+            }
+
+            Float3 centroidExtent = centroidBounds.GetExtent();
+            uint32_t axis = 0;
+            if (centroidExtent.y > GetAxis(centroidExtent, axis))
+            {
+                axis = 1;
+            }
+            if (centroidExtent.z > GetAxis(centroidExtent, axis))
+            {
+                axis = 2;
+            }
+
+            const float axisMin = GetAxis(centroidBounds.mMin, axis);
+            const float axisExtent = GetAxis(centroidExtent, axis);
+            uint32_t* order = mpOrder;
+            uint32_t mid = begin;
+
+            if (depth < kMaxSahDepth && axisExtent > 0.0f)
+            {
+                const float binScale = kBinCount / axisExtent;
+                auto binOf = [&](uint32_t item)
+                {
+                    uint32_t bin = static_cast<uint32_t>((GetAxis(mCentroids[item], axis) - axisMin) * binScale);
+                    return (std::min)(bin, kBinCount - 1);
+                };
+
+                Aabb binBounds[kBinCount];
+                uint32_t binCounts[kBinCount] = {};
+                for (uint32_t i = begin; i < end; ++i)
+                {
+                    uint32_t bin = binOf(order[i]);
+                    binBounds[bin].Extend(mpBounds[order[i]]);
+                    binCounts[bin]++;
+                }
+
+                // Cost of splitting before bin i, in item group tests weighted by the chance of reaching them
+                float rightCost[kBinCount] = {};
+                uint32_t rightCount[kBinCount] = {};
+                Aabb accumulated;
+                uint32_t accumulatedCount = 0;
+                for (uint32_t i = kBinCount - 1; i > 0; --i)
+                {
+                    accumulated.Extend(binBounds[i]);
+                    accumulatedCount += binCounts[i];
+                    rightCost[i] = HalfArea(accumulated) * GroupCount(accumulatedCount);
+                    rightCount[i] = accumulatedCount;
+                }
+
+                float bestCost = 1e30f;
+                uint32_t bestSplit = 0;
+                accumulated = Aabb();
+                accumulatedCount = 0;
+                for (uint32_t i = 1; i < kBinCount; ++i)
+                {
+                    accumulated.Extend(binBounds[i - 1]);
+                    accumulatedCount += binCounts[i - 1];
+                    if (accumulatedCount == 0 || rightCount[i] == 0)
+                    {
+                        continue;
+                    }
+
+                    float cost = HalfArea(accumulated) * GroupCount(accumulatedCount) + rightCost[i];
+                    if (cost < bestCost)
+                    {
+                        bestCost = cost;
+                        bestSplit = i;
+                    }
+                }
+
+                const float area = HalfArea(bounds);
+                if (count <= mParams.mMaxLeafSize && area * GroupCount(count) <= mParams.mTraversalCost * area + bestCost)
+                {
+                    nodes[nodeIndex].mFirst = begin;
+                    nodes[nodeIndex].mCount = count;
+                    return depth;
+                }
+
+                if (bestSplit > 0)
+                {
+                    mid = static_cast<uint32_t>(std::partition(order + begin, order + end, [&](uint32_t item) { return binOf(item) < bestSplit; }) - order);
+                }
+            }
+
+            // Median split when binning cannot separate the centroids
+            if (mid == begin || mid == end)
+            {
+                mid = begin + count / 2;
+                std::nth_element(order + begin, order + mid, order + end, [&](uint32_t a, uint32_t b)
+                {
+                    float centroidA = GetAxis(mCentroids[a], axis);
+                    float centroidB = GetAxis(mCentroids[b], axis);
+                    return centroidA < centroidB || (centroidA == centroidB && a < b);
+                });
+            }
+
+            const uint32_t firstChild = static_cast<uint32_t>(nodes.size());
+            nodes.resize(firstChild + 2);
+            nodes[nodeIndex].mFirst = firstChild;
+            nodes[nodeIndex].mCount = 0;
+
+            uint32_t leftDepth = BuildNode(nodes, firstChild, begin, mid, depth + 1, deferred);
+            uint32_t rightDepth = BuildNode(nodes, firstChild + 1, mid, end, depth + 1, deferred);
+            return (std::max)(leftDepth, rightDepth);
+        }
+
+    private:
+        const Aabb*                 mpBounds;
+        const std::vector<Float3>&  mCentroids;
+        const BvhBuildParams&       mParams;
+        uint32_t*                   mpOrder;
+    };
+
+    uint32_t BuildBvh(const Aabb* bounds, size_t count, const BvhBuildParams& params, ThreadPool* pool, std::vector<BvhNode>* nodes, std::vector<uint32_t>* order)
+    {
+        assert(count < 0x80000000u && params.mGroupSize > 0);
+        nodes->clear();
+        order->resize(count);
+        if (count == 0)
+        {
+            return 0;
+        }
+
+        std::vector<Float3> centroids(count);
+        ParallelFor(pool, count, 4096, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                centroids[i] = bounds[i].GetCenter();
+                (*order)[i] = static_cast<uint32_t>(i);
+            }
+        });
+
+        // Top levels here, and the subtrees they leave behind in parallel into their own node arrays
+        BvhBuilder builder(bounds, centroids, params, order->data());
+        std::vector<BvhBuilder::Task> deferred;
+        nodes->resize(1);
+        uint32_t maxDepth = builder.BuildNode(*nodes, 0, 0, static_cast<uint32_t>(count), 0, &deferred);
+
+        std::vector<std::vector<BvhNode>> subtrees(deferred.size());
+        std::vector<uint32_t> subtreeDepths(deferred.size());
+        ParallelFor(pool, deferred.size(), 1, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                const BvhBuilder::Task& task = deferred[i];
+                subtrees[i].resize(1);
+                subtreeDepths[i] = builder.BuildNode(subtrees[i], 0, task.mBegin, task.mEnd, task.mDepth, nullptr);
+            }
+        });
+
+        // Subtree roots replace their placeholders, the rest is appended in task order
+        for (size_t i = 0; i < deferred.size(); ++i)
+        {
+            const uint32_t offset = static_cast<uint32_t>(nodes->size()) - 1;
+            for (size_t j = 0; j < subtrees[i].size(); ++j)
+            {
+                BvhNode node = subtrees[i][j];
+                if (node.mCount == 0)
+                {
+                    node.mFirst += offset;
+                }
+
+                if (j == 0)
+                {
+                    (*nodes)[deferred[i].mNode] = node;
+                }
+                else
+                {
+                    nodes->push_back(node);
+                }
+            }
+            maxDepth = (std::max)(maxDepth, subtreeDepths[i]);
+        }
+
+        return maxDepth;
+    }
+}
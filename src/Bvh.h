@@ -0,0 +1,161 @@
+// Bvh.h
+
+#pragma once
+
+#include "MathTypes.h"
+#include <cassert>
+#include <emmintrin.h>
+#include <stdint.h>
+#include <vector>
+
+namespace Vnm
+{
+    class ThreadPool;
+
+    class Ray
+    {
+    public:
+        Float3 mOrigin;
+        Float3 mDirection;                  // Need not be normalized, distances are in units of its length
+        float  mMinDistance = 0.0f;
+        float  mMaxDistance = 1e30f;
+    };
+
+    // Node of a binary BVH. IntersectSiblings reads the layout with SSE.
+    class BvhNode
+    {
+    public:
+        Float3   mMin;
+        uint32_t mFirst;                    // First child, the second follows it, or first item of a leaf
+        Float3   mMax;
+        uint32_t mCount;                    // Items in a leaf, 0 for interior nodes
+    };
+
+    class BvhBuildParams
+    {
+    public:
+        uint32_t mGroupSize = 1;            // Leaf items are tested this many at a time for the cost of one test
+        uint32_t mMaxLeafSize = 4;          // Up to mGroupSize items always make a leaf, up to this many if cheaper
+        float    mTraversalCost = 1.0f;     // Of a node relative to one test of leaf items
+    };
+
+    // Builds a BVH over item bounds with a binned surface area heuristic. The top levels are split on
+    // the calling thread and the subtrees below them in parallel, and the result does not depend on the
+    // number of threads. Leaves point at ranges of order, which holds item indices. Returns the depth.
+    uint32_t BuildBvh(const Aabb* bounds, size_t count, const BvhBuildParams& params, ThreadPool* pool, std::vector<BvhNode>* nodes, std::vector<uint32_t>* order);
+
+    // Ray with its inverse direction, for box tests
+    class BvhRay
+    {
+    public:
+        explicit BvhRay(const Ray& ray);
+
+        __m128 mOrigin;                     // xyz0, the fourth lane of a node holds an index
+        __m128 mInvDirection;
+        float  mMinDistance;
+    };
+
+    // Slab test of two nodes, bit 0 and 1 of the result are set for the ones that are hit closer than
+    // tMax, with their entry distances in entries
+    inline int IntersectSiblings(const BvhRay& ray, const BvhNode& first, const BvhNode& second, float tMax, float* entries)
+    {
+        // Index lanes are cleared first, as integers they would be slow denormals. The zeros they give
+        // are then moved out of the way of min and max.
+        const __m128 xyzMask = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+        const __m128 nearMask = _mm_setr_ps(INFINITY, INFINITY, INFINITY, -INFINITY);
+        const __m128 farMask = _mm_setr_ps(-INFINITY, -INFINITY, -INFINITY, INFINITY);
+
+        __m128 firstMin = _mm_mul_ps(_mm_sub_ps(_mm_and_ps(_mm_loadu_ps(&first.mMin.x), xyzMask), ray.mOrigin), ray.mInvDirection);
+        __m128 firstMax = _mm_mul_ps(_mm_sub_ps(_mm_and_ps(_mm_loadu_ps(&first.mMax.x), xyzMask), ray.mOrigin), ray.mInvDirection);
+        __m128 secondMin = _mm_mul_ps(_mm_sub_ps(_mm_and_ps(_mm_loadu_ps(&second.mMin.x), xyzMask), ray.mOrigin), ray.mInvDirection);
+        __m128 secondMax = _mm_mul_ps(_mm_sub_ps(_mm_and_ps(_mm_loadu_ps(&second.mMax.x), xyzMask), ray.mOrigin), ray.mInvDirection);
+
+        __m128 firstNear = _mm_min_ps(_mm_min_ps(firstMin, firstMax), nearMask);
+        __m128 firstFar = _mm_max_ps(_mm_max_ps(firstMin, firstMax), farMask);
+        __m128 secondNear = _mm_min_ps(_mm_min_ps(secondMin, secondMax), nearMask);
+        __m128 secondFar = _mm_max_ps(_mm_max_ps(secondMin, secondMax), farMask);
+
+        // Lane 0 for the first node and lane 1 for the second
+        __m128 tNear = _mm_max_ps(_mm_unpacklo_ps(firstNear, secondNear), _mm_unpackhi_ps(firstNear, secondNear));
+        tNear = _mm_max_ps(_mm_max_ps(tNear, _mm_movehl_ps(tNear, tNear)), _mm_set1_ps(ray.mMinDistance));
+        __m128 tFar = _mm_min_ps(_mm_unpacklo_ps(firstFar, secondFar), _mm_unpackhi_ps(firstFar, secondFar));
+        tFar = _mm_min_ps(_mm_min_ps(tFar, _mm_movehl_ps(tFar, tFar)), _mm_set1_ps(tMax));
+
+        _mm_storel_pi(reinterpret_cast<__m64*>(entries), tNear);
+        return _mm_movemask_ps(_mm_cmple_ps(tNear, tFar)) & 3;
+    }
+
+    // Visits the leaves a ray passes through, nearest first. leaf(node, &tMax) tests the items of a
+    // leaf, lowers tMax to the closest hit and returns true to stop. Returns true if stopped.
+    template <typename LeafFunction>
+    bool TraverseBvh(const std::vector<BvhNode>& nodes, const Ray& ray, float* tMax, LeafFunction&& leaf)
+    {
+        static_assert(sizeof(BvhNode) == 8 * sizeof(float), "IntersectSiblings expects min, index, max, count");
+        const uint32_t kMaxStackDepth = 128;
+        const uint32_t kEmpty = 0xffffffff;
+
+        if (nodes.empty())
+        {
+            return false;
+        }
+
+        BvhRay bvhRay(ray);
+        float entries[2];
+        if (IntersectSiblings(bvhRay, nodes[0], nodes[0], *tMax, entries) == 0)
+        {
+            return false;
+        }
+
+        uint32_t stackNodes[kMaxStackDepth];
+        float stackEntries[kMaxStackDepth];
+        uint32_t stackSize = 0;
+        uint32_t nodeIndex = 0;
+        for (;;)
+        {
+            const BvhNode& node = nodes[nodeIndex];
+            if (node.mCount > 0)
+            {
+                if (leaf(node, tMax))
+                {
+                    return true;
+                }
+            }
+            else
+            {
+                int hitMask = IntersectSiblings(bvhRay, nodes[node.mFirst], nodes[node.mFirst + 1], *tMax, entries);
+                if (hitMask == 3)
+                {
+                    // Nearer child first, the other waits on the stack
+                    bool firstIsNear = entries[0] <= entries[1];
+                    assert(stackSize < kMaxStackDepth && "BuildBvh bounds the depth");
+                    stackNodes[stackSize] = firstIsNear ? node.mFirst + 1 : node.mFirst;
+                    stackEntries[stackSize] = firstIsNear ? entries[1] : entries[0];
+                    stackSize++;
+                    nodeIndex = firstIsNear ? node.mFirst : node.mFirst + 1;
+                    continue;
+                }
+                if (hitMask != 0)
+                {
+                    nodeIndex = node.mFirst + (hitMask >> 1);
+                    continue;
+                }
+            }
+
+            // Skip nodes that are behind the closest hit found since they were pushed
+            nodeIndex = kEmpty;
+            while (stackSize > 0)
+            {
+                stackSize--;
+                if (stackEntries[stackSize] <= *tMax)
+                {
+                    nodeIndex = stackNodes[stackSize];
+                    break;
+                }
+            }
+            if (nodeIndex == kEmpty)
+            {
+                return false;
+            }
+        }
+    }
+}
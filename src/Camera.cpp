@@ -69,6 +69,28 @@ namespace Vnm
         mRight = right;
     }
 
+    // The basis is blended and made orthonormal again, close enough to a slerp for the small
+    // rotations between two updates
+    Camera Camera::Lerp(const Camera& a, const Camera& b, float t)
+    {
+        DirectX::XMVECTOR position = DirectX::XMVectorLerp(a.mPosition, b.mPosition, t);
+        DirectX::XMVECTOR forward = DirectX::XMVector3Normalize(DirectX::XMVectorLerp(a.mForward, b.mForward, t));
+        DirectX::XMVECTOR up = DirectX::XMVectorLerp(a.mUp, b.mUp, t);
+        DirectX::XMVECTOR right = DirectX::XMVector3Normalize(DirectX::XMVector3Cross(up, forward));
+        up = DirectX::XMVector3Cross(forward, right);
+        return Camera(position, forward, up, right);
+    }
+
+    void Camera::CalcPickRay(float ndcX, float ndcY, float fovY, float aspect, DirectX::XMVECTOR* origin, DirectX::XMVECTOR* direction) const
+    {
+        float tanHalfFov = tanf(fovY * 0.5f);
+        DirectX::XMVECTOR offset = DirectX::XMVectorAdd(
+            DirectX::XMVectorScale(mRight, ndcX * tanHalfFov * aspect),
+            DirectX::XMVectorScale(mUp, ndcY * tanHalfFov));
+        *origin = mPosition;
+        *direction = DirectX::XMVector3Normalize(DirectX::XMVectorAdd(mForward, offset));
+    }
+
     void Camera::ResetBasis()
     {
         mForward = DirectX::XMVectorSet(0.0f, 0.0f, 1.0f, 1.0f);
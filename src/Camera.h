@@ -36,6 +36,12 @@ namespace Vnm
         void SetLookAtRecalcBasis(const DirectX::XMVECTOR& lookAtPos, const DirectX::XMVECTOR& right);
         void ResetBasis();
 
+        // Blends position and orientation, t from 0 at a to 1 at b
+        static Camera Lerp(const Camera& a, const Camera& b, float t);
+
+        // World space ray through a point of the view, ndc from -1 to 1 with y up
+        void CalcPickRay(float ndcX, float ndcY, float fovY, float aspect, DirectX::XMVECTOR* origin, DirectX::XMVECTOR* direction) const;
+
         // Accessors
         void SetPosition(const DirectX::XMVECTOR& position) { mPosition = position; }
 
@@ -0,0 +1,129 @@
+// CameraPath.cpp
+
+#include "CameraPath.h"
+#include <cassert>
+#include <fstream>
+
+namespace Vnm
+{
+    static const uint32_t kCameraPathMagic = 0x4d414356;    // "VCAM"
+    static const uint32_t kCameraPathVersion = 1;
+
+    class CameraPathHeader
+    {
+    public:
+        uint32_t mMagic;
+        uint32_t mVersion;
+        double   mStep;
+        uint32_t mNumFrames;
+        uint32_t mNumEvents;
+    };
+
+    static_assert(sizeof(CameraState) == 12 * sizeof(float), "CameraState is written as is");
+    static_assert(sizeof(InputEvent) == 8, "InputEvent is written as is");
+
+    void CameraPath::Clear(double stepSeconds)
+    {
+        mStep = stepSeconds;
+        mFrames.clear();
+        mEvents.clear();
+    }
+
+    void CameraPath::AddFrame(const CameraState& state)
+    {
+        mFrames.push_back(state);
+    }
+
+    void CameraPath::AddEvent(InputEventType type, uint8_t key)
+    {
+        InputEvent event;
+        event.mFrame = static_cast<uint32_t>(mFrames.size());
+        event.mType = type;
+        event.mKey = key;
+        mEvents.push_back(event);
+    }
+
+    bool CameraPath::Save(const char* fileName) const
+    {
+        std::ofstream file(fileName, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!file)
+        {
+            return false;
+        }
+
+        CameraPathHeader header = {};
+        header.mMagic = kCameraPathMagic;
+        header.mVersion = kCameraPathVersion;
+        header.mStep = mStep;
+        header.mNumFrames = static_cast<uint32_t>(mFrames.size());
+        header.mNumEvents = static_cast<uint32_t>(mEvents.size());
+
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(mFrames.data()), mFrames.size() * sizeof(CameraState));
+        file.write(reinterpret_cast<const char*>(mEvents.data()), mEvents.size() * sizeof(InputEvent));
+        return static_cast<bool>(file);
+    }
+
+    bool CameraPath::Load(const char* fileName)
+    {
+        Clear(0.0);
+
+        std::ifstream file(fileName, std::ios::in | std::ios::binary | std::ios::ate);
+        const uint64_t fileSize = file ? static_cast<uint64_t>(file.tellg()) : 0;
+        CameraPathHeader header = {};
+        if (!file || !file.seekg(0) || !file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+            header.mMagic != kCameraPathMagic || header.mVersion != kCameraPathVersion || !(header.mStep > 0.0))
+        {
+            return false;
+        }
+
+        // Counts come from the file, so they are checked against its size before anything is allocated
+        const uint64_t expectedSize = sizeof(header) + uint64_t(header.mNumFrames) * sizeof(CameraState) + uint64_t(header.mNumEvents) * sizeof(InputEvent);
+        if (expectedSize != fileSize)
+        {
+            return false;
+        }
+
+        mFrames.resize(header.mNumFrames);
+        mEvents.resize(header.mNumEvents);
+        file.read(reinterpret_cast<char*>(mFrames.data()), mFrames.size() * sizeof(CameraState));
+        file.read(reinterpret_cast<char*>(mEvents.data()), mEvents.size() * sizeof(InputEvent));
+        if (!file)
+        {
+            Clear(0.0);
+            return false;
+        }
+
+        mStep = header.mStep;
+        return true;
+    }
+
+    void CameraPathPlayer::Start(const CameraPath* path)
+    {
+        mpPath = path;
+        mFrame = 0;
+        mNextEvent = 0;
+    }
+
+    bool CameraPathPlayer::Advance(CameraState* state, const InputEvent** events, size_t* numEvents)
+    {
+        if (mpPath == nullptr || mFrame >= mpPath->GetFrameCount())
+        {
+            mpPath = nullptr;
+            return false;
+        }
+
+        const std::vector<InputEvent>& pathEvents = mpPath->GetEvents();
+        size_t firstEvent = mNextEvent;
+        while (mNextEvent < pathEvents.size() && pathEvents[mNextEvent].mFrame <= mFrame)
+        {
+            mNextEvent++;
+        }
+
+        *state = mpPath->GetFrame(mFrame);
+        *events = pathEvents.data() + firstEvent;
+        *numEvents = mNextEvent - firstEvent;
+        mFrame++;
+        return true;
+    }
+}
@@ -0,0 +1,79 @@
+// CameraPath.h
+
+#pragma once
+
+#include "MathTypes.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace Vnm
+{
+    class CameraState
+    {
+    public:
+        Float3 mPosition;
+        Float3 mForward;
+        Float3 mUp;
+        Float3 mRight;
+    };
+
+    enum InputEventType : uint8_t
+    {
+        keyDownEvent,
+        keyUpEvent
+    };
+
+    class InputEvent
+    {
+    public:
+        uint32_t mFrame;                    // Applied before this frame
+        uint8_t  mType;                     // InputEventType
+        uint8_t  mKey;                      // Virtual key code
+        uint16_t mPadding = 0;
+    };
+
+    // Camera states recorded once per fixed update step, with the key presses between them. Replaying
+    // the states instead of the input makes a path independent of frame rate and timing.
+    class CameraPath
+    {
+    public:
+        void Clear(double stepSeconds);
+        void AddFrame(const CameraState& state);
+        void AddEvent(InputEventType type, uint8_t key);
+
+        // Binary file of a header, the frames and the events. Load returns false and leaves the path
+        // empty if the file is missing, truncated or of another version.
+        bool Save(const char* fileName) const;
+        bool Load(const char* fileName);
+
+        double GetStep() const { return mStep; }
+        size_t GetFrameCount() const { return mFrames.size(); }
+        const CameraState& GetFrame(size_t frame) const { return mFrames[frame]; }
+        const std::vector<InputEvent>& GetEvents() const { return mEvents; }
+
+    private:
+        double                   mStep = 0.0;
+        std::vector<CameraState> mFrames;
+        std::vector<InputEvent>  mEvents;
+    };
+
+    // Plays a path back one frame per Advance, with the events due before each frame
+    class CameraPathPlayer
+    {
+    public:
+        // The path has to outlive the playback
+        void Start(const CameraPath* path);
+
+        // Returns false and stops at the end of the path. Events are those since the previous frame.
+        bool Advance(CameraState* state, const InputEvent** events, size_t* numEvents);
+
+        bool IsPlaying() const { return mpPath != nullptr; }
+        size_t GetFrame() const { return mFrame; }
+
+    private:
+        const CameraPath* mpPath = nullptr;
+        size_t            mFrame = 0;
+        size_t            mNextEvent = 0;
+    };
+}
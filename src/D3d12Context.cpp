@@ -3,8 +3,19 @@
 #include "D3d12Context.h"
 #include <DirectXMath.h>
 #include "DDSTextureLoader12.h"
+#include "AlphaCoverage.h"
+#include "BlockCompression.h"
+#include "MipGenerator.h"
+#include "D3d12Memory.h"
+#include "MappedFile.h"
+#include "Profiler.h"
+#include "TreePlacement.h"
 #include "Window.h"
+#include <algorithm>
 #include <cassert>
+#include <cfloat>
+#include <random>
+#include <string>
 
 #define TINYGLTF_IMPLEMENTATION
 #define STB_IMAGE_IMPLEMENTATION
@@ -24,6 +35,13 @@ constexpr int gX = 100;
 constexpr int gY = 100;
 constexpr int gWidth = 2560;
 constexpr int gHeight = 1600;
+constexpr float gNearZ = 0.1f;
+constexpr float gFarZ = 100.0f;
+constexpr float gFovY = 1.0f;
+constexpr uint32_t kTreePlacementSeed = 1;
+
+// GPU timer zone names, see PipelineIds
+static const char* const kPipelineNames[numPipelines] = { "Opaque", "Alpha test depth", "Alpha tested", "Alpha tested equal" };
 
 // TODO: Move these
 float scales[D3dContext::kTreePosCount];
@@ -180,12 +198,18 @@ void D3dContext::InitDevice(HWND hwnd)
     dsvHeapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_NONE;
     D3D_CHECK(mDevice->CreateDescriptorHeap(&dsvHeapDesc, IID_PPV_ARGS(&mDsvHeap)));
 
-    // CBVSRV descriptor heap
+    // CBVSRV descriptor heap, persistent views first and then a region per frame
+    mDescriptorAllocator.Init(kPersistentDescriptors, kFrameCount, kDescriptorsPerFrame);
     D3D12_DESCRIPTOR_HEAP_DESC cbvHeapDesc = {};
-    cbvHeapDesc.NumDescriptors = 100; // TODO: Un-hardcode and bounds check when creating descriptors
+    cbvHeapDesc.NumDescriptors = mDescriptorAllocator.GetHeapSize();
     cbvHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
     cbvHeapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
     D3D_CHECK(mDevice->CreateDescriptorHeap(&cbvHeapDesc, IID_PPV_ARGS(&mCbvSrvHeap)));
+    mCbvSrvDescriptorSize = mDevice->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+
+    // The texture array is one table, so it is allocated before anything can fragment the heap
+    mTextureArrayDescriptors = mDescriptorAllocator.AllocatePersistent(static_cast<UINT>(kMaxTextures));
+    mDefaultMaterialDescriptors = mDescriptorAllocator.AllocatePersistent(2);
 
     // Create frame resources
 
@@ -205,7 +229,8 @@ void D3dContext::InitDevice(HWND hwnd)
     depthOptClearValue.DepthStencil.Stencil = 0;
 
     CD3DX12_HEAP_PROPERTIES heapProperties(D3D12_HEAP_TYPE_DEFAULT);
-    CD3DX12_RESOURCE_DESC resourceDesc = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_D32_FLOAT, gWidth, gHeight, 1, 0, 1, 0, D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL);
+    // Typeless so the Hi-Z pass can read it as R32_FLOAT
+    CD3DX12_RESOURCE_DESC resourceDesc = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_R32_TYPELESS, gWidth, gHeight, 1, 0, 1, 0, D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL);
     D3D_CHECK(mDevice->CreateCommittedResource(
         &heapProperties,
         D3D12_HEAP_FLAG_NONE,
@@ -213,6 +238,7 @@ void D3dContext::InitDevice(HWND hwnd)
         D3D12_RESOURCE_STATE_DEPTH_WRITE,
         &depthOptClearValue,
         IID_PPV_ARGS(&mDepthStencil)));
+    TrackResource(mDevice.Get(), mDepthStencil.Get(), Vnm::MemoryCategory::RenderTargets);
 
     D3D12_DEPTH_STENCIL_VIEW_DESC dsvDesc = {};
     dsvDesc.Format = DXGI_FORMAT_D32_FLOAT;
@@ -226,8 +252,253 @@ void D3dContext::InitDevice(HWND hwnd)
     D3D_CHECK(mDevice->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&mCommandAllocator)));
 }
 
- static void InitAssets(D3dContext& context)
+static void CreateTextureFromMipChain(D3dContext& context, const Vnm::MipChain& mipChain, DXGI_FORMAT format, ID3D12Resource** texture, std::vector<D3D12_SUBRESOURCE_DATA>& subresources)
+{
+    const Vnm::MipLevel& top = mipChain.mLevels[0];
+    CD3DX12_HEAP_PROPERTIES heapProperties(D3D12_HEAP_TYPE_DEFAULT);
+    CD3DX12_RESOURCE_DESC resourceDesc = CD3DX12_RESOURCE_DESC::Tex2D(format, top.mWidth, top.mHeight, 1, static_cast<UINT16>(mipChain.mLevels.size()));
+    D3D_CHECK(context.mDevice->CreateCommittedResource(
+        &heapProperties,
+        D3D12_HEAP_FLAG_NONE,
+        &resourceDesc,
+        D3D12_RESOURCE_STATE_COPY_DEST,
+        nullptr,
+        IID_PPV_ARGS(texture)));
+    TrackResource(context.mDevice.Get(), *texture, Vnm::MemoryCategory::Textures);
+
+    for (const Vnm::MipLevel& level : mipChain.mLevels)
+    {
+        D3D12_SUBRESOURCE_DATA subresource = {};
+        subresource.pData = mipChain.mData.data() + level.mOffset;
+        subresource.RowPitch = static_cast<LONG_PTR>(level.mRowPitch);
+        subresource.SlicePitch = subresource.RowPitch * level.mHeight;
+        subresources.push_back(subresource);
+    }
+}
+
+// Embedded images get sRGB correct mips, which keep the alpha test coverage of alpha-tested ones.
+// They are block compressed when their size allows, through a DDS file in memory so the loader
+// creates them as it does files, and stay RGBA8 otherwise. Subresources point into generatedDds
+// or mipChain.
+static void CreateTextureFromPixels(D3dContext& context, const Vnm::TextureDesc& textureDesc, bool alphaTested, ID3D12Resource** texture, std::vector<D3D12_SUBRESOURCE_DATA>& subresources, std::vector<uint8_t>& generatedDds, Vnm::MipChain& mipChain)
+{
+    Vnm::MipGenParams mipParams;
+    mipParams.mAlphaCutoff = alphaTested ? Vnm::kAlphaTestThreshold : 0.0f;
+    if (Vnm::CanBlockCompress(textureDesc.mWidth, textureDesc.mHeight))
+    {
+        PROFILE_ZONE("CompressTexture");
+        const size_t pixelCount = static_cast<size_t>(textureDesc.mWidth) * textureDesc.mHeight;
+        const Vnm::BlockFormat format = Vnm::ChooseBlockFormat(textureDesc.mpPixels, pixelCount);
+        generatedDds = Vnm::BuildCompressedDds(textureDesc.mpPixels, textureDesc.mWidth, textureDesc.mHeight, format, &mipParams, &context.mThreadPool);
+        D3D_CHECK(DirectX::LoadDDSTextureFromMemory(context.mDevice.Get(), generatedDds.data(), generatedDds.size(), texture, subresources));
+        TrackResource(context.mDevice.Get(), *texture, Vnm::MemoryCategory::Textures);
+        return;
+    }
+
+    PROFILE_ZONE("GenerateMips");
+    Vnm::GenerateMips(textureDesc.mpPixels, textureDesc.mWidth, textureDesc.mHeight, static_cast<size_t>(textureDesc.mWidth) * 4, mipParams, &context.mThreadPool, &mipChain);
+    CreateTextureFromMipChain(context, mipChain, DXGI_FORMAT_R8G8B8A8_UNORM, texture, subresources);
+}
+
+// Mips of alpha-tested DDS files are rebuilt to keep the coverage of the alpha test, so distant
+// foliage does not thin out. Subresources point into generatedDds.
+static bool LoadAlphaTestedDds(D3dContext& context, const std::string& fileName, ID3D12Resource** texture, std::vector<D3D12_SUBRESOURCE_DATA>& subresources, std::vector<uint8_t>& generatedDds)
+{
+    PROFILE_ZONE("PreserveDdsAlphaCoverage");
+    Vnm::MappedFile mappedFile;
+    Vnm::CoverageReport report;
+    if (!mappedFile.Open(fileName) ||
+        !Vnm::PreserveDdsAlphaCoverage(mappedFile.GetData(), static_cast<size_t>(mappedFile.GetSize()), Vnm::kAlphaTestThreshold, &context.mThreadPool, &generatedDds, &report))
+    {
+        return false;
+    }
+
+    report.mName = fileName;
+    OutputDebugStringA(Vnm::FormatCoverageReport(report).c_str());
+    D3D_CHECK(DirectX::LoadDDSTextureFromMemory(context.mDevice.Get(), generatedDds.data(), generatedDds.size(), texture, subresources));
+    TrackResource(context.mDevice.Get(), *texture, Vnm::MemoryCategory::Textures);
+    return true;
+}
+
+// 8 bit RGBA files without mips get them built at load rather than being streamed
+static bool NeedsMipChain(const D3dMipTail& tail)
+{
+    const D3D12_RESOURCE_DESC& desc = tail.mDesc;
+    const bool rgba8 =
+        desc.Format == DXGI_FORMAT_R8G8B8A8_UNORM || desc.Format == DXGI_FORMAT_R8G8B8A8_UNORM_SRGB ||
+        desc.Format == DXGI_FORMAT_B8G8R8A8_UNORM || desc.Format == DXGI_FORMAT_B8G8R8A8_UNORM_SRGB;
+    return rgba8 && desc.MipLevels == 1 && (desc.Width > 1 || desc.Height > 1);
+}
+
+class ShaderSet
+{
+public:
+    ComPtr<ID3DBlob> mVertexShader;
+    ComPtr<ID3DBlob> mPixelShader;
+    ComPtr<ID3DBlob> mOpaquePixelShader;
+    ComPtr<ID3DBlob> mAlphaTestDepthPixelShader;
+};
+
+static void CompileShaders(D3dShaderCache& cache, const D3D_SHADER_MACRO* defines, const char* vsTarget, const char* psTarget, ShaderSet* shaders)
+{
+    UINT compileFlags = 0;
+#if defined(_DEBUG)
+    compileFlags |= D3DCOMPILE_DEBUG | D3DCOMPILE_SKIP_OPTIMIZATION;
+#endif//_DEBUG
+
+    shaders->mVertexShader = cache.Compile("shaders.hlsl", defines, "VsMain", vsTarget, compileFlags);
+    shaders->mPixelShader = cache.Compile("shaders.hlsl", defines, "PsMain", psTarget, compileFlags);
+    shaders->mOpaquePixelShader = cache.Compile("shaders.hlsl", defines, "PsOpaque", psTarget, compileFlags);
+    shaders->mAlphaTestDepthPixelShader = cache.Compile("shaders.hlsl", defines, "PsAlphaTestDepth", psTarget, compileFlags);
+}
+
+static std::string GetPipelineName(const char* prefix, uint32_t pipeline)
+{
+    return std::string(prefix) + kPipelineNames[pipeline];
+}
+
+// Creates the pipeline state of each PipelineIds entry from the alpha-tested description
+static void CreatePipelineStates(D3dShaderCache& cache, const char* prefix, D3D12_GRAPHICS_PIPELINE_STATE_DESC psoDesc, const ShaderSet& shaders, ComPtr<ID3D12PipelineState>* pipelineStates)
+{
+    psoDesc.VS = CD3DX12_SHADER_BYTECODE(shaders.mVertexShader.Get());
+    psoDesc.PS = CD3DX12_SHADER_BYTECODE(shaders.mPixelShader.Get());
+    pipelineStates[alphaTestedPipeline] = cache.CreateGraphicsPipeline(GetPipelineName(prefix, alphaTestedPipeline).c_str(), psoDesc);
+
+    // Opaque geometry doesn't need discard
+    D3D12_GRAPHICS_PIPELINE_STATE_DESC opaquePsoDesc = psoDesc;
+    opaquePsoDesc.PS = CD3DX12_SHADER_BYTECODE(shaders.mOpaquePixelShader.Get());
+    pipelineStates[opaquePipeline] = cache.CreateGraphicsPipeline(GetPipelineName(prefix, opaquePipeline).c_str(), opaquePsoDesc);
+
+    // Depth pre-pass for alpha-tested geometry
+    D3D12_GRAPHICS_PIPELINE_STATE_DESC depthPsoDesc = psoDesc;
+    depthPsoDesc.PS = CD3DX12_SHADER_BYTECODE(shaders.mAlphaTestDepthPixelShader.Get());
+    depthPsoDesc.NumRenderTargets = 0;
+    depthPsoDesc.RTVFormats[0] = DXGI_FORMAT_UNKNOWN;
+    depthPsoDesc.BlendState.RenderTarget[0].RenderTargetWriteMask = 0;
+    pipelineStates[alphaTestDepthPipeline] = cache.CreateGraphicsPipeline(GetPipelineName(prefix, alphaTestDepthPipeline).c_str(), depthPsoDesc);
+
+    // Alpha-tested color pass after the pre-pass only shades the visible surface
+    D3D12_GRAPHICS_PIPELINE_STATE_DESC equalPsoDesc = psoDesc;
+    equalPsoDesc.DepthStencilState.DepthFunc = D3D12_COMPARISON_FUNC_EQUAL;
+    equalPsoDesc.DepthStencilState.DepthWriteMask = D3D12_DEPTH_WRITE_MASK_ZERO;
+    pipelineStates[alphaTestedEqualPipeline] = cache.CreateGraphicsPipeline(GetPipelineName(prefix, alphaTestedEqualPipeline).c_str(), equalPsoDesc);
+}
+
+// Indirect draw templates and their compaction info, per pipeline
+class IndirectTemplateLists
+{
+public:
+    void Add(uint32_t pipeline, uint32_t model, const Vnm::IndirectDrawCommand& command)
+    {
+        Vnm::IndirectCommandInfo info;
+        info.mModel = model;
+        info.mPipeline = pipeline;
+        info.mRegionBase = 0;
+        mTemplates[pipeline].push_back(command);
+        mInfos[pipeline].push_back(info);
+    }
+
+    std::vector<Vnm::IndirectDrawCommand> mTemplates[numPipelines];
+    std::vector<Vnm::IndirectCommandInfo>  mInfos[numPipelines];
+};
+
+// Appends one indirect draw template per mesh and pipeline the mesh is drawn with. Alpha-tested
+// meshes get templates for both the pre-pass and the single pass pipelines so the pre-pass can be
+// toggled without rebuilding them.
+static void AddIndirectTemplates(const D3dContext& context, const D3dMesh* meshes, size_t numMeshes, uint32_t model, const Vnm::IndirectModelRange& range, IndirectTemplateLists* lists)
+{
+    for (size_t i = 0; i < numMeshes; ++i)
+    {
+        const D3dMesh& mesh = meshes[i];
+        Vnm::IndirectDrawCommand command = {};
+        command.mInstanceOffset = range.mFirstInstance;
+        command.mMaterial = context.mMaterialLibrary.GetMaterialTexture(mesh.mMaterialIndex);
+        command.mVertexBuffer.mBufferLocation = mesh.mVertexBufferView.BufferLocation;
+        command.mVertexBuffer.mSizeInBytes = mesh.mVertexBufferView.SizeInBytes;
+        command.mVertexBuffer.mStrideInBytes = mesh.mVertexBufferView.StrideInBytes;
+        command.mIndexBuffer.mBufferLocation = mesh.mIndexBufferView.BufferLocation;
+        command.mIndexBuffer.mSizeInBytes = mesh.mIndexBufferView.SizeInBytes;
+        command.mIndexBuffer.mFormat = static_cast<uint32_t>(mesh.mIndexBufferView.Format);
+        command.mDraw.mIndexCountPerInstance = static_cast<uint32_t>(mesh.mNumIndices);
+
+        if (!context.mMaterialLibrary.GetMaterial(mesh.mMaterialIndex).mAlphaTested)
+        {
+            lists->Add(opaquePipeline, model, command);
+        }
+        else
+        {
+            lists->Add(alphaTestDepthPipeline, model, command);
+            lists->Add(alphaTestedPipeline, model, command);
+            lists->Add(alphaTestedEqualPipeline, model, command);
+        }
+    }
+}
+
+static Vnm::Aabb CalcModelBounds(const GltfModel& model)
+{
+    Vnm::Aabb bounds;
+    for (const GltfMesh& mesh : model.meshes)
+    {
+        bounds.Extend({ mesh.boundsMin[0], mesh.boundsMin[1], mesh.boundsMin[2] });
+        bounds.Extend({ mesh.boundsMax[0], mesh.boundsMax[1], mesh.boundsMax[2] });
+    }
+    return bounds;
+}
+
+static void StoreFloat4x4(Vnm::Float4x4* dst, const DirectX::XMMATRIX& src)
+{
+    static_assert(sizeof(Vnm::Float4x4) == sizeof(DirectX::XMFLOAT4X4), "Float4x4 must match XMFLOAT4X4");
+    DirectX::XMFLOAT4X4 matrix;
+    DirectX::XMStoreFloat4x4(&matrix, src);
+    memcpy(dst, &matrix, sizeof(matrix));
+}
+
+// Triangle BVHs of the terrain and tree models, and a scene BVH over their instances with the
+// transforms Update draws them with
+static void BuildPickingBvhs(const GltfModel& treeModel, const GltfModel& coniferModel, D3dContext& context)
+{
+    PROFILE_ZONE("BuildPickingBvhs");
+    std::vector<Vnm::OccluderMesh> occluders;
+    const GltfModel* models[] = { &treeModel, &coniferModel };
+    Vnm::TriangleBvh* bvhs[] = { &context.mTreeBvh, &context.mConiferBvh };
+    for (size_t iModel = 0; iModel < _countof(models); ++iModel)
+    {
+        occluders.resize(models[iModel]->meshes.size());
+        for (size_t i = 0; i < occluders.size(); ++i)
+        {
+            BuildOccluderMesh(models[iModel]->meshes[i], &occluders[i]);
+        }
+        bvhs[iModel]->Build(occluders.data(), occluders.size(), &context.mThreadPool);
+    }
+
+    const Vnm::TriangleBvh* meshes[] = { &context.mTerrainBvh, &context.mTreeBvh, &context.mConiferBvh };
+    std::vector<Vnm::SceneInstance> instances(D3dContext::kTreePosCount);
+    StoreFloat4x4(&instances[0].mWorld, DirectX::XMMatrixIdentity());
+    instances[0].mMesh = 0;
+    for (size_t i = 1; i < D3dContext::kTreePosCount; ++i)
+    {
+        float scale = 0.0015f * (scales[i] + 0.5f);
+        float rotation = rotations[i] * DirectX::XM_2PI;
+        DirectX::XMMATRIX world = DirectX::XMMatrixRotationY(rotation) * DirectX::XMMatrixScaling(scale, scale, scale) * DirectX::XMMatrixTranslationFromVector(context.mTreePosArray[i]);
+        StoreFloat4x4(&instances[i].mWorld, world);
+        instances[i].mMesh = i < D3dContext::kTreePosCount / 2 ? 1 : 2;
+    }
+    context.mSceneBvh.Build(meshes, _countof(meshes), instances.data(), instances.size(), &context.mThreadPool);
+}
+
+// SRV of a texture, and its entry in the texture array of indirect draws
+static void CreateTextureViews(D3dContext& context, uint32_t texture, ID3D12Resource* resource)
 {
+    context.mDevice->CreateShaderResourceView(resource, 0, context.GetCpuDescriptor(context.mMaterialDescriptors[texture].mIndex + 1));
+    context.mDevice->CreateShaderResourceView(resource, 0, context.GetCpuDescriptor(context.mTextureArrayDescriptors.mIndex + texture));
+}
+
+static void InitAssets(D3dContext& context)
+{
+    PROFILE_ZONE("InitAssets");
+
+    context.mShaderCache.Init(context.mDevice.Get());
+
     // Create root signature
     D3D12_FEATURE_DATA_ROOT_SIGNATURE featureData = {};
     featureData.HighestVersion = D3D_ROOT_SIGNATURE_VERSION_1_1;
@@ -237,14 +508,20 @@ void D3dContext::InitDevice(HWND hwnd)
     }
 
     CD3DX12_DESCRIPTOR_RANGE1 ranges[2];
+    CD3DX12_DESCRIPTOR_RANGE1 textureRange;
     //CD3DX12_ROOT_PARAMETER1 rootParameters[1];
-    CD3DX12_ROOT_PARAMETER1 rootParameters[2];
+    CD3DX12_ROOT_PARAMETER1 rootParameters[numRootParameters];
 
     ranges[0].Init(D3D12_DESCRIPTOR_RANGE_TYPE_CBV, 1, 0, 0, D3D12_DESCRIPTOR_RANGE_FLAG_DATA_STATIC);
     ranges[1].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 0, 0, D3D12_DESCRIPTOR_RANGE_FLAG_NONE);
-    rootParameters[0].InitAsDescriptorTable(2, &ranges[0], D3D12_SHADER_VISIBILITY_ALL);
+    textureRange.Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, static_cast<UINT>(D3dContext::kMaxTextures), 3, 0, D3D12_DESCRIPTOR_RANGE_FLAG_NONE);
+    rootParameters[materialTableParameter].InitAsDescriptorTable(2, &ranges[0], D3D12_SHADER_VISIBILITY_ALL);
     //rootParameters[1].InitAsConstants(1, 1, 0);
-    rootParameters[1].InitAsConstantBufferView(1);
+    rootParameters[instanceConstantsParameter].InitAsConstantBufferView(1);
+    rootParameters[indirectConstantsParameter].InitAsConstants(2, 2, 0, D3D12_SHADER_VISIBILITY_ALL);
+    rootParameters[indirectInstancesParameter].InitAsShaderResourceView(1, 0, D3D12_ROOT_DESCRIPTOR_FLAG_NONE, D3D12_SHADER_VISIBILITY_VERTEX);
+    rootParameters[indirectIndicesParameter].InitAsShaderResourceView(2, 0, D3D12_ROOT_DESCRIPTOR_FLAG_NONE, D3D12_SHADER_VISIBILITY_VERTEX);
+    rootParameters[indirectTexturesParameter].InitAsDescriptorTable(1, &textureRange, D3D12_SHADER_VISIBILITY_PIXEL);
 
     CD3DX12_STATIC_SAMPLER_DESC samplers[1];
     samplers[0].Init(0, D3D12_FILTER_MIN_MAG_LINEAR_MIP_POINT);
@@ -258,16 +535,19 @@ void D3dContext::InitDevice(HWND hwnd)
     D3D_CHECK(context.mDevice->CreateRootSignature(0, signature->GetBufferPointer(), signature->GetBufferSize(), IID_PPV_ARGS(&context.mRootSignature)));
 
     // Create pipeline state
-    ComPtr<ID3DBlob> vertexShader;
-    ComPtr<ID3DBlob> pixelShader;
+    ShaderSet shaders;
+    CompileShaders(context.mShaderCache, nullptr, "vs_5_0", "ps_5_0", &shaders);
 
-    UINT compileFlags = 0;
-#if defined(_DEBUG)
-    compileFlags |= D3DCOMPILE_DEBUG | D3DCOMPILE_SKIP_OPTIMIZATION;
-#endif//_DEBUG
-
-    D3D_CHECK(D3DCompileFromFile(L"shaders.hlsl", nullptr, nullptr, "VsMain", "vs_5_0", compileFlags, 0, &vertexShader, nullptr));
-    D3D_CHECK(D3DCompileFromFile(L"shaders.hlsl", nullptr, nullptr, "PsMain", "ps_5_0", compileFlags, 0, &pixelShader, nullptr));
+    // Indirect draws index an array of every texture, which needs shader model 5.1
+    const std::string maxTextures = std::to_string(D3dContext::kMaxTextures);
+    const D3D_SHADER_MACRO indirectDefines[] =
+    {
+        { "INDIRECT", "1" },
+        { "MAX_TEXTURES", maxTextures.c_str() },
+        { nullptr, nullptr }
+    };
+    ShaderSet indirectShaders;
+    CompileShaders(context.mShaderCache, indirectDefines, "vs_5_1", "ps_5_1", &indirectShaders);
 
     // Input layout
     D3D12_INPUT_ELEMENT_DESC inputElementDescs[] =
@@ -282,8 +562,6 @@ void D3dContext::InitDevice(HWND hwnd)
     D3D12_GRAPHICS_PIPELINE_STATE_DESC psoDesc = {};
     psoDesc.InputLayout = { inputElementDescs, _countof(inputElementDescs) };
     psoDesc.pRootSignature = context.mRootSignature.Get();
-    psoDesc.VS = CD3DX12_SHADER_BYTECODE(vertexShader.Get());
-    psoDesc.PS = CD3DX12_SHADER_BYTECODE(pixelShader.Get());
     psoDesc.RasterizerState = CD3DX12_RASTERIZER_DESC(D3D12_DEFAULT);
     psoDesc.RasterizerState.CullMode = D3D12_CULL_MODE_BACK;
     psoDesc.BlendState = CD3DX12_BLEND_DESC(D3D12_DEFAULT);
@@ -294,7 +572,10 @@ void D3dContext::InitDevice(HWND hwnd)
     psoDesc.RTVFormats[0] = DXGI_FORMAT_R8G8B8A8_UNORM;
     psoDesc.DSVFormat = DXGI_FORMAT_D32_FLOAT;
     psoDesc.SampleDesc.Count = 1;
-    D3D_CHECK(context.mDevice->CreateGraphicsPipelineState(&psoDesc, IID_PPV_ARGS(&context.mPipelineState)));
+    CreatePipelineStates(context.mShaderCache, "", psoDesc, shaders, context.mPipelineStates);
+    CreatePipelineStates(context.mShaderCache, "Indirect ", psoDesc, indirectShaders, context.mIndirectPipelineStates);
+
+    context.mPipelineState = context.mPipelineStates[opaquePipeline];
 
     // Create command list
     D3D_CHECK(context.mDevice->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_DIRECT, context.mCommandAllocator.Get(), context.mPipelineState.Get(), IID_PPV_ARGS(&context.mCommandList)));
@@ -310,36 +591,81 @@ void D3dContext::InitDevice(HWND hwnd)
 
     GltfModel gltfInstancedModel[numGltfModels];
 
-    LoadGltf("terrain.glb", &gltfInstancedModel[terrainModelIndex]);
+    // Textures for meshes whose glTF material has no baseColor texture, indexed by mesh
+    const GltfFallbackMaterial terrainFallbacks[] =
+    {
+        { "ground_seamless_texture_7137.dds", false }
+    };
+    const GltfFallbackMaterial treeFallbacks[] =
+    {
+        { "T_Cap_02_BaseColor.dds", false },
+        { "T_WhiteOakBark_BaseColor.dds", false },
+        { "T_White_Oak_Leaves_Hero_1_BaseColor.dds", true },
+        { "T_White_Oak_Leaves_Hero_3_BaseColor.dds", true }
+    };
+    const GltfFallbackMaterial coniferFallbacks[] =
+    {
+        { "Bark_Color.dds", false },
+        { "Conifer_Color.dds", true }
+    };
+
+    LoadGltf("terrain.glb", &gltfInstancedModel[terrainModelIndex], &context.mThreadPool);
+    ResolveGltfMaterials(&gltfInstancedModel[terrainModelIndex], context.mMaterialLibrary, terrainFallbacks, _countof(terrainFallbacks));
     assert(gltfInstancedModel[terrainModelIndex].meshes.size() < D3dContext::kMaxMeshes && "Increase D3dContext::kMaxMeshes");
     context.mNumTerrainMeshes = gltfInstancedModel[terrainModelIndex].meshes.size();
     InitMeshesFromGltf(gltfInstancedModel[terrainModelIndex], context, context.mTerrainMesh, context.kMaxMeshes);
 
-    // TODO: Make better
-    // Extract tree positions
-    srand(time(NULL));
-    for (int i = 0; i < D3dContext::kTreePosCount; ++i)
+    // CPU copies of the terrain, for tree placement and occlusion culling
+    context.mTerrainOccluders.resize(context.mNumTerrainMeshes);
+    for (size_t i = 0; i < context.mNumTerrainMeshes; ++i)
     {
-        int index = ((float)rand() / (float)RAND_MAX) * (float)gltfInstancedModel[terrainModelIndex].meshes[0].numVertices;// context.kTreePosCount;
-        size_t vertexStride = gltfInstancedModel[terrainModelIndex].meshes[0].vertexStride;
-        const float* position = (const float*)(gltfInstancedModel[terrainModelIndex].meshes[0].vertices + index * vertexStride);
-        context.mTreePosArray[i] = DirectX::XMVectorSet(position[0], position[1], position[2], 1.0f);
+        BuildOccluderMesh(gltfInstancedModel[terrainModelIndex].meshes[i], &context.mTerrainOccluders[i]);
+    }
+    context.mTerrainBounds = CalcModelBounds(gltfInstancedModel[terrainModelIndex]);
+    context.mTerrainBvh.Build(context.mTerrainOccluders.data(), context.mTerrainOccluders.size(), &context.mThreadPool);
+
+    // Blue noise tree positions on the terrain surface. Start with a spacing one tree per unit area would
+    // have, which packs somewhat fewer points, and tighten it until all of them fit.
+    Vnm::Float3 terrainExtent = context.mTerrainBounds.GetExtent();
+    Vnm::TreePlacementParams placementParams;
+    placementParams.mSeed = kTreePlacementSeed;
+    placementParams.mMinDistance = sqrtf(terrainExtent.x * terrainExtent.z / D3dContext::kTreePosCount);
+    placementParams.mMaxPoints = D3dContext::kTreePosCount;
+    placementParams.mMaxSlopeDegrees = 40.0f;
+
+    Vnm::TreePlacement placement;
+    do
+    {
+        placement.Place(context.mTerrainOccluders.data(), context.mTerrainOccluders.size(), placementParams, &context.mThreadPool);
+        placementParams.mMinDistance *= 0.8f;
+    } while (placement.GetPoints().size() < D3dContext::kTreePosCount && placementParams.mMinDistance > terrainExtent.x * 1e-4f);
+
+    // Every instance needs a point of its own, trees are never stacked on each other
+    const std::vector<Vnm::Float3>& treePositions = placement.GetPoints();
+    assert(treePositions.size() >= D3dContext::kTreePosCount && "Not enough terrain flat enough for trees");
+    for (size_t i = 0; i < D3dContext::kTreePosCount; ++i)
+    {
+        const Vnm::Float3& position = treePositions[i];
+        context.mTreePosArray[i] = DirectX::XMVectorSet(position.x, position.y, position.z, 1.0f);
     }
 
-    // TODO: Make better
-    // Fill in random scale and rotation arrays
+    // Random scale and rotation per tree, from the same seed
+    std::mt19937 rng(kTreePlacementSeed);
+    std::uniform_real_distribution<float> unitDist(0.0f, 1.0f);
     for (int i = 0; i < D3dContext::kTreePosCount; ++i)
     {
-        scales[i] = (float)rand() / (float)RAND_MAX;
-        rotations[i]  = (float)rand() / (float)RAND_MAX;
+        scales[i] = unitDist(rng);
+        rotations[i] = unitDist(rng);
     }
 
-    LoadGltf("white_oak.glb", &gltfInstancedModel[treeModelIndex]);
+    LoadGltf("white_oak.glb", &gltfInstancedModel[treeModelIndex], &context.mThreadPool);
+    ResolveGltfMaterials(&gltfInstancedModel[treeModelIndex], context.mMaterialLibrary, treeFallbacks, _countof(treeFallbacks));
     assert(gltfInstancedModel[treeModelIndex].meshes.size() < D3dContext::kMaxMeshes && "Increase D3dContext::kMaxMeshes");
     context.mNumTreeMeshes = gltfInstancedModel[treeModelIndex].meshes.size();
     InitMeshesFromGltf(gltfInstancedModel[treeModelIndex], context, context.mTreeMesh, context.kMaxMeshes);
 
-    LoadGltf("conifer.glb", &gltfInstancedModel[coniferModelIndex]);
+    LoadGltf("conifer.glb", &gltfInstancedModel[coniferModelIndex], &context.mThreadPool);
+    ResolveGltfMaterials(&gltfInstancedModel[coniferModelIndex], context.mMaterialLibrary, coniferFallbacks, _countof(coniferFallbacks));
     assert(gltfInstancedModel[coniferModelIndex].meshes.size() < D3dContext::kMaxMeshes && "Increase D3dContext::kMaxMeshes");
     context.mNumConiferMeshes = gltfInstancedModel[coniferModelIndex].meshes.size();
     InitMeshesFromGltf(gltfInstancedModel[coniferModelIndex], context, context.mConiferMesh, context.kMaxMeshes);
@@ -354,12 +680,21 @@ void D3dContext::InitDevice(HWND hwnd)
         D3D12_RESOURCE_STATE_GENERIC_READ,
         nullptr,
         IID_PPV_ARGS(&context.mConstantBuffer)));
+    TrackResource(context.mDevice.Get(), context.mConstantBuffer.Get(), Vnm::MemoryCategory::Constants);
 
     // Create constant buffer view
     D3D12_CONSTANT_BUFFER_VIEW_DESC cbvDesc = {};
     cbvDesc.BufferLocation = context.mConstantBuffer->GetGPUVirtualAddress();
     cbvDesc.SizeInBytes = (UINT)ALIGN_256(sizeof(SceneConstantBuffer));
-    context.mDevice->CreateConstantBufferView(&cbvDesc, context.mCbvSrvHeap->GetCPUDescriptorHandleForHeapStart());
+    context.mDevice->CreateConstantBufferView(&cbvDesc, context.GetCpuDescriptor(context.mDefaultMaterialDescriptors.mIndex));
+
+    // The default material table has no texture, nor do unused texture array entries
+    D3D12_SHADER_RESOURCE_VIEW_DESC nullSrvDesc = {};
+    nullSrvDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+    nullSrvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+    nullSrvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+    nullSrvDesc.Texture2D.MipLevels = 1;
+    context.mDevice->CreateShaderResourceView(nullptr, &nullSrvDesc, context.GetCpuDescriptor(context.mDefaultMaterialDescriptors.mIndex + 1));
 
     // Map and initialize constant buffer
     CD3DX12_RANGE readRangeCb(0, 0);
@@ -375,17 +710,10 @@ void D3dContext::InitDevice(HWND hwnd)
         D3D_CHECK(HRESULT_FROM_WIN32(GetLastError()));
     }
 
-    // Load textures
-    std::vector<std::wstring> textureFilenames;
-    textureFilenames.emplace_back(L"ground_seamless_texture_7137.dds");
-    textureFilenames.emplace_back(L"T_Cap_02_BaseColor.dds");
-    textureFilenames.emplace_back(L"T_WhiteOakBark_BaseColor.dds");
-    textureFilenames.emplace_back(L"T_White_Oak_Leaves_Hero_1_BaseColor.dds");
-    textureFilenames.emplace_back(L"T_White_Oak_Leaves_Hero_3_BaseColor.dds");
-    textureFilenames.emplace_back(L"Bark_Color.dds");
-    textureFilenames.emplace_back(L"Conifer_Color.dds");
+    // Load textures referenced by the material library, one CBV/SRV descriptor pair per texture
+    Vnm::MaterialLibrary& library = context.mMaterialLibrary;
+    assert(library.GetTextureCount() <= D3dContext::kMaxTextures && "Increase D3dContext::kMaxTextures");
 
-    // TODO: Put in a check to make sure none of the textures are large enough to exceed this buffer size
     const UINT64 uploadBufferSize = 0x1000000 * 2;
 
     // Create GPU upload buffer
@@ -399,8 +727,25 @@ void D3dContext::InitDevice(HWND hwnd)
         D3D12_RESOURCE_STATE_GENERIC_READ,
         nullptr,
         IID_PPV_ARGS(&textureUploadHeap)));
+    TrackResource(context.mDevice.Get(), textureUploadHeap.Get(), Vnm::MemoryCategory::Upload);
+
+    // DDS textures start with their mip tail, the streamer loads the rest as the camera gets close.
+    // The scale is the pixels per unit of size at unit distance.
+    Vnm::TextureStreamingParams streamingParams;
+    streamingParams.mScreenScale = static_cast<float>(gHeight) / (2.0f * tanf(0.5f * gFovY));
+    context.mTextureStreamer.Init(context.mDevice.Get(), streamingParams, 32ull << 20);
+
+    std::vector<bool> alphaTested(library.GetTextureCount(), false);
+    for (uint32_t i = 0; i < library.GetMaterialCount(); ++i)
+    {
+        uint32_t texture = library.GetMaterial(i).mBaseColorTexture;
+        if (library.GetMaterial(i).mAlphaTested && texture != Vnm::InvalidIndex)
+        {
+            alphaTested[texture] = true;
+        }
+    }
 
-    for (size_t i = 0; i < textureFilenames.size(); ++i)
+    for (uint32_t i = 0; i < library.GetTextureCount(); ++i)
     {
         if (i > 0)
         {
@@ -409,32 +754,89 @@ void D3dContext::InitDevice(HWND hwnd)
         }
 
         // Create texture
-        std::unique_ptr<uint8_t[]> texData;
+        const Vnm::TextureDesc& textureDesc = library.GetTexture(i);
+        Vnm::MappedFile mappedFile;
+        std::vector<uint8_t> generatedDds;
+        Vnm::MipChain mipChain;
         std::vector<D3D12_SUBRESOURCE_DATA> subresources;
-        DirectX::LoadDDSTextureFromFile(context.mDevice.Get(), textureFilenames[i].c_str(), &context.mTexture[i], texData, subresources);
+        uint32_t canonicalTexture = i;
+        D3dMipTail mipTail;
+
+        if (textureDesc.mpPixels != nullptr)
+        {
+            CreateTextureFromPixels(context, textureDesc, alphaTested[i], &context.mTexture[i], subresources, generatedDds, mipChain);
+        }
+        else if (alphaTested[i] && LoadAlphaTestedDds(context, textureDesc.mFilename, &context.mTexture[i], subresources, generatedDds))
+        {
+            uint64_t contentHash = Vnm::HashBytes(generatedDds.data(), generatedDds.size());
+            canonicalTexture = library.ResolveTextureContent(i, contentHash);
+        }
+        else if (context.mTextureStreamer.ReadMipTail(textureDesc.mFilename, &mipTail))
+        {
+            canonicalTexture = library.ResolveTextureContent(i, mipTail.CalcContentHash());
+            if (canonicalTexture == i && NeedsMipChain(mipTail))
+            {
+                PROFILE_ZONE("GenerateMips");
+                const DirectX::DDS_MIP_LAYOUT& top = mipTail.mMips[0];
+                Vnm::GenerateMips(mipTail.mData.data(), top.width, top.height, static_cast<size_t>(top.rowPitch), Vnm::MipGenParams(), &context.mThreadPool, &mipChain);
+                CreateTextureFromMipChain(context, mipChain, mipTail.mDesc.Format, &context.mTexture[i], subresources);
+            }
+            else if (canonicalTexture == i)
+            {
+                context.mTextureStreamer.AddTexture(i, mipTail, &context.mTexture[i], subresources);
+            }
+        }
+        else
+        {
+            // Subresources point into the mapped file, so the only copy is the one to the upload heap
+            PROFILE_ZONE("LoadDDSTextureFromMappedFile");
+            if (!mappedFile.Open(textureDesc.mFilename))
+            {
+                char message[512];
+                snprintf(message, sizeof(message), "Failed to open texture %s\n", textureDesc.mFilename.c_str());
+                OutputDebugStringA(message);
+                assert(false && "Texture file missing");
+            }
+            D3D_CHECK(DirectX::LoadDDSTextureFromMemory(context.mDevice.Get(), mappedFile.GetData(), static_cast<size_t>(mappedFile.GetSize()), &context.mTexture[i], subresources));
+            TrackResource(context.mDevice.Get(), context.mTexture[i].Get(), Vnm::MemoryCategory::Textures);
+
+            // Files with different names can still hold the same image
+            uint64_t contentHash = Vnm::HashSeed;
+            for (const auto& subresource : subresources)
+            {
+                contentHash = Vnm::HashBytes(subresource.pData, subresource.SlicePitch, contentHash);
+            }
+            canonicalTexture = library.ResolveTextureContent(i, contentHash);
+        }
 
-        // Copy data to the upload heap and schedule a copy from the upload heap to the texture
-        UpdateSubresources(context.mCommandList.Get(), context.mTexture[i].Get(), textureUploadHeap.Get(), 0, 0, static_cast<UINT>(subresources.size()), subresources.data());
+        if (canonicalTexture == i)
+        {
+            assert(GetRequiredIntermediateSize(context.mTexture[i].Get(), 0, static_cast<UINT>(subresources.size())) <= uploadBufferSize && "Texture exceeds upload buffer size");
 
-        CD3DX12_RESOURCE_BARRIER resourceBarrier = CD3DX12_RESOURCE_BARRIER::Transition(
-            context.mTexture[i].Get(),
-            D3D12_RESOURCE_STATE_COPY_DEST,
-            D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE | D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
-        context.mCommandList->ResourceBarrier(1, &resourceBarrier);
+            // Copy data to the upload heap and schedule a copy from the upload heap to the texture
+            UpdateSubresources(context.mCommandList.Get(), context.mTexture[i].Get(), textureUploadHeap.Get(), 0, 0, static_cast<UINT>(subresources.size()), subresources.data());
+
+            CD3DX12_RESOURCE_BARRIER resourceBarrier = CD3DX12_RESOURCE_BARRIER::Transition(
+                context.mTexture[i].Get(),
+                D3D12_RESOURCE_STATE_COPY_DEST,
+                D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE | D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+            context.mCommandList->ResourceBarrier(1, &resourceBarrier);
+        }
+        else
+        {
+            // Duplicate of a texture that has already been uploaded
+            context.mTexture[i].Reset();
+        }
 
         // Create dummy SRV for constant buffer for the time being to stop validation spam
         D3D12_CONSTANT_BUFFER_VIEW_DESC cbvDesc = {};
         cbvDesc.BufferLocation = context.mConstantBuffer->GetGPUVirtualAddress();
         cbvDesc.SizeInBytes = (UINT)ALIGN_256(sizeof(SceneConstantBuffer));
-        context.mDevice->CreateConstantBufferView(
-            &cbvDesc, 
-            CD3DX12_CPU_DESCRIPTOR_HANDLE(context.mCbvSrvHeap->GetCPUDescriptorHandleForHeapStart(), 2 * i, context.mDevice->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV)));
+        context.mMaterialDescriptors[i] = context.mDescriptorAllocator.AllocatePersistent(2);
+        assert(context.mMaterialDescriptors[i].IsValid() && "Increase D3dContext::kPersistentDescriptors");
+        context.mDevice->CreateConstantBufferView(&cbvDesc, context.GetCpuDescriptor(context.mMaterialDescriptors[i].mIndex));
 
-        // Create SRV for the texture
-        context.mDevice->CreateShaderResourceView(
-            context.mTexture[i].Get(),
-            0,
-            CD3DX12_CPU_DESCRIPTOR_HANDLE(context.mCbvSrvHeap->GetCPUDescriptorHandleForHeapStart(), 2 * i + 1, context.mDevice->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV)));
+        CreateTextureViews(context, i, context.mTexture[canonicalTexture].Get());
 
         // Close command list and execute to begin initial GPU setup
         D3D_CHECK(context.mCommandList->Close());
@@ -444,45 +846,431 @@ void D3dContext::InitDevice(HWND hwnd)
 
         WaitForPreviousFrame(context);
     }
+
+    // Unused texture array entries still need valid descriptors
+    for (uint32_t i = library.GetTextureCount(); i < D3dContext::kMaxTextures; ++i)
+    {
+        context.mDevice->CreateShaderResourceView(nullptr, &nullSrvDesc, context.GetCpuDescriptor(context.mTextureArrayDescriptors.mIndex + i));
+    }
+
+    // Flat mesh table indexed by the mesh field of render queue sort keys
+    for (size_t i = 0; i < context.mNumTerrainMeshes; ++i) context.mMeshTable.push_back(&context.mTerrainMesh[i]);
+    for (size_t i = 0; i < context.mNumTreeMeshes; ++i) context.mMeshTable.push_back(&context.mTreeMesh[i]);
+    for (size_t i = 0; i < context.mNumConiferMeshes; ++i) context.mMeshTable.push_back(&context.mConiferMesh[i]);
+    context.mRenderQueue.Reserve(context.mMeshTable.size() * D3dContext::kTreePosCount);
+
+    // Model space bounds of the instanced models
+    context.mTreeBounds = CalcModelBounds(gltfInstancedModel[treeModelIndex]);
+    context.mConiferBounds = CalcModelBounds(gltfInstancedModel[coniferModelIndex]);
+
+    BuildPickingBvhs(gltfInstancedModel[treeModelIndex], gltfInstancedModel[coniferModelIndex], context);
+
+    uint64_t sceneBytes = Vnm::GetVectorBytes(context.mTerrainOccluders);
+    for (const Vnm::OccluderMesh& occluder : context.mTerrainOccluders)
+    {
+        sceneBytes += Vnm::GetVectorBytes(occluder.mPositions) + Vnm::GetVectorBytes(occluder.mIndices);
+    }
+    sceneBytes += context.mTerrainBvh.GetMemorySize() + context.mTreeBvh.GetMemorySize() + context.mConiferBvh.GetMemorySize() + context.mSceneBvh.GetMemorySize();
+    context.mSceneMemory.Reset(Vnm::MemoryCategory::AssetData, sceneBytes);
+
+    context.mHiZCuller.Init(context.mDevice.Get(), context.mDepthStencil.Get(), D3dContext::kTreePosCount, context.mShaderCache);
+    context.mGpuTimerBackend.Init(context.mDevice.Get(), context.mCommandQueue.Get(), Vnm::GpuTimer::kQueryCount);
+    context.mGpuTimer.SetProfileTrack(Vnm::CreateProfileTrack("GPU"));
+
+    // Indirect draw templates grouped by pipeline, each model owns its instance range
+    const Vnm::IndirectModelRange modelRanges[numGltfModels] =
+    {
+        { 0, 1 },
+        { 1, D3dContext::kTreePosCount / 2 },
+        { D3dContext::kTreePosCount / 2, D3dContext::kTreePosCount }
+    };
+    IndirectTemplateLists templateLists;
+    AddIndirectTemplates(context, context.mTerrainMesh, context.mNumTerrainMeshes, terrainModelIndex, modelRanges[terrainModelIndex], &templateLists);
+    AddIndirectTemplates(context, context.mTreeMesh, context.mNumTreeMeshes, treeModelIndex, modelRanges[treeModelIndex], &templateLists);
+    AddIndirectTemplates(context, context.mConiferMesh, context.mNumConiferMeshes, coniferModelIndex, modelRanges[coniferModelIndex], &templateLists);
+
+    std::vector<Vnm::IndirectDrawCommand> templates;
+    std::vector<Vnm::IndirectCommandInfo> templateInfos;
+    for (uint32_t pipeline = 0; pipeline < numPipelines; ++pipeline)
+    {
+        for (Vnm::IndirectCommandInfo& info : templateLists.mInfos[pipeline])
+        {
+            info.mRegionBase = static_cast<uint32_t>(templates.size());
+        }
+        templates.insert(templates.end(), templateLists.mTemplates[pipeline].begin(), templateLists.mTemplates[pipeline].end());
+        templateInfos.insert(templateInfos.end(), templateLists.mInfos[pipeline].begin(), templateLists.mInfos[pipeline].end());
+    }
+
+    context.mIndirectRenderer.Init(context.mDevice.Get(), context.mRootSignature.Get(), indirectConstantsParameter,
+                                   templates.data(), templateInfos.data(), static_cast<uint32_t>(templates.size()),
+                                   modelRanges, numGltfModels, numPipelines, context.mShaderCache);
+
+    OutputDebugStringA(library.Report().c_str());
+
+    context.mShaderCache.Save();
+    OutputDebugStringA(context.mShaderCache.Report().c_str());
+}
+
+// Queues visible instances in [firstInstance, endInstance) of each mesh, meshId is the mesh table index of meshes[0]
+static void QueueMeshDraws(D3dContext& context, const D3dMesh* meshes, size_t numMeshes, size_t firstInstance, size_t endInstance, const uint32_t* depthBuckets, const bool* instanceVisible, uint32_t& meshId)
+{
+    for (size_t i = 0; i < numMeshes; ++i, ++meshId)
+    {
+        uint32_t texture = context.mMaterialLibrary.GetMaterialTexture(meshes[i].mMaterialIndex);
+        assert(texture != Vnm::InvalidIndex);
+        bool alphaTested = context.mMaterialLibrary.GetMaterial(meshes[i].mMaterialIndex).mAlphaTested;
+
+        for (size_t iInstance = firstInstance; iInstance < endInstance; ++iInstance)
+        {
+            if (!instanceVisible[iInstance])
+            {
+                continue;
+            }
+
+            uint32_t instance = static_cast<uint32_t>(iInstance);
+            uint32_t depthBucket = depthBuckets[iInstance];
+
+            if (!alphaTested)
+            {
+                context.mRenderQueue.Add(Vnm::MakeSortKey(opaquePipeline, texture, meshId, depthBucket), instance);
+            }
+            else if (context.mDepthPrepass)
+            {
+                context.mRenderQueue.Add(Vnm::MakeSortKey(alphaTestDepthPipeline, texture, meshId, depthBucket), instance);
+                context.mRenderQueue.Add(Vnm::MakeSortKey(alphaTestedEqualPipeline, texture, meshId, depthBucket), instance);
+            }
+            else
+            {
+                context.mRenderQueue.Add(Vnm::MakeSortKey(alphaTestedPipeline, texture, meshId, depthBucket), instance);
+            }
+        }
+    }
+}
+
+// Estimates overdraw of the sorted queue from mesh bounding spheres, instanceSpheres holds the
+// view space position of each instance and its scale in w
+static void EstimateOverdraw(D3dContext& context, const DirectX::XMFLOAT4* instanceSpheres, float projScaleX, float projScaleY)
+{
+    const uint32_t tilesX = gWidth / 40;
+    const uint32_t tilesY = gHeight / 40;
+    context.mOverdrawEstimator.Begin(tilesX, tilesY);
+
+    const Vnm::DrawItem* items = context.mRenderQueue.GetItems();
+    for (size_t i = 0; i < context.mRenderQueue.GetCount(); ++i)
+    {
+        const D3dMesh& mesh = *context.mMeshTable[items[i].GetMesh()];
+        const DirectX::XMFLOAT4& sphere = instanceSpheres[items[i].mInstance];
+
+        // Mesh center offset is not rotated, grow the radius to cover it instead
+        float centerOffset = sqrtf(mesh.mBoundsCenter[0] * mesh.mBoundsCenter[0] + mesh.mBoundsCenter[1] * mesh.mBoundsCenter[1] + mesh.mBoundsCenter[2] * mesh.mBoundsCenter[2]);
+        float radius = (centerOffset + mesh.mBoundsRadius) * sphere.w;
+        float nearDepth = sphere.z - radius;
+        float farDepth = sphere.z + radius;
+        if (farDepth < gNearZ || nearDepth > gFarZ)
+        {
+            continue;
+        }
+
+        float minX = 0.0f;
+        float minY = 0.0f;
+        float maxX = 1.0f;
+        float maxY = 1.0f;
+        if (nearDepth > gNearZ)
+        {
+            float invDepth = 1.0f / sphere.z;
+            float centerX = sphere.x * projScaleX * invDepth;
+            float centerY = sphere.y * projScaleY * invDepth;
+            float extentX = radius * projScaleX * invDepth;
+            float extentY = radius * projScaleY * invDepth;
+            minX = 0.5f + 0.5f * (centerX - extentX);
+            maxX = 0.5f + 0.5f * (centerX + extentX);
+            minY = 0.5f - 0.5f * (centerY + extentY);
+            maxY = 0.5f - 0.5f * (centerY - extentY);
+        }
+
+        uint32_t flags = 0;
+        switch (items[i].GetPipeline())
+        {
+        case opaquePipeline:
+        case alphaTestedPipeline:
+            flags = Vnm::OverdrawWritesDepth;
+            break;
+        case alphaTestDepthPipeline:
+            flags = Vnm::OverdrawDepthOnly | Vnm::OverdrawWritesDepth;
+            break;
+        default:
+            break;
+        }
+
+        context.mOverdrawEstimator.AddDraw(minX, minY, maxX, maxY, nearDepth, farDepth, flags);
+    }
+}
+
+static void StoreBoundingSphere(DirectX::XMFLOAT4* dst, const Vnm::Aabb& bounds, const DirectX::XMMATRIX& world, float scale)
+{
+    Vnm::Float3 center = bounds.GetCenter();
+    DirectX::XMVECTOR worldCenter = DirectX::XMVector3Transform(DirectX::XMVectorSet(center.x, center.y, center.z, 1.0f), world);
+    DirectX::XMStoreFloat4(dst, DirectX::XMVectorSetW(worldCenter, 0.5f * Vnm::Length(bounds.GetExtent()) * scale));
+}
+
+static float CalcMaxExtent(const Vnm::Aabb& bounds)
+{
+    return (std::max)((std::max)(bounds.mMax.x - bounds.mMin.x, bounds.mMax.y - bounds.mMin.y), bounds.mMax.z - bounds.mMin.z);
+}
+
+static void AddTextureUses(D3dContext& context, const D3dMesh* meshes, size_t numMeshes, float distance, float size)
+{
+    for (size_t i = 0; i < numMeshes; ++i)
+    {
+        uint32_t texture = context.mMaterialLibrary.GetMaterialTexture(meshes[i].mMaterialIndex);
+        if (texture != Vnm::InvalidIndex)
+        {
+            context.mTextureStreamer.AddUse(texture, distance, size);
+        }
+    }
 }
 
 void D3dContext::Update(const DirectX::XMMATRIX& lookAt, float elapsedSeconds)
 {
+    PROFILE_ZONE("Update");
     static float totalRotation = 0.0f;
     //totalRotation += elapsedSeconds * 0.5f;
 
     DirectX::XMMATRIX matRotation = DirectX::XMMatrixRotationY(totalRotation);
     DirectX::XMMATRIX matLookAt = lookAt;
-    DirectX::XMMATRIX matPerspective = DirectX::XMMatrixPerspectiveFovLH(1.0f, static_cast<float>(gWidth) / static_cast<float>(gHeight), 0.1f, 100.0f);
+    DirectX::XMMATRIX matPerspective = DirectX::XMMatrixPerspectiveFovLH(gFovY, static_cast<float>(gWidth) / static_cast<float>(gHeight), gNearZ, gFarZ);
+    DirectX::XMStoreFloat4x4(&mView, matLookAt);
+    DirectX::XMStoreFloat4x4(&mProjection, matPerspective);
+
+    // The last frame has finished on the GPU, so its Hi-Z results can be read
+    mHiZVisibleCount = mHiZCuller.ReadVisibleCount();
+    DirectX::XMFLOAT4* hizSpheres = mHiZCuller.GetInstanceSpheres();
 
     // CB for terrain
     DirectX::XMMATRIX worldViewProj = matRotation * matLookAt * matPerspective;
     DirectX::XMMATRIX world = matRotation;
     memcpy(mpCbvDataBegin, &worldViewProj, sizeof(worldViewProj));
     memcpy(mpCbvDataBegin + sizeof(worldViewProj), &world, sizeof(world));
+    StoreBoundingSphere(&hizSpheres[0], mTerrainBounds, world, 1.0f);
+
+    static uint32_t depthBuckets[kTreePosCount];
+    static DirectX::XMFLOAT4 instanceSpheres[kTreePosCount];
+    static Vnm::Float4x4 instanceWorldViewProj[kTreePosCount];
+    static bool instanceVisible[kTreePosCount];
+    StoreFloat4x4(&instanceWorldViewProj[0], worldViewProj);
+    DirectX::XMStoreFloat4(&instanceSpheres[0], DirectX::XMVectorSetW(DirectX::XMVector3Transform(DirectX::XMVectorZero(), matRotation * matLookAt), 1.0f));
+    depthBuckets[0] = 0;
 
     // CBs for Tree instances
+    float treeDistance = FLT_MAX;
+    float treeScale = 0.0f;
+    float coniferDistance = FLT_MAX;
+    float coniferScale = 0.0f;
     for (int i = 1; i < kTreePosCount; ++i)
     {
+        DirectX::XMVECTOR viewPos = DirectX::XMVector3Transform(mTreePosArray[i], matRotation * matLookAt);
+        depthBuckets[i] = Vnm::CalcDepthBucket(DirectX::XMVectorGetZ(viewPos), gNearZ, gFarZ);
+
         size_t offset = i * ALIGN_256(sizeof(worldViewProj));
         float scaleFactor = scales[i] + 0.5;
         float scale = 0.0015f * scaleFactor;
+        DirectX::XMStoreFloat4(&instanceSpheres[i], DirectX::XMVectorSetW(viewPos, scale));
         float rotation = rotations[i] * DirectX::XM_2PI;
         world = DirectX::XMMatrixRotationY(rotation) * matRotation * DirectX::XMMatrixTranslationFromVector(mTreePosArray[i]);
         worldViewProj = DirectX::XMMatrixRotationY(rotation) * DirectX::XMMatrixScaling(scale, scale, scale) * matRotation * DirectX::XMMatrixTranslationFromVector(mTreePosArray[i]) * matLookAt * matPerspective;
         memcpy(mpCbvDataBegin + offset, &worldViewProj, sizeof(worldViewProj));
         memcpy(mpCbvDataBegin + offset + sizeof(worldViewProj), &world, sizeof(world));
+
+        // Keep a CPU copy, the constant buffer is write-combined memory
+        StoreFloat4x4(&instanceWorldViewProj[i], worldViewProj);
+        StoreBoundingSphere(&hizSpheres[i], i < kTreePosCount / 2 ? mTreeBounds : mConiferBounds, DirectX::XMMatrixScaling(scale, scale, scale) * world, scale);
+
+        // The instance that needs the most texture detail has the smallest distance for its size
+        float distance = DirectX::XMVectorGetX(DirectX::XMVector3Length(viewPos));
+        float& closestDistance = i < kTreePosCount / 2 ? treeDistance : coniferDistance;
+        float& closestScale = i < kTreePosCount / 2 ? treeScale : coniferScale;
+        if (distance * closestScale < closestDistance * scale)
+        {
+            closestDistance = distance;
+            closestScale = scale;
+        }
+    }
+
+    // The terrain is always under the camera
+    mTextureStreamer.BeginFrame();
+    AddTextureUses(*this, mTerrainMesh, mNumTerrainMeshes, 0.0f, 1.0f);
+    AddTextureUses(*this, mTreeMesh, mNumTreeMeshes, treeDistance, treeScale * CalcMaxExtent(mTreeBounds));
+    AddTextureUses(*this, mConiferMesh, mNumConiferMeshes, coniferDistance, coniferScale * CalcMaxExtent(mConiferBounds));
+
+    // Indirect draws are culled and compacted on the GPU
+    if (mIndirectDraws)
+    {
+        mRenderQueue.Clear();
+        mOverdrawEstimator.Begin(0, 0);
+        return;
+    }
+
+    // Rasterize the terrain into the occlusion buffer and test tree bounds against it
+    instanceVisible[0] = true;
+    if (mOcclusionCulling)
+    {
+        mOcclusionBuffer.Clear();
+        for (const auto& occluder : mTerrainOccluders)
+        {
+            mOcclusionBuffer.RasterizeMesh(occluder, instanceWorldViewProj[0]);
+        }
+        mOcclusionBuffer.BuildHierarchy();
+
+        for (int i = 1; i < kTreePosCount; ++i)
+        {
+            const Vnm::Aabb& bounds = i < kTreePosCount / 2 ? mTreeBounds : mConiferBounds;
+            instanceVisible[i] = mOcclusionBuffer.TestBox(bounds, instanceWorldViewProj[i]) == Vnm::OcclusionResult::Visible;
+        }
+    }
+    else
+    {
+        std::fill(instanceVisible + 1, instanceVisible + kTreePosCount, true);
+    }
+
+    // Rebuild and sort the render queue
+    mRenderQueue.Clear();
+    uint32_t meshId = 0;
+    QueueMeshDraws(*this, mTerrainMesh, mNumTerrainMeshes, 0, 1, depthBuckets, instanceVisible, meshId);
+    QueueMeshDraws(*this, mTreeMesh, mNumTreeMeshes, 1, kTreePosCount / 2, depthBuckets, instanceVisible, meshId);
+    QueueMeshDraws(*this, mConiferMesh, mNumConiferMeshes, kTreePosCount / 2, kTreePosCount, depthBuckets, instanceVisible, meshId);
+    mRenderQueue.Sort();
+
+    DirectX::XMFLOAT4X4 projection;
+    DirectX::XMStoreFloat4x4(&projection, matPerspective);
+    EstimateOverdraw(*this, instanceSpheres, projection._11, projection._22);
+}
+
+// Translates render queue output into command list calls
+class D3dRenderQueueBackend : public Vnm::RenderQueueBackend
+{
+public:
+    explicit D3dRenderQueueBackend(D3dContext& context)
+        : mContext(context)
+    {}
+
+    ~D3dRenderQueueBackend()
+    {
+        mContext.mGpuTimer.EndZone(mPipelineZone);
+    }
+
+    // Draws are sorted by pipeline first, so each pipeline is timed as one pass
+    void SetPipeline(uint32_t pipeline) override
+    {
+        mContext.mGpuTimer.EndZone(mPipelineZone);
+        mPipelineZone = mContext.mGpuTimer.BeginZone(kPipelineNames[pipeline]);
+        mContext.mCommandList->SetPipelineState(mContext.mPipelineStates[pipeline].Get());
+    }
+
+    void SetMaterial(uint32_t texture) override
+    {
+        mContext.mCommandList->SetGraphicsRootDescriptorTable(materialTableParameter, mContext.GetGpuDescriptor(mContext.mMaterialDescriptors[texture].mIndex));
+    }
+
+    void SetMesh(uint32_t mesh) override
+    {
+        mContext.mCommandList->IASetVertexBuffers(0, 1, &mContext.mMeshTable[mesh]->mVertexBufferView);
+        mContext.mCommandList->IASetIndexBuffer(&mContext.mMeshTable[mesh]->mIndexBufferView);
+    }
+
+    void Draw(uint32_t mesh, uint32_t instance) override
+    {
+        // Set root constant buffer view for this instance
+        mContext.mCommandList->SetGraphicsRootConstantBufferView(instanceConstantsParameter, mContext.mConstantBuffer->GetGPUVirtualAddress() + ALIGN_256(sizeof(SceneConstantBuffer)) * instance);
+        mContext.mCommandList->DrawIndexedInstanced(static_cast<UINT>(mContext.mMeshTable[mesh]->mNumIndices), 1, 0, 0, 0);
+    }
+
+private:
+    D3dContext& mContext;
+    uint32_t    mPipelineZone = Vnm::GpuTimer::kInvalidZone;
+};
+
+// One ExecuteIndirect per pipeline, in the same pipeline order as the render queue
+static void RecordIndirectDraws(D3dContext& context)
+{
+    context.mCommandList->SetGraphicsRootShaderResourceView(indirectInstancesParameter, context.mConstantBuffer->GetGPUVirtualAddress());
+    context.mCommandList->SetGraphicsRootShaderResourceView(indirectIndicesParameter, context.mIndirectRenderer.GetInstanceIndices()->GetGPUVirtualAddress());
+    context.mCommandList->SetGraphicsRootDescriptorTable(indirectTexturesParameter, context.GetGpuDescriptor(context.mTextureArrayDescriptors.mIndex));
+    context.mQueueStats = Vnm::RenderQueueStats();
+    context.mQueueStats.mMaterialChanges = 1;
+
+    for (uint32_t pipeline = 0; pipeline < numPipelines; ++pipeline)
+    {
+        bool prepassPipeline = pipeline == alphaTestDepthPipeline || pipeline == alphaTestedEqualPipeline;
+        if (prepassPipeline != context.mDepthPrepass && pipeline != opaquePipeline)
+        {
+            continue;
+        }
+
+        if (context.mIndirectRenderer.GetTemplateCount(pipeline) == 0)
+        {
+            continue;
+        }
+
+        Vnm::GpuZone pipelineZone(context.mGpuTimer, kPipelineNames[pipeline]);
+        context.mCommandList->SetPipelineState(context.mIndirectPipelineStates[pipeline].Get());
+        context.mIndirectRenderer.RecordDraws(context.mCommandList.Get(), pipeline);
+        context.mQueueStats.mPipelineChanges++;
+        context.mQueueStats.mDraws++;
     }
+
+    context.mIndirectRenderer.EndFrame(context.mCommandList.Get());
 }
 
 static void PopulateCommandList(D3dContext& context)
 {
+    PROFILE_ZONE("PopulateCommandList");
+
     // Command list allocators can only be reset when the associated command lists have finished execution on the GPU; use fences to determine GPU execution progress
     D3D_CHECK(context.mCommandAllocator->Reset());
 
     // When ExecuteCommandList() is called on a particular command list, that command list can then be reset at any time and must be before re-recording
     D3D_CHECK(context.mCommandList->Reset(context.mCommandAllocator.Get(), context.mPipelineState.Get()));
 
+    // The GPU is done with this frame's previous use, so are its descriptors
+    context.mDescriptorAllocator.BeginFrame(context.mFrameIndex);
+
+    // Mips that finished loading, and textures that were replaced, need new views
+    context.mStreamedTextureChanges.clear();
+    context.mTextureStreamer.Update(context.mCommandList.Get(), &context.mStreamedTextureChanges);
+    for (uint32_t changed : context.mStreamedTextureChanges)
+    {
+        context.mTexture[changed] = context.mTextureStreamer.GetResource(changed);
+        for (uint32_t i = 0; i < context.mMaterialLibrary.GetTextureCount(); ++i)
+        {
+            if (context.mMaterialLibrary.GetCanonicalTexture(i) == changed)
+            {
+                CreateTextureViews(context, i, context.mTexture[changed].Get());
+            }
+        }
+    }
+
+    context.mGpuTimerBackend.SetCommandList(context.mCommandList.Get());
+    context.mGpuTimer.BeginFrame(&context.mGpuTimerBackend);
+    uint32_t frameZone = context.mGpuTimer.BeginZone("GPU frame");
+
+    // GPU occlusion culling against the previous frame's depth, before it is cleared. Only indirect
+    // draws read the visible list, without culling it holds every instance.
+    if (context.mIndirectDraws)
+    {
+        Vnm::GpuZone cullZone(context.mGpuTimer, "Hi-Z cull");
+        context.mHiZCuller.Record(context.mCommandList.Get(), context.mView, context.mProjection, gNearZ, D3dContext::kTreePosCount, context.mHiZCulling);
+    }
+    else
+    {
+        context.mHiZCuller.Invalidate();
+    }
+
+    if (context.mIndirectDraws)
+    {
+        Vnm::GpuZone compactionZone(context.mGpuTimer, "Compaction");
+        context.mIndirectRenderer.RecordCompaction(context.mCommandList.Get(), context.mHiZCuller);
+    }
+
     // Set necessary state
     context.mCommandList->SetGraphicsRootSignature(context.mRootSignature.Get());
 
@@ -491,7 +1279,7 @@ static void PopulateCommandList(D3dContext& context)
     context.mCommandList->SetDescriptorHeaps(_countof(ppHeaps), ppHeaps);
 
     // Set root descriptor table
-    context.mCommandList->SetGraphicsRootDescriptorTable(0, context.mCbvSrvHeap->GetGPUDescriptorHandleForHeapStart());
+    context.mCommandList->SetGraphicsRootDescriptorTable(materialTableParameter, context.GetGpuDescriptor(context.mDefaultMaterialDescriptors.mIndex));
 
     context.mCommandList->RSSetViewports(1, &context.mViewport);
     context.mCommandList->RSSetScissorRects(1, &context.mScissorRect);
@@ -508,68 +1296,37 @@ static void PopulateCommandList(D3dContext& context)
     context.mCommandList->OMSetRenderTargets(1, &rtvHandle, FALSE, &dsvHandle);
 
     // Record commands
-    const float clearColor[] = { 0.8f, 0.85f, 1.0f, 1.0f };
-    context.mCommandList->ClearRenderTargetView(rtvHandle, clearColor, 0, nullptr);
-    context.mCommandList->ClearDepthStencilView(dsvHandle, D3D12_CLEAR_FLAG_DEPTH, 1.0f, 0, 0, nullptr);
-    context.mCommandList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-
-    UINT incrementSize = context.mDevice->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);  // TODO: store this somewhere else
-
-    for (size_t i = 0; i < context.mNumTerrainMeshes; ++i)
     {
-        context.mCommandList->IASetVertexBuffers(0, 1, &context.mTerrainMesh[i].mVertexBufferView);
-        context.mCommandList->IASetIndexBuffer(&context.mTerrainMesh[i].mIndexBufferView);
-
-        CD3DX12_GPU_DESCRIPTOR_HANDLE srvHandle(context.mCbvSrvHeap->GetGPUDescriptorHandleForHeapStart(), 0, incrementSize);
-        context.mCommandList->SetGraphicsRootDescriptorTable(0, srvHandle);
-
-        // Set root command buffer view for first instance
-        context.mCommandList->SetGraphicsRootConstantBufferView(1, context.mConstantBuffer->GetGPUVirtualAddress());
-        context.mCommandList->DrawIndexedInstanced(context.mTerrainMesh[i].mNumIndices, 1, 0, 0, 0);
+        Vnm::GpuZone clearZone(context.mGpuTimer, "Clear");
+        const float clearColor[] = { 0.8f, 0.85f, 1.0f, 1.0f };
+        context.mCommandList->ClearRenderTargetView(rtvHandle, clearColor, 0, nullptr);
+        context.mCommandList->ClearDepthStencilView(dsvHandle, D3D12_CLEAR_FLAG_DEPTH, 1.0f, 0, 0, nullptr);
     }
+    context.mCommandList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
-    for (size_t i = 0; i < context.mNumTreeMeshes; ++i)
+    if (context.mIndirectDraws)
     {
-        context.mCommandList->IASetVertexBuffers(0, 1, &context.mTreeMesh[i].mVertexBufferView);
-        context.mCommandList->IASetIndexBuffer(&context.mTreeMesh[i].mIndexBufferView);
-
-        CD3DX12_GPU_DESCRIPTOR_HANDLE srvHandle(context.mCbvSrvHeap->GetGPUDescriptorHandleForHeapStart(), (i + 1) * 2, incrementSize);
-        context.mCommandList->SetGraphicsRootDescriptorTable(0, srvHandle);
-        //context.mCommandList->SetGraphicsRootDescriptorTable(0, context.mCbvSrvHeap->GetGPUDescriptorHandleForHeapStart());
-
-        for (int iInstance = 1; iInstance < (context.kTreePosCount / 2); ++iInstance)
-        {
-            // Set root command buffer view for first instance
-            context.mCommandList->SetGraphicsRootConstantBufferView(1, context.mConstantBuffer->GetGPUVirtualAddress() + ALIGN_256(sizeof(SceneConstantBuffer)) * iInstance);
-            context.mCommandList->DrawIndexedInstanced(context.mTreeMesh[i].mNumIndices, 1, 0, 0, 0);
-        }
+        RecordIndirectDraws(context);
     }
-
-    for (size_t i = 0; i < context.mNumConiferMeshes; ++i)
+    else
     {
-        context.mCommandList->IASetVertexBuffers(0, 1, &context.mConiferMesh[i].mVertexBufferView);
-        context.mCommandList->IASetIndexBuffer(&context.mConiferMesh[i].mIndexBufferView);
-
-        CD3DX12_GPU_DESCRIPTOR_HANDLE srvHandle(context.mCbvSrvHeap->GetGPUDescriptorHandleForHeapStart(), (i + 5) * 2, incrementSize);
-        context.mCommandList->SetGraphicsRootDescriptorTable(0, srvHandle);
-
-        for (int iInstance = (context.kTreePosCount / 2); iInstance < context.kTreePosCount; ++iInstance)
-        {
-            // Set root command buffer view for first instance
-            context.mCommandList->SetGraphicsRootConstantBufferView(1, context.mConstantBuffer->GetGPUVirtualAddress() + ALIGN_256(sizeof(SceneConstantBuffer)) * iInstance);
-            context.mCommandList->DrawIndexedInstanced(context.mConiferMesh[i].mNumIndices, 1, 0, 0, 0);
-        }
+        D3dRenderQueueBackend backend(context);
+        context.mQueueStats = context.mRenderQueue.Submit(backend);
     }
 
     CD3DX12_RESOURCE_BARRIER presentResourceBarrier = CD3DX12_RESOURCE_BARRIER::Transition(context.mRenderTargets[context.mFrameIndex].Get(), D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_PRESENT);
     // Indicate that the back buffer will now be used to present
     context.mCommandList->ResourceBarrier(1, &presentResourceBarrier);
 
+    context.mGpuTimer.EndZone(frameZone);
+    context.mGpuTimer.EndFrame();
+
     D3D_CHECK(context.mCommandList->Close());
 }
 
 void D3dContext::Render()
 {
+    PROFILE_ZONE("Render");
     PopulateCommandList(*this);
 
     ID3D12CommandList* ppCommandLists[] = { mCommandList.Get() };
@@ -586,3 +1343,44 @@ void D3dContext::Destroy()
 
     CloseHandle(mFenceEvent);
 }
+
+bool D3dContext::Pick(const Vnm::Camera& camera, int x, int y, Vnm::SceneHit* hit, Vnm::Float3* position) const
+{
+    float ndcX = 2.0f * (static_cast<float>(x) + 0.5f) / gWidth - 1.0f;
+    float ndcY = 1.0f - 2.0f * (static_cast<float>(y) + 0.5f) / gHeight;
+    DirectX::XMVECTOR origin;
+    DirectX::XMVECTOR direction;
+    camera.CalcPickRay(ndcX, ndcY, gFovY, static_cast<float>(gWidth) / static_cast<float>(gHeight), &origin, &direction);
+
+    Vnm::Ray ray;
+    ray.mOrigin = { DirectX::XMVectorGetX(origin), DirectX::XMVectorGetY(origin), DirectX::XMVectorGetZ(origin) };
+    ray.mDirection = { DirectX::XMVectorGetX(direction), DirectX::XMVectorGetY(direction), DirectX::XMVectorGetZ(direction) };
+    ray.mMaxDistance = gFarZ;
+
+    if (!mSceneBvh.Raycast(ray, hit))
+    {
+        return false;
+    }
+    *position = ray.mOrigin + ray.mDirection * hit->mDistance;
+    return true;
+}
+
+// The terrain is drawn without a world transform, so its BVH is in world space
+bool D3dContext::GetTerrainHeight(float x, float z, float* height) const
+{
+    Vnm::Float3 point = { x, 0.0f, z };
+    uint8_t snapped = 0;
+    mTerrainBvh.SnapToSurface(&point, &snapped, 1, nullptr);
+    *height = point.y;
+    return snapped != 0;
+}
+
+D3D12_CPU_DESCRIPTOR_HANDLE D3dContext::GetCpuDescriptor(uint32_t index) const
+{
+    return CD3DX12_CPU_DESCRIPTOR_HANDLE(mCbvSrvHeap->GetCPUDescriptorHandleForHeapStart(), index, mCbvSrvDescriptorSize);
+}
+
+D3D12_GPU_DESCRIPTOR_HANDLE D3dContext::GetGpuDescriptor(uint32_t index) const
+{
+    return CD3DX12_GPU_DESCRIPTOR_HANDLE(mCbvSrvHeap->GetGPUDescriptorHandleForHeapStart(), index, mCbvSrvDescriptorSize);
+}
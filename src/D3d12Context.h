@@ -11,7 +11,23 @@
 #include <DirectXMath.h>
 #include <wrl.h>
 #include "d3dx12.h"
+#include "Camera.h"
+#include "D3d12GpuTimer.h"
+#include "D3d12HiZ.h"
+#include "D3d12Indirect.h"
 #include "D3d12Mesh.h"
+#include "D3d12ShaderCache.h"
+#include "D3d12TextureStreaming.h"
+#include "DescriptorAllocator.h"
+#include "Material.h"
+#include "MemoryTracker.h"
+#include "Overdraw.h"
+#include "RenderQueue.h"
+#include "SoftwareOcclusion.h"
+#include "ThreadPool.h"
+#include "SceneBvh.h"
+#include "TriangleBvh.h"
+#include <vector>
 
 // TODO: Move this out of context
 class SceneConstantBuffer
@@ -25,6 +41,28 @@ inline void D3D_CHECK(HRESULT hr)
     assert(SUCCEEDED(hr));
 }
 
+// Pipelines in the order they are drawn, used as the pipeline field of render queue sort keys
+enum PipelineIds
+{
+    opaquePipeline,
+    alphaTestDepthPipeline,   // Depth-only pre-pass for alpha-tested geometry
+    alphaTestedPipeline,      // Alpha-tested color without a pre-pass
+    alphaTestedEqualPipeline, // Alpha-tested color after the pre-pass, depth test EQUAL
+    numPipelines
+};
+
+// Parameters of the graphics root signature, see shaders.hlsl
+enum RootParameterIds
+{
+    materialTableParameter,     // Descriptor table, CBV b0 and texture SRV t0
+    instanceConstantsParameter, // Root CBV b1, one 256 byte slot of the constant buffer per instance
+    indirectConstantsParameter, // Root constants b2, set by the indirect command signature
+    indirectInstancesParameter, // Root SRV t1, the constant buffer read as instance data
+    indirectIndicesParameter,   // Root SRV t2, instance indices written by the compaction pass
+    indirectTexturesParameter,  // Descriptor table, every texture from t3
+    numRootParameters
+};
+
 class D3dContext
 {
 public:
@@ -33,6 +71,14 @@ public:
     void Render();
     void Destroy();
 
+    // Closest instance under the pixel at x, y of the back buffer, instance 0 is the terrain
+    bool Pick(const Vnm::Camera& camera, int x, int y, Vnm::SceneHit* hit, Vnm::Float3* position) const;
+    bool GetTerrainHeight(float x, float z, float* height) const;
+
+    // Handles of a descriptor of mCbvSrvHeap, by index from mDescriptorAllocator
+    D3D12_CPU_DESCRIPTOR_HANDLE GetCpuDescriptor(uint32_t index) const;
+    D3D12_GPU_DESCRIPTOR_HANDLE GetGpuDescriptor(uint32_t index) const;
+
     static const UINT   kFrameCount = 2;
     static const size_t kConstBufferSize = 4096 * 256;
     static const size_t kTreePosCount = 2048;
@@ -43,15 +89,30 @@ public:
     Microsoft::WRL::ComPtr<ID3D12CommandQueue>        mCommandQueue;
     Microsoft::WRL::ComPtr<ID3D12RootSignature>       mRootSignature;
     Microsoft::WRL::ComPtr<ID3D12PipelineState>       mPipelineState;
+    Microsoft::WRL::ComPtr<ID3D12PipelineState>       mPipelineStates[numPipelines];
+    Microsoft::WRL::ComPtr<ID3D12PipelineState>       mIndirectPipelineStates[numPipelines];
+    D3dShaderCache                                    mShaderCache;
     Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList> mCommandList;
 
     Microsoft::WRL::ComPtr<ID3D12DescriptorHeap>      mCbvSrvHeap;
+    Vnm::DescriptorAllocator                          mDescriptorAllocator;
+    UINT                                              mCbvSrvDescriptorSize = 0;
     Microsoft::WRL::ComPtr<ID3D12Resource>            mConstantBuffer;
     uint8_t*                                          mpCbvDataBegin;
     SceneConstantBuffer                               mConstantBufferData;
 
     static const size_t kMaxTextures = 100;
+    // Allocated once at load: the indirect texture table, the default material and a material pair
+    // per texture. Streaming rewrites the texture views in place.
+    static const UINT   kPersistentDescriptors = static_cast<UINT>(3 * kMaxTextures + 2);
+    static const UINT   kDescriptorsPerFrame = 256; // Reserved per frame in flight, nothing allocates from it yet
+    Vnm::DescriptorRange                              mDefaultMaterialDescriptors;  // CBV and a null SRV, bound before any material
+    Vnm::DescriptorRange                              mMaterialDescriptors[kMaxTextures]; // CBV/SRV pair per texture
+    Vnm::DescriptorRange                              mTextureArrayDescriptors;     // kMaxTextures SRVs that indirect draws index by texture
     Microsoft::WRL::ComPtr<ID3D12Resource>            mTexture[kMaxTextures];
+    Vnm::MaterialLibrary                              mMaterialLibrary;
+    D3dTextureStreamer                                mTextureStreamer;
+    std::vector<uint32_t>                             mStreamedTextureChanges;
 
     Microsoft::WRL::ComPtr<ID3D12Fence>               mFence;
     HANDLE                                            mFenceEvent;
@@ -76,6 +137,32 @@ public:
     size_t                                            mNumConiferMeshes;
     D3dMesh                                           mConiferMesh[kMaxMeshes];
     DirectX::XMVECTOR                                 mTreePosArray[kTreePosCount];
+    std::vector<const D3dMesh*>                       mMeshTable;
+    Vnm::RenderQueue                                  mRenderQueue;
+    Vnm::RenderQueueStats                             mQueueStats;  // Of the last PopulateCommandList, one draw per ExecuteIndirect
+    bool                                              mDepthPrepass = true;
+    Vnm::OverdrawEstimator                            mOverdrawEstimator;  // Of the render queue, zeros for indirect draws
+    std::vector<Vnm::OccluderMesh>                    mTerrainOccluders;
+    Vnm::Aabb                                         mTreeBounds;
+    Vnm::Aabb                                         mConiferBounds;
+    Vnm::OcclusionBuffer                              mOcclusionBuffer;
+    bool                                              mOcclusionCulling = true;
+    Vnm::Aabb                                         mTerrainBounds;
+    D3dHiZCuller                                      mHiZCuller;
+    bool                                              mHiZCulling = true;   // Of indirect draws, the CPU path culls with mOcclusionBuffer
+    uint32_t                                          mHiZVisibleCount = 0;
+    DirectX::XMFLOAT4X4                               mView;
+    DirectX::XMFLOAT4X4                               mProjection;
+    D3dIndirectRenderer                               mIndirectRenderer;
+    bool                                              mIndirectDraws = false;
+    Vnm::ThreadPool                                   mThreadPool;
+    Vnm::TriangleBvh                                  mTerrainBvh;
+    Vnm::TriangleBvh                                  mTreeBvh;
+    Vnm::TriangleBvh                                  mConiferBvh;
+    Vnm::SceneBvh                                     mSceneBvh;
+    Vnm::TrackedAllocation                            mSceneMemory;       // Terrain occluders and picking BVHs
+    D3dGpuTimerBackend                                mGpuTimerBackend;
+    Vnm::GpuTimer                                     mGpuTimer;
 
 private:
     void InitDevice(HWND hwnd);
@@ -0,0 +1,59 @@
+// D3d12GpuTimer.cpp
+
+#include "D3d12GpuTimer.h"
+#include "D3d12Context.h"
+#include "D3d12Memory.h"
+#include <cassert>
+#include <cstring>
+
+void D3dGpuTimerBackend::Init(ID3D12Device* device, ID3D12CommandQueue* queue, uint32_t queryCount)
+{
+    mpQueue = queue;
+    mQueryCount = queryCount;
+    D3D_CHECK(queue->GetTimestampFrequency(&mFrequency));
+
+    D3D12_QUERY_HEAP_DESC heapDesc = {};
+    heapDesc.Type = D3D12_QUERY_HEAP_TYPE_TIMESTAMP;
+    heapDesc.Count = queryCount;
+    D3D_CHECK(device->CreateQueryHeap(&heapDesc, IID_PPV_ARGS(&mQueryHeap)));
+
+    CD3DX12_HEAP_PROPERTIES heapProperties(D3D12_HEAP_TYPE_READBACK);
+    CD3DX12_RESOURCE_DESC resourceDesc = CD3DX12_RESOURCE_DESC::Buffer(queryCount * sizeof(uint64_t));
+    D3D_CHECK(device->CreateCommittedResource(
+        &heapProperties,
+        D3D12_HEAP_FLAG_NONE,
+        &resourceDesc,
+        D3D12_RESOURCE_STATE_COPY_DEST,
+        nullptr,
+        IID_PPV_ARGS(&mReadback)));
+    TrackResource(device, mReadback.Get(), Vnm::MemoryCategory::Readback);
+}
+
+void D3dGpuTimerBackend::WriteTimestamp(uint32_t query)
+{
+    assert(query < mQueryCount && mpCommandList != nullptr);
+    mpCommandList->EndQuery(mQueryHeap.Get(), D3D12_QUERY_TYPE_TIMESTAMP, query);
+}
+
+void D3dGpuTimerBackend::ResolveQueries(uint32_t first, uint32_t count)
+{
+    assert(first + count <= mQueryCount && mpCommandList != nullptr);
+    mpCommandList->ResolveQueryData(mQueryHeap.Get(), D3D12_QUERY_TYPE_TIMESTAMP, first, count, mReadback.Get(), first * sizeof(uint64_t));
+}
+
+void D3dGpuTimerBackend::ReadQueries(uint32_t first, uint32_t count, uint64_t* timestamps)
+{
+    assert(first + count <= mQueryCount);
+    uint8_t* pData;
+    CD3DX12_RANGE readRange(first * sizeof(uint64_t), (first + count) * sizeof(uint64_t));
+    D3D_CHECK(mReadback->Map(0, &readRange, reinterpret_cast<void**>(&pData)));
+    memcpy(timestamps, pData + first * sizeof(uint64_t), count * sizeof(uint64_t));
+    CD3DX12_RANGE writeRange(0, 0);
+    mReadback->Unmap(0, &writeRange);
+}
+
+// The CPU side of the calibration is QueryPerformanceCounter, the same clock as GetClockTicks
+bool D3dGpuTimerBackend::GetCalibration(uint64_t* gpuTicks, uint64_t* cpuTicks)
+{
+    return SUCCEEDED(mpQueue->GetClockCalibration(gpuTicks, cpuTicks));
+}
@@ -0,0 +1,33 @@
+// D3d12GpuTimer.h
+
+#pragma once
+
+#include "GpuTimer.h"
+#include <d3d12.h>
+#include <wrl.h>
+#include <stdint.h>
+
+// Timestamp query heap and the readback buffer it is resolved into, for a Vnm::GpuTimer on one
+// direct queue. Each frame in flight resolves into its own range of the buffer.
+class D3dGpuTimerBackend : public Vnm::GpuTimerBackend
+{
+public:
+    void Init(ID3D12Device* device, ID3D12CommandQueue* queue, uint32_t queryCount);
+
+    // Timestamps and resolves of the frame are recorded into commandList
+    void SetCommandList(ID3D12GraphicsCommandList* commandList) { mpCommandList = commandList; }
+
+    void WriteTimestamp(uint32_t query) override;
+    void ResolveQueries(uint32_t first, uint32_t count) override;
+    void ReadQueries(uint32_t first, uint32_t count, uint64_t* timestamps) override;
+    uint64_t GetFrequency() override { return mFrequency; }
+    bool GetCalibration(uint64_t* gpuTicks, uint64_t* cpuTicks) override;
+
+private:
+    Microsoft::WRL::ComPtr<ID3D12QueryHeap> mQueryHeap;
+    Microsoft::WRL::ComPtr<ID3D12Resource>  mReadback;
+    ID3D12CommandQueue*                     mpQueue = nullptr;
+    ID3D12GraphicsCommandList*              mpCommandList = nullptr;
+    uint32_t                                mQueryCount = 0;
+    uint64_t                                mFrequency = 0;
+};
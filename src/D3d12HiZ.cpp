@@ -0,0 +1,279 @@
+// D3d12HiZ.cpp
+
+#include "D3d12HiZ.h"
+#include "D3d12Context.h"
+#include "D3d12Memory.h"
+#include "HiZCulling.h"
+#include <algorithm>
+#include <cassert>
+
+using Microsoft::WRL::ComPtr;
+
+enum HiZRootParameters
+{
+    hizCullConstants,
+    hizDownsampleConstants,
+    hizDownsampleTable,
+    hizCullTable,
+    hizInstanceSpheres,
+    hizVisibleInstances,
+    hizVisibleCount,
+    numHiZRootParameters
+};
+
+static const UINT kHiZCullConstantCount = sizeof(D3dHiZCullConstants) / sizeof(uint32_t);
+static const UINT kHiZDownsampleConstantCount = 4;
+
+static ComPtr<ID3D12Resource> CreateBuffer(ID3D12Device* device, D3D12_HEAP_TYPE heapType, UINT64 size, D3D12_RESOURCE_FLAGS flags, D3D12_RESOURCE_STATES state, Vnm::MemoryCategory category)
+{
+    ComPtr<ID3D12Resource> buffer;
+    CD3DX12_HEAP_PROPERTIES heapProperties(heapType);
+    CD3DX12_RESOURCE_DESC resourceDesc = CD3DX12_RESOURCE_DESC::Buffer(size, flags);
+    D3D_CHECK(device->CreateCommittedResource(
+        &heapProperties,
+        D3D12_HEAP_FLAG_NONE,
+        &resourceDesc,
+        state,
+        nullptr,
+        IID_PPV_ARGS(&buffer)));
+    TrackResource(device, buffer.Get(), category);
+    return buffer;
+}
+
+void D3dHiZCuller::Init(ID3D12Device* device, ID3D12Resource* depthBuffer, uint32_t maxInstances, D3dShaderCache& shaderCache)
+{
+    D3D12_RESOURCE_DESC depthDesc = depthBuffer->GetDesc();
+    assert(depthDesc.Format == DXGI_FORMAT_R32_TYPELESS && "Depth buffer must be typeless to be read by the downsample pass");
+
+    mpDepthBuffer = depthBuffer;
+    mDepthWidth = static_cast<uint32_t>(depthDesc.Width);
+    mDepthHeight = depthDesc.Height;
+    mLevelCount = 1;
+    while ((std::max)(mDepthWidth, mDepthHeight) >> mLevelCount)
+    {
+        mLevelCount++;
+    }
+    const uint32_t numMips = mLevelCount - 1;
+
+    // Create root signature
+    D3D12_FEATURE_DATA_ROOT_SIGNATURE featureData = {};
+    featureData.HighestVersion = D3D_ROOT_SIGNATURE_VERSION_1_1;
+    if (FAILED(device->CheckFeatureSupport(D3D12_FEATURE_ROOT_SIGNATURE, &featureData, sizeof(featureData))))
+    {
+        featureData.HighestVersion = D3D_ROOT_SIGNATURE_VERSION_1_0;
+    }
+
+    CD3DX12_DESCRIPTOR_RANGE1 downsampleRanges[2];
+    downsampleRanges[0].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 0);
+    downsampleRanges[1].Init(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 1, 0);
+    CD3DX12_DESCRIPTOR_RANGE1 cullRange;
+    cullRange.Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 2);
+
+    CD3DX12_ROOT_PARAMETER1 rootParameters[numHiZRootParameters];
+    rootParameters[hizCullConstants].InitAsConstants(kHiZCullConstantCount, 0);
+    rootParameters[hizDownsampleConstants].InitAsConstants(kHiZDownsampleConstantCount, 1);
+    rootParameters[hizDownsampleTable].InitAsDescriptorTable(_countof(downsampleRanges), downsampleRanges);
+    rootParameters[hizCullTable].InitAsDescriptorTable(1, &cullRange);
+    rootParameters[hizInstanceSpheres].InitAsShaderResourceView(1);
+    rootParameters[hizVisibleInstances].InitAsUnorderedAccessView(1);
+    rootParameters[hizVisibleCount].InitAsUnorderedAccessView(2);
+
+    CD3DX12_VERSIONED_ROOT_SIGNATURE_DESC rootSignatureDesc;
+    rootSignatureDesc.Init_1_1(_countof(rootParameters), rootParameters, 0, nullptr, D3D12_ROOT_SIGNATURE_FLAG_NONE);
+
+    ComPtr<ID3DBlob> signature;
+    ComPtr<ID3DBlob> error;
+    D3D_CHECK(D3DX12SerializeVersionedRootSignature(&rootSignatureDesc, featureData.HighestVersion, &signature, &error));
+    D3D_CHECK(device->CreateRootSignature(0, signature->GetBufferPointer(), signature->GetBufferSize(), IID_PPV_ARGS(&mRootSignature)));
+
+    // Create pipeline states
+    ComPtr<ID3DBlob> downsampleShader;
+    ComPtr<ID3DBlob> cullShader;
+
+    UINT compileFlags = 0;
+#if defined(_DEBUG)
+    compileFlags |= D3DCOMPILE_DEBUG | D3DCOMPILE_SKIP_OPTIMIZATION;
+#endif//_DEBUG
+
+    downsampleShader = shaderCache.Compile("hiz.hlsl", nullptr, "CsHiZDownsample", "cs_5_0", compileFlags);
+    cullShader = shaderCache.Compile("hiz.hlsl", nullptr, "CsHiZCull", "cs_5_0", compileFlags);
+
+    D3D12_COMPUTE_PIPELINE_STATE_DESC psoDesc = {};
+    psoDesc.pRootSignature = mRootSignature.Get();
+    psoDesc.CS = CD3DX12_SHADER_BYTECODE(downsampleShader.Get());
+    mDownsamplePipeline = shaderCache.CreateComputePipeline("HiZ downsample", psoDesc);
+    psoDesc.CS = CD3DX12_SHADER_BYTECODE(cullShader.Get());
+    mCullPipeline = shaderCache.CreateComputePipeline("HiZ cull", psoDesc);
+
+    // Pyramid levels 1 and up, level 0 is the depth buffer itself
+    CD3DX12_HEAP_PROPERTIES heapProperties(D3D12_HEAP_TYPE_DEFAULT);
+    CD3DX12_RESOURCE_DESC hizDesc = CD3DX12_RESOURCE_DESC::Tex2D(
+        DXGI_FORMAT_R32_FLOAT, Vnm::HiZLevelSize(mDepthWidth, 1), Vnm::HiZLevelSize(mDepthHeight, 1), 1, static_cast<UINT16>(numMips), 1, 0, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
+    D3D_CHECK(device->CreateCommittedResource(
+        &heapProperties,
+        D3D12_HEAP_FLAG_NONE,
+        &hizDesc,
+        D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE,
+        nullptr,
+        IID_PPV_ARGS(&mHiZ)));
+    TrackResource(device, mHiZ.Get(), Vnm::MemoryCategory::RenderTargets);
+
+    // Source SRV and destination UAV for each downsample, then an SRV of the whole chain for culling
+    D3D12_DESCRIPTOR_HEAP_DESC heapDesc = {};
+    heapDesc.NumDescriptors = 2 * numMips + 1;
+    heapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
+    heapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
+    D3D_CHECK(device->CreateDescriptorHeap(&heapDesc, IID_PPV_ARGS(&mHeap)));
+    mDescriptorSize = device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+
+    D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+    srvDesc.Format = DXGI_FORMAT_R32_FLOAT;
+    srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+    srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+    srvDesc.Texture2D.MipLevels = 1;
+
+    D3D12_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
+    uavDesc.Format = DXGI_FORMAT_R32_FLOAT;
+    uavDesc.ViewDimension = D3D12_UAV_DIMENSION_TEXTURE2D;
+
+    for (uint32_t mip = 0; mip < numMips; ++mip)
+    {
+        srvDesc.Texture2D.MostDetailedMip = mip == 0 ? 0 : mip - 1;
+        device->CreateShaderResourceView(
+            mip == 0 ? depthBuffer : mHiZ.Get(),
+            &srvDesc,
+            CD3DX12_CPU_DESCRIPTOR_HANDLE(mHeap->GetCPUDescriptorHandleForHeapStart(), 2 * mip, mDescriptorSize));
+
+        uavDesc.Texture2D.MipSlice = mip;
+        device->CreateUnorderedAccessView(
+            mHiZ.Get(),
+            nullptr,
+            &uavDesc,
+            CD3DX12_CPU_DESCRIPTOR_HANDLE(mHeap->GetCPUDescriptorHandleForHeapStart(), 2 * mip + 1, mDescriptorSize));
+    }
+
+    srvDesc.Texture2D.MostDetailedMip = 0;
+    srvDesc.Texture2D.MipLevels = numMips;
+    device->CreateShaderResourceView(
+        mHiZ.Get(),
+        &srvDesc,
+        CD3DX12_CPU_DESCRIPTOR_HANDLE(mHeap->GetCPUDescriptorHandleForHeapStart(), 2 * numMips, mDescriptorSize));
+
+    // Instance and output buffers
+    mMaxInstances = maxInstances;
+    mInstanceSpheres = CreateBuffer(device, D3D12_HEAP_TYPE_UPLOAD, maxInstances * sizeof(DirectX::XMFLOAT4), D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, Vnm::MemoryCategory::Constants);
+    CD3DX12_RANGE readRange(0, 0);
+    D3D_CHECK(mInstanceSpheres->Map(0, &readRange, reinterpret_cast<void**>(&mpInstanceSpheres)));
+
+    mVisibleInstances = CreateBuffer(device, D3D12_HEAP_TYPE_DEFAULT, maxInstances * sizeof(uint32_t), D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COMMON, Vnm::MemoryCategory::GpuBuffers);
+    mVisibleCount = CreateBuffer(device, D3D12_HEAP_TYPE_DEFAULT, sizeof(uint32_t), D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COMMON, Vnm::MemoryCategory::GpuBuffers);
+    mVisibleCountReadback = CreateBuffer(device, D3D12_HEAP_TYPE_READBACK, sizeof(uint32_t), D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COPY_DEST, Vnm::MemoryCategory::Readback);
+
+    mVisibleCountReset = CreateBuffer(device, D3D12_HEAP_TYPE_UPLOAD, sizeof(uint32_t), D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, Vnm::MemoryCategory::Upload);
+    uint32_t* pReset;
+    D3D_CHECK(mVisibleCountReset->Map(0, &readRange, reinterpret_cast<void**>(&pReset)));
+    *pReset = 0;
+    mVisibleCountReset->Unmap(0, nullptr);
+}
+
+void D3dHiZCuller::Record(ID3D12GraphicsCommandList* commandList, const DirectX::XMFLOAT4X4& view, const DirectX::XMFLOAT4X4& proj, float nearZ, uint32_t numInstances, bool testOcclusion)
+{
+    assert(numInstances <= mMaxInstances);
+
+    // Nothing to test against until a frame has been rendered, every instance is output as visible
+    testOcclusion = testOcclusion && mHasPreviousView;
+
+    ID3D12DescriptorHeap* ppHeaps[] = { mHeap.Get() };
+    commandList->SetDescriptorHeaps(_countof(ppHeaps), ppHeaps);
+    commandList->SetComputeRootSignature(mRootSignature.Get());
+
+    CD3DX12_RESOURCE_BARRIER beginBarriers[] =
+    {
+        CD3DX12_RESOURCE_BARRIER::Transition(mVisibleCount.Get(), D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_COPY_DEST),
+        CD3DX12_RESOURCE_BARRIER::Transition(mVisibleInstances.Get(), D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_UNORDERED_ACCESS),
+        CD3DX12_RESOURCE_BARRIER::Transition(mpDepthBuffer, D3D12_RESOURCE_STATE_DEPTH_WRITE, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE)
+    };
+    commandList->ResourceBarrier(testOcclusion ? 3 : 2, beginBarriers);
+    commandList->CopyBufferRegion(mVisibleCount.Get(), 0, mVisibleCountReset.Get(), 0, sizeof(uint32_t));
+
+    // Build the pyramid one level at a time, each level reads the one before it
+    commandList->SetPipelineState(mDownsamplePipeline.Get());
+    const uint32_t numMips = mLevelCount - 1;
+    for (uint32_t mip = 0; mip < numMips && testOcclusion; ++mip)
+    {
+        const uint32_t level = mip + 1;
+        const uint32_t sizes[kHiZDownsampleConstantCount] =
+        {
+            Vnm::HiZLevelSize(mDepthWidth, level - 1),
+            Vnm::HiZLevelSize(mDepthHeight, level - 1),
+            Vnm::HiZLevelSize(mDepthWidth, level),
+            Vnm::HiZLevelSize(mDepthHeight, level)
+        };
+
+        CD3DX12_RESOURCE_BARRIER toUav = CD3DX12_RESOURCE_BARRIER::Transition(mHiZ.Get(), D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, mip);
+        commandList->ResourceBarrier(1, &toUav);
+
+        commandList->SetComputeRoot32BitConstants(hizDownsampleConstants, kHiZDownsampleConstantCount, sizes, 0);
+        commandList->SetComputeRootDescriptorTable(hizDownsampleTable, CD3DX12_GPU_DESCRIPTOR_HANDLE(mHeap->GetGPUDescriptorHandleForHeapStart(), 2 * mip, mDescriptorSize));
+        commandList->Dispatch((sizes[2] + 7) / 8, (sizes[3] + 7) / 8, 1);
+
+        CD3DX12_RESOURCE_BARRIER toSrv = CD3DX12_RESOURCE_BARRIER::Transition(mHiZ.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, mip);
+        commandList->ResourceBarrier(1, &toSrv);
+    }
+
+    // Cull with the view the pyramid was rendered with
+    D3dHiZCullConstants constants;
+    constants.mView = mPreviousView;
+    constants.mProjection[0] = proj._11;
+    constants.mProjection[1] = proj._22;
+    constants.mProjection[2] = proj._33;
+    constants.mProjection[3] = proj._43;
+    constants.mNearZ = nearZ;
+    constants.mDepthWidth = mDepthWidth;
+    constants.mDepthHeight = mDepthHeight;
+    constants.mLevelCount = testOcclusion ? mLevelCount : 0;
+    constants.mInstanceCount = numInstances;
+
+    CD3DX12_RESOURCE_BARRIER countToUav = CD3DX12_RESOURCE_BARRIER::Transition(mVisibleCount.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+    commandList->ResourceBarrier(1, &countToUav);
+
+    commandList->SetPipelineState(mCullPipeline.Get());
+    commandList->SetComputeRoot32BitConstants(hizCullConstants, kHiZCullConstantCount, &constants, 0);
+    commandList->SetComputeRootDescriptorTable(hizCullTable, CD3DX12_GPU_DESCRIPTOR_HANDLE(mHeap->GetGPUDescriptorHandleForHeapStart(), 2 * numMips, mDescriptorSize));
+    commandList->SetComputeRootShaderResourceView(hizInstanceSpheres, mInstanceSpheres->GetGPUVirtualAddress());
+    commandList->SetComputeRootUnorderedAccessView(hizVisibleInstances, mVisibleInstances->GetGPUVirtualAddress());
+    commandList->SetComputeRootUnorderedAccessView(hizVisibleCount, mVisibleCount->GetGPUVirtualAddress());
+    commandList->Dispatch((numInstances + 63) / 64, 1, 1);
+
+    CD3DX12_RESOURCE_BARRIER endBarriers[] =
+    {
+        CD3DX12_RESOURCE_BARRIER::Transition(mVisibleCount.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_SOURCE),
+        CD3DX12_RESOURCE_BARRIER::Transition(mVisibleInstances.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COMMON),
+        CD3DX12_RESOURCE_BARRIER::Transition(mpDepthBuffer, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_DEPTH_WRITE)
+    };
+    commandList->ResourceBarrier(testOcclusion ? 3 : 2, endBarriers);
+    commandList->CopyBufferRegion(mVisibleCountReadback.Get(), 0, mVisibleCount.Get(), 0, sizeof(uint32_t));
+
+    CD3DX12_RESOURCE_BARRIER countToCommon = CD3DX12_RESOURCE_BARRIER::Transition(mVisibleCount.Get(), D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_COMMON);
+    commandList->ResourceBarrier(1, &countToCommon);
+
+    mPreviousView = view;
+    mHasPreviousView = true;
+    mHasResults = true;
+}
+
+uint32_t D3dHiZCuller::ReadVisibleCount() const
+{
+    if (!mHasResults)
+    {
+        return 0;
+    }
+
+    uint32_t* pCount;
+    CD3DX12_RANGE readRange(0, sizeof(uint32_t));
+    D3D_CHECK(mVisibleCountReadback->Map(0, &readRange, reinterpret_cast<void**>(&pCount)));
+    uint32_t count = *pCount;
+    CD3DX12_RANGE writeRange(0, 0);
+    mVisibleCountReadback->Unmap(0, &writeRange);
+    return count;
+}
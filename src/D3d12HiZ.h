@@ -0,0 +1,77 @@
+// D3d12HiZ.h
+
+#pragma once
+
+#include <d3d12.h>
+#include <DirectXMath.h>
+#include <wrl.h>
+#include <stdint.h>
+
+class D3dShaderCache;
+
+// Root constants of CsHiZCull, see hiz.hlsl
+class D3dHiZCullConstants
+{
+public:
+    DirectX::XMFLOAT4X4 mView;
+    float               mProjection[4];
+    float               mNearZ;
+    uint32_t            mDepthWidth;
+    uint32_t            mDepthHeight;
+    uint32_t            mLevelCount;
+    uint32_t            mInstanceCount;
+};
+
+// GPU occlusion culling against the previous frame's depth. The depth buffer is downsampled into a
+// max-depth mip chain and a compute pass writes the indices of instances whose bounding spheres
+// pass the test to GetVisibleInstances(), with the count in the first uint of GetVisibleCount().
+class D3dHiZCuller
+{
+public:
+    // depthBuffer must be R32_TYPELESS so it can be read as R32_FLOAT
+    void Init(ID3D12Device* device, ID3D12Resource* depthBuffer, uint32_t maxInstances, D3dShaderCache& shaderCache);
+
+    // World space center and radius of each instance, written by the CPU before Record
+    DirectX::XMFLOAT4* GetInstanceSpheres() const { return mpInstanceSpheres; }
+
+    // Records the pyramid build and culling pass. Expects the depth buffer in DEPTH_WRITE holding the
+    // frame rendered with the view passed to the previous call, and leaves it in DEPTH_WRITE.
+    // Without testOcclusion, or before the first frame, every instance is written as visible.
+    // Leaves the command list's descriptor heap and compute state changed.
+    void Record(ID3D12GraphicsCommandList* commandList, const DirectX::XMFLOAT4X4& view, const DirectX::XMFLOAT4X4& proj, float nearZ, uint32_t numInstances, bool testOcclusion);
+
+    // Call on frames without a Record, the next Record then outputs every instance as visible
+    void Invalidate() { mHasPreviousView = false; mHasResults = false; }
+
+    // Visible count from the last recorded pass, valid once it has finished on the GPU
+    uint32_t ReadVisibleCount() const;
+
+    ID3D12Resource* GetVisibleInstances() const { return mVisibleInstances.Get(); }
+    ID3D12Resource* GetVisibleCount() const { return mVisibleCount.Get(); }
+    bool            HasResults() const { return mHasResults; }
+
+private:
+    Microsoft::WRL::ComPtr<ID3D12RootSignature>  mRootSignature;
+    Microsoft::WRL::ComPtr<ID3D12PipelineState>  mDownsamplePipeline;
+    Microsoft::WRL::ComPtr<ID3D12PipelineState>  mCullPipeline;
+    Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> mHeap;
+    UINT                                         mDescriptorSize = 0;
+
+    ID3D12Resource*                              mpDepthBuffer = nullptr;
+    uint32_t                                     mDepthWidth = 0;
+    uint32_t                                     mDepthHeight = 0;
+    uint32_t                                     mLevelCount = 0;
+    Microsoft::WRL::ComPtr<ID3D12Resource>       mHiZ;
+
+    uint32_t                                     mMaxInstances = 0;
+    Microsoft::WRL::ComPtr<ID3D12Resource>       mInstanceSpheres;
+    DirectX::XMFLOAT4*                           mpInstanceSpheres = nullptr;
+    Microsoft::WRL::ComPtr<ID3D12Resource>       mVisibleInstances;
+    Microsoft::WRL::ComPtr<ID3D12Resource>       mVisibleCount;
+    Microsoft::WRL::ComPtr<ID3D12Resource>       mVisibleCountReset;
+    Microsoft::WRL::ComPtr<ID3D12Resource>       mVisibleCountReadback;
+
+    DirectX::XMFLOAT4X4                          mPreviousView;
+    bool                                         mHasPreviousView = false;
+    bool                                         mHasResults = false;
+};
@@ -0,0 +1,310 @@
+// D3d12Indirect.cpp
+
+#include "D3d12Indirect.h"
+#include "D3d12Context.h"
+#include "D3d12HiZ.h"
+#include "D3d12Memory.h"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+using Microsoft::WRL::ComPtr;
+
+static_assert(sizeof(Vnm::IndirectVertexBufferView) == sizeof(D3D12_VERTEX_BUFFER_VIEW), "IndirectVertexBufferView must match D3D12_VERTEX_BUFFER_VIEW");
+static_assert(sizeof(Vnm::IndirectIndexBufferView) == sizeof(D3D12_INDEX_BUFFER_VIEW), "IndirectIndexBufferView must match D3D12_INDEX_BUFFER_VIEW");
+static_assert(sizeof(Vnm::IndirectDrawIndexedArgs) == sizeof(D3D12_DRAW_INDEXED_ARGUMENTS), "IndirectDrawIndexedArgs must match D3D12_DRAW_INDEXED_ARGUMENTS");
+static_assert(sizeof(Vnm::IndirectDrawCommand) == 16 * sizeof(uint32_t), "IndirectDrawCommand must match indirect.hlsl");
+
+enum IndirectRootParameters
+{
+    indirectCompactConstants,
+    indirectVisibleInstances,
+    indirectVisibleCount,
+    indirectInstanceModels,
+    indirectModels,
+    indirectTemplates,
+    indirectInfos,
+    indirectModelCounts,
+    indirectInstanceIndices,
+    indirectPipelineCounts,
+    indirectCommands,
+    numIndirectRootParameters
+};
+
+static ComPtr<ID3D12Resource> CreateBuffer(ID3D12Device* device, D3D12_HEAP_TYPE heapType, UINT64 size, D3D12_RESOURCE_FLAGS flags, D3D12_RESOURCE_STATES state, Vnm::MemoryCategory category)
+{
+    ComPtr<ID3D12Resource> buffer;
+    CD3DX12_HEAP_PROPERTIES heapProperties(heapType);
+    CD3DX12_RESOURCE_DESC resourceDesc = CD3DX12_RESOURCE_DESC::Buffer(size, flags);
+    D3D_CHECK(device->CreateCommittedResource(
+        &heapProperties,
+        D3D12_HEAP_FLAG_NONE,
+        &resourceDesc,
+        state,
+        nullptr,
+        IID_PPV_ARGS(&buffer)));
+    TrackResource(device, buffer.Get(), category);
+    return buffer;
+}
+
+// Upload buffer holding a copy of data, read directly by the GPU
+static ComPtr<ID3D12Resource> CreateUploadBuffer(ID3D12Device* device, const void* data, size_t size, Vnm::MemoryCategory category)
+{
+    ComPtr<ID3D12Resource> buffer = CreateBuffer(device, D3D12_HEAP_TYPE_UPLOAD, size, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ, category);
+    uint8_t* pData;
+    CD3DX12_RANGE readRange(0, 0);
+    D3D_CHECK(buffer->Map(0, &readRange, reinterpret_cast<void**>(&pData)));
+    if (data != nullptr)
+    {
+        memcpy(pData, data, size);
+    }
+    else
+    {
+        memset(pData, 0, size);
+    }
+    buffer->Unmap(0, nullptr);
+    return buffer;
+}
+
+static D3D12_INDIRECT_ARGUMENT_DESC ToD3dArgument(const Vnm::IndirectArgument& argument)
+{
+    D3D12_INDIRECT_ARGUMENT_DESC desc = {};
+    switch (argument.mType)
+    {
+    case Vnm::IndirectArgumentType::Draw:
+        desc.Type = D3D12_INDIRECT_ARGUMENT_TYPE_DRAW;
+        break;
+    case Vnm::IndirectArgumentType::DrawIndexed:
+        desc.Type = D3D12_INDIRECT_ARGUMENT_TYPE_DRAW_INDEXED;
+        break;
+    case Vnm::IndirectArgumentType::Dispatch:
+        desc.Type = D3D12_INDIRECT_ARGUMENT_TYPE_DISPATCH;
+        break;
+    case Vnm::IndirectArgumentType::VertexBufferView:
+        desc.Type = D3D12_INDIRECT_ARGUMENT_TYPE_VERTEX_BUFFER_VIEW;
+        desc.VertexBuffer.Slot = argument.mSlot;
+        break;
+    case Vnm::IndirectArgumentType::IndexBufferView:
+        desc.Type = D3D12_INDIRECT_ARGUMENT_TYPE_INDEX_BUFFER_VIEW;
+        break;
+    case Vnm::IndirectArgumentType::Constant:
+        desc.Type = D3D12_INDIRECT_ARGUMENT_TYPE_CONSTANT;
+        desc.Constant.RootParameterIndex = argument.mRootParameter;
+        desc.Constant.DestOffsetIn32BitValues = argument.mDestOffset;
+        desc.Constant.Num32BitValuesToSet = argument.mNum32BitValues;
+        break;
+    case Vnm::IndirectArgumentType::ConstantBufferView:
+        desc.Type = D3D12_INDIRECT_ARGUMENT_TYPE_CONSTANT_BUFFER_VIEW;
+        desc.ConstantBufferView.RootParameterIndex = argument.mRootParameter;
+        break;
+    case Vnm::IndirectArgumentType::ShaderResourceView:
+        desc.Type = D3D12_INDIRECT_ARGUMENT_TYPE_SHADER_RESOURCE_VIEW;
+        desc.ShaderResourceView.RootParameterIndex = argument.mRootParameter;
+        break;
+    case Vnm::IndirectArgumentType::UnorderedAccessView:
+        desc.Type = D3D12_INDIRECT_ARGUMENT_TYPE_UNORDERED_ACCESS_VIEW;
+        desc.UnorderedAccessView.RootParameterIndex = argument.mRootParameter;
+        break;
+    }
+    return desc;
+}
+
+void D3dIndirectRenderer::Init(ID3D12Device* device, ID3D12RootSignature* graphicsRootSignature, uint32_t constantsRootParameter,
+                               const Vnm::IndirectDrawCommand* templates, const Vnm::IndirectCommandInfo* infos, uint32_t numTemplates,
+                               const Vnm::IndirectModelRange* models, uint32_t numModels, uint32_t numPipelines, D3dShaderCache& shaderCache)
+{
+    mNumTemplates = numTemplates;
+    mNumModels = numModels;
+    mNumPipelines = numPipelines;
+
+    // Create command signature
+    Vnm::CommandSignatureBuilder builder = Vnm::MakeIndirectDrawSignature(constantsRootParameter);
+    std::string error;
+    bool validSignature = builder.Validate(&error);
+    assert(validSignature && "Invalid command signature");
+    (void)validSignature;
+    assert(builder.GetByteStride() == sizeof(Vnm::IndirectDrawCommand));
+
+    std::vector<D3D12_INDIRECT_ARGUMENT_DESC> argumentDescs;
+    for (const Vnm::IndirectArgument& argument : builder.GetArguments())
+    {
+        argumentDescs.push_back(ToD3dArgument(argument));
+    }
+
+    D3D12_COMMAND_SIGNATURE_DESC signatureDesc = {};
+    signatureDesc.ByteStride = builder.GetByteStride();
+    signatureDesc.NumArgumentDescs = static_cast<UINT>(argumentDescs.size());
+    signatureDesc.pArgumentDescs = argumentDescs.data();
+    D3D_CHECK(device->CreateCommandSignature(&signatureDesc, builder.NeedsRootSignature() ? graphicsRootSignature : nullptr, IID_PPV_ARGS(&mCommandSignature)));
+
+    // Create root signature
+    D3D12_FEATURE_DATA_ROOT_SIGNATURE featureData = {};
+    featureData.HighestVersion = D3D_ROOT_SIGNATURE_VERSION_1_1;
+    if (FAILED(device->CheckFeatureSupport(D3D12_FEATURE_ROOT_SIGNATURE, &featureData, sizeof(featureData))))
+    {
+        featureData.HighestVersion = D3D_ROOT_SIGNATURE_VERSION_1_0;
+    }
+
+    CD3DX12_ROOT_PARAMETER1 rootParameters[numIndirectRootParameters];
+    rootParameters[indirectCompactConstants].InitAsConstants(2, 0);
+    rootParameters[indirectVisibleInstances].InitAsShaderResourceView(0);
+    rootParameters[indirectVisibleCount].InitAsShaderResourceView(1);
+    rootParameters[indirectInstanceModels].InitAsShaderResourceView(2);
+    rootParameters[indirectModels].InitAsShaderResourceView(3);
+    rootParameters[indirectTemplates].InitAsShaderResourceView(4);
+    rootParameters[indirectInfos].InitAsShaderResourceView(5);
+    rootParameters[indirectModelCounts].InitAsUnorderedAccessView(0);
+    rootParameters[indirectInstanceIndices].InitAsUnorderedAccessView(1);
+    rootParameters[indirectPipelineCounts].InitAsUnorderedAccessView(2);
+    rootParameters[indirectCommands].InitAsUnorderedAccessView(3);
+
+    CD3DX12_VERSIONED_ROOT_SIGNATURE_DESC rootSignatureDesc;
+    rootSignatureDesc.Init_1_1(_countof(rootParameters), rootParameters, 0, nullptr, D3D12_ROOT_SIGNATURE_FLAG_NONE);
+
+    ComPtr<ID3DBlob> signature;
+    ComPtr<ID3DBlob> rootSignatureError;
+    D3D_CHECK(D3DX12SerializeVersionedRootSignature(&rootSignatureDesc, featureData.HighestVersion, &signature, &rootSignatureError));
+    D3D_CHECK(device->CreateRootSignature(0, signature->GetBufferPointer(), signature->GetBufferSize(), IID_PPV_ARGS(&mRootSignature)));
+
+    // Create pipeline states
+    ComPtr<ID3DBlob> binShader;
+    ComPtr<ID3DBlob> compactShader;
+
+    UINT compileFlags = 0;
+#if defined(_DEBUG)
+    compileFlags |= D3DCOMPILE_DEBUG | D3DCOMPILE_SKIP_OPTIMIZATION;
+#endif//_DEBUG
+
+    binShader = shaderCache.Compile("indirect.hlsl", nullptr, "CsBinInstances", "cs_5_0", compileFlags);
+    compactShader = shaderCache.Compile("indirect.hlsl", nullptr, "CsCompactCommands", "cs_5_0", compileFlags);
+
+    D3D12_COMPUTE_PIPELINE_STATE_DESC psoDesc = {};
+    psoDesc.pRootSignature = mRootSignature.Get();
+    psoDesc.CS = CD3DX12_SHADER_BYTECODE(binShader.Get());
+    mBinPipeline = shaderCache.CreateComputePipeline("Indirect bin instances", psoDesc);
+    psoDesc.CS = CD3DX12_SHADER_BYTECODE(compactShader.Get());
+    mCompactPipeline = shaderCache.CreateComputePipeline("Indirect compact commands", psoDesc);
+
+    // Model of each instance, and the command region of each pipeline
+    mNumInstances = 0;
+    for (uint32_t i = 0; i < numModels; ++i)
+    {
+        mNumInstances = models[i].mEndInstance > mNumInstances ? models[i].mEndInstance : mNumInstances;
+    }
+
+    std::vector<uint32_t> instanceModels(mNumInstances, UINT32_MAX);
+    for (uint32_t i = 0; i < numModels; ++i)
+    {
+        std::fill(instanceModels.begin() + models[i].mFirstInstance, instanceModels.begin() + models[i].mEndInstance, i);
+    }
+
+    mPipelineRegionBases.assign(numPipelines, 0);
+    mPipelineTemplateCounts.assign(numPipelines, 0);
+    for (uint32_t i = 0; i < numTemplates; ++i)
+    {
+        assert(infos[i].mPipeline < numPipelines && infos[i].mModel < numModels);
+        mPipelineRegionBases[infos[i].mPipeline] = infos[i].mRegionBase;
+        mPipelineTemplateCounts[infos[i].mPipeline]++;
+    }
+
+    // Read-only inputs stay in upload memory
+    mInstanceModels = CreateUploadBuffer(device, instanceModels.data(), instanceModels.size() * sizeof(uint32_t), Vnm::MemoryCategory::Constants);
+    mModels = CreateUploadBuffer(device, models, numModels * sizeof(Vnm::IndirectModelRange), Vnm::MemoryCategory::Constants);
+    mTemplates = CreateUploadBuffer(device, templates, numTemplates * sizeof(Vnm::IndirectDrawCommand), Vnm::MemoryCategory::Constants);
+    mInfos = CreateUploadBuffer(device, infos, numTemplates * sizeof(Vnm::IndirectCommandInfo), Vnm::MemoryCategory::Constants);
+    mCountsReset = CreateUploadBuffer(device, nullptr, (numModels > numPipelines ? numModels : numPipelines) * sizeof(uint32_t), Vnm::MemoryCategory::Upload);
+
+    mModelCounts = CreateBuffer(device, D3D12_HEAP_TYPE_DEFAULT, numModels * sizeof(uint32_t), D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COMMON, Vnm::MemoryCategory::GpuBuffers);
+    mInstanceIndices = CreateBuffer(device, D3D12_HEAP_TYPE_DEFAULT, mNumInstances * sizeof(uint32_t), D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COMMON, Vnm::MemoryCategory::GpuBuffers);
+    mPipelineCounts = CreateBuffer(device, D3D12_HEAP_TYPE_DEFAULT, numPipelines * sizeof(uint32_t), D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COMMON, Vnm::MemoryCategory::GpuBuffers);
+    mCommands = CreateBuffer(device, D3D12_HEAP_TYPE_DEFAULT, numTemplates * sizeof(Vnm::IndirectDrawCommand), D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COMMON, Vnm::MemoryCategory::GpuBuffers);
+}
+
+void D3dIndirectRenderer::RecordCompaction(ID3D12GraphicsCommandList* commandList, const D3dHiZCuller& culler)
+{
+    assert(culler.HasResults() && "The visible list must be recorded before compaction");
+
+    CD3DX12_RESOURCE_BARRIER beginBarriers[] =
+    {
+        CD3DX12_RESOURCE_BARRIER::Transition(culler.GetVisibleInstances(), D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE),
+        CD3DX12_RESOURCE_BARRIER::Transition(culler.GetVisibleCount(), D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE),
+        CD3DX12_RESOURCE_BARRIER::Transition(mModelCounts.Get(), D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_COPY_DEST),
+        CD3DX12_RESOURCE_BARRIER::Transition(mPipelineCounts.Get(), D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_COPY_DEST),
+        CD3DX12_RESOURCE_BARRIER::Transition(mInstanceIndices.Get(), D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_UNORDERED_ACCESS),
+        CD3DX12_RESOURCE_BARRIER::Transition(mCommands.Get(), D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_UNORDERED_ACCESS)
+    };
+    commandList->ResourceBarrier(_countof(beginBarriers), beginBarriers);
+    commandList->CopyBufferRegion(mModelCounts.Get(), 0, mCountsReset.Get(), 0, mNumModels * sizeof(uint32_t));
+    commandList->CopyBufferRegion(mPipelineCounts.Get(), 0, mCountsReset.Get(), 0, mNumPipelines * sizeof(uint32_t));
+
+    CD3DX12_RESOURCE_BARRIER countsToUav[] =
+    {
+        CD3DX12_RESOURCE_BARRIER::Transition(mModelCounts.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_UNORDERED_ACCESS),
+        CD3DX12_RESOURCE_BARRIER::Transition(mPipelineCounts.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_UNORDERED_ACCESS)
+    };
+    commandList->ResourceBarrier(_countof(countsToUav), countsToUav);
+
+    const uint32_t constants[2] = { mNumInstances, mNumTemplates };
+    commandList->SetComputeRootSignature(mRootSignature.Get());
+    commandList->SetComputeRoot32BitConstants(indirectCompactConstants, _countof(constants), constants, 0);
+    commandList->SetComputeRootShaderResourceView(indirectVisibleInstances, culler.GetVisibleInstances()->GetGPUVirtualAddress());
+    commandList->SetComputeRootShaderResourceView(indirectVisibleCount, culler.GetVisibleCount()->GetGPUVirtualAddress());
+    commandList->SetComputeRootShaderResourceView(indirectInstanceModels, mInstanceModels->GetGPUVirtualAddress());
+    commandList->SetComputeRootShaderResourceView(indirectModels, mModels->GetGPUVirtualAddress());
+    commandList->SetComputeRootShaderResourceView(indirectTemplates, mTemplates->GetGPUVirtualAddress());
+    commandList->SetComputeRootShaderResourceView(indirectInfos, mInfos->GetGPUVirtualAddress());
+    commandList->SetComputeRootUnorderedAccessView(indirectModelCounts, mModelCounts->GetGPUVirtualAddress());
+    commandList->SetComputeRootUnorderedAccessView(indirectInstanceIndices, mInstanceIndices->GetGPUVirtualAddress());
+    commandList->SetComputeRootUnorderedAccessView(indirectPipelineCounts, mPipelineCounts->GetGPUVirtualAddress());
+    commandList->SetComputeRootUnorderedAccessView(indirectCommands, mCommands->GetGPUVirtualAddress());
+
+    // The visible count is only known on the GPU, dispatch for every instance
+    commandList->SetPipelineState(mBinPipeline.Get());
+    commandList->Dispatch((mNumInstances + 63) / 64, 1, 1);
+
+    // Compaction reads the final model counts
+    CD3DX12_RESOURCE_BARRIER binned = CD3DX12_RESOURCE_BARRIER::UAV(mModelCounts.Get());
+    commandList->ResourceBarrier(1, &binned);
+
+    commandList->SetPipelineState(mCompactPipeline.Get());
+    commandList->Dispatch((mNumTemplates + 63) / 64, 1, 1);
+
+    CD3DX12_RESOURCE_BARRIER endBarriers[] =
+    {
+        CD3DX12_RESOURCE_BARRIER::Transition(culler.GetVisibleInstances(), D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_COMMON),
+        CD3DX12_RESOURCE_BARRIER::Transition(culler.GetVisibleCount(), D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_COMMON),
+        CD3DX12_RESOURCE_BARRIER::Transition(mModelCounts.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COMMON),
+        CD3DX12_RESOURCE_BARRIER::Transition(mPipelineCounts.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT),
+        CD3DX12_RESOURCE_BARRIER::Transition(mInstanceIndices.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE),
+        CD3DX12_RESOURCE_BARRIER::Transition(mCommands.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT)
+    };
+    commandList->ResourceBarrier(_countof(endBarriers), endBarriers);
+}
+
+void D3dIndirectRenderer::RecordDraws(ID3D12GraphicsCommandList* commandList, uint32_t pipeline)
+{
+    assert(pipeline < mNumPipelines);
+    if (mPipelineTemplateCounts[pipeline] == 0)
+    {
+        return;
+    }
+
+    commandList->ExecuteIndirect(
+        mCommandSignature.Get(),
+        mPipelineTemplateCounts[pipeline],
+        mCommands.Get(),
+        mPipelineRegionBases[pipeline] * sizeof(Vnm::IndirectDrawCommand),
+        mPipelineCounts.Get(),
+        pipeline * sizeof(uint32_t));
+}
+
+void D3dIndirectRenderer::EndFrame(ID3D12GraphicsCommandList* commandList)
+{
+    CD3DX12_RESOURCE_BARRIER barriers[] =
+    {
+        CD3DX12_RESOURCE_BARRIER::Transition(mPipelineCounts.Get(), D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT, D3D12_RESOURCE_STATE_COMMON),
+        CD3DX12_RESOURCE_BARRIER::Transition(mInstanceIndices.Get(), D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_COMMON),
+        CD3DX12_RESOURCE_BARRIER::Transition(mCommands.Get(), D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT, D3D12_RESOURCE_STATE_COMMON)
+    };
+    commandList->ResourceBarrier(_countof(barriers), barriers);
+}
@@ -0,0 +1,63 @@
+// D3d12Indirect.h
+
+#pragma once
+
+#include <d3d12.h>
+#include <wrl.h>
+#include <stdint.h>
+#include <vector>
+#include "IndirectArgs.h"
+
+class D3dHiZCuller;
+class D3dShaderCache;
+
+// GPU-driven drawing with ExecuteIndirect. Each frame the visible instance list written by the
+// Hi-Z pass is compacted into per-model instance index regions and per-pipeline command regions,
+// then every pipeline is drawn with a single ExecuteIndirect whose count comes from the GPU.
+class D3dIndirectRenderer
+{
+public:
+    // Templates are grouped by pipeline as described by Vnm::IndirectCommandInfo. constantsRootParameter
+    // is the graphics root parameter receiving the two root constants of each command.
+    void Init(ID3D12Device* device, ID3D12RootSignature* graphicsRootSignature, uint32_t constantsRootParameter,
+              const Vnm::IndirectDrawCommand* templates, const Vnm::IndirectCommandInfo* infos, uint32_t numTemplates,
+              const Vnm::IndirectModelRange* models, uint32_t numModels, uint32_t numPipelines, D3dShaderCache& shaderCache);
+
+    // Records the compaction of the culler's visible list, which must have been recorded earlier in
+    // the command list. Leaves the command list's compute state changed.
+    void RecordCompaction(ID3D12GraphicsCommandList* commandList, const D3dHiZCuller& culler);
+
+    // Draws the compacted commands of one pipeline, the pipeline state, root signature and the
+    // instance index SRV must already be set
+    void RecordDraws(ID3D12GraphicsCommandList* commandList, uint32_t pipeline);
+
+    // Returns the buffers to COMMON after the last RecordDraws of the frame
+    void EndFrame(ID3D12GraphicsCommandList* commandList);
+
+    ID3D12Resource* GetInstanceIndices() const { return mInstanceIndices.Get(); }
+    uint32_t        GetTemplateCount(uint32_t pipeline) const { return mPipelineTemplateCounts[pipeline]; }
+
+private:
+    Microsoft::WRL::ComPtr<ID3D12CommandSignature> mCommandSignature;
+    Microsoft::WRL::ComPtr<ID3D12RootSignature>    mRootSignature;
+    Microsoft::WRL::ComPtr<ID3D12PipelineState>    mBinPipeline;
+    Microsoft::WRL::ComPtr<ID3D12PipelineState>    mCompactPipeline;
+
+    uint32_t                                       mNumInstances = 0;
+    uint32_t                                       mNumTemplates = 0;
+    uint32_t                                       mNumModels = 0;
+    uint32_t                                       mNumPipelines = 0;
+    std::vector<uint32_t>                          mPipelineRegionBases;
+    std::vector<uint32_t>                          mPipelineTemplateCounts;
+
+    Microsoft::WRL::ComPtr<ID3D12Resource>         mInstanceModels;
+    Microsoft::WRL::ComPtr<ID3D12Resource>         mModels;
+    Microsoft::WRL::ComPtr<ID3D12Resource>         mTemplates;
+    Microsoft::WRL::ComPtr<ID3D12Resource>         mInfos;
+    Microsoft::WRL::ComPtr<ID3D12Resource>         mCountsReset;
+
+    Microsoft::WRL::ComPtr<ID3D12Resource>         mModelCounts;
+    Microsoft::WRL::ComPtr<ID3D12Resource>         mInstanceIndices;
+    Microsoft::WRL::ComPtr<ID3D12Resource>         mPipelineCounts;
+    Microsoft::WRL::ComPtr<ID3D12Resource>         mCommands;
+};
@@ -0,0 +1,96 @@
+// D3d12Memory.cpp
+
+#include "D3d12Memory.h"
+#include "D3d12Context.h"
+#include <stdio.h>
+
+using Microsoft::WRL::ComPtr;
+
+// {6E3A0F55-93C2-4D1B-8A3E-1F4C7B2D9A60}
+static const GUID kMemoryTagGuid = { 0x6e3a0f55, 0x93c2, 0x4d1b, { 0x8a, 0x3e, 0x1f, 0x4c, 0x7b, 0x2d, 0x9a, 0x60 } };
+
+// Attached to a resource as private data, which the resource releases when it is destroyed
+class D3dMemoryTag : public IUnknown
+{
+public:
+    D3dMemoryTag(Vnm::MemoryCategory category, uint64_t bytes) : mAllocation(category, bytes) {}
+
+    HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** object) override
+    {
+        if (object == nullptr)
+        {
+            return E_POINTER;
+        }
+        if (riid == __uuidof(IUnknown))
+        {
+            *object = static_cast<IUnknown*>(this);
+            AddRef();
+            return S_OK;
+        }
+        *object = nullptr;
+        return E_NOINTERFACE;
+    }
+
+    ULONG STDMETHODCALLTYPE AddRef() override
+    {
+        return InterlockedIncrement(&mRefCount);
+    }
+
+    ULONG STDMETHODCALLTYPE Release() override
+    {
+        ULONG refCount = InterlockedDecrement(&mRefCount);
+        if (refCount == 0)
+        {
+            delete this;
+        }
+        return refCount;
+    }
+
+private:
+    Vnm::TrackedAllocation mAllocation;
+    ULONG                  mRefCount = 1;
+};
+
+void TrackResource(ID3D12Device* device, ID3D12Resource* resource, Vnm::MemoryCategory category)
+{
+    D3D12_RESOURCE_DESC desc = resource->GetDesc();
+    D3D12_RESOURCE_ALLOCATION_INFO info = device->GetResourceAllocationInfo(0, 1, &desc);
+
+    // The resource holds the only reference, tracking a resource twice moves it to the new category
+    ComPtr<D3dMemoryTag> tag;
+    tag.Attach(new D3dMemoryTag(category, info.SizeInBytes));
+    D3D_CHECK(resource->SetPrivateDataInterface(kMemoryTagGuid, tag.Get()));
+}
+
+std::string FormatVideoMemoryInfo(ID3D12Device* device)
+{
+    ComPtr<IDXGIFactory4> factory;
+    ComPtr<IDXGIAdapter3> adapter;
+    if (FAILED(CreateDXGIFactory1(IID_PPV_ARGS(&factory))) ||
+        FAILED(factory->EnumAdapterByLuid(device->GetAdapterLuid(), IID_PPV_ARGS(&adapter))))
+    {
+        return "Video memory info unavailable\n";
+    }
+
+    const DXGI_MEMORY_SEGMENT_GROUP groups[] = { DXGI_MEMORY_SEGMENT_GROUP_LOCAL, DXGI_MEMORY_SEGMENT_GROUP_NON_LOCAL };
+    const char* groupNames[] = { "Local", "Non-local" };
+    const double kMiB = 1.0 / (1024.0 * 1024.0);
+
+    std::string report;
+    for (size_t i = 0; i < _countof(groups); ++i)
+    {
+        DXGI_QUERY_VIDEO_MEMORY_INFO info = {};
+        if (FAILED(adapter->QueryVideoMemoryInfo(0, groups[i], &info)))
+        {
+            continue;
+        }
+
+        char line[160];
+        snprintf(line, sizeof(line), "%s video memory: %.2f MiB used of %.2f MiB budget%s\n", groupNames[i],
+            static_cast<double>(info.CurrentUsage) * kMiB,
+            static_cast<double>(info.Budget) * kMiB,
+            info.CurrentUsage > info.Budget ? ", over budget" : "");
+        report += line;
+    }
+    return report;
+}
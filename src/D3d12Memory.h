@@ -0,0 +1,14 @@
+// D3d12Memory.h
+
+#pragma once
+
+#include "MemoryTracker.h"
+#include <d3d12.h>
+#include <string>
+
+// Tracks the allocation size of a committed resource in the category until the resource is
+// destroyed, however many references are held to it
+void TrackResource(ID3D12Device* device, ID3D12Resource* resource, Vnm::MemoryCategory category);
+
+// Usage and budget the OS reports for the device's adapter, in local and system memory
+std::string FormatVideoMemoryInfo(ID3D12Device* device);
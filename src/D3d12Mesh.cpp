@@ -2,10 +2,18 @@
 
 #include "D3d12Mesh.h"
 #include "D3d12Context.h"
+#include "D3d12Memory.h"
+#include "FrameTimer.h"
+#include "ImageDecoder.h"
+#include "Profiler.h"
+#include <algorithm>
 #include <cassert>
+#include <cfloat>
+#include <thread>
 
 void InitMeshesFromGltf(const GltfModel& gltfInstancedModel, D3dContext& context, D3dMesh* destMeshes, size_t maxDestMeshCount)
 {
+    PROFILE_ZONE("InitMeshesFromGltf");
     size_t numMeshes = gltfInstancedModel.meshes.size();
     assert(numMeshes <= maxDestMeshCount);
 
@@ -24,6 +32,7 @@ void InitMeshesFromGltf(const GltfModel& gltfInstancedModel, D3dContext& context
             D3D12_RESOURCE_STATE_GENERIC_READ,
             nullptr,
             IID_PPV_ARGS(&destMeshes[iMesh].mVertexBuffer)));
+        TrackResource(context.mDevice.Get(), destMeshes[iMesh].mVertexBuffer.Get(), Vnm::MemoryCategory::Geometry);
 
         // Copy triangle data to vertex buffer
         UINT8* pVertexData;
@@ -50,6 +59,7 @@ void InitMeshesFromGltf(const GltfModel& gltfInstancedModel, D3dContext& context
             D3D12_RESOURCE_STATE_GENERIC_READ,
             nullptr,
             IID_PPV_ARGS(&destMeshes[iMesh].mIndexBuffer)));
+        TrackResource(context.mDevice.Get(), destMeshes[iMesh].mIndexBuffer.Get(), Vnm::MemoryCategory::Geometry);
 
         // Copy data into index buffer
         UINT8* pIndexData;
@@ -62,6 +72,19 @@ void InitMeshesFromGltf(const GltfModel& gltfInstancedModel, D3dContext& context
         destMeshes[iMesh].mIndexBufferView.BufferLocation = destMeshes[iMesh].mIndexBuffer->GetGPUVirtualAddress();
         destMeshes[iMesh].mIndexBufferView.SizeInBytes = static_cast<UINT>(indexBufferSize);
         destMeshes[iMesh].mNumIndices = gltfInstancedModel.meshes[iMesh].numIndices;
+        destMeshes[iMesh].mMaterialIndex = gltfInstancedModel.meshes[iMesh].materialIndex;
+
+        // Bounding sphere around the AABB
+        const float* boundsMin = gltfInstancedModel.meshes[iMesh].boundsMin;
+        const float* boundsMax = gltfInstancedModel.meshes[iMesh].boundsMax;
+        float radiusSq = 0.0f;
+        for (int i = 0; i < 3; ++i)
+        {
+            float halfExtent = 0.5f * (boundsMax[i] - boundsMin[i]);
+            destMeshes[iMesh].mBoundsCenter[i] = boundsMin[i] + halfExtent;
+            radiusSq += halfExtent * halfExtent;
+        }
+        destMeshes[iMesh].mBoundsRadius = sqrtf(radiusSq);
 
         size_t indexSize = gltfInstancedModel.meshes[iMesh].indicesSize / gltfInstancedModel.meshes[iMesh].numIndices;
         switch (indexSize)
@@ -111,16 +134,115 @@ static void InterleaveArrays(size_t numArrays, uint8_t** srcArrays, size_t* attr
     }
 }
 
+// Image loader of tinygltf that leaves decoding to LoadGltf. Images in a buffer view are found again
+// once the model is parsed, the bytes of other images only live until this returns.
+static bool RecordGltfImage(tinygltf::Image* image, const int imageIndex, std::string*, std::string*, int, int, const unsigned char* bytes, int size, void* userData)
+{
+    auto* images = static_cast<std::vector<Vnm::EncodedImage>*>(userData);
+    if (images->size() <= static_cast<size_t>(imageIndex))
+    {
+        images->resize(imageIndex + 1);
+    }
+    if (image->bufferView < 0)
+    {
+        (*images)[imageIndex].mOwnedData.assign(bytes, bytes + size);
+    }
+    return true;
+}
+
+// Bytes of a glTF buffer that the mesh loop of LoadGltf overwrites when it interleaves vertices
+class GltfBufferRange
+{
+public:
+    int    mBuffer;
+    size_t mBegin;
+    size_t mEnd;
+};
+
+static void CollectVertexWriteRanges(const tinygltf::Model& model, std::vector<GltfBufferRange>* ranges)
+{
+    // Position, normal, tangent and texcoord, interleaved from the position data onward
+    const size_t vertexSize = sizeof(float) * (3 + 3 + 3 + 2);
+    for (const auto& mesh : model.meshes)
+    {
+        for (const auto& primitive : mesh.primitives)
+        {
+            auto position = primitive.attributes.find("POSITION");
+            if (position == primitive.attributes.end())
+            {
+                continue;
+            }
+            const tinygltf::Accessor& accessor = model.accessors[position->second];
+            const tinygltf::BufferView& bufferView = model.bufferViews[accessor.bufferView];
+            const size_t begin = bufferView.byteOffset + accessor.byteOffset;
+            ranges->push_back({ bufferView.buffer, begin, begin + accessor.count * vertexSize });
+        }
+    }
+}
+
+static bool OverlapsRanges(const std::vector<GltfBufferRange>& ranges, int buffer, size_t begin, size_t end)
+{
+    for (const GltfBufferRange& range : ranges)
+    {
+        if (range.mBuffer == buffer && range.mBegin < end && begin < range.mEnd)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
 // Interleaves vertex data in place, destructively
-void LoadGltf(const char* filename, GltfModel* dstModel)
+void LoadGltf(const char* filename, GltfModel* dstModel, Vnm::ThreadPool* pool)
 {
+    PROFILE_ZONE("LoadGltf");
     tinygltf::Model& model = dstModel->model;
     tinygltf::TinyGLTF loader;
     std::string error;
     std::string warning;
 
+    std::vector<Vnm::EncodedImage> encodedImages;
+    loader.SetImageLoader(RecordGltfImage, &encodedImages);
+
+    uint64_t start = Vnm::GetClockTicks();
     loader.LoadBinaryFromFile(&model, &error, &warning, filename);
+    const double parseMs = Vnm::TicksToSeconds(Vnm::GetClockTicks() - start) * 1000.0;
+
+    // Images are decoded while vertices are interleaved in place, so an image whose bytes the
+    // interleaving overwrites is decoded from a copy
+    std::vector<GltfBufferRange> vertexWriteRanges;
+    CollectVertexWriteRanges(model, &vertexWriteRanges);
+
+    encodedImages.resize(model.images.size());
+    for (size_t i = 0; i < model.images.size(); ++i)
+    {
+        Vnm::EncodedImage& encoded = encodedImages[i];
+        int bufferViewIndex = model.images[i].bufferView;
+        if (bufferViewIndex >= 0 && bufferViewIndex < static_cast<int>(model.bufferViews.size()))
+        {
+            const tinygltf::BufferView& bufferView = model.bufferViews[bufferViewIndex];
+            encoded.mpData = model.buffers[bufferView.buffer].data.data() + bufferView.byteOffset;
+            encoded.mSize = bufferView.byteLength;
+            if (OverlapsRanges(vertexWriteRanges, bufferView.buffer, bufferView.byteOffset, bufferView.byteOffset + bufferView.byteLength))
+            {
+                encoded.Copy(encoded.mpData, encoded.mSize);
+            }
+        }
+        else
+        {
+            encoded.mpData = encoded.mOwnedData.data();
+            encoded.mSize = encoded.mOwnedData.size();
+        }
+    }
 
+    std::vector<Vnm::DecodedImage> decodedImages(encodedImages.size());
+    Vnm::ImageDecodeStats decodeStats;
+    std::thread decodeThread([&]()
+    {
+        Vnm::DecodeImages(encodedImages.data(), encodedImages.size(), pool, decodedImages.data(), &decodeStats);
+    });
+
+    start = Vnm::GetClockTicks();
     size_t numMeshes = model.meshes.size();
     for (size_t i = 0; i < numMeshes; ++i)
     {
@@ -179,6 +301,19 @@ void LoadGltf(const char* filename, GltfModel* dstModel)
             auto& texcoordBufferView = model.bufferViews[texcoordAccessor.bufferView];
             uint8_t* gltfTexcoords = model.buffers[texcoordBufferView.buffer].data.data() + vertexTexcoordOffset + texcoordBufferView.byteOffset;
 
+            // Bounds have to be calculated before positions are interleaved in place
+            float boundsMin[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+            float boundsMax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+            const float* positions = reinterpret_cast<const float*>(gltfVertices);
+            for (size_t iVertex = 0; iVertex < posAccessor.count; ++iVertex)
+            {
+                for (int i = 0; i < 3; ++i)
+                {
+                    boundsMin[i] = (std::min)(boundsMin[i], positions[iVertex * 3 + i]);
+                    boundsMax[i] = (std::max)(boundsMax[i], positions[iVertex * 3 + i]);
+                }
+            }
+
             uint8_t* streams[] = { gltfVertices, gltfNormals, gltfTangents, gltfTexcoords };
             const size_t attribByteSize = sizeof(float) * 3;
             const size_t texcoordAttribByteSize = sizeof(float) * 2;
@@ -209,6 +344,139 @@ void LoadGltf(const char* filename, GltfModel* dstModel)
             curMesh.numIndices = gltfIndicesCount;
             curMesh.indicesSize = gltfIndicesSize;
             curMesh.indices = gltfIndices;
+            curMesh.gltfMaterial = primitive.material;
+            memcpy(curMesh.boundsMin, boundsMin, sizeof(boundsMin));
+            memcpy(curMesh.boundsMax, boundsMax, sizeof(boundsMax));
+        }
+    }
+    const double meshMs = Vnm::TicksToSeconds(Vnm::GetClockTicks() - start) * 1000.0;
+    decodeThread.join();
+
+    for (size_t i = 0; i < model.images.size(); ++i)
+    {
+        tinygltf::Image& image = model.images[i];
+        Vnm::DecodedImage& decoded = decodedImages[i];
+        if (!decoded.mPixels.empty())
+        {
+            image.image = std::move(decoded.mPixels);
+            image.width = static_cast<int>(decoded.mWidth);
+            image.height = static_cast<int>(decoded.mHeight);
+            image.component = 4;
+            image.bits = 8;
+            image.pixel_type = TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
+        }
+    }
+
+    char message[256];
+    snprintf(message, sizeof(message), "%s: parse %.2f ms, meshes %.2f ms, %zu images (%zu failed) %.2f MiB to %.2f MiB in %.2f ms\n",
+        filename, parseMs, meshMs, decodeStats.mImages, decodeStats.mFailed, decodeStats.mEncodedBytes / (1024.0 * 1024.0),
+        decodeStats.mDecodedBytes / (1024.0 * 1024.0), decodeStats.mMs);
+    OutputDebugStringA(message);
+
+    uint64_t modelBytes = Vnm::GetVectorBytes(dstModel->meshes);
+    for (const auto& buffer : model.buffers)
+    {
+        modelBytes += Vnm::GetVectorBytes(buffer.data);
+    }
+    for (const auto& image : model.images)
+    {
+        modelBytes += Vnm::GetVectorBytes(image.image);
+    }
+    dstModel->memory.Reset(Vnm::MemoryCategory::AssetData, modelBytes);
+}
+
+// Returns the library texture for a glTF texture index, or Vnm::InvalidIndex if it cannot be used
+static uint32_t AddGltfTexture(const tinygltf::Model& model, int textureIndex, Vnm::MaterialLibrary& library)
+{
+    if (textureIndex < 0 || textureIndex >= static_cast<int>(model.textures.size()))
+    {
+        return Vnm::InvalidIndex;
+    }
+
+    int imageIndex = model.textures[textureIndex].source;
+    if (imageIndex < 0 || imageIndex >= static_cast<int>(model.images.size()))
+    {
+        return Vnm::InvalidIndex;
+    }
+
+    // Embedded images are decoded to RGBA8 by LoadGltf
+    const tinygltf::Image& image = model.images[imageIndex];
+    if (!image.image.empty() && image.component == 4 && image.bits == 8)
+    {
+        return library.AddTexturePixels(image.image.data(), static_cast<uint32_t>(image.width), static_cast<uint32_t>(image.height));
+    }
+
+    // External images are expected to have been converted to DDS alongside the original
+    if (!image.uri.empty())
+    {
+        std::string filename = image.uri;
+        size_t separator = filename.find_last_of("/\\");
+        if (separator != std::string::npos)
+        {
+            filename = filename.substr(separator + 1);
+        }
+
+        size_t extension = filename.find_last_of('.');
+        if (extension != std::string::npos)
+        {
+            filename.resize(extension);
+        }
+
+        return library.AddTextureFile(filename + ".dds");
+    }
+
+    return Vnm::InvalidIndex;
+}
+
+void ResolveGltfMaterials(GltfModel* model, Vnm::MaterialLibrary& library, const GltfFallbackMaterial* fallbacks, size_t numFallbacks)
+{
+    const tinygltf::Model& gltf = model->model;
+
+    for (size_t iMesh = 0; iMesh < model->meshes.size(); ++iMesh)
+    {
+        GltfMesh& mesh = model->meshes[iMesh];
+
+        Vnm::Material material;
+        if (mesh.gltfMaterial >= 0 && mesh.gltfMaterial < static_cast<int>(gltf.materials.size()))
+        {
+            const tinygltf::Material& gltfMaterial = gltf.materials[mesh.gltfMaterial];
+            material.mBaseColorTexture = AddGltfTexture(gltf, gltfMaterial.pbrMetallicRoughness.baseColorTexture.index, library);
+            material.mAlphaTested = gltfMaterial.alphaMode == "MASK";
+        }
+
+        // Meshes past the end of the fallback list reuse its last entry
+        if (material.mBaseColorTexture == Vnm::InvalidIndex && numFallbacks > 0)
+        {
+            const GltfFallbackMaterial& fallback = fallbacks[iMesh < numFallbacks ? iMesh : numFallbacks - 1];
+            material.mBaseColorTexture = library.AddTextureFile(fallback.mTextureFilename);
+            material.mAlphaTested = fallback.mAlphaTested;
+        }
+
+        mesh.materialIndex = library.AddMaterial(material);
+    }
+}
+
+void BuildOccluderMesh(const GltfMesh& mesh, Vnm::OccluderMesh* dstOccluder)
+{
+    // Position is the first attribute of the interleaved vertex
+    dstOccluder->mPositions.resize(mesh.numVertices * 3);
+    for (size_t i = 0; i < mesh.numVertices; ++i)
+    {
+        memcpy(&dstOccluder->mPositions[i * 3], mesh.vertices + i * mesh.vertexStride, 3 * sizeof(float));
+    }
+
+    dstOccluder->mIndices.resize(mesh.numIndices);
+    size_t indexSize = mesh.indicesSize / mesh.numIndices;
+    for (size_t i = 0; i < mesh.numIndices; ++i)
+    {
+        if (indexSize == 2)
+        {
+            dstOccluder->mIndices[i] = reinterpret_cast<const uint16_t*>(mesh.indices)[i];
+        }
+        else
+        {
+            assert(indexSize == 4);
+            dstOccluder->mIndices[i] = reinterpret_cast<const uint32_t*>(mesh.indices)[i];
         }
     }
 }
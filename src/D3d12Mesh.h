@@ -5,6 +5,10 @@
 #include <d3d12.h>
 #include <wrl.h>
 #include "tiny_gltf.h"
+#include "Material.h"
+#include "MemoryTracker.h"
+#include "SoftwareOcclusion.h"
+#include "ThreadPool.h"
 
 class D3dMesh
 {
@@ -15,6 +19,9 @@ public:
     Microsoft::WRL::ComPtr<ID3D12Resource>            mIndexBuffer;
     D3D12_INDEX_BUFFER_VIEW                           mIndexBufferView;
     size_t                                            mNumIndices = 0;
+    uint32_t                                          mMaterialIndex = Vnm::InvalidIndex;
+    float                                             mBoundsCenter[3] = {};
+    float                                             mBoundsRadius = 0.0f;
 };
 
 class GltfMesh
@@ -27,15 +34,32 @@ public:
     size_t numIndices;
     size_t indicesSize;
     const uint8_t* indices;
+    float boundsMin[3];
+    float boundsMax[3];
+    int gltfMaterial = -1;
+    uint32_t materialIndex = Vnm::InvalidIndex;
+};
+
+// Used for meshes whose glTF material has no baseColor texture
+class GltfFallbackMaterial
+{
+public:
+    const char* mTextureFilename;
+    bool        mAlphaTested;
 };
 
 class GltfModel
 {
 public:
-    tinygltf::Model       model;
-    std::vector<GltfMesh> meshes;
+    tinygltf::Model        model;
+    std::vector<GltfMesh>  meshes;
+    Vnm::TrackedAllocation memory;      // Buffers and decoded images of the model
 };
 
 class D3dContext;
 void InitMeshesFromGltf(const GltfModel& gltfInstancedModel, D3dContext& context, D3dMesh* destMeshes, size_t maxDestMeshCount);
-void LoadGltf(const char* filename, GltfModel* dstModel);
+// Images are decoded to RGBA8 on pool while the meshes are processed, and stay empty if stb_image
+// cannot read them
+void LoadGltf(const char* filename, GltfModel* dstModel, Vnm::ThreadPool* pool);
+void ResolveGltfMaterials(GltfModel* model, Vnm::MaterialLibrary& library, const GltfFallbackMaterial* fallbacks, size_t numFallbacks);
+void BuildOccluderMesh(const GltfMesh& mesh, Vnm::OccluderMesh* dstOccluder);
@@ -0,0 +1,325 @@
+// D3d12ShaderCache.cpp
+
+#include "D3d12ShaderCache.h"
+#include "D3d12Context.h"
+#include "FrameTimer.h"
+#include "MappedFile.h"
+#include "Material.h"
+#include <cstring>
+#include <fstream>
+#include <stdio.h>
+#include <type_traits>
+
+using Microsoft::WRL::ComPtr;
+
+static const char* const kShaderCacheFile = "shaders.cache";
+static const char* const kPipelineCacheFile = "pipelines.cache";
+
+static double GetElapsedMs(uint64_t start)
+{
+    return Vnm::TicksToSeconds(Vnm::GetClockTicks() - start) * 1000.0;
+}
+
+static uint64_t HashBytecode(const D3D12_SHADER_BYTECODE& bytecode, uint64_t hash)
+{
+    return Vnm::HashBytes(bytecode.pShaderBytecode, bytecode.BytecodeLength, hash);
+}
+
+static std::wstring GetLibraryName(const char* name, uint64_t hash)
+{
+    char hex[20];
+    snprintf(hex, sizeof(hex), "_%016llx", static_cast<unsigned long long>(hash));
+    std::string narrow = std::string(name) + hex;
+    return std::wstring(narrow.begin(), narrow.end());
+}
+
+// Only scalars are hashed as raw bytes, structs can hold padding with no defined value
+template <typename T>
+static uint64_t HashValue(const T& value, uint64_t hash)
+{
+    static_assert(std::is_arithmetic<T>::value || std::is_enum<T>::value, "Hash struct members one by one");
+    return Vnm::HashBytes(&value, sizeof(value), hash);
+}
+
+static uint64_t HashString(const char* string, uint64_t hash)
+{
+    return string ? Vnm::HashBytes(string, strlen(string) + 1, hash) : HashValue(0, hash);
+}
+
+static uint64_t HashBlendState(const D3D12_BLEND_DESC& desc, uint64_t hash)
+{
+    hash = HashValue(desc.AlphaToCoverageEnable, hash);
+    hash = HashValue(desc.IndependentBlendEnable, hash);
+    for (const D3D12_RENDER_TARGET_BLEND_DESC& target : desc.RenderTarget)
+    {
+        hash = HashValue(target.BlendEnable, hash);
+        hash = HashValue(target.LogicOpEnable, hash);
+        hash = HashValue(target.SrcBlend, hash);
+        hash = HashValue(target.DestBlend, hash);
+        hash = HashValue(target.BlendOp, hash);
+        hash = HashValue(target.SrcBlendAlpha, hash);
+        hash = HashValue(target.DestBlendAlpha, hash);
+        hash = HashValue(target.BlendOpAlpha, hash);
+        hash = HashValue(target.LogicOp, hash);
+        hash = HashValue(target.RenderTargetWriteMask, hash);
+    }
+    return hash;
+}
+
+static uint64_t HashRasterizerState(const D3D12_RASTERIZER_DESC& desc, uint64_t hash)
+{
+    hash = HashValue(desc.FillMode, hash);
+    hash = HashValue(desc.CullMode, hash);
+    hash = HashValue(desc.FrontCounterClockwise, hash);
+    hash = HashValue(desc.DepthBias, hash);
+    hash = HashValue(desc.DepthBiasClamp, hash);
+    hash = HashValue(desc.SlopeScaledDepthBias, hash);
+    hash = HashValue(desc.DepthClipEnable, hash);
+    hash = HashValue(desc.MultisampleEnable, hash);
+    hash = HashValue(desc.AntialiasedLineEnable, hash);
+    hash = HashValue(desc.ForcedSampleCount, hash);
+    return HashValue(desc.ConservativeRaster, hash);
+}
+
+static uint64_t HashStencilOp(const D3D12_DEPTH_STENCILOP_DESC& desc, uint64_t hash)
+{
+    hash = HashValue(desc.StencilFailOp, hash);
+    hash = HashValue(desc.StencilDepthFailOp, hash);
+    hash = HashValue(desc.StencilPassOp, hash);
+    return HashValue(desc.StencilFunc, hash);
+}
+
+static uint64_t HashDepthStencilState(const D3D12_DEPTH_STENCIL_DESC& desc, uint64_t hash)
+{
+    hash = HashValue(desc.DepthEnable, hash);
+    hash = HashValue(desc.DepthWriteMask, hash);
+    hash = HashValue(desc.DepthFunc, hash);
+    hash = HashValue(desc.StencilEnable, hash);
+    hash = HashValue(desc.StencilReadMask, hash);
+    hash = HashValue(desc.StencilWriteMask, hash);
+    hash = HashStencilOp(desc.FrontFace, hash);
+    return HashStencilOp(desc.BackFace, hash);
+}
+
+static uint64_t HashInputLayout(const D3D12_INPUT_LAYOUT_DESC& desc, uint64_t hash)
+{
+    hash = HashValue(desc.NumElements, hash);
+    for (UINT i = 0; i < desc.NumElements; ++i)
+    {
+        const D3D12_INPUT_ELEMENT_DESC& element = desc.pInputElementDescs[i];
+        hash = HashString(element.SemanticName, hash);
+        hash = HashValue(element.SemanticIndex, hash);
+        hash = HashValue(element.Format, hash);
+        hash = HashValue(element.InputSlot, hash);
+        hash = HashValue(element.AlignedByteOffset, hash);
+        hash = HashValue(element.InputSlotClass, hash);
+        hash = HashValue(element.InstanceDataStepRate, hash);
+    }
+    return hash;
+}
+
+static uint64_t HashStreamOutput(const D3D12_STREAM_OUTPUT_DESC& desc, uint64_t hash)
+{
+    hash = HashValue(desc.NumEntries, hash);
+    for (UINT i = 0; i < desc.NumEntries; ++i)
+    {
+        const D3D12_SO_DECLARATION_ENTRY& entry = desc.pSODeclaration[i];
+        hash = HashValue(entry.Stream, hash);
+        hash = HashString(entry.SemanticName, hash);
+        hash = HashValue(entry.SemanticIndex, hash);
+        hash = HashValue(entry.StartComponent, hash);
+        hash = HashValue(entry.ComponentCount, hash);
+        hash = HashValue(entry.OutputSlot, hash);
+    }
+    hash = HashValue(desc.NumStrides, hash);
+    for (UINT i = 0; i < desc.NumStrides; ++i)
+    {
+        hash = HashValue(desc.pBufferStrides[i], hash);
+    }
+    return HashValue(desc.RasterizedStream, hash);
+}
+
+// The root signature and cached blob are left out, the rest is hashed member by member
+static std::wstring GetLibraryName(const char* name, const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc)
+{
+    uint64_t hash = Vnm::HashSeed;
+    for (const D3D12_SHADER_BYTECODE* bytecode : { &desc.VS, &desc.PS, &desc.DS, &desc.HS, &desc.GS })
+    {
+        hash = HashBytecode(*bytecode, hash);
+    }
+    hash = HashStreamOutput(desc.StreamOutput, hash);
+    hash = HashBlendState(desc.BlendState, hash);
+    hash = HashValue(desc.SampleMask, hash);
+    hash = HashRasterizerState(desc.RasterizerState, hash);
+    hash = HashDepthStencilState(desc.DepthStencilState, hash);
+    hash = HashInputLayout(desc.InputLayout, hash);
+    hash = HashValue(desc.IBStripCutValue, hash);
+    hash = HashValue(desc.PrimitiveTopologyType, hash);
+    hash = HashValue(desc.NumRenderTargets, hash);
+    for (DXGI_FORMAT format : desc.RTVFormats)
+    {
+        hash = HashValue(format, hash);
+    }
+    hash = HashValue(desc.DSVFormat, hash);
+    hash = HashValue(desc.SampleDesc.Count, hash);
+    hash = HashValue(desc.SampleDesc.Quality, hash);
+    hash = HashValue(desc.NodeMask, hash);
+    return GetLibraryName(name, HashValue(desc.Flags, hash));
+}
+
+static std::wstring GetLibraryName(const char* name, const D3D12_COMPUTE_PIPELINE_STATE_DESC& desc)
+{
+    uint64_t hash = HashBytecode(desc.CS, Vnm::HashSeed);
+    hash = HashValue(desc.NodeMask, hash);
+    return GetLibraryName(name, HashValue(desc.Flags, hash));
+}
+
+void D3dShaderCache::Init(ID3D12Device* device)
+{
+    mpDevice = device;
+    mShaders.Load(kShaderCacheFile);
+
+    if (SUCCEEDED(device->QueryInterface(IID_PPV_ARGS(&mDevice))))
+    {
+        Vnm::MappedFile file;
+        if (file.Open(kPipelineCacheFile))
+        {
+            mLibraryData.assign(file.GetData(), file.GetData() + file.GetSize());
+        }
+
+        // A library of another driver or adapter, or a damaged one, is rebuilt on Save
+        if (!mLibraryData.empty() && FAILED(mDevice->CreatePipelineLibrary(mLibraryData.data(), mLibraryData.size(), IID_PPV_ARGS(&mLibrary))))
+        {
+            mLibrary.Reset();
+            mLibraryData.clear();
+        }
+    }
+}
+
+void D3dShaderCache::Save()
+{
+    if (!mShaders.Save(kShaderCacheFile))
+    {
+        OutputDebugStringA("Failed to write the shader cache\n");
+    }
+    if (!mDevice || !mLibraryDirty)
+    {
+        return;
+    }
+
+    // Built again from the pipelines of this run only, so pipelines that changed do not pile up
+    ComPtr<ID3D12PipelineLibrary> library;
+    if (FAILED(mDevice->CreatePipelineLibrary(nullptr, 0, IID_PPV_ARGS(&library))))
+    {
+        return;
+    }
+    for (const auto& pipeline : mPipelines)
+    {
+        library->StorePipeline(pipeline.first.c_str(), pipeline.second.Get());
+    }
+
+    std::vector<uint8_t> data(library->GetSerializedSize());
+    if (SUCCEEDED(library->Serialize(data.data(), data.size())))
+    {
+        std::ofstream file(kPipelineCacheFile, std::ios::out | std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(data.data()), data.size());
+        mLibraryDirty = !file;
+    }
+}
+
+ComPtr<ID3DBlob> D3dShaderCache::Compile(const char* fileName, const D3D_SHADER_MACRO* defines, const char* entryPoint, const char* target, UINT flags)
+{
+    uint64_t start = Vnm::GetClockTicks();
+
+    std::vector<Vnm::ShaderDefine> shaderDefines;
+    for (const D3D_SHADER_MACRO* define = defines; define != nullptr && define->Name != nullptr; ++define)
+    {
+        shaderDefines.push_back({ define->Name, define->Definition });
+    }
+
+    // Sources that cannot be read are left to the compiler to report
+    uint64_t sourceHash = 0;
+    bool hashed = Vnm::CalcShaderSourceHash(fileName, &sourceHash);
+    uint64_t key = Vnm::CalcShaderKey(sourceHash, entryPoint, target, shaderDefines.data(), shaderDefines.size(), flags, D3D_COMPILER_VERSION);
+
+    ComPtr<ID3DBlob> bytecode;
+    const std::vector<uint8_t>* cached = hashed ? mShaders.Find(key) : nullptr;
+    if (cached != nullptr)
+    {
+        D3D_CHECK(D3DCreateBlob(cached->size(), &bytecode));
+        memcpy(bytecode->GetBufferPointer(), cached->data(), cached->size());
+        mStats.mShadersCached++;
+    }
+    else
+    {
+        std::wstring wideFileName(fileName, fileName + strlen(fileName));
+        ComPtr<ID3DBlob> errors;
+        HRESULT hr = D3DCompileFromFile(wideFileName.c_str(), defines, D3D_COMPILE_STANDARD_FILE_INCLUDE, entryPoint, target, flags, 0, &bytecode, &errors);
+        if (errors)
+        {
+            OutputDebugStringA(static_cast<const char*>(errors->GetBufferPointer()));
+        }
+        D3D_CHECK(hr);
+        if (hashed && bytecode)
+        {
+            mShaders.Add(key, bytecode->GetBufferPointer(), bytecode->GetBufferSize());
+        }
+        mStats.mShadersCompiled++;
+    }
+
+    mStats.mShaderMs += GetElapsedMs(start);
+    return bytecode;
+}
+
+ComPtr<ID3D12PipelineState> D3dShaderCache::CreateGraphicsPipeline(const char* name, const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc)
+{
+    uint64_t start = Vnm::GetClockTicks();
+    std::wstring libraryName = GetLibraryName(name, desc);
+
+    ComPtr<ID3D12PipelineState> pipeline;
+    if (mLibrary && SUCCEEDED(mLibrary->LoadGraphicsPipeline(libraryName.c_str(), &desc, IID_PPV_ARGS(&pipeline))))
+    {
+        mStats.mPipelinesCached++;
+    }
+    else
+    {
+        D3D_CHECK(mpDevice->CreateGraphicsPipelineState(&desc, IID_PPV_ARGS(&pipeline)));
+        mStats.mPipelinesCreated++;
+        mLibraryDirty = true;
+    }
+    mPipelines.emplace_back(libraryName, pipeline);
+
+    mStats.mPipelineMs += GetElapsedMs(start);
+    return pipeline;
+}
+
+ComPtr<ID3D12PipelineState> D3dShaderCache::CreateComputePipeline(const char* name, const D3D12_COMPUTE_PIPELINE_STATE_DESC& desc)
+{
+    uint64_t start = Vnm::GetClockTicks();
+    std::wstring libraryName = GetLibraryName(name, desc);
+
+    ComPtr<ID3D12PipelineState> pipeline;
+    if (mLibrary && SUCCEEDED(mLibrary->LoadComputePipeline(libraryName.c_str(), &desc, IID_PPV_ARGS(&pipeline))))
+    {
+        mStats.mPipelinesCached++;
+    }
+    else
+    {
+        D3D_CHECK(mpDevice->CreateComputePipelineState(&desc, IID_PPV_ARGS(&pipeline)));
+        mStats.mPipelinesCreated++;
+        mLibraryDirty = true;
+    }
+    mPipelines.emplace_back(libraryName, pipeline);
+
+    mStats.mPipelineMs += GetElapsedMs(start);
+    return pipeline;
+}
+
+std::string D3dShaderCache::Report() const
+{
+    char text[256];
+    snprintf(text, sizeof(text), "Shaders: %zu compiled, %zu from cache in %.1f ms. Pipelines: %zu created, %zu from library in %.1f ms%s\n",
+        mStats.mShadersCompiled, mStats.mShadersCached, mStats.mShaderMs, mStats.mPipelinesCreated, mStats.mPipelinesCached, mStats.mPipelineMs,
+        mDevice ? "" : " (no pipeline library support)");
+    return text;
+}
@@ -0,0 +1,54 @@
+// D3d12ShaderCache.h
+
+#pragma once
+
+#include "ShaderCache.h"
+#include <d3d12.h>
+#include <d3dcompiler.h>
+#include <wrl.h>
+#include <string>
+#include <vector>
+
+class D3dShaderCacheStats
+{
+public:
+    size_t mShadersCompiled = 0;
+    size_t mShadersCached = 0;
+    double mShaderMs = 0.0;
+    size_t mPipelinesCreated = 0;
+    size_t mPipelinesCached = 0;
+    double mPipelineMs = 0.0;
+};
+
+// Shader bytecode and pipeline states kept in the working directory between runs, so a warm start
+// neither compiles HLSL nor has the driver compile pipelines. Bytecode is keyed by the source of
+// the file and its includes, the entry point, target, defines and flags. Pipelines are stored in an
+// ID3D12PipelineLibrary under their name and a hash of their description and bytecode, so a
+// changed pipeline misses instead of failing to load.
+class D3dShaderCache
+{
+public:
+    void Init(ID3D12Device* device);
+
+    // Writes the caches if anything was compiled or created since Init
+    void Save();
+
+    Microsoft::WRL::ComPtr<ID3DBlob> Compile(const char* fileName, const D3D_SHADER_MACRO* defines, const char* entryPoint, const char* target, UINT flags);
+
+    // name only needs to tell the pipelines of the application apart
+    Microsoft::WRL::ComPtr<ID3D12PipelineState> CreateGraphicsPipeline(const char* name, const D3D12_GRAPHICS_PIPELINE_STATE_DESC& desc);
+    Microsoft::WRL::ComPtr<ID3D12PipelineState> CreateComputePipeline(const char* name, const D3D12_COMPUTE_PIPELINE_STATE_DESC& desc);
+
+    const D3dShaderCacheStats& GetStats() const { return mStats; }
+    std::string Report() const;
+
+private:
+    Microsoft::WRL::ComPtr<ID3D12Device1>          mDevice;         // Null if pipeline libraries are not supported
+    ID3D12Device*                                  mpDevice = nullptr;
+    Microsoft::WRL::ComPtr<ID3D12PipelineLibrary>  mLibrary;
+    std::vector<uint8_t>                           mLibraryData;    // The library reads from it until released
+    std::vector<std::pair<std::wstring, Microsoft::WRL::ComPtr<ID3D12PipelineState>>> mPipelines; // Of this run, by library name
+    bool                                           mLibraryDirty = false;
+    Vnm::ShaderCache                               mShaders;
+    D3dShaderCacheStats                            mStats;
+};
@@ -0,0 +1,312 @@
+// D3d12TextureStreaming.cpp
+
+#include "D3d12TextureStreaming.h"
+#include "D3d12Context.h"
+#include "D3d12Memory.h"
+#include "Material.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <cassert>
+#include <fstream>
+
+using Microsoft::WRL::ComPtr;
+
+static const D3D12_RESOURCE_STATES kShaderResourceState = D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE | D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE;
+
+static bool IsBlockCompressed(DXGI_FORMAT format)
+{
+    return (format >= DXGI_FORMAT_BC1_TYPELESS && format <= DXGI_FORMAT_BC5_SNORM) ||
+        (format >= DXGI_FORMAT_BC6H_TYPELESS && format <= DXGI_FORMAT_BC7_UNORM_SRGB);
+}
+
+static void TransitionToShaderResource(ID3D12GraphicsCommandList* commandList, ID3D12Resource* resource)
+{
+    CD3DX12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::Transition(resource, D3D12_RESOURCE_STATE_COPY_DEST, kShaderResourceState);
+    commandList->ResourceBarrier(1, &barrier);
+}
+
+// Duplicates are found by the shape of the texture and its tail, which already tell any two
+// different images apart in practice
+uint64_t D3dMipTail::CalcContentHash() const
+{
+    const uint32_t shape[] =
+    {
+        static_cast<uint32_t>(mDesc.Width),
+        mDesc.Height,
+        mDesc.MipLevels,
+        static_cast<uint32_t>(mDesc.Format)
+    };
+    uint64_t hash = Vnm::HashBytes(shape, sizeof(shape));
+    return Vnm::HashBytes(mData.data(), mData.size(), hash);
+}
+
+void D3dTextureStreamer::Init(ID3D12Device* device, const Vnm::TextureStreamingParams& params, uint64_t uploadBufferSize)
+{
+    mpDevice = device;
+    mResidency.Init(params);
+    mUploadRing.Init(uploadBufferSize);
+
+    // Mapped for good, the I/O thread reads into it
+    CD3DX12_HEAP_PROPERTIES heapProperties(D3D12_HEAP_TYPE_UPLOAD);
+    CD3DX12_RESOURCE_DESC resourceDesc = CD3DX12_RESOURCE_DESC::Buffer(uploadBufferSize);
+    D3D_CHECK(device->CreateCommittedResource(
+        &heapProperties,
+        D3D12_HEAP_FLAG_NONE,
+        &resourceDesc,
+        D3D12_RESOURCE_STATE_GENERIC_READ,
+        nullptr,
+        IID_PPV_ARGS(&mUploadBuffer)));
+    TrackResource(device, mUploadBuffer.Get(), Vnm::MemoryCategory::Upload);
+
+    CD3DX12_RANGE readRange(0, 0);
+    D3D_CHECK(mUploadBuffer->Map(0, &readRange, reinterpret_cast<void**>(&mpUploadData)));
+}
+
+bool D3dTextureStreamer::ReadMipTail(const std::string& fileName, D3dMipTail* tail) const
+{
+    std::wstring wideFileName(fileName.begin(), fileName.end());
+    if (FAILED(DirectX::GetDDSTextureLayoutFromFile(wideFileName.c_str(), tail->mDesc, tail->mMips)))
+    {
+        return false;
+    }
+
+    const D3D12_RESOURCE_DESC& desc = tail->mDesc;
+    const uint32_t mipCount = static_cast<uint32_t>(tail->mMips.size());
+    tail->mFirstMip = Vnm::CalcTailMip(static_cast<uint32_t>(desc.Width), desc.Height, mipCount, mResidency.GetParams().mTailSize);
+
+    // Any mip down to the tail can become the first of a resource, which block compressed
+    // textures need to be a multiple of the block size
+    if (IsBlockCompressed(desc.Format))
+    {
+        for (uint32_t mip = 0; mip <= tail->mFirstMip; ++mip)
+        {
+            if ((tail->mMips[mip].width % 4) != 0 || (tail->mMips[mip].height % 4) != 0)
+            {
+                return false;
+            }
+        }
+    }
+
+    // Mips follow each other in the file, smallest last
+    const DirectX::DDS_MIP_LAYOUT& first = tail->mMips[tail->mFirstMip];
+    const DirectX::DDS_MIP_LAYOUT& last = tail->mMips.back();
+    const uint64_t size = last.offset + last.slicePitch - first.offset;
+
+    std::ifstream file(fileName, std::ios::in | std::ios::binary);
+    tail->mData.resize(static_cast<size_t>(size));
+    file.seekg(static_cast<std::streamoff>(first.offset));
+    file.read(reinterpret_cast<char*>(tail->mData.data()), static_cast<std::streamsize>(size));
+    if (!file)
+    {
+        return false;
+    }
+
+    tail->mFileName = fileName;
+    tail->mMemory.Reset(Vnm::MemoryCategory::AssetData, size);
+    return true;
+}
+
+void D3dTextureStreamer::AddTexture(uint32_t texture, const D3dMipTail& tail, ID3D12Resource** resource, std::vector<D3D12_SUBRESOURCE_DATA>& subresources)
+{
+    StreamedTexture streamed;
+    streamed.mFileName = tail.mFileName;
+    streamed.mTexture = texture;
+    streamed.mDesc = tail.mDesc;
+    streamed.mMips = tail.mMips;
+    streamed.mFirstMip = tail.mFirstMip;
+
+    std::vector<uint64_t> mipSizes;
+    for (const auto& mip : tail.mMips)
+    {
+        mipSizes.push_back(mip.slicePitch);
+    }
+    uint32_t index = mResidency.AddTexture(static_cast<uint32_t>(tail.mDesc.Width), tail.mDesc.Height, mipSizes.data(), static_cast<uint32_t>(mipSizes.size()));
+    assert(index == mTextures.size() && mResidency.GetTailMip(index) == tail.mFirstMip);
+
+    streamed.mResource = CreateTexture(streamed, tail.mFirstMip);
+    D3D_CHECK(streamed.mResource.CopyTo(resource));
+
+    subresources.clear();
+    for (size_t mip = tail.mFirstMip; mip < tail.mMips.size(); ++mip)
+    {
+        D3D12_SUBRESOURCE_DATA subresource = {};
+        subresource.pData = tail.mData.data() + (tail.mMips[mip].offset - tail.mMips[tail.mFirstMip].offset);
+        subresource.RowPitch = static_cast<LONG_PTR>(tail.mMips[mip].rowPitch);
+        subresource.SlicePitch = static_cast<LONG_PTR>(tail.mMips[mip].slicePitch);
+        subresources.push_back(subresource);
+    }
+
+    if (mStreamIndices.size() <= texture)
+    {
+        mStreamIndices.resize(texture + 1, Vnm::InvalidIndex);
+    }
+    mStreamIndices[texture] = index;
+    mTextures.push_back(std::move(streamed));
+}
+
+void D3dTextureStreamer::BeginFrame()
+{
+    mResidency.BeginFrame();
+}
+
+void D3dTextureStreamer::AddUse(uint32_t texture, float distance, float size)
+{
+    if (texture < mStreamIndices.size() && mStreamIndices[texture] != Vnm::InvalidIndex)
+    {
+        mResidency.AddUse(mStreamIndices[texture], distance, size);
+    }
+}
+
+ID3D12Resource* D3dTextureStreamer::GetResource(uint32_t texture) const
+{
+    if (texture < mStreamIndices.size() && mStreamIndices[texture] != Vnm::InvalidIndex)
+    {
+        return mTextures[mStreamIndices[texture]].mResource.Get();
+    }
+    return nullptr;
+}
+
+ComPtr<ID3D12Resource> D3dTextureStreamer::CreateTexture(const StreamedTexture& texture, uint32_t firstMip) const
+{
+    D3D12_RESOURCE_DESC desc = texture.mDesc;
+    desc.Width = texture.mMips[firstMip].width;
+    desc.Height = texture.mMips[firstMip].height;
+    desc.MipLevels = static_cast<UINT16>(texture.mMips.size() - firstMip);
+
+    ComPtr<ID3D12Resource> resource;
+    CD3DX12_HEAP_PROPERTIES heapProperties(D3D12_HEAP_TYPE_DEFAULT);
+    D3D_CHECK(mpDevice->CreateCommittedResource(
+        &heapProperties,
+        D3D12_HEAP_FLAG_NONE,
+        &desc,
+        D3D12_RESOURCE_STATE_COPY_DEST,
+        nullptr,
+        IID_PPV_ARGS(&resource)));
+    TrackResource(mpDevice, resource.Get(), Vnm::MemoryCategory::Textures);
+    return resource;
+}
+
+// The new resource is left in the copy destination state
+void D3dTextureStreamer::ReplaceResource(ID3D12GraphicsCommandList* commandList, StreamedTexture& texture, uint32_t firstMip, std::vector<uint32_t>* changedTextures)
+{
+    ComPtr<ID3D12Resource> resource = CreateTexture(texture, firstMip);
+
+    CD3DX12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::Transition(texture.mResource.Get(), kShaderResourceState, D3D12_RESOURCE_STATE_COPY_SOURCE);
+    commandList->ResourceBarrier(1, &barrier);
+
+    const uint32_t mipCount = static_cast<uint32_t>(texture.mMips.size());
+    for (uint32_t mip = (std::max)(firstMip, texture.mFirstMip); mip < mipCount; ++mip)
+    {
+        CD3DX12_TEXTURE_COPY_LOCATION dst(resource.Get(), mip - firstMip);
+        CD3DX12_TEXTURE_COPY_LOCATION src(texture.mResource.Get(), mip - texture.mFirstMip);
+        commandList->CopyTextureRegion(&dst, 0, 0, 0, &src, nullptr);
+    }
+
+    mRetired.push_back(texture.mResource);
+    texture.mResource = resource;
+    texture.mFirstMip = firstMip;
+    changedTextures->push_back(texture.mTexture);
+}
+
+void D3dTextureStreamer::CalcMipFootprint(const StreamedTexture& texture, uint32_t mip, D3D12_PLACED_SUBRESOURCE_FOOTPRINT* footprint, UINT* numRows, UINT64* rowSize, UINT64* totalBytes) const
+{
+    D3D12_RESOURCE_DESC mipDesc = texture.mDesc;
+    mipDesc.Width = texture.mMips[mip].width;
+    mipDesc.Height = texture.mMips[mip].height;
+    mipDesc.MipLevels = 1;
+    mpDevice->GetCopyableFootprints(&mipDesc, 0, 1, 0, footprint, numRows, rowSize, totalBytes);
+}
+
+// Reserves the mip's footprint in the upload ring and has the I/O thread read it there
+void D3dTextureStreamer::StartLoad(const Vnm::StreamingRequest& load)
+{
+    const StreamedTexture& texture = mTextures[load.mTexture];
+    const DirectX::DDS_MIP_LAYOUT& layout = texture.mMips[load.mMip];
+
+    D3D12_PLACED_SUBRESOURCE_FOOTPRINT footprint;
+    UINT numRows = 0;
+    UINT64 rowSize = 0;
+    UINT64 totalBytes = 0;
+    CalcMipFootprint(texture, load.mMip, &footprint, &numRows, &rowSize, &totalBytes);
+    assert(numRows == layout.numRows && rowSize == layout.rowPitch);
+
+    if (totalBytes > mUploadRing.GetSize())
+    {
+        mResidency.CompleteLoad(load, false);
+        return;
+    }
+
+    uint64_t offset = 0;
+    if (!mUploadRing.Allocate(totalBytes, D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT, &offset))
+    {
+        mResidency.CancelLoad(load);
+        return;
+    }
+
+    Vnm::StreamingRead read;
+    read.mFileName = texture.mFileName;
+    read.mOffset = layout.offset;
+    read.mSize = layout.slicePitch;
+    read.mRequest = load;
+    read.mpDestination = mpUploadData + offset;
+    read.mRowSize = rowSize;
+    read.mRowPitch = footprint.Footprint.RowPitch;
+    read.mNumRows = numRows;
+    mIoThread.Submit(std::move(read));
+}
+
+void D3dTextureStreamer::UploadMip(ID3D12GraphicsCommandList* commandList, const Vnm::StreamingRead& read, std::vector<uint32_t>* changedTextures)
+{
+    StreamedTexture& texture = mTextures[read.mRequest.mTexture];
+    const uint32_t mip = read.mRequest.mMip;
+
+    D3D12_PLACED_SUBRESOURCE_FOOTPRINT footprint;
+    UINT numRows = 0;
+    UINT64 rowSize = 0;
+    UINT64 totalBytes = 0;
+    CalcMipFootprint(texture, mip, &footprint, &numRows, &rowSize, &totalBytes);
+    footprint.Offset = static_cast<UINT64>(read.mpDestination - mpUploadData);
+
+    ReplaceResource(commandList, texture, mip, changedTextures);
+    CD3DX12_TEXTURE_COPY_LOCATION dst(texture.mResource.Get(), 0);
+    CD3DX12_TEXTURE_COPY_LOCATION src(mUploadBuffer.Get(), footprint);
+    commandList->CopyTextureRegion(&dst, 0, 0, 0, &src, nullptr);
+    TransitionToShaderResource(commandList, texture.mResource.Get());
+}
+
+void D3dTextureStreamer::Update(ID3D12GraphicsCommandList* commandList, std::vector<uint32_t>* changedTextures)
+{
+    PROFILE_ZONE("Texture streaming");
+
+    // The GPU is done with the copies of the last Update
+    mRetired.clear();
+    for (; mUploadsToFree > 0; --mUploadsToFree)
+    {
+        mUploadRing.FreeOldest();
+    }
+
+    // Reads finish in the order they started, the order of their upload ring allocations
+    Vnm::StreamingRead read;
+    while (mIoThread.Poll(&read))
+    {
+        if (read.mSuccess)
+        {
+            UploadMip(commandList, read, changedTextures);
+        }
+        mResidency.CompleteLoad(read.mRequest, read.mSuccess);
+        mUploadsToFree++;
+    }
+
+    mResidency.Update(&mLoads, &mEvictions);
+    for (const Vnm::StreamingRequest& eviction : mEvictions)
+    {
+        StreamedTexture& texture = mTextures[eviction.mTexture];
+        ReplaceResource(commandList, texture, eviction.mMip, changedTextures);
+        TransitionToShaderResource(commandList, texture.mResource.Get());
+    }
+
+    for (const Vnm::StreamingRequest& load : mLoads)
+    {
+        StartLoad(load);
+    }
+}
@@ -0,0 +1,90 @@
+// D3d12TextureStreaming.h
+
+#pragma once
+
+#include "DDSTextureLoader12.h"
+#include "MemoryTracker.h"
+#include "TextureStreaming.h"
+#include "UploadRing.h"
+#include <d3d12.h>
+#include <wrl.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Header and smallest mips of a DDS file, read without the rest of it
+class D3dMipTail
+{
+public:
+    std::string                          mFileName;
+    D3D12_RESOURCE_DESC                  mDesc;         // Full mip chain
+    std::vector<DirectX::DDS_MIP_LAYOUT> mMips;
+    uint32_t                             mFirstMip = 0;
+    std::vector<uint8_t>                 mData;         // Mips from mFirstMip on
+    Vnm::TrackedAllocation               mMemory;
+
+    uint64_t CalcContentHash() const;
+};
+
+// Streams the mips of DDS textures above their tails. Textures are committed resources holding
+// their resident mips, so a change of residency creates a new resource, copies the mips both have
+// on the GPU and retires the old one. Textures are known by their material library index.
+class D3dTextureStreamer
+{
+public:
+    void Init(ID3D12Device* device, const Vnm::TextureStreamingParams& params, uint64_t uploadBufferSize);
+
+    // Returns false if the file cannot be read or streamed, e.g. if it is not a plain 2D texture
+    bool ReadMipTail(const std::string& fileName, D3dMipTail* tail) const;
+
+    // Creates the texture with the mips of tail, which the caller uploads from subresources. They
+    // point into tail.
+    void AddTexture(uint32_t texture, const D3dMipTail& tail, ID3D12Resource** resource, std::vector<D3D12_SUBRESOURCE_DATA>& subresources);
+
+    // Uses of the frame, see Vnm::TextureResidency::AddUse
+    void BeginFrame();
+    void AddUse(uint32_t texture, float distance, float size);
+
+    // Records the uploads of finished reads and the copies of evictions into commandList and
+    // starts new reads. Reads go straight into space reserved in the upload ring, which is freed
+    // once the copy from it is done. The GPU has to be done with the previous Update's commands.
+    // Textures whose resource was replaced are added to changedTextures.
+    void Update(ID3D12GraphicsCommandList* commandList, std::vector<uint32_t>* changedTextures);
+
+    ID3D12Resource* GetResource(uint32_t texture) const;
+    const Vnm::TextureResidency& GetResidency() const { return mResidency; }
+
+private:
+    class StreamedTexture
+    {
+    public:
+        std::string                            mFileName;
+        uint32_t                               mTexture;
+        D3D12_RESOURCE_DESC                    mDesc;
+        std::vector<DirectX::DDS_MIP_LAYOUT>   mMips;
+        Microsoft::WRL::ComPtr<ID3D12Resource> mResource;
+        uint32_t                               mFirstMip;   // Mip of the resource's subresource 0
+    };
+
+    Microsoft::WRL::ComPtr<ID3D12Resource> CreateTexture(const StreamedTexture& texture, uint32_t firstMip) const;
+    void ReplaceResource(ID3D12GraphicsCommandList* commandList, StreamedTexture& texture, uint32_t firstMip, std::vector<uint32_t>* changedTextures);
+    void CalcMipFootprint(const StreamedTexture& texture, uint32_t mip, D3D12_PLACED_SUBRESOURCE_FOOTPRINT* footprint, UINT* numRows, UINT64* rowSize, UINT64* totalBytes) const;
+    void StartLoad(const Vnm::StreamingRequest& load);
+    void UploadMip(ID3D12GraphicsCommandList* commandList, const Vnm::StreamingRead& read, std::vector<uint32_t>* changedTextures);
+
+    ID3D12Device*                                       mpDevice = nullptr;
+    Vnm::TextureResidency                               mResidency;
+    std::vector<StreamedTexture>                        mTextures;
+    std::vector<uint32_t>                               mStreamIndices;     // Per library texture
+    std::vector<Microsoft::WRL::ComPtr<ID3D12Resource>> mRetired;
+    std::vector<Vnm::StreamingRequest>                  mLoads;
+    std::vector<Vnm::StreamingRequest>                  mEvictions;
+
+    Microsoft::WRL::ComPtr<ID3D12Resource>              mUploadBuffer;
+    uint8_t*                                            mpUploadData = nullptr;
+    Vnm::UploadRing                                     mUploadRing;
+    size_t                                              mUploadsToFree = 0; // Copied from in the last Update
+
+    // Last, so it stops before the upload buffer it reads into is released
+    Vnm::StreamingIoThread                              mIoThread;
+};
@@ -422,6 +422,91 @@ namespace
     }
 
 
+    //--------------------------------------------------------------------------------------
+    HRESULT LoadTextureHeaderFromFile(
+        _In_z_ const wchar_t* fileName,
+        uint8_t(&headerData)[DDS_DX10_HEADER_SIZE],
+        const DDS_HEADER** header,
+        size_t* headerSize,
+        uint64_t* fileSize) noexcept
+    {
+        if (!header || !headerSize || !fileSize)
+        {
+            return E_POINTER;
+        }
+
+        *headerSize = 0;
+        *fileSize = 0;
+
+    #ifdef _WIN32
+        ScopedHandle hFile(safe_handle(CreateFile2(
+            fileName,
+            GENERIC_READ, FILE_SHARE_READ, OPEN_EXISTING,
+            nullptr)));
+
+        if (!hFile)
+        {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+
+        FILE_STANDARD_INFO fileInfo;
+        if (!GetFileInformationByHandleEx(hFile.get(), FileStandardInfo, &fileInfo, sizeof(fileInfo)))
+        {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+
+        const uint64_t len = static_cast<uint64_t>(fileInfo.EndOfFile.QuadPart);
+        if (len < DDS_MIN_HEADER_SIZE)
+        {
+            return E_FAIL;
+        }
+
+        // Only the headers are read, the DX10 header may not be there
+        const DWORD toRead = static_cast<DWORD>(std::min<uint64_t>(len, DDS_DX10_HEADER_SIZE));
+        DWORD bytesRead = 0;
+        if (!ReadFile(hFile.get(), headerData, toRead, &bytesRead, nullptr))
+        {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+
+        if (bytesRead < toRead)
+        {
+            return E_FAIL;
+        }
+
+    #else // !WIN32
+        std::ifstream inFile(std::filesystem::path(fileName), std::ios::in | std::ios::binary | std::ios::ate);
+        if (!inFile)
+            return E_FAIL;
+
+        const std::streampos fileLen = inFile.tellg();
+        if (!inFile || fileLen < static_cast<std::streampos>(DDS_MIN_HEADER_SIZE))
+            return E_FAIL;
+
+        const uint64_t len = static_cast<uint64_t>(fileLen);
+        const size_t toRead = static_cast<size_t>(std::min<uint64_t>(len, DDS_DX10_HEADER_SIZE));
+        inFile.seekg(0, std::ios::beg);
+        inFile.read(reinterpret_cast<char*>(headerData), static_cast<std::streamsize>(toRead));
+        if (!inFile)
+            return E_FAIL;
+    #endif
+
+        const DDS_HEADER* hdr = nullptr;
+        const uint8_t* bitData = nullptr;
+        size_t bitSize = 0;
+        HRESULT hr = LoadTextureDataFromMemory(headerData, toRead, &hdr, &bitData, &bitSize);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+
+        *header = hdr;
+        *headerSize = static_cast<size_t>(bitData - headerData);
+        *fileSize = len;
+        return S_OK;
+    }
+
+
     //--------------------------------------------------------------------------------------
     // Return the BPP for a particular format
     //--------------------------------------------------------------------------------------
@@ -1845,3 +1930,158 @@ HRESULT DirectX::LoadDDSTextureFromFileEx(
 
     return hr;
 }
+
+
+//--------------------------------------------------------------------------------------
+_Use_decl_annotations_
+HRESULT DirectX::GetDDSTextureLayoutFromFile(
+    const wchar_t* fileName,
+    D3D12_RESOURCE_DESC& desc,
+    std::vector<DDS_MIP_LAYOUT>& layout,
+    DDS_LOADER_FLAGS loadFlags)
+{
+    desc = {};
+    layout.clear();
+
+    if (!fileName)
+    {
+        return E_INVALIDARG;
+    }
+
+    uint8_t headerData[DDS_DX10_HEADER_SIZE] = {};
+    const DDS_HEADER* header = nullptr;
+    size_t headerSize = 0;
+    uint64_t fileSize = 0;
+    HRESULT hr = LoadTextureHeaderFromFile(fileName, headerData, &header, &headerSize, &fileSize);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    DXGI_FORMAT format = DXGI_FORMAT_UNKNOWN;
+    if ((header->ddspf.flags & DDS_FOURCC) &&
+        (MAKEFOURCC('D', 'X', '1', '0') == header->ddspf.fourCC))
+    {
+        auto d3d10ext = reinterpret_cast<const DDS_HEADER_DXT10*>(reinterpret_cast<const char*>(header) + sizeof(DDS_HEADER));
+        if (d3d10ext->resourceDimension != D3D12_RESOURCE_DIMENSION_TEXTURE2D
+            || d3d10ext->arraySize != 1
+            || (d3d10ext->miscFlag & 0x4 /* RESOURCE_MISC_TEXTURECUBE */))
+        {
+            return HRESULT_E_NOT_SUPPORTED;
+        }
+
+        format = d3d10ext->dxgiFormat;
+    }
+    else
+    {
+        if ((header->flags & DDS_HEADER_FLAGS_VOLUME) || (header->caps2 & DDS_CUBEMAP))
+        {
+            return HRESULT_E_NOT_SUPPORTED;
+        }
+
+        format = GetDXGIFormat(header->ddspf);
+    }
+
+    // Planar and video formats need the device to count their planes
+    switch (format)
+    {
+    case DXGI_FORMAT_UNKNOWN:
+    case DXGI_FORMAT_NV12:
+    case DXGI_FORMAT_P010:
+    case DXGI_FORMAT_P016:
+    case DXGI_FORMAT_420_OPAQUE:
+    case DXGI_FORMAT_YUY2:
+    case DXGI_FORMAT_Y210:
+    case DXGI_FORMAT_Y216:
+    case DXGI_FORMAT_NV11:
+    case DXGI_FORMAT_AI44:
+    case DXGI_FORMAT_IA44:
+    case DXGI_FORMAT_P8:
+    case DXGI_FORMAT_A8P8:
+    case DXGI_FORMAT_P208:
+    case DXGI_FORMAT_V208:
+    case DXGI_FORMAT_V408:
+        return HRESULT_E_NOT_SUPPORTED;
+
+    default:
+        if (BitsPerPixel(format) == 0 || IsDepthStencil(format))
+        {
+            return HRESULT_E_NOT_SUPPORTED;
+        }
+        break;
+    }
+
+    size_t mipCount = header->mipMapCount;
+    if (0 == mipCount)
+    {
+        mipCount = 1;
+    }
+
+    if (mipCount > D3D12_REQ_MIP_LEVELS
+        || header->width > D3D12_REQ_TEXTURE2D_U_OR_V_DIMENSION
+        || header->height > D3D12_REQ_TEXTURE2D_U_OR_V_DIMENSION)
+    {
+        return HRESULT_E_NOT_SUPPORTED;
+    }
+
+    // Same walk over the mips as FillInitData
+    layout.reserve(mipCount);
+    uint64_t offset = headerSize;
+    size_t w = header->width;
+    size_t h = header->height;
+    for (size_t i = 0; i < mipCount; i++)
+    {
+        size_t NumBytes = 0;
+        size_t RowBytes = 0;
+        size_t NumRows = 0;
+        hr = GetSurfaceInfo(w, h, format, &NumBytes, &RowBytes, &NumRows);
+        if (FAILED(hr))
+        {
+            layout.clear();
+            return hr;
+        }
+
+        if (NumBytes > UINT32_MAX || RowBytes > UINT32_MAX)
+        {
+            layout.clear();
+            return HRESULT_E_ARITHMETIC_OVERFLOW;
+        }
+
+        if (offset + NumBytes > fileSize)
+        {
+            layout.clear();
+            return HRESULT_E_HANDLE_EOF;
+        }
+
+        DDS_MIP_LAYOUT mip = {};
+        mip.offset = offset;
+        mip.rowPitch = RowBytes;
+        mip.slicePitch = NumBytes;
+        mip.numRows = static_cast<uint32_t>(NumRows);
+        mip.width = static_cast<uint32_t>(w);
+        mip.height = static_cast<uint32_t>(h);
+        layout.emplace_back(mip);
+
+        offset += NumBytes;
+        w = std::max<size_t>(w >> 1, 1);
+        h = std::max<size_t>(h >> 1, 1);
+    }
+
+    if (loadFlags & DDS_LOADER_FORCE_SRGB)
+    {
+        format = MakeSRGB(format);
+    }
+    else if (loadFlags & DDS_LOADER_IGNORE_SRGB)
+    {
+        format = MakeLinear(format);
+    }
+
+    desc.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
+    desc.Width = header->width;
+    desc.Height = header->height;
+    desc.DepthOrArraySize = 1;
+    desc.MipLevels = static_cast<UINT16>(mipCount);
+    desc.Format = format;
+    desc.SampleDesc.Count = 1;
+    return S_OK;
+}
@@ -123,4 +123,23 @@ namespace DirectX
         std::vector<D3D12_SUBRESOURCE_DATA>& subresources,
         _Out_opt_ DDS_ALPHA_MODE* alphaMode = nullptr,
         _Out_opt_ bool* isCubeMap = nullptr);
+
+    // Where one mip of a DDS file is, for reading it on its own
+    struct DDS_MIP_LAYOUT
+    {
+        uint64_t offset;        // From the start of the file
+        uint64_t rowPitch;
+        uint64_t slicePitch;
+        uint32_t numRows;
+        uint32_t width;
+        uint32_t height;
+    };
+
+    // Reads only the header of a 2D DDS file without array slices or planes and locates each of
+    // its mips. desc describes a texture of the full mip chain.
+    HRESULT __cdecl GetDDSTextureLayoutFromFile(
+        _In_z_ const wchar_t* szFileName,
+        D3D12_RESOURCE_DESC& desc,
+        std::vector<DDS_MIP_LAYOUT>& layout,
+        DDS_LOADER_FLAGS loadFlags = DDS_LOADER_DEFAULT);
 }
@@ -0,0 +1,509 @@
+// DdsFile.cpp
+
+#include "DdsFile.h"
+#include <algorithm>
+#include <cstring>
+
+namespace Vnm
+{
+    // File layout, as in DDSTextureLoader12
+    struct DdsPixelFormat
+    {
+        uint32_t size;
+        uint32_t flags;
+        uint32_t fourCC;
+        uint32_t rgbBitCount;
+        uint32_t rBitMask;
+        uint32_t gBitMask;
+        uint32_t bBitMask;
+        uint32_t aBitMask;
+    };
+
+    struct DdsHeader
+    {
+        uint32_t       size;
+        uint32_t       flags;
+        uint32_t       height;
+        uint32_t       width;
+        uint32_t       pitchOrLinearSize;
+        uint32_t       depth;
+        uint32_t       mipMapCount;
+        uint32_t       reserved1[11];
+        DdsPixelFormat ddspf;
+        uint32_t       caps;
+        uint32_t       caps2;
+        uint32_t       caps3;
+        uint32_t       caps4;
+        uint32_t       reserved2;
+    };
+
+    struct DdsHeaderDxt10
+    {
+        uint32_t dxgiFormat;
+        uint32_t resourceDimension;
+        uint32_t miscFlag;
+        uint32_t arraySize;
+        uint32_t miscFlags2;
+    };
+
+    static_assert(sizeof(DdsHeader) == 124, "DDS header size mismatch");
+    static_assert(sizeof(DdsHeaderDxt10) == 20, "DDS DX10 header size mismatch");
+
+    static constexpr uint32_t MakeFourCC(char a, char b, char c, char d)
+    {
+        return static_cast<uint32_t>(static_cast<uint8_t>(a)) | (static_cast<uint32_t>(static_cast<uint8_t>(b)) << 8) |
+            (static_cast<uint32_t>(static_cast<uint8_t>(c)) << 16) | (static_cast<uint32_t>(static_cast<uint8_t>(d)) << 24);
+    }
+
+    static const uint32_t kDdsMagic = MakeFourCC('D', 'D', 'S', ' ');
+    static const uint32_t kDdsFourCC = 0x4;
+    static const uint32_t kDdsRgb = 0x40;
+    static const uint32_t kDdsLuminance = 0x20000;
+    static const uint32_t kDdsAlpha = 0x2;
+    static const uint32_t kDdsBumpDuDv = 0x80000;
+    static const uint32_t kDdsHeaderFlagsHeight = 0x2;
+    static const uint32_t kDdsHeaderFlagsVolume = 0x800000;
+    static const uint32_t kDdsCubeMap = 0x200;
+    static const uint32_t kDdsCubeMapAllFaces = 0xFC00;
+    static const uint32_t kResourceMiscTextureCube = 0x4;
+    static const uint32_t kDdsHeaderFlagsTexture = 0x1007;         // Caps, height, width and pixel format
+    static const uint32_t kDdsHeaderFlagsMipMap = 0x20000;
+    static const uint32_t kDdsHeaderFlagsLinearSize = 0x80000;
+    static const uint32_t kDdsHeaderFlagsPitch = 0x8;
+    static const uint32_t kDdsSurfaceFlagsTexture = 0x1000;
+    static const uint32_t kDdsSurfaceFlagsMipMap = 0x400008;        // Complex and mip map
+    static const uint32_t kResourceDimensionTexture2D = 3;
+
+    // D3D12 hardware limits, as the loader bounds them
+    static const uint32_t kMaxMipLevels = 15;
+    static const uint32_t kMaxTexture1DSize = 16384;
+    static const uint32_t kMaxTexture2DSize = 16384;
+    static const uint32_t kMaxTexture3DSize = 2048;
+    static const uint32_t kMaxArraySize = 2048;
+
+    static const char* const kErrorNames[static_cast<size_t>(DdsError::Count)] =
+    {
+        "none",
+        "too small",
+        "bad magic",
+        "bad header",
+        "unsupported format",
+        "unsupported dimension",
+        "invalid size",
+        "too large",
+        "truncated"
+    };
+
+    const char* GetDdsErrorName(DdsError error)
+    {
+        return error < DdsError::Count ? kErrorNames[static_cast<size_t>(error)] : "unknown";
+    }
+
+    uint32_t GetDdsBitsPerPixel(uint32_t format)
+    {
+        if (format >= 1 && format <= 4) return 128;     // R32G32B32A32
+        if (format >= 5 && format <= 8) return 96;      // R32G32B32
+        if (format >= 9 && format <= 22) return 64;     // R16G16B16A16, R32G32, R32G8X24
+        if (format >= 23 && format <= 47) return 32;    // R10G10B10A2 to R24G8
+        if (format >= 48 && format <= 59) return 16;    // R8G8, R16
+        if (format >= 60 && format <= 65) return 8;     // R8, A8
+        if (format == 66) return 1;                     // R1
+        if (format == 67) return 32;                    // R9G9B9E5
+        if (format == 68 || format == 69) return 16;    // R8G8_B8G8, G8R8_G8B8
+        if (format >= 70 && format <= 72) return 4;     // BC1
+        if (format >= 73 && format <= 78) return 8;     // BC2, BC3
+        if (format >= 79 && format <= 81) return 4;     // BC4
+        if (format >= 82 && format <= 84) return 8;     // BC5
+        if (format == 85 || format == 86) return 16;    // B5G6R5, B5G5R5A1
+        if (format >= 87 && format <= 93) return 32;    // B8G8R8A8, B8G8R8X8
+        if (format >= 94 && format <= 99) return 8;     // BC6H, BC7
+        if (format == 115) return 16;                   // B4G4R4A4
+        return 0;
+    }
+
+    bool IsDdsBlockCompressed(uint32_t format)
+    {
+        return (format >= 70 && format <= 84) || (format >= 94 && format <= 99);
+    }
+
+    // Two pixels share a 32 bit word
+    static bool IsPacked(uint32_t format)
+    {
+        return format == 68 || format == 69;
+    }
+
+    // Depth stencil formats with a stencil plane, which the loader does not support
+    static bool IsPlanarDepthStencil(uint32_t format)
+    {
+        return (format >= 19 && format <= 22) || (format >= 44 && format <= 47);
+    }
+
+    static bool IsBitMask(const DdsPixelFormat& ddpf, uint32_t r, uint32_t g, uint32_t b, uint32_t a)
+    {
+        return ddpf.rBitMask == r && ddpf.gBitMask == g && ddpf.bBitMask == b && ddpf.aBitMask == a;
+    }
+
+    // Formats of files without the DX10 header, as the loader's GetDXGIFormat maps them
+    static uint32_t GetLegacyFormat(const DdsPixelFormat& ddpf)
+    {
+        if (ddpf.flags & kDdsRgb)
+        {
+            switch (ddpf.rgbBitCount)
+            {
+            case 32:
+                if (IsBitMask(ddpf, 0x000000ff, 0x0000ff00, 0x00ff0000, 0xff000000)) return 28;   // R8G8B8A8_UNORM
+                if (IsBitMask(ddpf, 0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000)) return 87;   // B8G8R8A8_UNORM
+                if (IsBitMask(ddpf, 0x00ff0000, 0x0000ff00, 0x000000ff, 0)) return 88;            // B8G8R8X8_UNORM
+                if (IsBitMask(ddpf, 0x3ff00000, 0x000ffc00, 0x000003ff, 0xc0000000)) return 24;   // R10G10B10A2_UNORM, with D3DX's swapped masks
+                if (IsBitMask(ddpf, 0x0000ffff, 0xffff0000, 0, 0)) return 35;                     // R16G16_UNORM
+                if (IsBitMask(ddpf, 0xffffffff, 0, 0, 0)) return 41;                              // R32_FLOAT
+                return 0;
+            case 16:
+                if (IsBitMask(ddpf, 0x7c00, 0x03e0, 0x001f, 0x8000)) return 86;                   // B5G5R5A1_UNORM
+                if (IsBitMask(ddpf, 0xf800, 0x07e0, 0x001f, 0)) return 85;                        // B5G6R5_UNORM
+                if (IsBitMask(ddpf, 0x0f00, 0x00f0, 0x000f, 0xf000)) return 115;                  // B4G4R4A4_UNORM
+                if (IsBitMask(ddpf, 0x00ff, 0, 0, 0xff00)) return 49;                             // R8G8_UNORM
+                if (IsBitMask(ddpf, 0xffff, 0, 0, 0)) return 56;                                  // R16_UNORM
+                return 0;
+            case 8:
+                if (IsBitMask(ddpf, 0xff, 0, 0, 0)) return 61;                                    // R8_UNORM
+                return 0;
+            default:
+                return 0;
+            }
+        }
+        else if (ddpf.flags & kDdsLuminance)
+        {
+            switch (ddpf.rgbBitCount)
+            {
+            case 16:
+                if (IsBitMask(ddpf, 0xffff, 0, 0, 0)) return 56;                                  // R16_UNORM
+                if (IsBitMask(ddpf, 0x00ff, 0, 0, 0xff00)) return 49;                             // R8G8_UNORM
+                return 0;
+            case 8:
+                if (IsBitMask(ddpf, 0xff, 0, 0, 0)) return 61;                                    // R8_UNORM
+                if (IsBitMask(ddpf, 0x00ff, 0, 0, 0xff00)) return 49;                             // R8G8_UNORM
+                return 0;
+            default:
+                return 0;
+            }
+        }
+        else if (ddpf.flags & kDdsAlpha)
+        {
+            return ddpf.rgbBitCount == 8 ? 65 : 0;                                                // A8_UNORM
+        }
+        else if (ddpf.flags & kDdsBumpDuDv)
+        {
+            switch (ddpf.rgbBitCount)
+            {
+            case 32:
+                if (IsBitMask(ddpf, 0x000000ff, 0x0000ff00, 0x00ff0000, 0xff000000)) return 31;   // R8G8B8A8_SNORM
+                if (IsBitMask(ddpf, 0x0000ffff, 0xffff0000, 0, 0)) return 37;                     // R16G16_SNORM
+                return 0;
+            case 16:
+                if (IsBitMask(ddpf, 0x00ff, 0xff00, 0, 0)) return 51;                             // R8G8_SNORM
+                return 0;
+            default:
+                return 0;
+            }
+        }
+        else if (ddpf.flags & kDdsFourCC)
+        {
+            switch (ddpf.fourCC)
+            {
+            case MakeFourCC('D', 'X', 'T', '1'): return 71;
+            case MakeFourCC('D', 'X', 'T', '2'):
+            case MakeFourCC('D', 'X', 'T', '3'): return 74;
+            case MakeFourCC('D', 'X', 'T', '4'):
+            case MakeFourCC('D', 'X', 'T', '5'): return 77;
+            case MakeFourCC('A', 'T', 'I', '1'):
+            case MakeFourCC('B', 'C', '4', 'U'): return 80;
+            case MakeFourCC('B', 'C', '4', 'S'): return 81;
+            case MakeFourCC('A', 'T', 'I', '2'):
+            case MakeFourCC('B', 'C', '5', 'U'): return 83;
+            case MakeFourCC('B', 'C', '5', 'S'): return 84;
+            case MakeFourCC('R', 'G', 'B', 'G'): return 68;
+            case MakeFourCC('G', 'R', 'G', 'B'): return 69;
+            case 36: return 11;                         // D3DFMT_A16B16G16R16
+            case 110: return 13;                        // D3DFMT_Q16W16V16U16
+            case 111: return 54;                        // D3DFMT_R16F
+            case 112: return 34;                        // D3DFMT_G16R16F
+            case 113: return 10;                        // D3DFMT_A16B16G16R16F
+            case 114: return 41;                        // D3DFMT_R32F
+            case 115: return 16;                        // D3DFMT_G32R32F
+            case 116: return 2;                         // D3DFMT_A32B32G32R32F
+            default: return 0;
+            }
+        }
+        return 0;
+    }
+
+    static void CalcSurfaceSize(uint32_t width, uint32_t height, uint32_t format, uint64_t* rowPitch, uint32_t* numRows)
+    {
+        if (IsDdsBlockCompressed(format))
+        {
+            const uint64_t bytesPerBlock = GetDdsBitsPerPixel(format) * 2;
+            *rowPitch = (std::max)((width + 3u) / 4u, 1u) * bytesPerBlock;
+            *numRows = (std::max)((height + 3u) / 4u, 1u);
+        }
+        else if (IsPacked(format))
+        {
+            *rowPitch = ((static_cast<uint64_t>(width) + 1) >> 1) * 4;
+            *numRows = height;
+        }
+        else
+        {
+            *rowPitch = (static_cast<uint64_t>(width) * GetDdsBitsPerPixel(format) + 7) / 8;
+            *numRows = height;
+        }
+    }
+
+    static bool Fail(DdsError* error, DdsError reason)
+    {
+        if (error != nullptr)
+        {
+            *error = reason;
+        }
+        return false;
+    }
+
+    // Rejects layouts D3D12 cannot create, before any subresource is sized
+    static DdsError CheckLimits(const DdsLayout& layout)
+    {
+        if (layout.mWidth == 0 || layout.mHeight == 0 || layout.mDepth == 0 || layout.mArraySize == 0)
+        {
+            return DdsError::InvalidSize;
+        }
+
+        uint32_t maxSize = 0;
+        switch (layout.mDimension)
+        {
+        case DdsDimension::Texture1D:
+            maxSize = kMaxTexture1DSize;
+            break;
+        case DdsDimension::Texture2D:
+            maxSize = kMaxTexture2DSize;
+            break;
+        case DdsDimension::Texture3D:
+            maxSize = kMaxTexture3DSize;
+            if (layout.mArraySize != 1)
+            {
+                return DdsError::UnsupportedDimension;
+            }
+            break;
+        }
+        if (layout.mWidth > maxSize || layout.mHeight > maxSize || layout.mDepth > maxSize ||
+            layout.mArraySize > kMaxArraySize || layout.mMipCount > kMaxMipLevels)
+        {
+            return DdsError::TooLarge;
+        }
+
+        // A chain ends at 1x1x1
+        uint32_t largest = (std::max)((std::max)(layout.mWidth, layout.mHeight), layout.mDepth);
+        uint32_t fullChain = 1;
+        while (largest > 1)
+        {
+            largest >>= 1;
+            fullChain++;
+        }
+        return layout.mMipCount > fullChain ? DdsError::InvalidSize : DdsError::None;
+    }
+
+    bool ParseDdsHeader(const uint8_t* data, size_t size, uint64_t fileSize, DdsLayout* layout, DdsError* error)
+    {
+        Fail(error, DdsError::None);
+        size = static_cast<size_t>((std::min)(static_cast<uint64_t>(size), fileSize));
+        if (data == nullptr || size < sizeof(uint32_t) + sizeof(DdsHeader))
+        {
+            return Fail(error, DdsError::TooSmall);
+        }
+
+        // Copied out, data need not be aligned
+        uint32_t magic;
+        DdsHeader header;
+        memcpy(&magic, data, sizeof(magic));
+        memcpy(&header, data + sizeof(magic), sizeof(header));
+        if (magic != kDdsMagic)
+        {
+            return Fail(error, DdsError::BadMagic);
+        }
+        if (header.size != sizeof(DdsHeader) || header.ddspf.size != sizeof(DdsPixelFormat))
+        {
+            return Fail(error, DdsError::BadHeader);
+        }
+
+        layout->mWidth = header.width;
+        layout->mHeight = header.height;
+        layout->mDepth = (header.flags & kDdsHeaderFlagsVolume) ? header.depth : 1;
+        layout->mMipCount = (std::max)(header.mipMapCount, 1u);
+        layout->mArraySize = 1;
+        layout->mCubeMap = false;
+        layout->mDataOffset = sizeof(uint32_t) + sizeof(DdsHeader);
+        layout->mSubresources.clear();
+
+        if ((header.ddspf.flags & kDdsFourCC) && header.ddspf.fourCC == MakeFourCC('D', 'X', '1', '0'))
+        {
+            DdsHeaderDxt10 dxt10;
+            if (size < layout->mDataOffset + sizeof(dxt10))
+            {
+                return Fail(error, DdsError::TooSmall);
+            }
+            memcpy(&dxt10, data + layout->mDataOffset, sizeof(dxt10));
+            layout->mDataOffset += sizeof(dxt10);
+
+            layout->mFormat = dxt10.dxgiFormat;
+            layout->mArraySize = dxt10.arraySize;
+            if (layout->mArraySize == 0)
+            {
+                return Fail(error, DdsError::InvalidSize);
+            }
+
+            switch (dxt10.resourceDimension)
+            {
+            case 2:
+                // D3DX writes 1D textures with a height of 1
+                if ((header.flags & kDdsHeaderFlagsHeight) && header.height != 1)
+                {
+                    return Fail(error, DdsError::BadHeader);
+                }
+                layout->mDimension = DdsDimension::Texture1D;
+                layout->mHeight = 1;
+                layout->mDepth = 1;
+                break;
+            case 3:
+                layout->mDimension = DdsDimension::Texture2D;
+                layout->mDepth = 1;
+                if (dxt10.miscFlag & kResourceMiscTextureCube)
+                {
+                    // Six faces of up to the largest array size cannot overflow
+                    if (layout->mArraySize > kMaxArraySize)
+                    {
+                        return Fail(error, DdsError::TooLarge);
+                    }
+                    layout->mArraySize *= 6;
+                    layout->mCubeMap = true;
+                }
+                break;
+            case 4:
+                if (!(header.flags & kDdsHeaderFlagsVolume))
+                {
+                    return Fail(error, DdsError::BadHeader);
+                }
+                layout->mDimension = DdsDimension::Texture3D;
+                break;
+            default:
+                return Fail(error, DdsError::UnsupportedDimension);
+            }
+        }
+        else
+        {
+            layout->mFormat = GetLegacyFormat(header.ddspf);
+            if (header.flags & kDdsHeaderFlagsVolume)
+            {
+                layout->mDimension = DdsDimension::Texture3D;
+            }
+            else
+            {
+                layout->mDimension = DdsDimension::Texture2D;
+                layout->mDepth = 1;
+                if (header.caps2 & kDdsCubeMap)
+                {
+                    // Partial cube maps are not supported
+                    if ((header.caps2 & kDdsCubeMapAllFaces) != kDdsCubeMapAllFaces)
+                    {
+                        return Fail(error, DdsError::UnsupportedDimension);
+                    }
+                    layout->mArraySize = 6;
+                    layout->mCubeMap = true;
+                }
+            }
+        }
+
+        if (GetDdsBitsPerPixel(layout->mFormat) == 0 || IsPlanarDepthStencil(layout->mFormat))
+        {
+            return Fail(error, DdsError::UnsupportedFormat);
+        }
+
+        const DdsError limitError = CheckLimits(*layout);
+        if (limitError != DdsError::None)
+        {
+            return Fail(error, limitError);
+        }
+
+        // Array slices follow each other, each with all its mips. Every subresource has at least
+        // one byte, so a short file stops this loop long before the count gets large.
+        uint64_t offset = layout->mDataOffset;
+        for (uint32_t slice = 0; slice < layout->mArraySize; ++slice)
+        {
+            uint32_t width = layout->mWidth;
+            uint32_t height = layout->mHeight;
+            uint32_t depth = layout->mDepth;
+            for (uint32_t mip = 0; mip < layout->mMipCount; ++mip)
+            {
+                DdsSubresource subresource;
+                CalcSurfaceSize(width, height, layout->mFormat, &subresource.mRowPitch, &subresource.mNumRows);
+                subresource.mOffset = offset;
+                subresource.mSize = subresource.mRowPitch * subresource.mNumRows * depth;
+                subresource.mWidth = width;
+                subresource.mHeight = height;
+                subresource.mDepth = depth;
+
+                // Sizes are bounded by the limits, far from overflowing
+                offset += subresource.mSize;
+                if (offset > fileSize)
+                {
+                    layout->mSubresources.clear();
+                    return Fail(error, DdsError::Truncated);
+                }
+                layout->mSubresources.push_back(subresource);
+
+                width = (std::max)(width / 2, 1u);
+                height = (std::max)(height / 2, 1u);
+                depth = (std::max)(depth / 2, 1u);
+            }
+        }
+        return true;
+    }
+
+    bool ParseDds(const uint8_t* data, size_t size, DdsLayout* layout, DdsError* error)
+    {
+        return ParseDdsHeader(data, size, size, layout, error);
+    }
+
+    void AppendDdsHeader(uint32_t format, uint32_t width, uint32_t height, uint32_t mipCount, std::vector<uint8_t>* dds)
+    {
+        uint64_t rowPitch = 0;
+        uint32_t numRows = 0;
+        CalcSurfaceSize(width, height, format, &rowPitch, &numRows);
+        const bool blockCompressed = IsDdsBlockCompressed(format);
+
+        DdsHeader header = {};
+        header.size = sizeof(DdsHeader);
+        header.flags = kDdsHeaderFlagsTexture | (blockCompressed ? kDdsHeaderFlagsLinearSize : kDdsHeaderFlagsPitch);
+        header.height = height;
+        header.width = width;
+        header.pitchOrLinearSize = static_cast<uint32_t>(blockCompressed ? rowPitch * numRows : rowPitch);
+        header.mipMapCount = mipCount;
+        header.ddspf.size = sizeof(DdsPixelFormat);
+        header.ddspf.flags = kDdsFourCC;
+        header.ddspf.fourCC = MakeFourCC('D', 'X', '1', '0');
+        header.caps = kDdsSurfaceFlagsTexture;
+        if (mipCount > 1)
+        {
+            header.flags |= kDdsHeaderFlagsMipMap;
+            header.caps |= kDdsSurfaceFlagsMipMap;
+        }
+
+        DdsHeaderDxt10 dx10Header = {};
+        dx10Header.dxgiFormat = format;
+        dx10Header.resourceDimension = kResourceDimensionTexture2D;
+        dx10Header.arraySize = 1;
+
+        const size_t offset = dds->size();
+        dds->resize(offset + sizeof(kDdsMagic) + sizeof(header) + sizeof(dx10Header));
+        uint8_t* dst = dds->data() + offset;
+        memcpy(dst, &kDdsMagic, sizeof(kDdsMagic));
+        memcpy(dst + sizeof(kDdsMagic), &header, sizeof(header));
+        memcpy(dst + sizeof(kDdsMagic) + sizeof(header), &dx10Header, sizeof(dx10Header));
+    }
+}
@@ -0,0 +1,80 @@
+// DdsFile.h
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace Vnm
+{
+    enum class DdsDimension
+    {
+        Texture1D,
+        Texture2D,
+        Texture3D
+    };
+
+    // Why a file was rejected
+    enum class DdsError
+    {
+        None,
+        TooSmall,                           // Shorter than the headers
+        BadMagic,
+        BadHeader,                          // Header sizes or flags that contradict each other
+        UnsupportedFormat,
+        UnsupportedDimension,
+        InvalidSize,                        // Zero sizes, or more mips than the size has
+        TooLarge,                           // Beyond the limits of D3D12 hardware
+        Truncated,                          // Shorter than its subresources
+        Count
+    };
+
+    const char* GetDdsErrorName(DdsError error);
+
+    // Bytes of one subresource in the file, in D3D12 subresource order (mip + slice * mip count)
+    class DdsSubresource
+    {
+    public:
+        uint64_t mOffset;                   // From the start of the file
+        uint64_t mSize;                     // All depth slices
+        uint64_t mRowPitch;                 // Bytes of a row of pixels, or of blocks
+        uint32_t mNumRows;
+        uint32_t mWidth;
+        uint32_t mHeight;
+        uint32_t mDepth;
+    };
+
+    class DdsLayout
+    {
+    public:
+        uint32_t                    mFormat = 0;    // DXGI_FORMAT
+        DdsDimension                mDimension = DdsDimension::Texture2D;
+        uint32_t                    mWidth = 0;
+        uint32_t                    mHeight = 0;
+        uint32_t                    mDepth = 0;
+        uint32_t                    mMipCount = 0;
+        uint32_t                    mArraySize = 0; // Six per cube
+        bool                        mCubeMap = false;
+        uint64_t                    mDataOffset = 0;
+        std::vector<DdsSubresource> mSubresources;
+    };
+
+    // Bits per pixel of a DXGI_FORMAT value, per texel of a 4x4 block if block compressed, or 0
+    // if the format is not supported
+    uint32_t GetDdsBitsPerPixel(uint32_t format);
+    bool IsDdsBlockCompressed(uint32_t format);
+
+    // Parses the header of a DDS file in memory and locates its subresources without a device.
+    // Returns false if the file is not a DDS file the loader would accept, with the reason in
+    // error. Every field is checked before it is used, so any bytes are safe to pass in.
+    bool ParseDds(const uint8_t* data, size_t size, DdsLayout* layout, DdsError* error = nullptr);
+
+    // Same from the start of a file of fileSize bytes, at least the DDS and DX10 headers if there
+    // is one. kDdsMaxHeaderSize bytes are always enough.
+    constexpr size_t kDdsMaxHeaderSize = 148;
+    bool ParseDdsHeader(const uint8_t* data, size_t size, uint64_t fileSize, DdsLayout* layout, DdsError* error = nullptr);
+
+    // Appends the DDS and DX10 headers of a 2D texture, for subresources appended after them
+    void AppendDdsHeader(uint32_t format, uint32_t width, uint32_t height, uint32_t mipCount, std::vector<uint8_t>* dds);
+}
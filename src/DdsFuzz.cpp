@@ -0,0 +1,84 @@
+// DdsFuzz.cpp
+//
+// Built as a libFuzzer target with VNM_DDS_FUZZER defined, e.g.
+//   clang++ -std=c++14 -g -O1 -fsanitize=fuzzer,address,undefined -DVNM_DDS_FUZZER DdsFuzz.cpp DdsFile.cpp -o dds_fuzzer
+
+#include "DdsFuzz.h"
+#include <algorithm>
+#include <cstdlib>
+
+namespace Vnm
+{
+    static bool CheckLayout(const DdsLayout& layout, size_t size)
+    {
+        if (layout.mSubresources.size() != static_cast<size_t>(layout.mMipCount) * layout.mArraySize ||
+            GetDdsBitsPerPixel(layout.mFormat) == 0 ||
+            (layout.mCubeMap && layout.mArraySize % 6 != 0) ||
+            (layout.mDimension != DdsDimension::Texture3D && layout.mDepth != 1))
+        {
+            return false;
+        }
+
+        uint64_t offset = layout.mDataOffset;
+        for (size_t i = 0; i < layout.mSubresources.size(); ++i)
+        {
+            const DdsSubresource& subresource = layout.mSubresources[i];
+            const uint32_t mip = static_cast<uint32_t>(i % layout.mMipCount);
+            if (subresource.mOffset != offset ||
+                subresource.mSize != subresource.mRowPitch * subresource.mNumRows * subresource.mDepth ||
+                subresource.mSize == 0 ||
+                subresource.mWidth != (std::max)(layout.mWidth >> mip, 1u) ||
+                subresource.mHeight != (std::max)(layout.mHeight >> mip, 1u) ||
+                subresource.mDepth != (std::max)(layout.mDepth >> mip, 1u))
+            {
+                return false;
+            }
+            offset += subresource.mSize;
+        }
+        return offset <= size;
+    }
+
+    bool FuzzDdsOnce(const uint8_t* data, size_t size, DdsError* error)
+    {
+        DdsLayout layout;
+        DdsError parseError = DdsError::None;
+        const bool parsed = ParseDds(data, size, &layout, &parseError);
+        if (error != nullptr)
+        {
+            *error = parseError;
+        }
+        if (parsed != (parseError == DdsError::None))
+        {
+            return false;
+        }
+
+        // Planning uploads from the headers alone gives the same answer
+        DdsLayout headerLayout;
+        DdsError headerError = DdsError::None;
+        const bool headerParsed = ParseDdsHeader(data, (std::min)(size, kDdsMaxHeaderSize), size, &headerLayout, &headerError);
+        if (headerParsed != parsed || headerError != parseError)
+        {
+            return false;
+        }
+
+        if (!parsed)
+        {
+            return layout.mSubresources.empty();
+        }
+
+        return CheckLayout(layout, size) &&
+            headerLayout.mSubresources.size() == layout.mSubresources.size() &&
+            headerLayout.mFormat == layout.mFormat;
+    }
+}
+
+#ifdef VNM_DDS_FUZZER
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    if (!Vnm::FuzzDdsOnce(data, size))
+    {
+        abort();
+    }
+    return 0;
+}
+#endif
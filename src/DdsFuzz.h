@@ -0,0 +1,15 @@
+// DdsFuzz.h
+
+#pragma once
+
+#include "DdsFile.h"
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Vnm
+{
+    // Parses arbitrary bytes as a DDS file and checks what the parser returns. Any layout it
+    // accepts has to be the same from the headers alone, and its subresources have to follow each
+    // other inside the file with the sizes their dimensions give. Returns false if a check fails.
+    bool FuzzDdsOnce(const uint8_t* data, size_t size, DdsError* error = nullptr);
+}
@@ -0,0 +1,78 @@
+// DdsUpload.cpp
+
+#include "DdsUpload.h"
+#include <cassert>
+#include <cstring>
+
+namespace Vnm
+{
+    static uint64_t AlignUp(uint64_t value, uint64_t alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    uint64_t CalcDdsUploadFootprint(const DdsSubresource& subresource, DdsUploadFootprint* footprint)
+    {
+        footprint->mOffset = 0;
+        footprint->mRowPitch = AlignUp(subresource.mRowPitch, kUploadRowPitchAlignment);
+        footprint->mRowSize = subresource.mRowPitch;
+        footprint->mNumRows = subresource.mNumRows;
+        footprint->mWidth = subresource.mWidth;
+        footprint->mHeight = subresource.mHeight;
+        footprint->mDepth = subresource.mDepth;
+
+        // The last row needs no padding after it
+        const uint64_t rows = static_cast<uint64_t>(subresource.mNumRows) * subresource.mDepth;
+        return (rows - 1) * footprint->mRowPitch + footprint->mRowSize;
+    }
+
+    uint64_t CalcDdsUploadFootprints(const DdsLayout& layout, std::vector<DdsUploadFootprint>* footprints)
+    {
+        footprints->resize(layout.mSubresources.size());
+        uint64_t size = 0;
+        for (size_t i = 0; i < layout.mSubresources.size(); ++i)
+        {
+            DdsUploadFootprint& footprint = (*footprints)[i];
+            const uint64_t offset = AlignUp(size, kUploadPlacementAlignment);
+            size = offset + CalcDdsUploadFootprint(layout.mSubresources[i], &footprint);
+            footprint.mOffset = offset;
+        }
+        return size;
+    }
+
+    void ExpandRowPitch(uint8_t* data, uint32_t numRows, uint64_t rowSize, uint64_t rowPitch)
+    {
+        assert(rowPitch >= rowSize);
+        if (rowPitch == rowSize || numRows < 2)
+        {
+            return;
+        }
+
+        // Row 0 is already in place
+        for (uint32_t row = numRows - 1; row > 0; --row)
+        {
+            memmove(data + row * rowPitch, data + row * rowSize, static_cast<size_t>(rowSize));
+        }
+    }
+
+    bool ReadDdsSubresources(std::istream& file, const DdsLayout& layout, const std::vector<DdsUploadFootprint>& footprints, uint8_t* upload)
+    {
+        assert(footprints.size() == layout.mSubresources.size());
+        for (size_t i = 0; i < layout.mSubresources.size(); ++i)
+        {
+            const DdsSubresource& subresource = layout.mSubresources[i];
+            const DdsUploadFootprint& footprint = footprints[i];
+            uint8_t* dst = upload + footprint.mOffset;
+
+            file.seekg(static_cast<std::streamoff>(subresource.mOffset));
+            file.read(reinterpret_cast<char*>(dst), static_cast<std::streamsize>(subresource.mSize));
+            if (!file)
+            {
+                return false;
+            }
+
+            ExpandRowPitch(dst, footprint.mNumRows * footprint.mDepth, footprint.mRowSize, footprint.mRowPitch);
+        }
+        return true;
+    }
+}
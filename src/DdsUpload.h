@@ -0,0 +1,44 @@
+// DdsUpload.h
+
+#pragma once
+
+#include "DdsFile.h"
+#include <istream>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace Vnm
+{
+    // Placement alignments of texture data in upload buffers, as required by D3D12
+    constexpr uint64_t kUploadPlacementAlignment = 512;
+    constexpr uint64_t kUploadRowPitchAlignment = 256;
+
+    // Where a subresource goes in an upload buffer, as D3D12_PLACED_SUBRESOURCE_FOOTPRINT
+    class DdsUploadFootprint
+    {
+    public:
+        uint64_t mOffset;                   // From the start of the upload allocation
+        uint64_t mRowPitch;                 // Aligned
+        uint64_t mRowSize;                  // Bytes of a row in the file
+        uint32_t mNumRows;                  // Per depth slice
+        uint32_t mWidth;
+        uint32_t mHeight;
+        uint32_t mDepth;
+    };
+
+    // Footprints of all subresources of layout packed into one allocation, returns its size
+    uint64_t CalcDdsUploadFootprints(const DdsLayout& layout, std::vector<DdsUploadFootprint>* footprints);
+
+    // Footprint of one subresource placed at the start of an allocation, returns its size
+    uint64_t CalcDdsUploadFootprint(const DdsSubresource& subresource, DdsUploadFootprint* footprint);
+
+    // Spreads numRows rows of rowSize bytes, packed at the start of data, to rowPitch apart. Rows
+    // are moved last first, so the spread rows never overwrite rows that have not moved yet.
+    void ExpandRowPitch(uint8_t* data, uint32_t numRows, uint64_t rowSize, uint64_t rowPitch);
+
+    // Reads each subresource of layout from file with one read straight into its footprint in
+    // upload, then moves its rows to the aligned pitch. upload has to hold the size returned by
+    // CalcDdsUploadFootprints.
+    bool ReadDdsSubresources(std::istream& file, const DdsLayout& layout, const std::vector<DdsUploadFootprint>& footprints, uint8_t* upload);
+}
@@ -0,0 +1,143 @@
+// DescriptorAllocator.cpp
+
+#include "DescriptorAllocator.h"
+#include <algorithm>
+#include <cassert>
+
+namespace Vnm
+{
+    void DescriptorAllocator::Init(uint32_t persistentCount, uint32_t frameCount, uint32_t descriptorsPerFrame)
+    {
+        assert(frameCount > 0);
+        mPersistentCount = persistentCount;
+        mFrameCount = frameCount;
+        mDescriptorsPerFrame = descriptorsPerFrame;
+        mFrameIndex = 0;
+        mFrameUsed = 0;
+        mFramePeak = 0;
+        mPersistentUsed = 0;
+        mFreeRanges.clear();
+        if (persistentCount > 0)
+        {
+            DescriptorRange all;
+            all.mIndex = 0;
+            all.mCount = persistentCount;
+            mFreeRanges.push_back(all);
+        }
+        mPendingFrees.assign(frameCount, std::vector<DescriptorRange>());
+    }
+
+    DescriptorRange DescriptorAllocator::AllocatePersistent(uint32_t count)
+    {
+        DescriptorRange range;
+        if (count == 0)
+        {
+            return range;
+        }
+
+        for (size_t i = 0; i < mFreeRanges.size(); ++i)
+        {
+            DescriptorRange& free = mFreeRanges[i];
+            if (free.mCount >= count)
+            {
+                range.mIndex = free.mIndex;
+                range.mCount = count;
+                free.mIndex += count;
+                free.mCount -= count;
+                if (free.mCount == 0)
+                {
+                    mFreeRanges.erase(mFreeRanges.begin() + i);
+                }
+                mPersistentUsed += count;
+                return range;
+            }
+        }
+        return range;
+    }
+
+    void DescriptorAllocator::FreePersistent(const DescriptorRange& range)
+    {
+        if (range.IsValid() && range.mCount > 0)
+        {
+            assert(range.mIndex + range.mCount <= mPersistentCount);
+            mPendingFrees[mFrameIndex].push_back(range);
+        }
+    }
+
+    void DescriptorAllocator::Release(const DescriptorRange& range)
+    {
+        auto next = std::lower_bound(mFreeRanges.begin(), mFreeRanges.end(), range,
+            [](const DescriptorRange& a, const DescriptorRange& b) { return a.mIndex < b.mIndex; });
+        assert(next == mFreeRanges.end() || range.mIndex + range.mCount <= next->mIndex);
+        assert(next == mFreeRanges.begin() || (next - 1)->mIndex + (next - 1)->mCount <= range.mIndex);
+        mPersistentUsed -= range.mCount;
+
+        // Merge with the free ranges on either side
+        const bool joinsPrevious = next != mFreeRanges.begin() && (next - 1)->mIndex + (next - 1)->mCount == range.mIndex;
+        const bool joinsNext = next != mFreeRanges.end() && range.mIndex + range.mCount == next->mIndex;
+        if (joinsPrevious && joinsNext)
+        {
+            (next - 1)->mCount += range.mCount + next->mCount;
+            mFreeRanges.erase(next);
+        }
+        else if (joinsPrevious)
+        {
+            (next - 1)->mCount += range.mCount;
+        }
+        else if (joinsNext)
+        {
+            next->mIndex = range.mIndex;
+            next->mCount += range.mCount;
+        }
+        else
+        {
+            mFreeRanges.insert(next, range);
+        }
+    }
+
+    void DescriptorAllocator::BeginFrame(uint32_t frameIndex)
+    {
+        assert(frameIndex < mFrameCount);
+        mFrameIndex = frameIndex;
+        mFrameUsed = 0;
+        for (const DescriptorRange& range : mPendingFrees[frameIndex])
+        {
+            Release(range);
+        }
+        mPendingFrees[frameIndex].clear();
+    }
+
+    DescriptorRange DescriptorAllocator::AllocateFrame(uint32_t count)
+    {
+        DescriptorRange range;
+        if (count > 0 && count <= mDescriptorsPerFrame - mFrameUsed)
+        {
+            range.mIndex = mPersistentCount + mFrameIndex * mDescriptorsPerFrame + mFrameUsed;
+            range.mCount = count;
+            mFrameUsed += count;
+            mFramePeak = (std::max)(mFramePeak, mFrameUsed);
+        }
+        return range;
+    }
+
+    void DescriptorAllocator::CalcStats(DescriptorAllocatorStats* stats) const
+    {
+        *stats = DescriptorAllocatorStats();
+        stats->mPersistentUsed = mPersistentUsed;
+        stats->mFreeRanges = static_cast<uint32_t>(mFreeRanges.size());
+        for (const DescriptorRange& range : mFreeRanges)
+        {
+            stats->mPersistentFree += range.mCount;
+            stats->mLargestFreeRange = (std::max)(stats->mLargestFreeRange, range.mCount);
+        }
+        for (const auto& pending : mPendingFrees)
+        {
+            for (const DescriptorRange& range : pending)
+            {
+                stats->mPendingFree += range.mCount;
+            }
+        }
+        stats->mFrameUsed = mFrameUsed;
+        stats->mFramePeak = mFramePeak;
+    }
+}
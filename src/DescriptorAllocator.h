@@ -0,0 +1,79 @@
+// DescriptorAllocator.h
+
+#pragma once
+
+#include "Material.h"
+#include <stdint.h>
+#include <vector>
+
+namespace Vnm
+{
+    // Consecutive descriptors of a heap, by index from its start
+    class DescriptorRange
+    {
+    public:
+        uint32_t mIndex = InvalidIndex;
+        uint32_t mCount = 0;
+
+        bool IsValid() const { return mIndex != InvalidIndex; }
+    };
+
+    class DescriptorAllocatorStats
+    {
+    public:
+        uint32_t mPersistentUsed = 0;       // Including frees that wait for the GPU
+        uint32_t mPersistentFree = 0;       // Released, not counting frees that wait for the GPU
+        uint32_t mPendingFree = 0;
+        uint32_t mFreeRanges = 0;
+        uint32_t mLargestFreeRange = 0;
+        uint32_t mFrameUsed = 0;            // Of the current frame
+        uint32_t mFramePeak = 0;            // Most any frame has used
+
+        // Fraction of the free descriptors outside the largest free range
+        float CalcFragmentation() const
+        {
+            return mPersistentFree > 0 ? 1.0f - static_cast<float>(mLargestFreeRange) / mPersistentFree : 0.0f;
+        }
+    };
+
+    // Index bookkeeping of a shader visible descriptor heap, without a device. The start of the heap
+    // holds persistent ranges, which keep their index until freed so that shaders can index them,
+    // found first fit in index order from a sorted list of free ranges. Each frame in flight has a
+    // region of its own after them, allocated linearly and reset when the frame comes around again.
+    class DescriptorAllocator
+    {
+    public:
+        void Init(uint32_t persistentCount, uint32_t frameCount, uint32_t descriptorsPerFrame);
+
+        uint32_t GetHeapSize() const { return mPersistentCount + mFrameCount * mDescriptorsPerFrame; }
+
+        // Invalid range if no free range is long enough
+        DescriptorRange AllocatePersistent(uint32_t count);
+
+        // The GPU may still read the range in frames already submitted, so it is only reused after
+        // BeginFrame has come back to the current frame
+        void FreePersistent(const DescriptorRange& range);
+
+        // Starts frame frameIndex, in [0, frameCount), once the GPU has finished with its previous
+        // use. Empties its region and releases the ranges freed during that use.
+        void BeginFrame(uint32_t frameIndex);
+
+        // Valid until the next BeginFrame of the same frame index, invalid if the region is full
+        DescriptorRange AllocateFrame(uint32_t count);
+
+        void CalcStats(DescriptorAllocatorStats* stats) const;
+
+    private:
+        void Release(const DescriptorRange& range);
+
+        uint32_t                                  mPersistentCount = 0;
+        uint32_t                                  mFrameCount = 0;
+        uint32_t                                  mDescriptorsPerFrame = 0;
+        uint32_t                                  mFrameIndex = 0;
+        uint32_t                                  mFrameUsed = 0;
+        uint32_t                                  mFramePeak = 0;
+        uint32_t                                  mPersistentUsed = 0;
+        std::vector<DescriptorRange>              mFreeRanges;      // Sorted by index, never adjacent
+        std::vector<std::vector<DescriptorRange>> mPendingFrees;    // Per frame index
+    };
+}
@@ -0,0 +1,159 @@
+// FrameTimer.cpp
+
+#include "FrameTimer.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <fstream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <chrono>
+#endif
+
+namespace Vnm
+{
+#ifdef _WIN32
+    uint64_t GetClockTicks()
+    {
+        LARGE_INTEGER counter;
+        QueryPerformanceCounter(&counter);
+        return static_cast<uint64_t>(counter.QuadPart);
+    }
+
+    uint64_t GetClockFrequency()
+    {
+        // Fixed at boot
+        static const uint64_t frequency = []()
+        {
+            LARGE_INTEGER value;
+            QueryPerformanceFrequency(&value);
+            return static_cast<uint64_t>(value.QuadPart);
+        }();
+        return frequency;
+    }
+#else
+    uint64_t GetClockTicks()
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    uint64_t GetClockFrequency()
+    {
+        return 1000000000;
+    }
+#endif
+
+    double TicksToSeconds(uint64_t ticks)
+    {
+        return static_cast<double>(ticks) / static_cast<double>(GetClockFrequency());
+    }
+
+    void FrameTimeHistory::Add(double seconds)
+    {
+        if (mTimes.size() < kCapacity)
+        {
+            mTimes.push_back(seconds);
+            return;
+        }
+
+        mTimes[mNext] = seconds;
+        mNext = (mNext + 1) % kCapacity;
+    }
+
+    void FrameTimeHistory::Clear()
+    {
+        mTimes.clear();
+        mNext = 0;
+    }
+
+    void FrameTimeHistory::CalcStats(FrameTimeStats* stats) const
+    {
+        *stats = FrameTimeStats();
+        stats->mFrames = mTimes.size();
+        if (mTimes.empty())
+        {
+            return;
+        }
+
+        std::vector<double> sorted(mTimes);
+        std::sort(sorted.begin(), sorted.end());
+
+        double total = 0.0;
+        for (double time : sorted)
+        {
+            total += time;
+        }
+
+        auto percentile = [&](double fraction)
+        {
+            size_t rank = static_cast<size_t>(ceil(fraction * sorted.size()));
+            return sorted[(std::max)(rank, size_t(1)) - 1];
+        };
+
+        stats->mAverage = total / sorted.size();
+        stats->mP50 = percentile(0.50);
+        stats->mP95 = percentile(0.95);
+        stats->mP99 = percentile(0.99);
+        stats->mMax = sorted.back();
+    }
+
+    FixedTimestep::FixedTimestep(double stepSeconds, uint32_t maxSteps)
+        : mStep(stepSeconds)
+        , mMaxSteps(maxSteps)
+    {
+        assert(stepSeconds > 0.0 && maxSteps > 0);
+    }
+
+    uint32_t FixedTimestep::Advance(double frameSeconds)
+    {
+        mAccumulated += (std::max)(frameSeconds, 0.0);
+        uint32_t steps = static_cast<uint32_t>(mAccumulated / mStep);
+        if (steps > mMaxSteps)
+        {
+            steps = mMaxSteps;
+            mAccumulated = mStep * steps;
+        }
+
+        mAccumulated = (std::max)(mAccumulated - mStep * steps, 0.0);
+        return steps;
+    }
+
+    void FrameLog::SetColumns(const char* const* names, size_t count)
+    {
+        mColumns.assign(names, names + count);
+        mValues.clear();
+    }
+
+    void FrameLog::AddRow(const double* values)
+    {
+        mValues.insert(mValues.end(), values, values + mColumns.size());
+    }
+
+    bool FrameLog::WriteCsv(const char* fileName) const
+    {
+        std::ofstream file(fileName, std::ios::out | std::ios::trunc);
+        if (!file)
+        {
+            return false;
+        }
+
+        for (size_t column = 0; column < mColumns.size(); ++column)
+        {
+            file << (column > 0 ? "," : "") << mColumns[column];
+        }
+        file << "\n";
+
+        for (size_t row = 0; row < GetRowCount(); ++row)
+        {
+            for (size_t column = 0; column < mColumns.size(); ++column)
+            {
+                file << (column > 0 ? "," : "") << mValues[row * mColumns.size() + column];
+            }
+            file << "\n";
+        }
+        return static_cast<bool>(file);
+    }
+}
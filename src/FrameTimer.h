@@ -0,0 +1,81 @@
+// FrameTimer.h
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace Vnm
+{
+    // Monotonic high resolution clock, QueryPerformanceCounter on Windows
+    uint64_t GetClockTicks();
+    uint64_t GetClockFrequency();           // Ticks per second
+    double TicksToSeconds(uint64_t ticks);
+
+    class FrameTimeStats
+    {
+    public:
+        size_t mFrames = 0;
+        double mAverage = 0.0;              // Seconds
+        double mP50 = 0.0;
+        double mP95 = 0.0;
+        double mP99 = 0.0;
+        double mMax = 0.0;
+    };
+
+    // Durations of the most recent frames
+    class FrameTimeHistory
+    {
+    public:
+        static const size_t kCapacity = 1024;
+
+        void Add(double seconds);
+        void Clear();
+
+        // Nearest rank percentiles over the frames in the history
+        void CalcStats(FrameTimeStats* stats) const;
+
+        size_t GetCount() const { return mTimes.size(); }
+
+    private:
+        std::vector<double> mTimes;
+        size_t              mNext = 0;
+    };
+
+    // Splits frame time into fixed steps for updates that should not depend on the frame rate. What
+    // is left over is the fraction of a step to interpolate the last two steps by.
+    class FixedTimestep
+    {
+    public:
+        // Frames longer than maxSteps steps drop the rest, so a stall does not have to be caught up
+        FixedTimestep(double stepSeconds, uint32_t maxSteps);
+
+        // Returns the number of steps to run this frame
+        uint32_t Advance(double frameSeconds);
+
+        double GetStep() const { return mStep; }
+        float GetAlpha() const { return static_cast<float>(mAccumulated / mStep); }
+
+    private:
+        double   mStep;
+        uint32_t mMaxSteps;
+        double   mAccumulated = 0.0;
+    };
+
+    // Per frame values in named columns, written as CSV for spreadsheets and plotting
+    class FrameLog
+    {
+    public:
+        void SetColumns(const char* const* names, size_t count);
+        void AddRow(const double* values);  // One value per column
+        bool WriteCsv(const char* fileName) const;
+
+        size_t GetRowCount() const { return mColumns.empty() ? 0 : mValues.size() / mColumns.size(); }
+
+    private:
+        std::vector<std::string> mColumns;
+        std::vector<double>      mValues;
+    };
+}
@@ -0,0 +1,127 @@
+// GpuTimer.cpp
+
+#include "GpuTimer.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <cassert>
+
+namespace Vnm
+{
+    static uint32_t QueryIndex(uint32_t frameSlot, uint32_t zone)
+    {
+        return 2 * (frameSlot * GpuTimer::kMaxZonesPerFrame + zone);
+    }
+
+    void GpuTimer::BeginFrame(GpuTimerBackend* backend)
+    {
+        assert(!mInFrame && backend != nullptr);
+        mpBackend = backend;
+
+        const uint32_t frameSlot = static_cast<uint32_t>(mFrame % kFramesInFlight);
+        if (mFrames[frameSlot].mResolved)
+        {
+            ReadResults(frameSlot);
+        }
+
+        mFrames[frameSlot].mCount = 0;
+        mFrames[frameSlot].mResolved = false;
+        mInFrame = true;
+    }
+
+    void GpuTimer::EndFrame()
+    {
+        assert(mInFrame);
+        const uint32_t frameSlot = static_cast<uint32_t>(mFrame % kFramesInFlight);
+        FrameZones& frame = mFrames[frameSlot];
+        if (frame.mCount > 0)
+        {
+            mpBackend->ResolveQueries(QueryIndex(frameSlot, 0), 2 * frame.mCount);
+            frame.mResolved = true;
+        }
+
+        mInFrame = false;
+        mFrame++;
+    }
+
+    uint32_t GpuTimer::BeginZone(const char* name)
+    {
+        const uint32_t frameSlot = static_cast<uint32_t>(mFrame % kFramesInFlight);
+        FrameZones& frame = mFrames[frameSlot];
+        if (!mInFrame || frame.mCount == kMaxZonesPerFrame)
+        {
+            return kInvalidZone;
+        }
+
+        const uint32_t zone = frame.mCount++;
+        frame.mNames[zone] = name;
+        mpBackend->WriteTimestamp(QueryIndex(frameSlot, zone));
+        return zone;
+    }
+
+    void GpuTimer::EndZone(uint32_t zone)
+    {
+        if (zone == kInvalidZone || !mInFrame)
+        {
+            return;
+        }
+
+        const uint32_t frameSlot = static_cast<uint32_t>(mFrame % kFramesInFlight);
+        assert(zone < mFrames[frameSlot].mCount);
+        mpBackend->WriteTimestamp(QueryIndex(frameSlot, zone) + 1);
+    }
+
+    GpuZoneStats& GpuTimer::FindStats(const char* name)
+    {
+        for (GpuZoneStats& stats : mStats)
+        {
+            if (stats.mName == name)
+            {
+                return stats;
+            }
+        }
+
+        mStats.emplace_back();
+        mStats.back().mName = name;
+        return mStats.back();
+    }
+
+    void GpuTimer::ReadResults(uint32_t frameSlot)
+    {
+        const FrameZones& frame = mFrames[frameSlot];
+        uint64_t timestamps[2 * kMaxZonesPerFrame];
+        mpBackend->ReadQueries(QueryIndex(frameSlot, 0), 2 * frame.mCount, timestamps);
+
+        const uint64_t frequency = mpBackend->GetFrequency();
+        if (frequency == 0)
+        {
+            return;
+        }
+
+        // GPU ticks relative to a moment both clocks were read at, scaled to the CPU clock
+        uint64_t gpuReference = 0;
+        uint64_t cpuReference = 0;
+        const bool calibrated = mpTrack != nullptr && mpBackend->GetCalibration(&gpuReference, &cpuReference);
+        const double gpuToCpu = static_cast<double>(GetClockFrequency()) / static_cast<double>(frequency);
+        auto toCpuTicks = [&](uint64_t gpuTicks)
+        {
+            double offset = static_cast<double>(static_cast<int64_t>(gpuTicks - gpuReference)) * gpuToCpu;
+            return static_cast<uint64_t>(static_cast<int64_t>(cpuReference) + static_cast<int64_t>(offset));
+        };
+
+        for (uint32_t zone = 0; zone < frame.mCount; ++zone)
+        {
+            const uint64_t begin = timestamps[2 * zone];
+            const uint64_t end = (std::max)(timestamps[2 * zone + 1], begin);
+            const double seconds = static_cast<double>(end - begin) / static_cast<double>(frequency);
+
+            GpuZoneStats& stats = FindStats(frame.mNames[zone]);
+            stats.mLastMs = seconds * 1000.0;
+            stats.mHistory.Add(seconds);
+
+            if (calibrated)
+            {
+                RecordProfileEvent(mpTrack, frame.mNames[zone], toCpuTicks(begin), toCpuTicks(end));
+            }
+        }
+    }
+}
@@ -0,0 +1,100 @@
+// GpuTimer.h
+
+#pragma once
+
+#include "FrameTimer.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace Vnm
+{
+    class ProfileTrack;
+
+    // Timestamp queries of a graphics API. Queries of a frame are resolved into that frame's range
+    // of a readback buffer, which is read once the frame has finished on the GPU.
+    class GpuTimerBackend
+    {
+    public:
+        virtual ~GpuTimerBackend() = default;
+
+        virtual void WriteTimestamp(uint32_t query) = 0;
+        virtual void ResolveQueries(uint32_t first, uint32_t count) = 0;
+        virtual void ReadQueries(uint32_t first, uint32_t count, uint64_t* timestamps) = 0;
+
+        virtual uint64_t GetFrequency() = 0;
+
+        // A GPU timestamp and the GetClockTicks value at the same moment
+        virtual bool GetCalibration(uint64_t* gpuTicks, uint64_t* cpuTicks) = 0;
+    };
+
+    class GpuZoneStats
+    {
+    public:
+        const char*      mName = nullptr;
+        double           mLastMs = 0.0;
+        FrameTimeHistory mHistory;          // In seconds
+    };
+
+    // Times passes on the GPU with a begin and end timestamp each. Every frame in flight has its own
+    // range of kMaxZonesPerFrame query pairs, so a frame's results are read when its range comes
+    // around again, kFramesInFlight frames later. The caller has to make sure the GPU is done with
+    // that frame by then. Zones past the limit of a frame are not timed.
+    class GpuTimer
+    {
+    public:
+        static const uint32_t kMaxZonesPerFrame = 32;
+        static const uint32_t kFramesInFlight = 3;
+        static const uint32_t kQueryCount = 2 * kMaxZonesPerFrame * kFramesInFlight;
+
+        // Reads back the results of the frame whose queries are about to be reused
+        void BeginFrame(GpuTimerBackend* backend);
+        void EndFrame();
+
+        // Zones can nest. Names have to outlive the timer, zones are matched by the pointer.
+        uint32_t BeginZone(const char* name);
+        void EndZone(uint32_t zone);
+
+        // Results are also added to this profiler track, moved to the CPU clock
+        void SetProfileTrack(ProfileTrack* track) { mpTrack = track; }
+
+        const std::vector<GpuZoneStats>& GetStats() const { return mStats; }
+        uint64_t GetFrame() const { return mFrame; }
+
+        static const uint32_t kInvalidZone = 0xffffffff;
+
+    private:
+        class FrameZones
+        {
+        public:
+            const char* mNames[kMaxZonesPerFrame];
+            uint32_t    mCount = 0;
+            bool        mResolved = false;
+        };
+
+        void ReadResults(uint32_t frameSlot);
+        GpuZoneStats& FindStats(const char* name);
+
+        GpuTimerBackend* mpBackend = nullptr;
+        FrameZones       mFrames[kFramesInFlight];
+        uint64_t         mFrame = 0;
+        bool             mInFrame = false;
+        ProfileTrack*    mpTrack = nullptr;
+        std::vector<GpuZoneStats> mStats;
+    };
+
+    // Times the scope on the GPU
+    class GpuZone
+    {
+    public:
+        GpuZone(GpuTimer& timer, const char* name) : mTimer(timer), mZone(timer.BeginZone(name)) {}
+        ~GpuZone() { mTimer.EndZone(mZone); }
+
+        GpuZone(const GpuZone&) = delete;
+        GpuZone& operator=(const GpuZone&) = delete;
+
+    private:
+        GpuTimer& mTimer;
+        uint32_t  mZone;
+    };
+}
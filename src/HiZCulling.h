@@ -0,0 +1,120 @@
+// HiZCulling.h
+
+// Hierarchical-Z culling math shared by the CPU (HiZPyramid) and the GPU culling pass (hiz.hlsl).
+// Only uses the subset of C++ and HLSL that means the same in both.
+//
+// Pyramid level 0 is the depth buffer itself, level n has size max(1, size0 >> n) and holds the
+// max depth of its 2x2 footprint in level n - 1. The last texel of an odd-sized level also takes
+// the extra row/column, so a level 0 texel at x always maps to min(x >> n, sizeN - 1).
+
+#ifdef __cplusplus
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+
+namespace Vnm
+{
+typedef uint32_t uint;
+#define HIZ_INLINE inline
+#define HIZ_OUT(type) type&
+#else
+#define HIZ_INLINE
+#define HIZ_OUT(type) out type
+#endif
+
+HIZ_INLINE uint HiZMinU(uint a, uint b) { return a < b ? a : b; }
+HIZ_INLINE uint HiZMaxU(uint a, uint b) { return a > b ? a : b; }
+HIZ_INLINE float HiZMaxF(float a, float b) { return a > b ? a : b; }
+
+HIZ_INLINE uint HiZLevelSize(uint size0, uint level)
+{
+    return HiZMaxU(size0 >> level, 1u);
+}
+
+// Last source texel read by destination texel coord, the first one is 2 * coord
+HIZ_INLINE uint HiZFootprintEnd(uint coord, uint sourceSize, uint destSize)
+{
+    return coord + 1 == destSize ? sourceSize - 1 : HiZMinU(2 * coord + 1, sourceSize - 1);
+}
+
+// Screen space tangent slopes (x / z) of a view space sphere along one axis, requires z > radius
+HIZ_INLINE void HiZTangentSlopes(float c, float z, float radius, HIZ_OUT(float) minSlope, HIZ_OUT(float) maxSlope)
+{
+    float t = sqrt(c * c + z * z - radius * radius);
+    minSlope = (c * t - z * radius) / (c * radius + z * t);
+    maxSlope = (c * t + z * radius) / (z * t - c * radius);
+}
+
+// Projects a left-handed view space sphere to a [0, 1] screen rectangle (v pointing down) and the
+// depth of its nearest point. Returns false if the sphere crosses the near plane, in which case it
+// must be treated as visible.
+HIZ_INLINE bool HiZProjectSphere(
+    float cx, float cy, float cz, float radius,
+    float projScaleX, float projScaleY, float projZScale, float projZOffset, float nearZ,
+    HIZ_OUT(float) minU, HIZ_OUT(float) minV, HIZ_OUT(float) maxU, HIZ_OUT(float) maxV, HIZ_OUT(float) nearestDepth)
+{
+    minU = 0.0f;
+    minV = 0.0f;
+    maxU = 1.0f;
+    maxV = 1.0f;
+    nearestDepth = 0.0f;
+
+    if (cz - radius < nearZ)
+    {
+        return false;
+    }
+
+    float minX;
+    float maxX;
+    float minY;
+    float maxY;
+    HiZTangentSlopes(cx, cz, radius, minX, maxX);
+    HiZTangentSlopes(cy, cz, radius, minY, maxY);
+
+    minU = 0.5f + 0.5f * projScaleX * minX;
+    maxU = 0.5f + 0.5f * projScaleX * maxX;
+    minV = 0.5f - 0.5f * projScaleY * maxY;
+    maxV = 0.5f - 0.5f * projScaleY * minY;
+    nearestDepth = projZScale + projZOffset / (cz - radius);
+    return true;
+}
+
+HIZ_INLINE bool HiZRectOffscreen(float minU, float minV, float maxU, float maxV)
+{
+    return maxU < 0.0f || maxV < 0.0f || minU > 1.0f || minV > 1.0f;
+}
+
+// Level 0 texel under a screen coordinate, clamped to the screen
+HIZ_INLINE uint HiZTexelCoord(float u, uint size0)
+{
+    float texel = u * size0;
+    return texel <= 0.0f ? 0u : HiZMinU(uint(texel), size0 - 1);
+}
+
+// Finest level at which the level 0 texel rectangle [x0, x1] x [y0, y1] touches at most 2x2 texels
+HIZ_INLINE uint HiZSelectLevel(uint x0, uint y0, uint x1, uint y1, uint firstLevel, uint levelCount)
+{
+    uint size = HiZMaxU(x1 - x0, y1 - y0) + 1;
+    uint level = firstLevel;
+    while ((1u << level) < size && level + 1 < levelCount)
+    {
+        level++;
+    }
+    return level;
+}
+
+HIZ_INLINE uint HiZLevelTexel(uint coord0, uint size0, uint level)
+{
+    return HiZMinU(coord0 >> level, HiZLevelSize(size0, level) - 1);
+}
+
+// Conservative test against the max depth of the texels covering the rectangle
+HIZ_INLINE bool HiZIsVisible(float nearestDepth, float depth00, float depth10, float depth01, float depth11)
+{
+    return nearestDepth <= HiZMaxF(HiZMaxF(depth00, depth10), HiZMaxF(depth01, depth11));
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,104 @@
+// HiZPyramid.cpp
+
+#include "HiZPyramid.h"
+#include "HiZCulling.h"
+#include <algorithm>
+#include <cassert>
+
+namespace Vnm
+{
+    uint32_t HiZPyramid::GetLevelWidth(uint32_t level) const
+    {
+        return HiZLevelSize(mWidth, level);
+    }
+
+    uint32_t HiZPyramid::GetLevelHeight(uint32_t level) const
+    {
+        return HiZLevelSize(mHeight, level);
+    }
+
+    void HiZPyramid::Build(const float* depth, uint32_t width, uint32_t height)
+    {
+        assert(width > 0 && height > 0);
+        mWidth = width;
+        mHeight = height;
+
+        uint32_t levelCount = 1;
+        while ((std::max)(width, height) >> levelCount)
+        {
+            levelCount++;
+        }
+
+        mLevels.resize(levelCount);
+        mLevels[0].assign(depth, depth + size_t(width) * height);
+
+        for (uint32_t level = 1; level < levelCount; ++level)
+        {
+            const uint32_t sourceWidth = GetLevelWidth(level - 1);
+            const uint32_t sourceHeight = GetLevelHeight(level - 1);
+            const uint32_t destWidth = GetLevelWidth(level);
+            const uint32_t destHeight = GetLevelHeight(level);
+            const float* source = mLevels[level - 1].data();
+            mLevels[level].resize(size_t(destWidth) * destHeight);
+            float* dest = mLevels[level].data();
+
+            for (uint32_t y = 0; y < destHeight; ++y)
+            {
+                uint32_t endY = HiZFootprintEnd(y, sourceHeight, destHeight);
+                for (uint32_t x = 0; x < destWidth; ++x)
+                {
+                    uint32_t endX = HiZFootprintEnd(x, sourceWidth, destWidth);
+                    float maxDepth = 0.0f;
+                    for (uint32_t sourceY = 2 * y; sourceY <= endY; ++sourceY)
+                    {
+                        for (uint32_t sourceX = 2 * x; sourceX <= endX; ++sourceX)
+                        {
+                            maxDepth = (std::max)(maxDepth, source[sourceY * sourceWidth + sourceX]);
+                        }
+                    }
+                    dest[y * destWidth + x] = maxDepth;
+                }
+            }
+        }
+    }
+
+    bool HiZPyramid::TestSphere(const Float3& viewCenter, float radius, const HiZProjection& projection) const
+    {
+        float minU;
+        float minV;
+        float maxU;
+        float maxV;
+        float nearestDepth;
+        if (!HiZProjectSphere(viewCenter.x, viewCenter.y, viewCenter.z, radius,
+            projection.mScaleX, projection.mScaleY, projection.mZScale, projection.mZOffset, projection.mNearZ,
+            minU, minV, maxU, maxV, nearestDepth))
+        {
+            return true;
+        }
+
+        if (HiZRectOffscreen(minU, minV, maxU, maxV))
+        {
+            return false;
+        }
+
+        uint32_t x0 = HiZTexelCoord(minU, mWidth);
+        uint32_t y0 = HiZTexelCoord(minV, mHeight);
+        uint32_t x1 = HiZTexelCoord(maxU, mWidth);
+        uint32_t y1 = HiZTexelCoord(maxV, mHeight);
+        uint32_t level = HiZSelectLevel(x0, y0, x1, y1, 0, GetLevelCount());
+
+        const uint32_t levelWidth = GetLevelWidth(level);
+        const float* depth = GetLevel(level);
+        uint32_t levelX0 = HiZLevelTexel(x0, mWidth, level);
+        uint32_t levelY0 = HiZLevelTexel(y0, mHeight, level);
+        uint32_t levelX1 = HiZLevelTexel(x1, mWidth, level);
+        uint32_t levelY1 = HiZLevelTexel(y1, mHeight, level);
+        assert(levelX1 - levelX0 <= 1 && levelY1 - levelY0 <= 1);
+
+        return HiZIsVisible(nearestDepth,
+            depth[levelY0 * levelWidth + levelX0],
+            depth[levelY0 * levelWidth + levelX1],
+            depth[levelY1 * levelWidth + levelX0],
+            depth[levelY1 * levelWidth + levelX1]);
+    }
+}
@@ -0,0 +1,42 @@
+// HiZPyramid.h
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include "MathTypes.h"
+
+namespace Vnm
+{
+    // Projection terms needed to test view space spheres, taken from an XMMatrixPerspectiveFovLH
+    // style matrix: mScaleX = _11, mScaleY = _22, mZScale = _33, mZOffset = _43
+    class HiZProjection
+    {
+    public:
+        float mScaleX = 1.0f;
+        float mScaleY = 1.0f;
+        float mZScale = 1.0f;
+        float mZOffset = 0.0f;
+        float mNearZ = 0.0f;
+    };
+
+    // CPU max-depth pyramid built with the same rules as the GPU downsample pass, see HiZCulling.h
+    class HiZPyramid
+    {
+    public:
+        void Build(const float* depth, uint32_t width, uint32_t height);
+
+        // False only if the sphere is off screen or behind the depth buffer
+        bool TestSphere(const Float3& viewCenter, float radius, const HiZProjection& projection) const;
+
+        uint32_t     GetLevelCount() const { return static_cast<uint32_t>(mLevels.size()); }
+        uint32_t     GetLevelWidth(uint32_t level) const;
+        uint32_t     GetLevelHeight(uint32_t level) const;
+        const float* GetLevel(uint32_t level) const { return mLevels[level].data(); }
+
+    private:
+        uint32_t                        mWidth = 0;
+        uint32_t                        mHeight = 0;
+        std::vector<std::vector<float>> mLevels;
+    };
+}
@@ -0,0 +1,60 @@
+// ImageDecoder.cpp
+
+#include "ImageDecoder.h"
+#include "FrameTimer.h"
+#include "ThreadPool.h"
+#include "stb_image.h"
+
+namespace Vnm
+{
+    bool DecodeImage(const EncodedImage& image, DecodedImage* decoded)
+    {
+        decoded->mPixels.clear();
+        decoded->mWidth = 0;
+        decoded->mHeight = 0;
+        if (image.mpData == nullptr || image.mSize == 0 || image.mSize > INT32_MAX)
+        {
+            return false;
+        }
+
+        int width = 0;
+        int height = 0;
+        int channels = 0;
+        stbi_uc* pixels = stbi_load_from_memory(image.mpData, static_cast<int>(image.mSize), &width, &height, &channels, 4);
+        if (pixels == nullptr)
+        {
+            return false;
+        }
+
+        if (width > 0 && height > 0)
+        {
+            decoded->mWidth = static_cast<uint32_t>(width);
+            decoded->mHeight = static_cast<uint32_t>(height);
+            decoded->mPixels.assign(pixels, pixels + static_cast<size_t>(width) * height * 4);
+        }
+        stbi_image_free(pixels);
+        return !decoded->mPixels.empty();
+    }
+
+    void DecodeImages(const EncodedImage* images, size_t count, ThreadPool* pool, DecodedImage* decoded, ImageDecodeStats* stats)
+    {
+        const uint64_t start = GetClockTicks();
+        ParallelFor(pool, count, 1, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                DecodeImage(images[i], &decoded[i]);
+            }
+        });
+
+        *stats = ImageDecodeStats();
+        stats->mImages = count;
+        for (size_t i = 0; i < count; ++i)
+        {
+            stats->mFailed += decoded[i].mPixels.empty() ? 1 : 0;
+            stats->mEncodedBytes += images[i].mSize;
+            stats->mDecodedBytes += decoded[i].mPixels.size();
+        }
+        stats->mMs = TicksToSeconds(GetClockTicks() - start) * 1000.0;
+    }
+}
@@ -0,0 +1,54 @@
+// ImageDecoder.h
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace Vnm
+{
+    class ThreadPool;
+
+    // PNG, JPEG or other stb_image file in memory. Images inside a glTF buffer point into it,
+    // images read from elsewhere keep a copy.
+    class EncodedImage
+    {
+    public:
+        const uint8_t*       mpData = nullptr;
+        size_t               mSize = 0;
+        std::vector<uint8_t> mOwnedData;
+
+        void Copy(const uint8_t* data, size_t size)
+        {
+            mOwnedData.assign(data, data + size);
+            mpData = mOwnedData.data();
+            mSize = size;
+        }
+    };
+
+    class DecodedImage
+    {
+    public:
+        std::vector<uint8_t> mPixels;       // RGBA8, rows packed
+        uint32_t             mWidth = 0;
+        uint32_t             mHeight = 0;
+    };
+
+    class ImageDecodeStats
+    {
+    public:
+        size_t   mImages = 0;
+        size_t   mFailed = 0;
+        uint64_t mEncodedBytes = 0;
+        uint64_t mDecodedBytes = 0;
+        double   mMs = 0.0;
+    };
+
+    // Decodes to RGBA8 whatever the channels of the file. Returns false and leaves decoded empty if
+    // stb_image cannot read it.
+    bool DecodeImage(const EncodedImage& image, DecodedImage* decoded);
+
+    // One image per batch, as stb_image decodes a file on one thread
+    void DecodeImages(const EncodedImage* images, size_t count, ThreadPool* pool, DecodedImage* decoded, ImageDecodeStats* stats);
+}
@@ -0,0 +1,340 @@
+// IndirectArgs.cpp
+
+#include "IndirectArgs.h"
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+
+namespace Vnm
+{
+    uint32_t CommandSignatureBuilder::GetArgumentSize(const IndirectArgument& argument)
+    {
+        switch (argument.mType)
+        {
+        case IndirectArgumentType::Draw:                return 4 * sizeof(uint32_t);
+        case IndirectArgumentType::DrawIndexed:         return 5 * sizeof(uint32_t);
+        case IndirectArgumentType::Dispatch:            return 3 * sizeof(uint32_t);
+        case IndirectArgumentType::VertexBufferView:    return sizeof(IndirectVertexBufferView);
+        case IndirectArgumentType::IndexBufferView:     return sizeof(IndirectIndexBufferView);
+        case IndirectArgumentType::Constant:            return argument.mNum32BitValues * sizeof(uint32_t);
+        case IndirectArgumentType::ConstantBufferView:
+        case IndirectArgumentType::ShaderResourceView:
+        case IndirectArgumentType::UnorderedAccessView: return sizeof(uint64_t);
+        }
+        assert(0);
+        return 0;
+    }
+
+    CommandSignatureBuilder& CommandSignatureBuilder::Add(const IndirectArgument& argument)
+    {
+        mArguments.push_back(argument);
+        mArguments.back().mOffset = mSize;
+        mSize += GetArgumentSize(argument);
+
+        // Arguments holding GPU addresses make the equivalent C++ struct 8-byte aligned
+        if (argument.mType == IndirectArgumentType::VertexBufferView ||
+            argument.mType == IndirectArgumentType::IndexBufferView ||
+            argument.mType == IndirectArgumentType::ConstantBufferView ||
+            argument.mType == IndirectArgumentType::ShaderResourceView ||
+            argument.mType == IndirectArgumentType::UnorderedAccessView)
+        {
+            mAlignment = 8;
+        }
+
+        return *this;
+    }
+
+    CommandSignatureBuilder& CommandSignatureBuilder::AddConstant(uint32_t rootParameter, uint32_t num32BitValues, uint32_t destOffset)
+    {
+        IndirectArgument argument;
+        argument.mType = IndirectArgumentType::Constant;
+        argument.mRootParameter = rootParameter;
+        argument.mNum32BitValues = num32BitValues;
+        argument.mDestOffset = destOffset;
+        return Add(argument);
+    }
+
+    CommandSignatureBuilder& CommandSignatureBuilder::AddConstantBufferView(uint32_t rootParameter)
+    {
+        IndirectArgument argument;
+        argument.mType = IndirectArgumentType::ConstantBufferView;
+        argument.mRootParameter = rootParameter;
+        return Add(argument);
+    }
+
+    CommandSignatureBuilder& CommandSignatureBuilder::AddShaderResourceView(uint32_t rootParameter)
+    {
+        IndirectArgument argument;
+        argument.mType = IndirectArgumentType::ShaderResourceView;
+        argument.mRootParameter = rootParameter;
+        return Add(argument);
+    }
+
+    CommandSignatureBuilder& CommandSignatureBuilder::AddUnorderedAccessView(uint32_t rootParameter)
+    {
+        IndirectArgument argument;
+        argument.mType = IndirectArgumentType::UnorderedAccessView;
+        argument.mRootParameter = rootParameter;
+        return Add(argument);
+    }
+
+    CommandSignatureBuilder& CommandSignatureBuilder::AddVertexBufferView(uint32_t slot)
+    {
+        IndirectArgument argument;
+        argument.mType = IndirectArgumentType::VertexBufferView;
+        argument.mSlot = slot;
+        return Add(argument);
+    }
+
+    CommandSignatureBuilder& CommandSignatureBuilder::AddIndexBufferView()
+    {
+        IndirectArgument argument;
+        argument.mType = IndirectArgumentType::IndexBufferView;
+        return Add(argument);
+    }
+
+    CommandSignatureBuilder& CommandSignatureBuilder::AddDraw()
+    {
+        IndirectArgument argument;
+        argument.mType = IndirectArgumentType::Draw;
+        return Add(argument);
+    }
+
+    CommandSignatureBuilder& CommandSignatureBuilder::AddDrawIndexed()
+    {
+        IndirectArgument argument;
+        argument.mType = IndirectArgumentType::DrawIndexed;
+        return Add(argument);
+    }
+
+    CommandSignatureBuilder& CommandSignatureBuilder::AddDispatch()
+    {
+        IndirectArgument argument;
+        argument.mType = IndirectArgumentType::Dispatch;
+        return Add(argument);
+    }
+
+    bool CommandSignatureBuilder::Validate(std::string* error) const
+    {
+        std::string message;
+        uint32_t vertexBufferSlots = 0;
+        size_t numDraws = 0;
+
+        for (size_t i = 0; i < mArguments.size(); ++i)
+        {
+            const IndirectArgument& argument = mArguments[i];
+            switch (argument.mType)
+            {
+            case IndirectArgumentType::Draw:
+            case IndirectArgumentType::DrawIndexed:
+            case IndirectArgumentType::Dispatch:
+                numDraws++;
+                if (i + 1 != mArguments.size())
+                {
+                    message = "draw or dispatch must be the last argument";
+                }
+                break;
+            case IndirectArgumentType::VertexBufferView:
+                if (argument.mSlot >= 32 || (vertexBufferSlots & (1u << argument.mSlot)))
+                {
+                    message = "vertex buffer slot out of range or set twice";
+                }
+                else
+                {
+                    vertexBufferSlots |= 1u << argument.mSlot;
+                }
+                break;
+            case IndirectArgumentType::Constant:
+                if (argument.mNum32BitValues == 0)
+                {
+                    message = "constant argument without values";
+                }
+                break;
+            default:
+                break;
+            }
+        }
+
+        if (message.empty() && numDraws != 1)
+        {
+            message = "exactly one draw or dispatch argument is required";
+        }
+
+        if (!message.empty() && error != nullptr)
+        {
+            *error = message;
+        }
+        return message.empty();
+    }
+
+    bool CommandSignatureBuilder::NeedsRootSignature() const
+    {
+        for (const IndirectArgument& argument : mArguments)
+        {
+            if (argument.mType == IndirectArgumentType::Constant ||
+                argument.mType == IndirectArgumentType::ConstantBufferView ||
+                argument.mType == IndirectArgumentType::ShaderResourceView ||
+                argument.mType == IndirectArgumentType::UnorderedAccessView)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    uint32_t CommandSignatureBuilder::GetByteStride() const
+    {
+        return (mSize + mAlignment - 1) & ~(mAlignment - 1);
+    }
+
+    CommandSignatureBuilder MakeIndirectDrawSignature(uint32_t constantsRootParameter)
+    {
+        CommandSignatureBuilder builder;
+        builder.AddConstant(constantsRootParameter, 2)
+               .AddVertexBufferView(0)
+               .AddIndexBufferView()
+               .AddDrawIndexed();
+        return builder;
+    }
+
+    void IndirectDrawCompactor::Init(const IndirectDrawCommand* templates, const IndirectCommandInfo* infos, size_t numTemplates,
+                                     const IndirectModelRange* models, size_t numModels, uint32_t numPipelines)
+    {
+        mTemplates.assign(templates, templates + numTemplates);
+        mInfos.assign(infos, infos + numTemplates);
+        mModels.assign(models, models + numModels);
+
+        uint32_t numInstances = 0;
+        for (const IndirectModelRange& model : mModels)
+        {
+            assert(model.mFirstInstance <= model.mEndInstance);
+            numInstances = model.mEndInstance > numInstances ? model.mEndInstance : numInstances;
+        }
+
+        mInstanceModels.assign(numInstances, UINT32_MAX);
+        for (size_t i = 0; i < mModels.size(); ++i)
+        {
+            for (uint32_t instance = mModels[i].mFirstInstance; instance < mModels[i].mEndInstance; ++instance)
+            {
+                assert(mInstanceModels[instance] == UINT32_MAX && "Model instance ranges overlap");
+                mInstanceModels[instance] = static_cast<uint32_t>(i);
+            }
+        }
+
+        mInstanceIndices.assign(numInstances, 0);
+        mModelCounts.assign(numModels, 0);
+        mCommands.assign(numTemplates, IndirectDrawCommand());
+        mPipelineCounts.assign(numPipelines, 0);
+    }
+
+    void IndirectDrawCompactor::Compact(const uint32_t* visibleInstances, uint32_t visibleCount)
+    {
+        std::fill(mModelCounts.begin(), mModelCounts.end(), 0);
+        std::fill(mPipelineCounts.begin(), mPipelineCounts.end(), 0);
+
+        for (uint32_t i = 0; i < visibleCount; ++i)
+        {
+            uint32_t instance = visibleInstances[i];
+            uint32_t model = instance < mInstanceModels.size() ? mInstanceModels[instance] : UINT32_MAX;
+            if (model == UINT32_MAX)
+            {
+                continue;
+            }
+
+            mInstanceIndices[mModels[model].mFirstInstance + mModelCounts[model]++] = instance;
+        }
+
+        for (size_t i = 0; i < mTemplates.size(); ++i)
+        {
+            const IndirectCommandInfo& info = mInfos[i];
+            uint32_t instanceCount = mModelCounts[info.mModel];
+            if (instanceCount == 0)
+            {
+                continue;
+            }
+
+            IndirectDrawCommand& command = mCommands[info.mRegionBase + mPipelineCounts[info.mPipeline]++];
+            command = mTemplates[i];
+            command.mDraw.mInstanceCount = instanceCount;
+        }
+    }
+
+    bool IndirectDrawCompactor::Validate(const uint32_t* visibleInstances, uint32_t visibleCount, std::string* error) const
+    {
+        char message[256] = {};
+
+        // Every visible instance must appear exactly once in its model's region
+        std::vector<uint32_t> seen(mInstanceModels.size(), 0);
+        for (size_t model = 0; model < mModels.size() && !message[0]; ++model)
+        {
+            if (mModels[model].mFirstInstance + mModelCounts[model] > mModels[model].mEndInstance)
+            {
+                snprintf(message, sizeof(message), "model %zu overflows its instance region", model);
+                break;
+            }
+
+            for (uint32_t i = 0; i < mModelCounts[model]; ++i)
+            {
+                uint32_t instance = mInstanceIndices[mModels[model].mFirstInstance + i];
+                if (instance >= seen.size() || mInstanceModels[instance] != model || seen[instance]++)
+                {
+                    snprintf(message, sizeof(message), "instance %u is binned to the wrong model or twice", instance);
+                    break;
+                }
+            }
+        }
+
+        for (uint32_t i = 0; i < visibleCount && !message[0]; ++i)
+        {
+            uint32_t instance = visibleInstances[i];
+            if (instance < seen.size() && mInstanceModels[instance] != UINT32_MAX && seen[instance] == 0)
+            {
+                snprintf(message, sizeof(message), "visible instance %u is not drawn", instance);
+            }
+        }
+
+        // Each template of a model with visible instances is emitted once, into its pipeline's group
+        for (size_t groupBegin = 0; groupBegin < mTemplates.size() && !message[0];)
+        {
+            const uint32_t pipeline = mInfos[groupBegin].mPipeline;
+            size_t groupEnd = groupBegin;
+            uint32_t expectedCount = 0;
+            for (; groupEnd < mTemplates.size() && mInfos[groupEnd].mPipeline == pipeline; ++groupEnd)
+            {
+                if (mInfos[groupEnd].mRegionBase != groupBegin)
+                {
+                    snprintf(message, sizeof(message), "template %zu has region base %u, expected %zu", groupEnd, mInfos[groupEnd].mRegionBase, groupBegin);
+                }
+                expectedCount += mModelCounts[mInfos[groupEnd].mModel] > 0 ? 1 : 0;
+            }
+
+            if (!message[0] && mPipelineCounts[pipeline] != expectedCount)
+            {
+                snprintf(message, sizeof(message), "pipeline %u has %u commands, expected %u", pipeline, mPipelineCounts[pipeline], expectedCount);
+            }
+
+            for (uint32_t i = 0; i < mPipelineCounts[pipeline] && !message[0]; ++i)
+            {
+                // The instance offset identifies the model, whose visible count must have been patched in
+                const IndirectDrawCommand& command = mCommands[groupBegin + i];
+                size_t model = 0;
+                while (model < mModels.size() && mModels[model].mFirstInstance != command.mInstanceOffset)
+                {
+                    model++;
+                }
+                if (model == mModels.size() || command.mDraw.mInstanceCount != mModelCounts[model])
+                {
+                    snprintf(message, sizeof(message), "pipeline %u command %u has a bad instance offset or count", pipeline, i);
+                }
+            }
+
+            groupBegin = groupEnd;
+        }
+
+        if (message[0] && error != nullptr)
+        {
+            *error = message;
+        }
+        return message[0] == 0;
+    }
+}
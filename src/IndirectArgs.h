@@ -0,0 +1,171 @@
+// IndirectArgs.h
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace Vnm
+{
+    // Mirrors D3D12_INDIRECT_ARGUMENT_TYPE without depending on d3d12.h
+    enum class IndirectArgumentType
+    {
+        Draw,
+        DrawIndexed,
+        Dispatch,
+        VertexBufferView,
+        IndexBufferView,
+        Constant,
+        ConstantBufferView,
+        ShaderResourceView,
+        UnorderedAccessView
+    };
+
+    class IndirectArgument
+    {
+    public:
+        IndirectArgumentType mType;
+        uint32_t             mSlot = 0;            // Vertex buffer slot
+        uint32_t             mRootParameter = 0;   // Constant and root descriptor arguments
+        uint32_t             mDestOffset = 0;      // First 32-bit value written by a Constant argument
+        uint32_t             mNum32BitValues = 0;  // Constant arguments
+        uint32_t             mOffset = 0;          // Byte offset in the command record, set by the builder
+    };
+
+    // Describes the layout of one command in an indirect argument buffer. Arguments are packed in
+    // the order they are added, and the stride is rounded up to 8 bytes when the record contains GPU
+    // addresses so that it matches a C++ struct with the same members.
+    class CommandSignatureBuilder
+    {
+    public:
+        CommandSignatureBuilder& AddConstant(uint32_t rootParameter, uint32_t num32BitValues, uint32_t destOffset = 0);
+        CommandSignatureBuilder& AddConstantBufferView(uint32_t rootParameter);
+        CommandSignatureBuilder& AddShaderResourceView(uint32_t rootParameter);
+        CommandSignatureBuilder& AddUnorderedAccessView(uint32_t rootParameter);
+        CommandSignatureBuilder& AddVertexBufferView(uint32_t slot);
+        CommandSignatureBuilder& AddIndexBufferView();
+        CommandSignatureBuilder& AddDraw();
+        CommandSignatureBuilder& AddDrawIndexed();
+        CommandSignatureBuilder& AddDispatch();
+
+        // Checks the rules ID3D12Device::CreateCommandSignature enforces: exactly one draw or
+        // dispatch and it comes last, and no vertex buffer slot is set twice
+        bool Validate(std::string* error) const;
+
+        // True if the arguments need a root signature, i.e. anything other than the draw/dispatch and buffer views
+        bool NeedsRootSignature() const;
+
+        const std::vector<IndirectArgument>& GetArguments() const { return mArguments; }
+        uint32_t GetByteStride() const;
+
+        static uint32_t GetArgumentSize(const IndirectArgument& argument);
+
+    private:
+        CommandSignatureBuilder& Add(const IndirectArgument& argument);
+
+        std::vector<IndirectArgument> mArguments;
+        uint32_t                      mSize = 0;
+        uint32_t                      mAlignment = 4;
+    };
+
+    // Argument layouts with the same size and member order as the D3D12 structures
+    class IndirectVertexBufferView
+    {
+    public:
+        uint64_t mBufferLocation;
+        uint32_t mSizeInBytes;
+        uint32_t mStrideInBytes;
+    };
+
+    class IndirectIndexBufferView
+    {
+    public:
+        uint64_t mBufferLocation;
+        uint32_t mSizeInBytes;
+        uint32_t mFormat;
+    };
+
+    class IndirectDrawIndexedArgs
+    {
+    public:
+        uint32_t mIndexCountPerInstance;
+        uint32_t mInstanceCount;
+        uint32_t mStartIndexLocation;
+        int32_t  mBaseVertexLocation;
+        uint32_t mStartInstanceLocation;
+    };
+
+    // One instanced draw of a mesh over the visible instances of its model. mInstanceOffset and
+    // mMaterial are root constants: the first entry of the model's region in the instance index
+    // buffer, and the texture array index. Must match IndirectDrawCommand in indirect.hlsl.
+    class IndirectDrawCommand
+    {
+    public:
+        uint32_t                 mInstanceOffset;
+        uint32_t                 mMaterial;
+        IndirectVertexBufferView mVertexBuffer;
+        IndirectIndexBufferView  mIndexBuffer;
+        IndirectDrawIndexedArgs  mDraw;
+        uint32_t                 mPad;
+    };
+
+    // Command signature matching IndirectDrawCommand, constantsRootParameter takes 2 values
+    CommandSignatureBuilder MakeIndirectDrawSignature(uint32_t constantsRootParameter);
+
+    // Instances [mFirstInstance, mEndInstance) belong to a model. Its region of the instance index
+    // buffer starts at mFirstInstance, so regions of different models never overlap.
+    class IndirectModelRange
+    {
+    public:
+        uint32_t mFirstInstance;
+        uint32_t mEndInstance;
+    };
+
+    // Per template information used by the compaction pass. Templates are grouped by pipeline and
+    // mRegionBase is the index of the first template of the group, compacted commands of a pipeline
+    // are written from there on.
+    class IndirectCommandInfo
+    {
+    public:
+        uint32_t mModel;
+        uint32_t mPipeline;
+        uint32_t mRegionBase;
+        uint32_t mPad = 0;
+    };
+
+    // Compaction of the indirect argument buffer, the same algorithm as CsBinInstances and
+    // CsCompactCommands in indirect.hlsl. Visible instances are binned into their model's region of
+    // instanceIndices, then every template whose model has visible instances is copied to its
+    // pipeline's region of commands with the instance count patched in. pipelineCounts receives
+    // the number of commands per pipeline, the count buffer of ExecuteIndirect.
+    class IndirectDrawCompactor
+    {
+    public:
+        void Init(const IndirectDrawCommand* templates, const IndirectCommandInfo* infos, size_t numTemplates,
+                  const IndirectModelRange* models, size_t numModels, uint32_t numPipelines);
+
+        void Compact(const uint32_t* visibleInstances, uint32_t visibleCount);
+
+        // Checks that every visible instance is drawn exactly once per template of its model, and
+        // that commands stay inside their pipeline regions
+        bool Validate(const uint32_t* visibleInstances, uint32_t visibleCount, std::string* error) const;
+
+        const std::vector<uint32_t>&            GetInstanceIndices() const { return mInstanceIndices; }
+        const std::vector<uint32_t>&            GetModelCounts() const { return mModelCounts; }
+        const std::vector<IndirectDrawCommand>& GetCommands() const { return mCommands; }
+        const std::vector<uint32_t>&            GetPipelineCounts() const { return mPipelineCounts; }
+
+    private:
+        std::vector<IndirectDrawCommand> mTemplates;
+        std::vector<IndirectCommandInfo> mInfos;
+        std::vector<IndirectModelRange>  mModels;
+        std::vector<uint32_t>            mInstanceModels;
+
+        std::vector<uint32_t>            mInstanceIndices;
+        std::vector<uint32_t>            mModelCounts;
+        std::vector<IndirectDrawCommand> mCommands;
+        std::vector<uint32_t>            mPipelineCounts;
+    };
+}
@@ -0,0 +1,170 @@
+// MappedFile.cpp
+
+#include "MappedFile.h"
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Vnm
+{
+    MappedFile::MappedFile(MappedFile&& other) noexcept
+        : mpData(other.mpData)
+        , mSize(other.mSize)
+    {
+        other.mpData = nullptr;
+        other.mSize = 0;
+    }
+
+    MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+    {
+        if (this != &other)
+        {
+            Close();
+            mpData = other.mpData;
+            mSize = other.mSize;
+            other.mpData = nullptr;
+            other.mSize = 0;
+        }
+        return *this;
+    }
+
+#ifdef _WIN32
+    // The view keeps the mapping and file open, so neither handle is kept
+    bool MappedFile::Open(const std::string& fileName)
+    {
+        Close();
+        HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            return false;
+        }
+
+        LARGE_INTEGER size;
+        HANDLE mapping = nullptr;
+        if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+        {
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        }
+        CloseHandle(file);
+        if (mapping == nullptr)
+        {
+            return false;
+        }
+
+        mpData = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        CloseHandle(mapping);
+        if (mpData == nullptr)
+        {
+            return false;
+        }
+
+        mSize = static_cast<uint64_t>(size.QuadPart);
+        return true;
+    }
+
+    void MappedFile::Close()
+    {
+        if (mpData != nullptr)
+        {
+            UnmapViewOfFile(mpData);
+            mpData = nullptr;
+            mSize = 0;
+        }
+    }
+
+    std::vector<std::string> ListFiles(const std::string& directory, const char* extension)
+    {
+        std::vector<std::string> files;
+        WIN32_FIND_DATAA findData;
+        HANDLE find = FindFirstFileA((directory + "\\*" + extension).c_str(), &findData);
+        if (find == INVALID_HANDLE_VALUE)
+        {
+            return files;
+        }
+
+        do
+        {
+            if ((findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0)
+            {
+                files.push_back(directory + "\\" + findData.cFileName);
+            }
+        } while (FindNextFileA(find, &findData));
+        FindClose(find);
+
+        std::sort(files.begin(), files.end());
+        return files;
+    }
+#else
+    bool MappedFile::Open(const std::string& fileName)
+    {
+        Close();
+        int file = open(fileName.c_str(), O_RDONLY);
+        if (file < 0)
+        {
+            return false;
+        }
+
+        struct stat status;
+        void* data = MAP_FAILED;
+        if (fstat(file, &status) == 0 && status.st_size > 0)
+        {
+            data = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+        }
+        close(file);
+        if (data == MAP_FAILED)
+        {
+            return false;
+        }
+
+        // Textures are read front to back, once
+        madvise(data, static_cast<size_t>(status.st_size), MADV_SEQUENTIAL);
+        mpData = static_cast<const uint8_t*>(data);
+        mSize = static_cast<uint64_t>(status.st_size);
+        return true;
+    }
+
+    void MappedFile::Close()
+    {
+        if (mpData != nullptr)
+        {
+            munmap(const_cast<uint8_t*>(mpData), static_cast<size_t>(mSize));
+            mpData = nullptr;
+            mSize = 0;
+        }
+    }
+
+    std::vector<std::string> ListFiles(const std::string& directory, const char* extension)
+    {
+        std::vector<std::string> files;
+        DIR* dir = opendir(directory.c_str());
+        if (dir == nullptr)
+        {
+            return files;
+        }
+
+        const size_t extensionLength = strlen(extension);
+        while (const dirent* entry = readdir(dir))
+        {
+            const size_t length = strlen(entry->d_name);
+            if (length > extensionLength && strcmp(entry->d_name + length - extensionLength, extension) == 0)
+            {
+                files.push_back(directory + "/" + entry->d_name);
+            }
+        }
+        closedir(dir);
+
+        std::sort(files.begin(), files.end());
+        return files;
+    }
+#endif
+}
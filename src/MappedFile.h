@@ -0,0 +1,40 @@
+// MappedFile.h
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace Vnm
+{
+    // Read only view of a whole file in memory. Pages are read by the OS as they are touched, so
+    // pointers into the view can be handed to copies without reading the file into a buffer first.
+    class MappedFile
+    {
+    public:
+        MappedFile() = default;
+        ~MappedFile() { Close(); }
+
+        MappedFile(MappedFile&& other) noexcept;
+        MappedFile& operator=(MappedFile&& other) noexcept;
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        // Returns false if the file cannot be opened or is empty
+        bool Open(const std::string& fileName);
+        void Close();
+
+        bool           IsOpen() const { return mpData != nullptr; }
+        const uint8_t* GetData() const { return mpData; }
+        uint64_t       GetSize() const { return mSize; }
+
+    private:
+        const uint8_t* mpData = nullptr;
+        uint64_t       mSize = 0;
+    };
+
+    // Sorted paths of the files in directory whose names end in extension, e.g. ".dds"
+    std::vector<std::string> ListFiles(const std::string& directory, const char* extension);
+}
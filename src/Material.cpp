@@ -0,0 +1,157 @@
+// Material.cpp
+
+#include "Material.h"
+#include <cassert>
+#include <cstdio>
+
+namespace Vnm
+{
+    uint64_t HashBytes(const void* data, size_t size, uint64_t seed)
+    {
+        const uint64_t prime = 1099511628211ull;
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+
+        uint64_t hash = seed;
+        for (size_t i = 0; i < size; ++i)
+        {
+            hash ^= bytes[i];
+            hash *= prime;
+        }
+
+        return hash;
+    }
+
+    uint32_t MaterialLibrary::AddTextureFile(const std::string& filename)
+    {
+        for (size_t i = 0; i < mTextures.size(); ++i)
+        {
+            if (mTextures[i].mFilename == filename)
+            {
+                return static_cast<uint32_t>(i);
+            }
+        }
+
+        mTextures.emplace_back();
+        mTextures.back().mFilename = filename;
+        return static_cast<uint32_t>(mTextures.size() - 1);
+    }
+
+    uint32_t MaterialLibrary::AddTexturePixels(const uint8_t* pixels, uint32_t width, uint32_t height)
+    {
+        assert(pixels != nullptr);
+
+        uint64_t hash = HashBytes(&width, sizeof(width));
+        hash = HashBytes(&height, sizeof(height), hash);
+        hash = HashBytes(pixels, size_t(width) * height * 4, hash);
+
+        for (size_t i = 0; i < mTextures.size(); ++i)
+        {
+            if (mTextures[i].mContentHash == hash)
+            {
+                return GetCanonicalTexture(static_cast<uint32_t>(i));
+            }
+        }
+
+        mTextures.emplace_back();
+        TextureDesc& texture = mTextures.back();
+        texture.mpPixels = pixels;
+        texture.mWidth = width;
+        texture.mHeight = height;
+        texture.mContentHash = hash;
+        return static_cast<uint32_t>(mTextures.size() - 1);
+    }
+
+    uint32_t MaterialLibrary::AddMaterial(const Material& material)
+    {
+        for (size_t i = 0; i < mMaterials.size(); ++i)
+        {
+            if (mMaterials[i] == material)
+            {
+                return static_cast<uint32_t>(i);
+            }
+        }
+
+        mMaterials.push_back(material);
+        return static_cast<uint32_t>(mMaterials.size() - 1);
+    }
+
+    uint32_t MaterialLibrary::ResolveTextureContent(uint32_t texture, uint64_t contentHash)
+    {
+        assert(texture < mTextures.size());
+        mTextures[texture].mContentHash = contentHash;
+
+        for (uint32_t i = 0; i < texture; ++i)
+        {
+            if (mTextures[i].mContentHash == contentHash && mTextures[i].mCanonical == InvalidIndex)
+            {
+                mTextures[texture].mCanonical = i;
+                return i;
+            }
+        }
+
+        return texture;
+    }
+
+    uint32_t MaterialLibrary::GetCanonicalTexture(uint32_t texture) const
+    {
+        assert(texture < mTextures.size());
+        return (mTextures[texture].mCanonical == InvalidIndex) ? texture : mTextures[texture].mCanonical;
+    }
+
+    uint32_t MaterialLibrary::GetMaterialTexture(uint32_t material) const
+    {
+        if (material >= mMaterials.size() || mMaterials[material].mBaseColorTexture == InvalidIndex)
+        {
+            return InvalidIndex;
+        }
+
+        return GetCanonicalTexture(mMaterials[material].mBaseColorTexture);
+    }
+
+    size_t MaterialLibrary::GetUniqueTextureCount() const
+    {
+        size_t count = 0;
+        for (const auto& texture : mTextures)
+        {
+            if (texture.mCanonical == InvalidIndex)
+            {
+                ++count;
+            }
+        }
+
+        return count;
+    }
+
+    std::string MaterialLibrary::Report() const
+    {
+        std::string report;
+        char line[512];
+
+        snprintf(line, sizeof(line), "Materials: %zu, textures: %zu (%zu unique)\n", mMaterials.size(), mTextures.size(), GetUniqueTextureCount());
+        report += line;
+
+        for (size_t i = 0; i < mTextures.size(); ++i)
+        {
+            const TextureDesc& texture = mTextures[i];
+            const char* name = texture.mFilename.empty() ? "<embedded>" : texture.mFilename.c_str();
+            if (texture.mCanonical != InvalidIndex)
+            {
+                snprintf(line, sizeof(line), "  texture %zu: %s (duplicate of %u)\n", i, name, texture.mCanonical);
+            }
+            else
+            {
+                snprintf(line, sizeof(line), "  texture %zu: %s hash %016llx\n", i, name, static_cast<unsigned long long>(texture.mContentHash));
+            }
+            report += line;
+        }
+
+        for (size_t i = 0; i < mMaterials.size(); ++i)
+        {
+            uint32_t texture = GetMaterialTexture(static_cast<uint32_t>(i));
+            snprintf(line, sizeof(line), "  material %zu: texture %d%s\n", i, texture == InvalidIndex ? -1 : static_cast<int>(texture), mMaterials[i].mAlphaTested ? " alpha-tested" : "");
+            report += line;
+        }
+
+        return report;
+    }
+}
@@ -0,0 +1,72 @@
+// Material.h
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace Vnm
+{
+    constexpr uint32_t InvalidIndex = UINT32_MAX;
+    constexpr uint64_t HashSeed = 14695981039346656037ull; // FNV-1a offset basis
+
+    // 64-bit FNV-1a, used for content deduplication of textures
+    uint64_t HashBytes(const void* data, size_t size, uint64_t seed = HashSeed);
+
+    class TextureDesc
+    {
+    public:
+        std::string    mFilename;                 // DDS file on disk, empty for embedded images
+        const uint8_t* mpPixels = nullptr;        // RGBA8 pixels of an embedded image, owned by the glTF model
+        uint32_t       mWidth = 0;
+        uint32_t       mHeight = 0;
+        uint64_t       mContentHash = 0;          // 0 until the texture data has been seen
+        uint32_t       mCanonical = InvalidIndex; // Earlier texture with identical content, if any
+    };
+
+    class Material
+    {
+    public:
+        uint32_t mBaseColorTexture = InvalidIndex;
+        bool     mAlphaTested = false;
+
+        bool operator==(const Material& other) const
+        {
+            return mBaseColorTexture == other.mBaseColorTexture && mAlphaTested == other.mAlphaTested;
+        }
+    };
+
+    // Owns the texture and material tables shared by all loaded models. Textures referenced by
+    // file are deduplicated by name when added and by content once their data has been loaded,
+    // embedded images are deduplicated by content immediately.
+    class MaterialLibrary
+    {
+    public:
+        MaterialLibrary() = default;
+        ~MaterialLibrary() = default;
+
+        uint32_t AddTextureFile(const std::string& filename);
+        uint32_t AddTexturePixels(const uint8_t* pixels, uint32_t width, uint32_t height);
+        uint32_t AddMaterial(const Material& material);
+
+        // Records the content hash of a file texture once loaded, returns the texture that should
+        // be used in its place (itself, unless identical content was already seen)
+        uint32_t ResolveTextureContent(uint32_t texture, uint64_t contentHash);
+
+        uint32_t GetCanonicalTexture(uint32_t texture) const;
+        uint32_t GetMaterialTexture(uint32_t material) const;
+        size_t   GetUniqueTextureCount() const;
+
+        size_t             GetTextureCount() const { return mTextures.size(); }
+        size_t             GetMaterialCount() const { return mMaterials.size(); }
+        const TextureDesc& GetTexture(uint32_t index) const { return mTextures[index]; }
+        const Material&    GetMaterial(uint32_t index) const { return mMaterials[index]; }
+
+        std::string Report() const;
+
+    private:
+        std::vector<TextureDesc> mTextures;
+        std::vector<Material>    mMaterials;
+    };
+}
@@ -0,0 +1,150 @@
+// MathTypes.h
+
+#pragma once
+
+#include <math.h>
+
+namespace Vnm
+{
+    // Plain math types for CPU-side systems that should not depend on DirectXMath. Float4x4 has the
+    // same layout as DirectX::XMFLOAT4X4 (row-major, row vectors), so either can be copied to the other.
+
+    class Float3
+    {
+    public:
+        float x;
+        float y;
+        float z;
+    };
+
+    class Float4
+    {
+    public:
+        float x;
+        float y;
+        float z;
+        float w;
+    };
+
+    class Float4x4
+    {
+    public:
+        float m[4][4];
+    };
+
+    inline Float3 operator+(const Float3& a, const Float3& b) { return { a.x + b.x, a.y + b.y, a.z + b.z }; }
+    inline Float3 operator-(const Float3& a, const Float3& b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+    inline Float3 operator*(const Float3& a, float s) { return { a.x * s, a.y * s, a.z * s }; }
+
+    inline float  Dot(const Float3& a, const Float3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+    inline Float3 Cross(const Float3& a, const Float3& b) { return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x }; }
+    inline float  Length(const Float3& a) { return sqrtf(Dot(a, a)); }
+    inline Float3 Normalize(const Float3& a) { float length = Length(a); return length > 0.0f ? a * (1.0f / length) : a; }
+    inline Float3 Min(const Float3& a, const Float3& b) { return { a.x < b.x ? a.x : b.x, a.y < b.y ? a.y : b.y, a.z < b.z ? a.z : b.z }; }
+    inline Float3 Max(const Float3& a, const Float3& b) { return { a.x > b.x ? a.x : b.x, a.y > b.y ? a.y : b.y, a.z > b.z ? a.z : b.z }; }
+
+    // Transforms (p, 1) by m
+    inline Float4 TransformPoint(const Float3& p, const Float4x4& m)
+    {
+        return
+        {
+            p.x * m.m[0][0] + p.y * m.m[1][0] + p.z * m.m[2][0] + m.m[3][0],
+            p.x * m.m[0][1] + p.y * m.m[1][1] + p.z * m.m[2][1] + m.m[3][1],
+            p.x * m.m[0][2] + p.y * m.m[1][2] + p.z * m.m[2][2] + m.m[3][2],
+            p.x * m.m[0][3] + p.y * m.m[1][3] + p.z * m.m[2][3] + m.m[3][3]
+        };
+    }
+
+    // Transforms (v, 0) by m
+    inline Float3 TransformVector(const Float3& v, const Float4x4& m)
+    {
+        return
+        {
+            v.x * m.m[0][0] + v.y * m.m[1][0] + v.z * m.m[2][0],
+            v.x * m.m[0][1] + v.y * m.m[1][1] + v.z * m.m[2][1],
+            v.x * m.m[0][2] + v.y * m.m[1][2] + v.z * m.m[2][2]
+        };
+    }
+
+    // Inverse of a matrix whose last column is 0, 0, 0, 1
+    inline Float4x4 InverseAffine(const Float4x4& m)
+    {
+        Float3 row0 = { m.m[0][0], m.m[0][1], m.m[0][2] };
+        Float3 row1 = { m.m[1][0], m.m[1][1], m.m[1][2] };
+        Float3 row2 = { m.m[2][0], m.m[2][1], m.m[2][2] };
+
+        // Columns of the inverse 3x3 are the cross products of the rows over the determinant
+        Float3 column0 = Cross(row1, row2);
+        Float3 column1 = Cross(row2, row0);
+        Float3 column2 = Cross(row0, row1);
+        float invDet = 1.0f / Dot(row0, column0);
+
+        Float4x4 result =
+        {{
+            { column0.x * invDet, column1.x * invDet, column2.x * invDet, 0.0f },
+            { column0.y * invDet, column1.y * invDet, column2.y * invDet, 0.0f },
+            { column0.z * invDet, column1.z * invDet, column2.z * invDet, 0.0f },
+            { 0.0f, 0.0f, 0.0f, 1.0f }
+        }};
+        Float3 translation = TransformVector({ m.m[3][0], m.m[3][1], m.m[3][2] }, result);
+        result.m[3][0] = -translation.x;
+        result.m[3][1] = -translation.y;
+        result.m[3][2] = -translation.z;
+        return result;
+    }
+
+    inline Float4x4 Multiply(const Float4x4& a, const Float4x4& b)
+    {
+        Float4x4 result;
+        for (int row = 0; row < 4; ++row)
+        {
+            for (int column = 0; column < 4; ++column)
+            {
+                result.m[row][column] = a.m[row][0] * b.m[0][column] + a.m[row][1] * b.m[1][column] + a.m[row][2] * b.m[2][column] + a.m[row][3] * b.m[3][column];
+            }
+        }
+        return result;
+    }
+
+    // Same conventions as XMMatrixLookAtLH and XMMatrixPerspectiveFovLH
+    inline Float4x4 LookAtLH(const Float3& eye, const Float3& target, const Float3& up)
+    {
+        Float3 zAxis = Normalize(target - eye);
+        Float3 xAxis = Normalize(Cross(up, zAxis));
+        Float3 yAxis = Cross(zAxis, xAxis);
+        return
+        {{
+            { xAxis.x, yAxis.x, zAxis.x, 0.0f },
+            { xAxis.y, yAxis.y, zAxis.y, 0.0f },
+            { xAxis.z, yAxis.z, zAxis.z, 0.0f },
+            { -Dot(xAxis, eye), -Dot(yAxis, eye), -Dot(zAxis, eye), 1.0f }
+        }};
+    }
+
+    inline Float4x4 PerspectiveFovLH(float fovY, float aspect, float nearZ, float farZ)
+    {
+        float yScale = 1.0f / tanf(fovY * 0.5f);
+        float xScale = yScale / aspect;
+        float zScale = farZ / (farZ - nearZ);
+        return
+        {{
+            { xScale, 0.0f, 0.0f, 0.0f },
+            { 0.0f, yScale, 0.0f, 0.0f },
+            { 0.0f, 0.0f, zScale, 1.0f },
+            { 0.0f, 0.0f, -nearZ * zScale, 0.0f }
+        }};
+    }
+
+    class Aabb
+    {
+    public:
+        Float3 mMin = { 1e30f, 1e30f, 1e30f };
+        Float3 mMax = { -1e30f, -1e30f, -1e30f };
+
+        bool   IsValid() const { return mMin.x <= mMax.x; }
+        void   Extend(const Float3& p) { mMin = Min(mMin, p); mMax = Max(mMax, p); }
+        void   Extend(const Aabb& box) { mMin = Min(mMin, box.mMin); mMax = Max(mMax, box.mMax); }
+        Float3 GetCenter() const { return (mMin + mMax) * 0.5f; }
+        Float3 GetExtent() const { return mMax - mMin; }
+    };
+}
@@ -0,0 +1,199 @@
+// MemoryTracker.cpp
+
+#include "MemoryTracker.h"
+#include <atomic>
+#include <cassert>
+#include <stdio.h>
+
+namespace Vnm
+{
+    static const size_t kNumCategories = static_cast<size_t>(MemoryCategory::Count);
+
+    static const char* const kCategoryNames[kNumCategories] =
+    {
+        "Geometry",
+        "Textures",
+        "Render targets",
+        "Constants",
+        "Upload",
+        "Readback",
+        "GPU buffers",
+        "Asset data"
+    };
+
+    class MemoryCounters
+    {
+    public:
+        std::atomic<uint64_t> mCurrent;
+        std::atomic<uint64_t> mPeak;
+        std::atomic<uint64_t> mAllocations;
+        std::atomic<uint64_t> mBudget;
+    };
+
+    // Zero initialized as statics, so tracking works during static initialization
+    static MemoryCounters sCategories[kNumCategories];
+    static MemoryCounters sTotal;
+
+    static MemoryCounters& GetCounters(MemoryCategory category)
+    {
+        assert(category < MemoryCategory::Count);
+        return sCategories[static_cast<size_t>(category)];
+    }
+
+    static void RaisePeak(std::atomic<uint64_t>& peak, uint64_t value)
+    {
+        uint64_t previous = peak.load(std::memory_order_relaxed);
+        while (previous < value && !peak.compare_exchange_weak(previous, value, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    static MemoryUsage LoadUsage(const MemoryCounters& counters)
+    {
+        MemoryUsage usage;
+        usage.mCurrent = counters.mCurrent.load(std::memory_order_relaxed);
+        usage.mPeak = counters.mPeak.load(std::memory_order_relaxed);
+        usage.mAllocations = counters.mAllocations.load(std::memory_order_relaxed);
+        usage.mBudget = counters.mBudget.load(std::memory_order_relaxed);
+        return usage;
+    }
+
+    const char* GetMemoryCategoryName(MemoryCategory category)
+    {
+        assert(category < MemoryCategory::Count);
+        return kCategoryNames[static_cast<size_t>(category)];
+    }
+
+    bool IsGpuMemoryCategory(MemoryCategory category)
+    {
+        return category != MemoryCategory::AssetData;
+    }
+
+    void TrackAllocation(MemoryCategory category, uint64_t bytes)
+    {
+        MemoryCounters& counters = GetCounters(category);
+        counters.mAllocations.fetch_add(1, std::memory_order_relaxed);
+        RaisePeak(counters.mPeak, counters.mCurrent.fetch_add(bytes, std::memory_order_relaxed) + bytes);
+
+        sTotal.mAllocations.fetch_add(1, std::memory_order_relaxed);
+        RaisePeak(sTotal.mPeak, sTotal.mCurrent.fetch_add(bytes, std::memory_order_relaxed) + bytes);
+    }
+
+    void TrackFree(MemoryCategory category, uint64_t bytes)
+    {
+        MemoryCounters& counters = GetCounters(category);
+        assert(counters.mCurrent.load(std::memory_order_relaxed) >= bytes && "Freed more than was tracked");
+        counters.mAllocations.fetch_sub(1, std::memory_order_relaxed);
+        counters.mCurrent.fetch_sub(bytes, std::memory_order_relaxed);
+
+        sTotal.mAllocations.fetch_sub(1, std::memory_order_relaxed);
+        sTotal.mCurrent.fetch_sub(bytes, std::memory_order_relaxed);
+    }
+
+    void SetMemoryBudget(MemoryCategory category, uint64_t bytes)
+    {
+        GetCounters(category).mBudget.store(bytes, std::memory_order_relaxed);
+    }
+
+    MemoryUsage GetMemoryUsage(MemoryCategory category)
+    {
+        return LoadUsage(GetCounters(category));
+    }
+
+    MemoryUsage GetTotalMemoryUsage()
+    {
+        return LoadUsage(sTotal);
+    }
+
+    void ResetMemoryPeaks()
+    {
+        for (MemoryCounters& counters : sCategories)
+        {
+            counters.mPeak.store(counters.mCurrent.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+        sTotal.mPeak.store(sTotal.mCurrent.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+
+    static void AppendRow(std::string& report, const char* name, const MemoryUsage& usage)
+    {
+        const double kMiB = 1.0 / (1024.0 * 1024.0);
+        char line[160];
+        snprintf(line, sizeof(line), "  %-16s %10.2f %10.2f %8llu", name,
+            static_cast<double>(usage.mCurrent) * kMiB,
+            static_cast<double>(usage.mPeak) * kMiB,
+            static_cast<unsigned long long>(usage.mAllocations));
+        report += line;
+
+        if (usage.mBudget > 0)
+        {
+            snprintf(line, sizeof(line), "  budget %.2f MiB%s", static_cast<double>(usage.mBudget) * kMiB,
+                usage.mPeak > usage.mBudget ? " EXCEEDED" : "");
+            report += line;
+        }
+        report += "\n";
+    }
+
+    std::string FormatMemoryReport()
+    {
+        std::string report = "Memory (MiB)        current       peak   allocs\n";
+
+        MemoryUsage gpuTotal;
+        MemoryUsage cpuTotal;
+        for (size_t i = 0; i < kNumCategories; ++i)
+        {
+            MemoryCategory category = static_cast<MemoryCategory>(i);
+            MemoryUsage usage = GetMemoryUsage(category);
+            AppendRow(report, kCategoryNames[i], usage);
+
+            MemoryUsage& subtotal = IsGpuMemoryCategory(category) ? gpuTotal : cpuTotal;
+            subtotal.mCurrent += usage.mCurrent;
+            subtotal.mPeak += usage.mPeak;
+            subtotal.mAllocations += usage.mAllocations;
+        }
+
+        // Subtotal peaks are sums of the category peaks, an upper bound
+        AppendRow(report, "GPU", gpuTotal);
+        AppendRow(report, "CPU", cpuTotal);
+        AppendRow(report, "Total", GetTotalMemoryUsage());
+        return report;
+    }
+
+    TrackedAllocation::TrackedAllocation(TrackedAllocation&& other) noexcept
+        : mCategory(other.mCategory)
+        , mBytes(other.mBytes)
+    {
+        other.mBytes = 0;
+    }
+
+    TrackedAllocation& TrackedAllocation::operator=(TrackedAllocation&& other) noexcept
+    {
+        if (this != &other)
+        {
+            Release();
+            mCategory = other.mCategory;
+            mBytes = other.mBytes;
+            other.mBytes = 0;
+        }
+        return *this;
+    }
+
+    void TrackedAllocation::Reset(MemoryCategory category, uint64_t bytes)
+    {
+        Release();
+        mCategory = category;
+        mBytes = bytes;
+        if (mBytes > 0)
+        {
+            TrackAllocation(mCategory, mBytes);
+        }
+    }
+
+    void TrackedAllocation::Release()
+    {
+        if (mBytes > 0)
+        {
+            TrackFree(mCategory, mBytes);
+            mBytes = 0;
+        }
+    }
+}
@@ -0,0 +1,86 @@
+// MemoryTracker.h
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+namespace Vnm
+{
+    enum class MemoryCategory
+    {
+        Geometry,                           // Vertex and index buffers
+        Textures,
+        RenderTargets,                      // Depth buffer and Hi-Z pyramid
+        Constants,                          // Constant and per instance buffers
+        Upload,                             // Staging for copies to the GPU
+        Readback,
+        GpuBuffers,                         // Other buffers written on the GPU, such as culling output
+        AssetData,                          // CPU copies of loaded models, images and acceleration structures
+        Count
+    };
+
+    const char* GetMemoryCategoryName(MemoryCategory category);
+    bool IsGpuMemoryCategory(MemoryCategory category);
+
+    class MemoryUsage
+    {
+    public:
+        uint64_t mCurrent = 0;              // Bytes
+        uint64_t mPeak = 0;
+        uint64_t mAllocations = 0;          // Live allocations
+        uint64_t mBudget = 0;               // 0 if the category has none
+    };
+
+    // Thread safe counters per category. Every TrackAllocation needs a TrackFree of the same
+    // category and size once the memory is released.
+    void TrackAllocation(MemoryCategory category, uint64_t bytes);
+    void TrackFree(MemoryCategory category, uint64_t bytes);
+
+    // The report flags categories above their budget
+    void SetMemoryBudget(MemoryCategory category, uint64_t bytes);
+
+    MemoryUsage GetMemoryUsage(MemoryCategory category);
+
+    // Current and peak of the sum of all categories. The total peak is the highest sum at any one
+    // time, which can be less than the sum of the category peaks.
+    MemoryUsage GetTotalMemoryUsage();
+
+    // Peaks restart from the current usage, e.g. after loading
+    void ResetMemoryPeaks();
+
+    // Table of all categories with GPU and CPU subtotals
+    std::string FormatMemoryReport();
+
+    // Tracks memory for the lifetime of the object, for owners that should not have to pair
+    // TrackAllocation and TrackFree themselves
+    class TrackedAllocation
+    {
+    public:
+        TrackedAllocation() = default;
+        TrackedAllocation(MemoryCategory category, uint64_t bytes) { Reset(category, bytes); }
+        ~TrackedAllocation() { Release(); }
+
+        TrackedAllocation(TrackedAllocation&& other) noexcept;
+        TrackedAllocation& operator=(TrackedAllocation&& other) noexcept;
+        TrackedAllocation(const TrackedAllocation&) = delete;
+        TrackedAllocation& operator=(const TrackedAllocation&) = delete;
+
+        // Frees what was tracked before
+        void Reset(MemoryCategory category, uint64_t bytes);
+        void Release();
+
+        uint64_t GetSize() const { return mBytes; }
+
+    private:
+        MemoryCategory mCategory = MemoryCategory::AssetData;
+        uint64_t       mBytes = 0;
+    };
+
+    template <typename T>
+    uint64_t GetVectorBytes(const T& vector)
+    {
+        return static_cast<uint64_t>(vector.capacity()) * sizeof(typename T::value_type);
+    }
+}
@@ -0,0 +1,331 @@
+// MipGenerator.cpp
+
+#include "MipGenerator.h"
+#include "AlphaCoverage.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <emmintrin.h>
+
+namespace Vnm
+{
+    static const uint32_t kKaiserTaps = 12;
+    static const uint32_t kLinearToSrgbSize = 16384;
+    static const uint32_t kCoverageBins = 4096;
+    static const size_t kRowsPerBatch = 8;
+
+    static float SrgbToLinear(float value)
+    {
+        return value <= 0.04045f ? value / 12.92f : powf((value + 0.055f) / 1.055f, 2.4f);
+    }
+
+    static float LinearToSrgb(float value)
+    {
+        return value <= 0.0031308f ? value * 12.92f : 1.055f * powf(value, 1.0f / 2.4f) - 0.055f;
+    }
+
+    // Conversions between 8 bit channels and linear floats
+    class ColorTables
+    {
+    public:
+        ColorTables()
+        {
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                mUnormToFloat[i] = static_cast<float>(i) / 255.0f;
+                mSrgbToLinear[i] = SrgbToLinear(mUnormToFloat[i]);
+            }
+            for (uint32_t i = 0; i < kLinearToSrgbSize; ++i)
+            {
+                const float srgb = LinearToSrgb(static_cast<float>(i) / (kLinearToSrgbSize - 1));
+                mLinearToSrgb[i] = static_cast<uint8_t>((std::min)(srgb * 255.0f + 0.5f, 255.0f));
+            }
+        }
+
+        float   mUnormToFloat[256];
+        float   mSrgbToLinear[256];
+        uint8_t mLinearToSrgb[kLinearToSrgbSize];
+    };
+
+    static const ColorTables& GetColorTables()
+    {
+        static const ColorTables tables;
+        return tables;
+    }
+
+    // Mip 0, read from the RGBA8 input and converted as it is read
+    class Rgba8Source
+    {
+    public:
+        const uint8_t* mpData;
+        size_t         mRowPitch;
+        const float*   mpColorTable;
+
+        __m128 Load(uint32_t x, uint32_t y) const
+        {
+            const uint8_t* pixel = mpData + y * mRowPitch + x * 4;
+            return _mm_setr_ps(mpColorTable[pixel[0]], mpColorTable[pixel[1]], mpColorTable[pixel[2]], pixel[3] * (1.0f / 255.0f));
+        }
+    };
+
+    // Later mips, from the linear level filtered before
+    class LinearSource
+    {
+    public:
+        const float* mpData;
+        uint32_t     mWidth;
+
+        __m128 Load(uint32_t x, uint32_t y) const
+        {
+            return _mm_loadu_ps(mpData + (static_cast<size_t>(y) * mWidth + x) * 4);
+        }
+    };
+
+    static float BesselI0(float x)
+    {
+        float sum = 1.0f;
+        float term = 1.0f;
+        for (int k = 1; k < 20; ++k)
+        {
+            const float factor = x / (2.0f * k);
+            term *= factor * factor;
+            sum += term;
+        }
+        return sum;
+    }
+
+    // Sinc windowed three output texels to each side, tap t reads source texel 2 * x - 5 + t
+    static void CalcKaiserWeights(float* weights)
+    {
+        const float kWidth = 3.0f;
+        const float kAlpha = 4.0f;
+        const float kPi = 3.14159265f;
+
+        float sum = 0.0f;
+        for (uint32_t t = 0; t < kKaiserTaps; ++t)
+        {
+            const float distance = (static_cast<float>(t) - 5.5f) * 0.5f;
+            const float sinc = sinf(kPi * distance) / (kPi * distance);
+            const float ratio = distance / kWidth;
+            const float window = BesselI0(kAlpha * sqrtf((std::max)(1.0f - ratio * ratio, 0.0f))) / BesselI0(kAlpha);
+            weights[t] = sinc * window;
+            sum += weights[t];
+        }
+        for (uint32_t t = 0; t < kKaiserTaps; ++t)
+        {
+            weights[t] /= sum;
+        }
+    }
+
+    template <typename Source>
+    static void BoxFilterRow(const Source& source, const MipLevel& above, uint32_t y, uint32_t width, float* output)
+    {
+        const uint32_t y0 = (std::min)(2 * y, above.mHeight - 1);
+        const uint32_t y1 = (std::min)(2 * y + 1, above.mHeight - 1);
+        const __m128 quarter = _mm_set1_ps(0.25f);
+        for (uint32_t x = 0; x < width; ++x)
+        {
+            const uint32_t x0 = (std::min)(2 * x, above.mWidth - 1);
+            const uint32_t x1 = (std::min)(2 * x + 1, above.mWidth - 1);
+            const __m128 sum = _mm_add_ps(_mm_add_ps(source.Load(x0, y0), source.Load(x1, y0)), _mm_add_ps(source.Load(x0, y1), source.Load(x1, y1)));
+            _mm_storeu_ps(output + 4 * x, _mm_mul_ps(sum, quarter));
+        }
+    }
+
+    // Vertical pass over the source row into column, then horizontal into output. Ringing past
+    // the range of the channels is clamped.
+    template <typename Source>
+    static void KaiserFilterRow(const Source& source, const MipLevel& above, uint32_t y, uint32_t width, const float* weights, float* column, float* output)
+    {
+        memset(column, 0, static_cast<size_t>(above.mWidth) * 4 * sizeof(float));
+        for (uint32_t t = 0; t < kKaiserTaps; ++t)
+        {
+            const int64_t row = static_cast<int64_t>(2 * y) - 5 + t;
+            const uint32_t sourceY = static_cast<uint32_t>((std::min)((std::max)(row, int64_t(0)), static_cast<int64_t>(above.mHeight - 1)));
+            const __m128 weight = _mm_set1_ps(weights[t]);
+            for (uint32_t x = 0; x < above.mWidth; ++x)
+            {
+                const __m128 sum = _mm_add_ps(_mm_loadu_ps(column + 4 * x), _mm_mul_ps(weight, source.Load(x, sourceY)));
+                _mm_storeu_ps(column + 4 * x, sum);
+            }
+        }
+
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        const int64_t lastX = above.mWidth - 1;
+        for (uint32_t x = 0; x < width; ++x)
+        {
+            __m128 sum = zero;
+            for (uint32_t t = 0; t < kKaiserTaps; ++t)
+            {
+                const int64_t sourceX = (std::min)((std::max)(static_cast<int64_t>(2 * x) - 5 + t, int64_t(0)), lastX);
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[t]), _mm_loadu_ps(column + 4 * sourceX)));
+            }
+            _mm_storeu_ps(output + 4 * x, _mm_min_ps(_mm_max_ps(sum, zero), one));
+        }
+    }
+
+    template <typename Source>
+    static void FilterRows(const Source& source, const MipLevel& above, const MipLevel& level, MipFilter filter, const float* weights, size_t begin, size_t end, float* output)
+    {
+        std::vector<float> column;
+        if (filter == MipFilter::Kaiser)
+        {
+            column.resize(static_cast<size_t>(above.mWidth) * 4);
+        }
+
+        for (size_t y = begin; y < end; ++y)
+        {
+            float* row = output + y * level.mWidth * 4;
+            if (filter == MipFilter::Kaiser)
+            {
+                KaiserFilterRow(source, above, static_cast<uint32_t>(y), level.mWidth, weights, column.data(), row);
+            }
+            else
+            {
+                BoxFilterRow(source, above, static_cast<uint32_t>(y), level.mWidth, row);
+            }
+        }
+    }
+
+    // Rounds linear values to 8 bits, color through the sRGB table if srgb is set
+    static void StoreRow(const float* linear, uint32_t width, bool srgb, float alphaScale, uint8_t* output)
+    {
+        const ColorTables& tables = GetColorTables();
+        const float colorScale = srgb ? static_cast<float>(kLinearToSrgbSize - 1) : 255.0f;
+        const __m128 scale = _mm_setr_ps(colorScale, colorScale, colorScale, 255.0f * alphaScale);
+        const __m128 limit = _mm_setr_ps(colorScale, colorScale, colorScale, 255.0f);
+        const __m128 zero = _mm_setzero_ps();
+        for (uint32_t x = 0; x < width; ++x)
+        {
+            const __m128 value = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(linear + 4 * x), scale), zero), limit);
+            alignas(16) int32_t channels[4];
+            _mm_store_si128(reinterpret_cast<__m128i*>(channels), _mm_cvtps_epi32(value));
+            for (int c = 0; c < 3; ++c)
+            {
+                output[4 * x + c] = srgb ? tables.mLinearToSrgb[channels[c]] : static_cast<uint8_t>(channels[c]);
+            }
+            output[4 * x + 3] = static_cast<uint8_t>(channels[3]);
+        }
+    }
+
+    // Scale of alpha that lets as many pixels as coverage of them pass the alpha test. Pixels
+    // are counted in bins of alpha, and the cutoff is moved to the bin edge closest to coverage.
+    static float FindAlphaScale(const float* linear, size_t pixelCount, float cutoff, float coverage)
+    {
+        std::vector<uint32_t> histogram(kCoverageBins, 0);
+        for (size_t i = 0; i < pixelCount; ++i)
+        {
+            const int bin = static_cast<int>(linear[4 * i + 3] * kCoverageBins);
+            histogram[(std::min)((std::max)(bin, 0), static_cast<int>(kCoverageBins) - 1)]++;
+        }
+
+        const double target = static_cast<double>(coverage) * pixelCount;
+        size_t passing = 0;
+        uint32_t edge = kCoverageBins;
+        while (edge > 1 && static_cast<double>(passing) < target)
+        {
+            edge--;
+            passing += histogram[edge];
+        }
+
+        if (edge == kCoverageBins)
+        {
+            return 1.0f;
+        }
+
+        // One bin less may be closer
+        if (static_cast<double>(passing) - target > target - static_cast<double>(passing - histogram[edge]))
+        {
+            edge++;
+        }
+        return cutoff * kCoverageBins / static_cast<float>(edge);
+    }
+
+    uint32_t CalcMipCount(uint32_t width, uint32_t height)
+    {
+        uint32_t mipCount = 1;
+        while (((std::max)(width, height) >> mipCount) > 0)
+        {
+            mipCount++;
+        }
+        return mipCount;
+    }
+
+    void GenerateMips(const uint8_t* rgba, uint32_t width, uint32_t height, size_t rowPitch, const MipGenParams& params, ThreadPool* pool, MipChain* chain)
+    {
+        assert(width > 0 && height > 0 && rowPitch >= static_cast<size_t>(width) * 4);
+
+        uint32_t mipCount = CalcMipCount(width, height);
+        if (params.mMaxMips > 0)
+        {
+            mipCount = (std::min)(mipCount, params.mMaxMips);
+        }
+
+        chain->mLevels.clear();
+        size_t size = 0;
+        for (uint32_t mip = 0; mip < mipCount; ++mip)
+        {
+            MipLevel level;
+            level.mOffset = size;
+            level.mWidth = (std::max)(width >> mip, 1u);
+            level.mHeight = (std::max)(height >> mip, 1u);
+            level.mRowPitch = static_cast<size_t>(level.mWidth) * 4;
+            chain->mLevels.push_back(level);
+            size += level.mRowPitch * level.mHeight;
+        }
+        chain->mData.resize(size);
+
+        for (uint32_t y = 0; y < height; ++y)
+        {
+            memcpy(chain->mData.data() + y * chain->mLevels[0].mRowPitch, rgba + y * rowPitch, chain->mLevels[0].mRowPitch);
+        }
+
+        // Coverage of the alpha test on mip 0, which the other mips match
+        const float coverage = params.mAlphaCutoff > 0.0f ? CalcAlphaCoverage(rgba, width, height, rowPitch, params.mAlphaCutoff) : 0.0f;
+
+        float weights[kKaiserTaps];
+        CalcKaiserWeights(weights);
+
+        const ColorTables& tables = GetColorTables();
+        const Rgba8Source top = { rgba, rowPitch, params.mSrgb ? tables.mSrgbToLinear : tables.mUnormToFloat };
+        std::vector<float> previous;
+        std::vector<float> current;
+        for (uint32_t mip = 1; mip < mipCount; ++mip)
+        {
+            const MipLevel& above = chain->mLevels[mip - 1];
+            const MipLevel& level = chain->mLevels[mip];
+            current.resize(static_cast<size_t>(level.mWidth) * level.mHeight * 4);
+
+            const LinearSource linear = { previous.data(), above.mWidth };
+            ParallelFor(pool, level.mHeight, kRowsPerBatch, [&](size_t begin, size_t end)
+            {
+                if (mip == 1)
+                {
+                    FilterRows(top, above, level, params.mFilter, weights, begin, end, current.data());
+                }
+                else
+                {
+                    FilterRows(linear, above, level, params.mFilter, weights, begin, end, current.data());
+                }
+            });
+
+            // The scale applies to this mip only, the next is filtered from the unscaled alpha
+            const float alphaScale = params.mAlphaCutoff > 0.0f ?
+                FindAlphaScale(current.data(), static_cast<size_t>(level.mWidth) * level.mHeight, params.mAlphaCutoff, coverage) : 1.0f;
+
+            uint8_t* output = chain->mData.data() + level.mOffset;
+            ParallelFor(pool, level.mHeight, kRowsPerBatch, [&](size_t begin, size_t end)
+            {
+                for (size_t y = begin; y < end; ++y)
+                {
+                    StoreRow(current.data() + y * level.mWidth * 4, level.mWidth, params.mSrgb, alphaScale, output + y * level.mRowPitch);
+                }
+            });
+
+            previous.swap(current);
+        }
+    }
+}
@@ -0,0 +1,51 @@
+// MipGenerator.h
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace Vnm
+{
+    class ThreadPool;
+
+    enum class MipFilter
+    {
+        Box,                                // 2x2 average
+        Kaiser                              // Kaiser windowed sinc, sharper, 12 taps per axis
+    };
+
+    class MipGenParams
+    {
+    public:
+        MipFilter mFilter = MipFilter::Box;
+        bool      mSrgb = true;             // Color is sRGB encoded and filtered in linear space
+        float     mAlphaCutoff = 0.0f;      // Alpha test threshold whose coverage every mip keeps, 0 for none
+        uint32_t  mMaxMips = 0;             // 0 for the full chain down to 1x1
+    };
+
+    class MipLevel
+    {
+    public:
+        size_t   mOffset;                   // Into MipChain::mData
+        size_t   mRowPitch;
+        uint32_t mWidth;
+        uint32_t mHeight;
+    };
+
+    // RGBA8 mips one after another, each with rows of mRowPitch bytes, as UpdateSubresources takes them
+    class MipChain
+    {
+    public:
+        std::vector<uint8_t>  mData;
+        std::vector<MipLevel> mLevels;
+    };
+
+    // Builds mips of an RGBA8 image, including a copy of the image as mip 0. Each mip is filtered
+    // from the one above in floating point with SSE, one pixel per register, and the rows of a mip
+    // are filtered in parallel. The result does not depend on the number of threads.
+    void GenerateMips(const uint8_t* rgba, uint32_t width, uint32_t height, size_t rowPitch, const MipGenParams& params, ThreadPool* pool, MipChain* chain);
+
+    uint32_t CalcMipCount(uint32_t width, uint32_t height);
+}
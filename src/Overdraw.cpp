@@ -0,0 +1,55 @@
+// Overdraw.cpp
+
+#include "Overdraw.h"
+#include <algorithm>
+#include <cfloat>
+
+namespace Vnm
+{
+    void OverdrawEstimator::Begin(uint32_t tilesX, uint32_t tilesY)
+    {
+        mTilesX = tilesX;
+        mTilesY = tilesY;
+        mTileDepth.assign(size_t(tilesX) * tilesY, FLT_MAX);
+
+        mStats = OverdrawStats();
+        mStats.mScreenTiles = mTileDepth.size();
+    }
+
+    void OverdrawEstimator::AddDraw(float minX, float minY, float maxX, float maxY, float nearDepth, float farDepth, uint32_t flags)
+    {
+        if (maxX <= 0.0f || maxY <= 0.0f || minX >= 1.0f || minY >= 1.0f)
+        {
+            return;
+        }
+
+        // Tiles whose centers lie inside the rectangle
+        int x0 = std::max(0, static_cast<int>(minX * mTilesX + 0.5f));
+        int y0 = std::max(0, static_cast<int>(minY * mTilesY + 0.5f));
+        int x1 = std::min(static_cast<int>(mTilesX), static_cast<int>(maxX * mTilesX + 0.5f));
+        int y1 = std::min(static_cast<int>(mTilesY), static_cast<int>(maxY * mTilesY + 0.5f));
+
+        for (int y = y0; y < y1; ++y)
+        {
+            float* row = &mTileDepth[size_t(y) * mTilesX];
+            for (int x = x0; x < x1; ++x)
+            {
+                bool visible = nearDepth < row[x];
+
+                if (!(flags & OverdrawDepthOnly))
+                {
+                    mStats.mCoveredFragments++;
+                    if (visible)
+                    {
+                        mStats.mShadedFragments++;
+                    }
+                }
+
+                if ((flags & OverdrawWritesDepth) && visible)
+                {
+                    row[x] = std::min(row[x], farDepth);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,47 @@
+// Overdraw.h
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace Vnm
+{
+    constexpr uint32_t OverdrawDepthOnly   = 1 << 0; // Draw writes no color, it is not counted as shaded
+    constexpr uint32_t OverdrawWritesDepth = 1 << 1; // Draw is solid enough to hide what is behind it
+
+    class OverdrawStats
+    {
+    public:
+        size_t mScreenTiles = 0;
+        size_t mCoveredFragments = 0; // Tile fragments touched by color draws
+        size_t mShadedFragments = 0;  // Tile fragments not rejected by an earlier depth write
+
+        float GetDepthComplexity() const { return mScreenTiles ? static_cast<float>(mCoveredFragments) / mScreenTiles : 0.0f; }
+        float GetShadedOverdraw() const { return mScreenTiles ? static_cast<float>(mShadedFragments) / mScreenTiles : 0.0f; }
+    };
+
+    // Coarse CPU estimate of pixel shading overdraw for a draw order. Draws are approximated by their
+    // screen rectangle and view depth range on a low resolution tile grid, so the numbers are only
+    // meaningful relative to each other, e.g. for tracking regressions in draw ordering.
+    class OverdrawEstimator
+    {
+    public:
+        OverdrawEstimator() = default;
+        ~OverdrawEstimator() = default;
+
+        void Begin(uint32_t tilesX, uint32_t tilesY);
+
+        // Rectangle is in normalized [0, 1] screen coordinates
+        void AddDraw(float minX, float minY, float maxX, float maxY, float nearDepth, float farDepth, uint32_t flags);
+
+        const OverdrawStats& GetStats() const { return mStats; }
+
+    private:
+        uint32_t           mTilesX = 0;
+        uint32_t           mTilesY = 0;
+        std::vector<float> mTileDepth;
+        OverdrawStats      mStats;
+    };
+}
@@ -0,0 +1,165 @@
+// Profiler.cpp
+
+#include "Profiler.h"
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace Vnm
+{
+    static_assert((kProfileEventsPerThread & (kProfileEventsPerThread - 1)) == 0, "Ring buffer size must be a power of two");
+
+    // Ring buffer of a thread or track, written by one thread. mWritten counts every event ever
+    // recorded and is published after the event, so readers see complete events.
+    class ProfileTrack
+    {
+    public:
+        std::vector<ProfileEvent> mEvents;
+        std::atomic<uint64_t>     mWritten;
+        uint32_t                  mThread;
+        std::string               mName;
+    };
+
+    static std::mutex sProfilerMutex;
+    static std::vector<std::unique_ptr<ProfileTrack>> sTracks;
+    static thread_local ProfileTrack* tThreadTrack = nullptr;
+
+    static ProfileTrack* AddTrack(const char* name)
+    {
+        std::unique_ptr<ProfileTrack> track(new ProfileTrack());
+        track->mEvents.resize(kProfileEventsPerThread);
+        track->mWritten.store(0);
+        track->mName = name != nullptr ? name : "";
+
+        std::lock_guard<std::mutex> lock(sProfilerMutex);
+        track->mThread = static_cast<uint32_t>(sTracks.size());
+        sTracks.push_back(std::move(track));
+        return sTracks.back().get();
+    }
+
+    // Tracks outlive their threads, so events of finished workers still make it into the trace
+    static ProfileTrack* GetThreadTrack()
+    {
+        if (tThreadTrack == nullptr)
+        {
+            tThreadTrack = AddTrack(nullptr);
+        }
+        return tThreadTrack;
+    }
+
+    ProfileTrack* CreateProfileTrack(const char* name)
+    {
+        return AddTrack(name);
+    }
+
+    void RecordProfileEvent(ProfileTrack* track, const char* name, uint64_t start, uint64_t end)
+    {
+        uint64_t index = track->mWritten.load(std::memory_order_relaxed);
+        ProfileEvent& event = track->mEvents[index & (kProfileEventsPerThread - 1)];
+        event.mName = name;
+        event.mStart = start;
+        event.mEnd = end;
+        event.mThread = track->mThread;
+        track->mWritten.store(index + 1, std::memory_order_release);
+    }
+
+    void RecordProfileEvent(const char* name, uint64_t start, uint64_t end)
+    {
+        RecordProfileEvent(GetThreadTrack(), name, start, end);
+    }
+
+    void SetProfilerThreadName(const char* name)
+    {
+        ProfileTrack* track = GetThreadTrack();
+        std::lock_guard<std::mutex> lock(sProfilerMutex);
+        track->mName = name;
+    }
+
+    void CollectProfileEvents(std::vector<ProfileEvent>* events)
+    {
+        events->clear();
+        std::lock_guard<std::mutex> lock(sProfilerMutex);
+        for (const auto& track : sTracks)
+        {
+            uint64_t written = track->mWritten.load(std::memory_order_acquire);
+            uint64_t first = written > kProfileEventsPerThread ? written - kProfileEventsPerThread : 0;
+            for (uint64_t i = first; i < written; ++i)
+            {
+                events->push_back(track->mEvents[i & (kProfileEventsPerThread - 1)]);
+            }
+        }
+    }
+
+    void ClearProfileEvents()
+    {
+        std::lock_guard<std::mutex> lock(sProfilerMutex);
+        for (const auto& track : sTracks)
+        {
+            track->mWritten.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    static void WriteJsonString(std::ofstream& file, const char* text)
+    {
+        file << '"';
+        for (const char* c = text; *c != '\0'; ++c)
+        {
+            if (*c == '"' || *c == '\\')
+            {
+                file << '\\';
+            }
+            file << *c;
+        }
+        file << '"';
+    }
+
+    bool WriteChromeTrace(const char* fileName)
+    {
+        std::vector<ProfileEvent> events;
+        CollectProfileEvents(&events);
+
+        std::ofstream file(fileName, std::ios::out | std::ios::trunc);
+        if (!file)
+        {
+            return false;
+        }
+
+        // Timestamps in microseconds from the first event
+        uint64_t base = UINT64_MAX;
+        for (const ProfileEvent& event : events)
+        {
+            base = (std::min)(base, event.mStart);
+        }
+
+        file << "{\"traceEvents\":[\n";
+        file.precision(3);
+        file << std::fixed;
+        bool first = true;
+        {
+            std::lock_guard<std::mutex> lock(sProfilerMutex);
+            for (const auto& track : sTracks)
+            {
+                file << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << track->mThread << ",\"args\":{\"name\":";
+                std::string name = track->mName.empty() ? "Thread " + std::to_string(track->mThread) : track->mName;
+                WriteJsonString(file, name.c_str());
+                file << "}}";
+                first = false;
+            }
+        }
+
+        for (const ProfileEvent& event : events)
+        {
+            file << (first ? "" : ",\n") << "{\"name\":";
+            WriteJsonString(file, event.mName);
+            file << ",\"cat\":\"cpu\",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.mThread
+                 << ",\"ts\":" << TicksToSeconds(event.mStart - base) * 1e6
+                 << ",\"dur\":" << TicksToSeconds(event.mEnd - event.mStart) * 1e6 << "}";
+            first = false;
+        }
+        file << "\n]}\n";
+        return static_cast<bool>(file);
+    }
+}
@@ -0,0 +1,74 @@
+// Profiler.h
+
+#pragma once
+
+#include "FrameTimer.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// 0 compiles PROFILE_ZONE out
+#ifndef VNM_PROFILER
+#define VNM_PROFILER 1
+#endif
+
+namespace Vnm
+{
+    class ProfileEvent
+    {
+    public:
+        const char* mName;
+        uint64_t    mStart;                 // GetClockTicks
+        uint64_t    mEnd;
+        uint32_t    mThread;                // Index in the order threads first recorded and tracks were created
+    };
+
+    static const size_t kProfileEventsPerThread = 1 << 15;
+
+    // Adds a zone to the calling thread's ring buffer, which keeps the most recent
+    // kProfileEventsPerThread. Recording takes no locks after the first event of a thread.
+    void RecordProfileEvent(const char* name, uint64_t start, uint64_t end);
+
+    // Shown in the trace instead of the thread index
+    void SetProfilerThreadName(const char* name);
+
+    // Timeline of its own in the trace, for events that are not zones of a thread, such as passes
+    // timed on the GPU. Only one thread at a time may record into a track.
+    class ProfileTrack;
+    ProfileTrack* CreateProfileTrack(const char* name);
+    void RecordProfileEvent(ProfileTrack* track, const char* name, uint64_t start, uint64_t end);
+
+    // Events of every thread, oldest first per thread. Threads still recording may overwrite the
+    // oldest events while they are copied.
+    void CollectProfileEvents(std::vector<ProfileEvent>* events);
+
+    // Drops all events, only while no other thread records
+    void ClearProfileEvents();
+
+    // Chrome trace event JSON, for chrome://tracing or ui.perfetto.dev
+    bool WriteChromeTrace(const char* fileName);
+
+    // Times its scope. The name has to outlive the profile, only the pointer is kept.
+    class ProfileZone
+    {
+    public:
+        explicit ProfileZone(const char* name) : mName(name), mStart(GetClockTicks()) {}
+        ~ProfileZone() { RecordProfileEvent(mName, mStart, GetClockTicks()); }
+
+        ProfileZone(const ProfileZone&) = delete;
+        ProfileZone& operator=(const ProfileZone&) = delete;
+
+    private:
+        const char* mName;
+        uint64_t    mStart;
+    };
+}
+
+#define VNM_PROFILE_CONCAT_INNER(a, b) a##b
+#define VNM_PROFILE_CONCAT(a, b) VNM_PROFILE_CONCAT_INNER(a, b)
+
+#if VNM_PROFILER
+#define PROFILE_ZONE(name) Vnm::ProfileZone VNM_PROFILE_CONCAT(profileZone, __LINE__)(name)
+#else
+#define PROFILE_ZONE(name)
+#endif
@@ -0,0 +1,142 @@
+// RenderQueue.cpp
+
+#include "RenderQueue.h"
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+namespace Vnm
+{
+    uint64_t MakeSortKey(uint32_t pipeline, uint32_t material, uint32_t mesh, uint32_t depthBucket)
+    {
+        assert(pipeline < (1u << SortKeyPipelineBits));
+        assert(material < (1u << SortKeyMaterialBits));
+        assert(mesh < (1u << SortKeyMeshBits));
+        assert(depthBucket < (1u << SortKeyDepthBits));
+
+        return (static_cast<uint64_t>(pipeline) << SortKeyPipelineShift) |
+               (static_cast<uint64_t>(material) << SortKeyMaterialShift) |
+               (static_cast<uint64_t>(mesh) << SortKeyMeshShift) |
+               (static_cast<uint64_t>(depthBucket) << SortKeyDepthShift);
+    }
+
+    uint32_t CalcDepthBucket(float viewDepth, float nearZ, float farZ)
+    {
+        static_assert(DepthBucketCount <= (1u << SortKeyDepthBits), "Depth buckets must fit the sort key");
+
+        if (!(viewDepth > nearZ))
+        {
+            return 0;
+        }
+        if (viewDepth >= farZ)
+        {
+            return DepthBucketCount - 1;
+        }
+
+        float t = logf(viewDepth / nearZ) / logf(farZ / nearZ);
+        return static_cast<uint32_t>(t * static_cast<float>(DepthBucketCount - 1));
+    }
+
+    // LSD radix sort on 8-bit digits. All histograms are built in one pass up front so that
+    // digits which are the same for every item (unused key bits, a single pipeline) are skipped.
+    void RenderQueue::Sort()
+    {
+        const size_t count = mItems.size();
+        if (count < 2)
+        {
+            return;
+        }
+
+        constexpr int numPasses = sizeof(uint64_t);
+        uint32_t histograms[numPasses][256];
+        memset(histograms, 0, sizeof(histograms));
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            uint64_t key = mItems[i].mSortKey;
+            for (int pass = 0; pass < numPasses; ++pass)
+            {
+                histograms[pass][(key >> (pass * 8)) & 0xff]++;
+            }
+        }
+
+        mScratch.resize(count);
+        DrawItem* src = mItems.data();
+        DrawItem* dst = mScratch.data();
+
+        for (int pass = 0; pass < numPasses; ++pass)
+        {
+            uint32_t* histogram = histograms[pass];
+            const uint32_t firstDigit = static_cast<uint32_t>(src[0].mSortKey >> (pass * 8)) & 0xff;
+            if (histogram[firstDigit] == count)
+            {
+                continue;
+            }
+
+            uint32_t offset = 0;
+            for (int digit = 0; digit < 256; ++digit)
+            {
+                uint32_t digitCount = histogram[digit];
+                histogram[digit] = offset;
+                offset += digitCount;
+            }
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                uint32_t digit = static_cast<uint32_t>(src[i].mSortKey >> (pass * 8)) & 0xff;
+                dst[histogram[digit]++] = src[i];
+            }
+
+            DrawItem* temp = src;
+            src = dst;
+            dst = temp;
+        }
+
+        if (src != mItems.data())
+        {
+            mItems.swap(mScratch);
+        }
+    }
+
+    RenderQueueStats RenderQueue::Submit(RenderQueueBackend& backend) const
+    {
+        RenderQueueStats stats;
+
+        uint32_t pipeline = UINT32_MAX;
+        uint32_t material = UINT32_MAX;
+        uint32_t mesh = UINT32_MAX;
+
+        for (const DrawItem& item : mItems)
+        {
+            // A pipeline change invalidates nothing else in D3D12, but we rebind everything after it
+            // so backends don't need to track bindings across pipelines
+            if (item.GetPipeline() != pipeline)
+            {
+                pipeline = item.GetPipeline();
+                material = UINT32_MAX;
+                mesh = UINT32_MAX;
+                backend.SetPipeline(pipeline);
+                stats.mPipelineChanges++;
+            }
+
+            if (item.GetMaterial() != material)
+            {
+                material = item.GetMaterial();
+                backend.SetMaterial(material);
+                stats.mMaterialChanges++;
+            }
+
+            if (item.GetMesh() != mesh)
+            {
+                mesh = item.GetMesh();
+                backend.SetMesh(mesh);
+                stats.mMeshChanges++;
+            }
+
+            backend.Draw(mesh, item.mInstance);
+            stats.mDraws++;
+        }
+
+        return stats;
+    }
+}
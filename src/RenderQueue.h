@@ -0,0 +1,88 @@
+// RenderQueue.h
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace Vnm
+{
+    // Sort key layout, most significant first: pipeline | material | mesh | depth bucket | unused.
+    // Material is the state bound for it (e.g. the descriptor table), not the material table index.
+    constexpr uint32_t SortKeyPipelineBits = 8;
+    constexpr uint32_t SortKeyMaterialBits = 16;
+    constexpr uint32_t SortKeyMeshBits     = 16;
+    constexpr uint32_t SortKeyDepthBits    = 16;
+
+    constexpr uint32_t SortKeyDepthShift    = 8;
+    constexpr uint32_t SortKeyMeshShift     = SortKeyDepthShift + SortKeyDepthBits;
+    constexpr uint32_t SortKeyMaterialShift = SortKeyMeshShift + SortKeyMeshBits;
+    constexpr uint32_t SortKeyPipelineShift = SortKeyMaterialShift + SortKeyMaterialBits;
+    static_assert(SortKeyPipelineShift + SortKeyPipelineBits == 64, "Sort key fields must fill 64 bits");
+
+    uint64_t MakeSortKey(uint32_t pipeline, uint32_t material, uint32_t mesh, uint32_t depthBucket);
+
+    // Depth buckets are logarithmic so resolution goes where overdraw is most visible. 256 buckets
+    // keeps the depth in a single radix digit, so depth ordering costs one sort pass.
+    constexpr uint32_t DepthBucketCount = 256;
+
+    // Quantizes view depth into a depth bucket, nearest first
+    uint32_t CalcDepthBucket(float viewDepth, float nearZ, float farZ);
+
+    class DrawItem
+    {
+    public:
+        uint64_t mSortKey;
+        uint32_t mInstance;
+        uint32_t mPad;
+
+        uint32_t GetPipeline() const { return static_cast<uint32_t>(mSortKey >> SortKeyPipelineShift) & ((1u << SortKeyPipelineBits) - 1); }
+        uint32_t GetMaterial() const { return static_cast<uint32_t>(mSortKey >> SortKeyMaterialShift) & ((1u << SortKeyMaterialBits) - 1); }
+        uint32_t GetMesh() const { return static_cast<uint32_t>(mSortKey >> SortKeyMeshShift) & ((1u << SortKeyMeshBits) - 1); }
+    };
+
+    // Receives the state changes and draws of a sorted queue
+    class RenderQueueBackend
+    {
+    public:
+        virtual ~RenderQueueBackend() = default;
+
+        virtual void SetPipeline(uint32_t pipeline) = 0;
+        virtual void SetMaterial(uint32_t material) = 0;
+        virtual void SetMesh(uint32_t mesh) = 0;
+        virtual void Draw(uint32_t mesh, uint32_t instance) = 0;
+    };
+
+    class RenderQueueStats
+    {
+    public:
+        size_t mDraws = 0;
+        size_t mPipelineChanges = 0;
+        size_t mMaterialChanges = 0;
+        size_t mMeshChanges = 0;
+    };
+
+    // Collects draw items for a frame, radix sorts them by key and emits only the state changes
+    // needed between consecutive draws
+    class RenderQueue
+    {
+    public:
+        RenderQueue() = default;
+        ~RenderQueue() = default;
+
+        void Clear() { mItems.clear(); }
+        void Reserve(size_t count) { mItems.reserve(count); mScratch.reserve(count); }
+        void Add(uint64_t sortKey, uint32_t instance) { mItems.push_back({ sortKey, instance, 0 }); }
+
+        void Sort();
+        RenderQueueStats Submit(RenderQueueBackend& backend) const;
+
+        size_t          GetCount() const { return mItems.size(); }
+        const DrawItem* GetItems() const { return mItems.data(); }
+
+    private:
+        std::vector<DrawItem> mItems;
+        std::vector<DrawItem> mScratch;
+    };
+}
@@ -0,0 +1,129 @@
+// SceneBvh.cpp
+
+#include "SceneBvh.h"
+#include "MemoryTracker.h"
+#include "ThreadPool.h"
+#include <cassert>
+
+namespace Vnm
+{
+    static const size_t kQueryBatchSize = 64;
+
+    static Aabb TransformAabb(const Aabb& box, const Float4x4& m)
+    {
+        Aabb result;
+        for (int corner = 0; corner < 8; ++corner)
+        {
+            Float3 p =
+            {
+                (corner & 1) ? box.mMax.x : box.mMin.x,
+                (corner & 2) ? box.mMax.y : box.mMin.y,
+                (corner & 4) ? box.mMax.z : box.mMin.z
+            };
+            Float4 transformed = TransformPoint(p, m);
+            result.Extend(Float3{ transformed.x, transformed.y, transformed.z });
+        }
+        return result;
+    }
+
+    void SceneBvh::Build(const TriangleBvh* const* meshes, size_t numMeshes, const SceneInstance* instances, size_t numInstances, ThreadPool* pool)
+    {
+        mMeshes.assign(meshes, meshes + numMeshes);
+        mStats = SceneBvhStats();
+        mStats.mInstances = numInstances;
+
+        // Instances of empty meshes get empty bounds, which no ray hits
+        std::vector<Aabb> bounds(numInstances);
+        ParallelFor(pool, numInstances, 1024, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                assert(instances[i].mMesh < numMeshes);
+                const Aabb& meshBounds = meshes[instances[i].mMesh]->GetBounds();
+                bounds[i] = meshBounds.IsValid() ? TransformAabb(meshBounds, instances[i].mWorld) : Aabb();
+            }
+        });
+
+        // Testing an instance means traversing its mesh, so leaves rarely hold more than one
+        BvhBuildParams params;
+        params.mGroupSize = 1;
+        params.mMaxLeafSize = 2;
+        params.mTraversalCost = 0.25f;
+
+        std::vector<uint32_t> order;
+        mStats.mMaxDepth = BuildBvh(bounds.data(), numInstances, params, pool, &mNodes, &order);
+        mStats.mNodes = mNodes.size();
+
+        mInstances.resize(numInstances);
+        ParallelFor(pool, numInstances, 1024, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                const SceneInstance& instance = instances[order[i]];
+                mInstances[i].mWorldToObject = InverseAffine(instance.mWorld);
+                mInstances[i].mMesh = instance.mMesh;
+                mInstances[i].mIndex = order[i];
+            }
+        });
+    }
+
+    bool SceneBvh::Raycast(const Ray& ray, SceneHit* hit) const
+    {
+        float tMax = ray.mMaxDistance;
+        const Instance* hitInstance = nullptr;
+        RayHit meshHit;
+
+        TraverseBvh(mNodes, ray, &tMax, [&](const BvhNode& leaf, float* leafMax)
+        {
+            for (uint32_t i = leaf.mFirst; i < leaf.mFirst + leaf.mCount; ++i)
+            {
+                // Without normalizing the direction, distances are the same in object space
+                const Instance& instance = mInstances[i];
+                Float4 origin = TransformPoint(ray.mOrigin, instance.mWorldToObject);
+                Ray objectRay;
+                objectRay.mOrigin = { origin.x, origin.y, origin.z };
+                objectRay.mDirection = TransformVector(ray.mDirection, instance.mWorldToObject);
+                objectRay.mMinDistance = ray.mMinDistance;
+                objectRay.mMaxDistance = *leafMax;
+
+                if (mMeshes[instance.mMesh]->Raycast(objectRay, &meshHit))
+                {
+                    *leafMax = meshHit.mDistance;
+                    hitInstance = &instance;
+                }
+            }
+            return false;
+        });
+
+        if (hitInstance == nullptr)
+        {
+            return false;
+        }
+
+        hit->mDistance = tMax;
+        hit->mInstance = hitInstance->mIndex;
+        hit->mMesh = hitInstance->mMesh;
+        hit->mSubmesh = meshHit.mMesh;
+        hit->mTriangle = meshHit.mTriangle;
+        hit->mU = meshHit.mU;
+        hit->mV = meshHit.mV;
+        return true;
+    }
+
+    void SceneBvh::Raycast(const Ray* rays, SceneHit* hits, size_t count, ThreadPool* pool) const
+    {
+        ParallelFor(pool, count, kQueryBatchSize, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                hits[i] = SceneHit();
+                Raycast(rays[i], &hits[i]);
+            }
+        });
+    }
+
+    uint64_t SceneBvh::GetMemorySize() const
+    {
+        return GetVectorBytes(mNodes) + GetVectorBytes(mInstances) + GetVectorBytes(mMeshes);
+    }
+}
@@ -0,0 +1,75 @@
+// SceneBvh.h
+
+#pragma once
+
+#include "TriangleBvh.h"
+#include <stdint.h>
+#include <vector>
+
+namespace Vnm
+{
+    class SceneInstance
+    {
+    public:
+        Float4x4 mWorld;                    // Affine
+        uint32_t mMesh;                     // Index into the meshes the scene is built with
+    };
+
+    class SceneHit
+    {
+    public:
+        static const uint32_t kNoHit = RayHit::kNoHit;
+
+        float    mDistance = 1e30f;         // In units of the world space ray direction
+        uint32_t mInstance = kNoHit;
+        uint32_t mMesh = kNoHit;            // Mesh of the instance
+        uint32_t mSubmesh = kNoHit;         // RayHit::mMesh within that mesh
+        uint32_t mTriangle = kNoHit;
+        float    mU = 0.0f;
+        float    mV = 0.0f;
+
+        bool IsHit() const { return mInstance != kNoHit; }
+    };
+
+    class SceneBvhStats
+    {
+    public:
+        size_t   mInstances = 0;
+        size_t   mNodes = 0;
+        uint32_t mMaxDepth = 0;
+    };
+
+    // Two level BVH for picking: a top level over the world bounds of instances, and the triangle
+    // BVH of each instance's mesh below it, which rays enter transformed into object space. The meshes
+    // are referenced, not copied, and have to outlive the scene.
+    class SceneBvh
+    {
+    public:
+        // pool may be null to build on the calling thread
+        void Build(const TriangleBvh* const* meshes, size_t numMeshes, const SceneInstance* instances, size_t numInstances, ThreadPool* pool);
+
+        // Closest hit, returns false and leaves hit untouched on a miss
+        bool Raycast(const Ray& ray, SceneHit* hit) const;
+        void Raycast(const Ray* rays, SceneHit* hits, size_t count, ThreadPool* pool) const;
+
+        const SceneBvhStats& GetStats() const { return mStats; }
+
+        // Bytes held by the top level, without the meshes
+        uint64_t GetMemorySize() const;
+
+    private:
+        // In leaf order
+        class Instance
+        {
+        public:
+            Float4x4 mWorldToObject;
+            uint32_t mMesh;
+            uint32_t mIndex;
+        };
+
+        std::vector<BvhNode>            mNodes;
+        std::vector<Instance>           mInstances;
+        std::vector<const TriangleBvh*> mMeshes;
+        SceneBvhStats                   mStats;
+    };
+}
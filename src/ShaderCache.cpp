@@ -0,0 +1,191 @@
+// ShaderCache.cpp
+
+#include "ShaderCache.h"
+#include "MappedFile.h"
+#include "Material.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+namespace Vnm
+{
+    static const uint32_t kShaderCacheMagic = 0x43485356;     // "VSHC"
+    static const uint32_t kShaderCacheVersion = 1;
+
+    class ShaderCacheHeader
+    {
+    public:
+        uint32_t mMagic;
+        uint32_t mVersion;
+        uint64_t mCount;
+        uint64_t mChecksum;         // HashBytes of everything after the header
+    };
+
+    static bool HashSourceFile(const std::string& fileName, std::vector<std::string>* visited, uint64_t* hash)
+    {
+        // Include guards make files include each other, each file counts once
+        if (std::find(visited->begin(), visited->end(), fileName) != visited->end())
+        {
+            return true;
+        }
+        visited->push_back(fileName);
+
+        MappedFile file;
+        if (!file.Open(fileName))
+        {
+            return false;
+        }
+        const char* text = reinterpret_cast<const char*>(file.GetData());
+        const size_t size = static_cast<size_t>(file.GetSize());
+        *hash = HashBytes(text, size, *hash);
+
+        const size_t separator = fileName.find_last_of("/\\");
+        const std::string directory = separator == std::string::npos ? std::string() : fileName.substr(0, separator + 1);
+        for (size_t lineStart = 0; lineStart < size;)
+        {
+            const char* lineEnd = static_cast<const char*>(memchr(text + lineStart, '\n', size - lineStart));
+            const size_t lineSize = lineEnd != nullptr ? static_cast<size_t>(lineEnd - text) - lineStart : size - lineStart;
+            const std::string line(text + lineStart, lineSize);
+            lineStart += lineSize + 1;
+
+            const size_t directive = line.find_first_not_of(" \t");
+            if (directive == std::string::npos || line.compare(directive, 8, "#include") != 0)
+            {
+                continue;
+            }
+            const size_t open = line.find('"', directive + 8);
+            const size_t close = open == std::string::npos ? std::string::npos : line.find('"', open + 1);
+            if (close != std::string::npos && !HashSourceFile(directory + line.substr(open + 1, close - open - 1), visited, hash))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool CalcShaderSourceHash(const std::string& fileName, uint64_t* hash)
+    {
+        std::vector<std::string> visited;
+        *hash = HashSeed;
+        return HashSourceFile(fileName, &visited, hash);
+    }
+
+    uint64_t CalcShaderKey(uint64_t sourceHash, const char* entryPoint, const char* target, const ShaderDefine* defines, size_t defineCount,
+        uint32_t flags, uint32_t compilerVersion)
+    {
+        // Strings with their terminators, so that "ab" + "c" differs from "a" + "bc"
+        uint64_t key = HashBytes(&sourceHash, sizeof(sourceHash));
+        key = HashBytes(entryPoint, strlen(entryPoint) + 1, key);
+        key = HashBytes(target, strlen(target) + 1, key);
+        for (size_t i = 0; i < defineCount; ++i)
+        {
+            key = HashBytes(defines[i].mName, strlen(defines[i].mName) + 1, key);
+            key = HashBytes(defines[i].mValue != nullptr ? defines[i].mValue : "", defines[i].mValue != nullptr ? strlen(defines[i].mValue) + 1 : 1, key);
+        }
+        key = HashBytes(&flags, sizeof(flags), key);
+        return HashBytes(&compilerVersion, sizeof(compilerVersion), key);
+    }
+
+    bool ShaderCache::Load(const std::string& fileName)
+    {
+        mShaders.clear();
+        mDirty = false;
+
+        MappedFile file;
+        if (!file.Open(fileName) || file.GetSize() < sizeof(ShaderCacheHeader))
+        {
+            return false;
+        }
+
+        ShaderCacheHeader header;
+        memcpy(&header, file.GetData(), sizeof(header));
+        const uint8_t* data = file.GetData() + sizeof(header);
+        const uint64_t size = file.GetSize() - sizeof(header);
+        if (header.mMagic != kShaderCacheMagic || header.mVersion != kShaderCacheVersion ||
+            header.mChecksum != HashBytes(data, static_cast<size_t>(size)))
+        {
+            return false;
+        }
+
+        uint64_t offset = 0;
+        for (uint64_t i = 0; i < header.mCount; ++i)
+        {
+            uint64_t entry[2];      // Key and bytecode size
+            if (size - offset < sizeof(entry))
+            {
+                mShaders.clear();
+                return false;
+            }
+            memcpy(entry, data + offset, sizeof(entry));
+            offset += sizeof(entry);
+            if (size - offset < entry[1])
+            {
+                mShaders.clear();
+                return false;
+            }
+            mShaders[entry[0]].assign(data + offset, data + offset + entry[1]);
+            offset += entry[1];
+        }
+        return true;
+    }
+
+    bool ShaderCache::Save(const std::string& fileName)
+    {
+        if (!mDirty)
+        {
+            return true;
+        }
+
+        // Sorted by key, so the same shaders always make the same file
+        std::vector<uint64_t> keys;
+        for (const auto& shader : mShaders)
+        {
+            keys.push_back(shader.first);
+        }
+        std::sort(keys.begin(), keys.end());
+
+        std::vector<uint8_t> data;
+        for (uint64_t key : keys)
+        {
+            const std::vector<uint8_t>& bytecode = mShaders[key];
+            const uint64_t entry[2] = { key, bytecode.size() };
+            data.insert(data.end(), reinterpret_cast<const uint8_t*>(entry), reinterpret_cast<const uint8_t*>(entry) + sizeof(entry));
+            data.insert(data.end(), bytecode.begin(), bytecode.end());
+        }
+
+        ShaderCacheHeader header;
+        header.mMagic = kShaderCacheMagic;
+        header.mVersion = kShaderCacheVersion;
+        header.mCount = keys.size();
+        header.mChecksum = HashBytes(data.data(), data.size());
+
+        std::ofstream file(fileName, std::ios::out | std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(data.data()), data.size());
+        if (!file)
+        {
+            return false;
+        }
+        mDirty = false;
+        return true;
+    }
+
+    const std::vector<uint8_t>* ShaderCache::Find(uint64_t key)
+    {
+        auto shader = mShaders.find(key);
+        if (shader == mShaders.end())
+        {
+            mStats.mMisses++;
+            return nullptr;
+        }
+        mStats.mHits++;
+        return &shader->second;
+    }
+
+    void ShaderCache::Add(uint64_t key, const void* data, size_t size)
+    {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        mShaders[key].assign(bytes, bytes + size);
+        mDirty = true;
+    }
+}
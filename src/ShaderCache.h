@@ -0,0 +1,60 @@
+// ShaderCache.h
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Vnm
+{
+    // Same layout as D3D_SHADER_MACRO
+    class ShaderDefine
+    {
+    public:
+        const char* mName;
+        const char* mValue;
+    };
+
+    // Hash of a shader source file and of every file it includes with #include "...", found
+    // relative to the including file. Returns false if any of them cannot be read.
+    bool CalcShaderSourceHash(const std::string& fileName, uint64_t* hash);
+
+    // Everything that changes the bytecode of a compile. compilerVersion keeps bytecode of another
+    // compiler from being used.
+    uint64_t CalcShaderKey(uint64_t sourceHash, const char* entryPoint, const char* target, const ShaderDefine* defines, size_t defineCount,
+        uint32_t flags, uint32_t compilerVersion);
+
+    class ShaderCacheStats
+    {
+    public:
+        size_t mHits = 0;
+        size_t mMisses = 0;
+    };
+
+    // Compiled shaders by key, kept in one file between runs. The file has a checksum, a file
+    // that is truncated or damaged is ignored as a whole and rewritten on the next save.
+    class ShaderCache
+    {
+    public:
+        // Returns false and leaves the cache empty if the file is missing or invalid
+        bool Load(const std::string& fileName);
+
+        // Writes the file if anything was added since it was loaded
+        bool Save(const std::string& fileName);
+
+        // Null if the key is not cached, counted as a hit or a miss
+        const std::vector<uint8_t>* Find(uint64_t key);
+        void Add(uint64_t key, const void* data, size_t size);
+
+        size_t                  GetCount() const { return mShaders.size(); }
+        const ShaderCacheStats& GetStats() const { return mStats; }
+
+    private:
+        std::unordered_map<uint64_t, std::vector<uint8_t>> mShaders;
+        ShaderCacheStats                                   mStats;
+        bool                                               mDirty = false;
+    };
+}
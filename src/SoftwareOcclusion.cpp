@@ -0,0 +1,332 @@
+// SoftwareOcclusion.cpp
+
+#include "SoftwareOcclusion.h"
+#include <algorithm>
+#include <cassert>
+#include <xmmintrin.h>
+
+namespace Vnm
+{
+    OcclusionBuffer::OcclusionBuffer()
+        : mDepth(kWidth * kHeight, 1.0f)
+        , mTileMaxDepth(kTilesX * kTilesY, 1.0f)
+    {
+    }
+
+    void OcclusionBuffer::Clear()
+    {
+        std::fill(mDepth.begin(), mDepth.end(), 1.0f);
+        std::fill(mTileMaxDepth.begin(), mTileMaxDepth.end(), 1.0f);
+        mStats = OcclusionStats();
+    }
+
+    void OcclusionBuffer::RasterizeMesh(const OccluderMesh& mesh, const Float4x4& worldViewProj)
+    {
+        assert(mesh.mPositions.size() % 3 == 0 && mesh.mIndices.size() % 3 == 0);
+
+        // Transform all vertices to clip space up front, one SIMD lane per component
+        const __m128 row0 = _mm_loadu_ps(worldViewProj.m[0]);
+        const __m128 row1 = _mm_loadu_ps(worldViewProj.m[1]);
+        const __m128 row2 = _mm_loadu_ps(worldViewProj.m[2]);
+        const __m128 row3 = _mm_loadu_ps(worldViewProj.m[3]);
+
+        const size_t numVertices = mesh.mPositions.size() / 3;
+        mClipVertices.resize(numVertices);
+        const float* position = mesh.mPositions.data();
+        for (size_t i = 0; i < numVertices; ++i, position += 3)
+        {
+            __m128 clip = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(_mm_set1_ps(position[0]), row0), _mm_mul_ps(_mm_set1_ps(position[1]), row1)),
+                _mm_add_ps(_mm_mul_ps(_mm_set1_ps(position[2]), row2), row3));
+            _mm_storeu_ps(&mClipVertices[i].x, clip);
+        }
+
+        const size_t numIndices = mesh.mIndices.size();
+        for (size_t i = 0; i < numIndices; i += 3)
+        {
+            Float4 triangle[3] =
+            {
+                mClipVertices[mesh.mIndices[i]],
+                mClipVertices[mesh.mIndices[i + 1]],
+                mClipVertices[mesh.mIndices[i + 2]]
+            };
+
+            // Trivially reject triangles entirely outside one frustum plane
+            if ((triangle[0].x > triangle[0].w && triangle[1].x > triangle[1].w && triangle[2].x > triangle[2].w) ||
+                (triangle[0].x < -triangle[0].w && triangle[1].x < -triangle[1].w && triangle[2].x < -triangle[2].w) ||
+                (triangle[0].y > triangle[0].w && triangle[1].y > triangle[1].w && triangle[2].y > triangle[2].w) ||
+                (triangle[0].y < -triangle[0].w && triangle[1].y < -triangle[1].w && triangle[2].y < -triangle[2].w) ||
+                (triangle[0].z > triangle[0].w && triangle[1].z > triangle[1].w && triangle[2].z > triangle[2].w) ||
+                (triangle[0].z < 0.0f && triangle[1].z < 0.0f && triangle[2].z < 0.0f))
+            {
+                continue;
+            }
+
+            RasterizeTriangle(triangle);
+        }
+
+        mStats.mOccluderTriangles += numIndices / 3;
+    }
+
+    // Rasterizes a screen space triangle (x, y in pixels, z in [0, 1]) with a depth min test
+    static void RasterizeScreenTriangle(float* depth, const float* p0, const float* p1, const float* p2)
+    {
+        float area = (p1[0] - p0[0]) * (p2[1] - p0[1]) - (p2[0] - p0[0]) * (p1[1] - p0[1]);
+        if (area < 0.0f)
+        {
+            std::swap(p1, p2);
+            area = -area;
+        }
+        if (area < 1e-6f)
+        {
+            return;
+        }
+
+        const int width = static_cast<int>(OcclusionBuffer::kWidth);
+        const int height = static_cast<int>(OcclusionBuffer::kHeight);
+
+        int minX = std::max(0, static_cast<int>(std::min({ p0[0], p1[0], p2[0] })));
+        int maxX = std::min(width - 1, static_cast<int>(std::max({ p0[0], p1[0], p2[0] })));
+        int minY = std::max(0, static_cast<int>(std::min({ p0[1], p1[1], p2[1] })));
+        int maxY = std::min(height - 1, static_cast<int>(std::max({ p0[1], p1[1], p2[1] })));
+        if (minX > maxX || minY > maxY)
+        {
+            return;
+        }
+
+        // Edge functions a * x + b * y + c, positive inside
+        const float* vertices[3] = { p0, p1, p2 };
+        float edgeA[3];
+        float edgeB[3];
+        float edgeC[3];
+        for (int i = 0; i < 3; ++i)
+        {
+            const float* a = vertices[i];
+            const float* b = vertices[(i + 1) % 3];
+            edgeA[i] = a[1] - b[1];
+            edgeB[i] = b[0] - a[0];
+            edgeC[i] = -(edgeA[i] * a[0] + edgeB[i] * a[1]);
+        }
+
+        // Depth plane
+        float invArea = 1.0f / area;
+        float dzdx = ((p1[2] - p0[2]) * (p2[1] - p0[1]) - (p2[2] - p0[2]) * (p1[1] - p0[1])) * invArea;
+        float dzdy = ((p1[0] - p0[0]) * (p2[2] - p0[2]) - (p2[0] - p0[0]) * (p1[2] - p0[2])) * invArea;
+
+        const __m128 pixelOffsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 a0 = _mm_set1_ps(edgeA[0]);
+        const __m128 a1 = _mm_set1_ps(edgeA[1]);
+        const __m128 a2 = _mm_set1_ps(edgeA[2]);
+        const __m128 zdx = _mm_set1_ps(dzdx);
+
+        // Width is a multiple of 4, so 4-pixel blocks starting on an aligned x never leave the row
+        const int startX = minX & ~3;
+
+        for (int y = minY; y <= maxY; ++y)
+        {
+            float py = static_cast<float>(y) + 0.5f;
+            __m128 rowE0 = _mm_set1_ps(edgeB[0] * py + edgeC[0]);
+            __m128 rowE1 = _mm_set1_ps(edgeB[1] * py + edgeC[1]);
+            __m128 rowE2 = _mm_set1_ps(edgeB[2] * py + edgeC[2]);
+            __m128 rowZ = _mm_set1_ps(p0[2] - dzdx * p0[0] + dzdy * (py - p0[1]));
+            float* row = depth + y * width;
+
+            for (int x = startX; x <= maxX; x += 4)
+            {
+                __m128 px = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), pixelOffsets);
+                __m128 e0 = _mm_add_ps(_mm_mul_ps(a0, px), rowE0);
+                __m128 e1 = _mm_add_ps(_mm_mul_ps(a1, px), rowE1);
+                __m128 e2 = _mm_add_ps(_mm_mul_ps(a2, px), rowE2);
+                __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+                if (_mm_movemask_ps(inside) == 0)
+                {
+                    continue;
+                }
+
+                __m128 z = _mm_add_ps(_mm_mul_ps(zdx, px), rowZ);
+                __m128 oldDepth = _mm_loadu_ps(row + x);
+                __m128 newDepth = _mm_min_ps(oldDepth, z);
+                _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, newDepth), _mm_andnot_ps(inside, oldDepth)));
+            }
+        }
+    }
+
+    static Float4 Lerp(const Float4& a, const Float4& b, float t)
+    {
+        return { a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t, a.z + (b.z - a.z) * t, a.w + (b.w - a.w) * t };
+    }
+
+    void OcclusionBuffer::RasterizeTriangle(const Float4* v)
+    {
+        // Clip against the near plane (z >= 0), giving at most a quad
+        Float4 clipped[4];
+        int numClipped = 0;
+        for (int i = 0; i < 3; ++i)
+        {
+            const Float4& a = v[i];
+            const Float4& b = v[(i + 1) % 3];
+            if (a.z >= 0.0f)
+            {
+                clipped[numClipped++] = a;
+            }
+            if ((a.z >= 0.0f) != (b.z >= 0.0f))
+            {
+                clipped[numClipped++] = Lerp(a, b, a.z / (a.z - b.z));
+            }
+        }
+
+        if (numClipped < 3)
+        {
+            return;
+        }
+
+        float screen[4][3];
+        for (int i = 0; i < numClipped; ++i)
+        {
+            float invW = 1.0f / clipped[i].w;
+            screen[i][0] = (clipped[i].x * invW * 0.5f + 0.5f) * kWidth;
+            screen[i][1] = (0.5f - clipped[i].y * invW * 0.5f) * kHeight;
+            screen[i][2] = clipped[i].z * invW;
+        }
+
+        RasterizeScreenTriangle(mDepth.data(), screen[0], screen[1], screen[2]);
+        if (numClipped == 4)
+        {
+            RasterizeScreenTriangle(mDepth.data(), screen[0], screen[2], screen[3]);
+        }
+    }
+
+    void OcclusionBuffer::BuildHierarchy()
+    {
+        for (uint32_t tileY = 0; tileY < kTilesY; ++tileY)
+        {
+            for (uint32_t tileX = 0; tileX < kTilesX; ++tileX)
+            {
+                const float* tile = mDepth.data() + tileY * kTileSize * kWidth + tileX * kTileSize;
+                __m128 tileMax = _mm_setzero_ps();
+                for (uint32_t y = 0; y < kTileSize; ++y)
+                {
+                    tileMax = _mm_max_ps(tileMax, _mm_loadu_ps(tile + y * kWidth));
+                    tileMax = _mm_max_ps(tileMax, _mm_loadu_ps(tile + y * kWidth + 4));
+                }
+
+                tileMax = _mm_max_ps(tileMax, _mm_shuffle_ps(tileMax, tileMax, _MM_SHUFFLE(1, 0, 3, 2)));
+                tileMax = _mm_max_ps(tileMax, _mm_shuffle_ps(tileMax, tileMax, _MM_SHUFFLE(2, 3, 0, 1)));
+                _mm_store_ss(&mTileMaxDepth[tileY * kTilesX + tileX], tileMax);
+            }
+        }
+    }
+
+    OcclusionResult OcclusionBuffer::TestBox(const Aabb& box, const Float4x4& worldViewProj)
+    {
+        mStats.mTested++;
+
+        float minX = 1e30f;
+        float minY = 1e30f;
+        float maxX = -1e30f;
+        float maxY = -1e30f;
+        float minZ = 1.0f;
+        uint32_t outsideAll = 0x3f;
+
+        for (int i = 0; i < 8; ++i)
+        {
+            Float3 corner =
+            {
+                (i & 1) ? box.mMax.x : box.mMin.x,
+                (i & 2) ? box.mMax.y : box.mMin.y,
+                (i & 4) ? box.mMax.z : box.mMin.z
+            };
+            Float4 clip = TransformPoint(corner, worldViewProj);
+
+            uint32_t outside = 0;
+            outside |= (clip.x > clip.w) ? 0x01 : 0;
+            outside |= (clip.x < -clip.w) ? 0x02 : 0;
+            outside |= (clip.y > clip.w) ? 0x04 : 0;
+            outside |= (clip.y < -clip.w) ? 0x08 : 0;
+            outside |= (clip.z > clip.w) ? 0x10 : 0;
+            outside |= (clip.z < 0.0f) ? 0x20 : 0;
+            outsideAll &= outside;
+
+            if (clip.z < 0.0f || clip.w <= 0.0f)
+            {
+                // Crosses the near plane, treat as visible unless it is outside another plane
+                minZ = -1.0f;
+                continue;
+            }
+
+            float invW = 1.0f / clip.w;
+            float sx = (clip.x * invW * 0.5f + 0.5f) * kWidth;
+            float sy = (0.5f - clip.y * invW * 0.5f) * kHeight;
+            minX = std::min(minX, sx);
+            maxX = std::max(maxX, sx);
+            minY = std::min(minY, sy);
+            maxY = std::max(maxY, sy);
+            minZ = std::min(minZ, clip.z * invW);
+        }
+
+        if (outsideAll != 0)
+        {
+            mStats.mOutsideFrustum++;
+            return OcclusionResult::OutsideFrustum;
+        }
+
+        if (minZ < 0.0f)
+        {
+            return OcclusionResult::Visible;
+        }
+
+        int x0 = std::max(0, static_cast<int>(minX));
+        int y0 = std::max(0, static_cast<int>(minY));
+        int x1 = std::min(static_cast<int>(kWidth) - 1, static_cast<int>(maxX));
+        int y1 = std::min(static_cast<int>(kHeight) - 1, static_cast<int>(maxY));
+        if (x0 > x1 || y0 > y1)
+        {
+            mStats.mOutsideFrustum++;
+            return OcclusionResult::OutsideFrustum;
+        }
+
+        // A pixel only holds the depth at its center, an occluder edge crossing it can leave the rest
+        // uncovered. Its neighbors hold the depth beyond the edge, so they are tested as well. Past
+        // the edge of the screen there are no neighbors, so a box that reaches it stays visible.
+        if (x0 == 0 || y0 == 0 || x1 == static_cast<int>(kWidth) - 1 || y1 == static_cast<int>(kHeight) - 1)
+        {
+            return OcclusionResult::Visible;
+        }
+        x0 -= 1;
+        y0 -= 1;
+        x1 += 1;
+        y1 += 1;
+
+        for (int tileY = y0 / kTileSize; tileY <= y1 / static_cast<int>(kTileSize); ++tileY)
+        {
+            for (int tileX = x0 / kTileSize; tileX <= x1 / static_cast<int>(kTileSize); ++tileX)
+            {
+                if (minZ > mTileMaxDepth[tileY * kTilesX + tileX])
+                {
+                    continue;
+                }
+
+                // Tile can't reject the box on its own, check the covered pixels
+                int pixelX0 = std::max(x0, tileX * static_cast<int>(kTileSize));
+                int pixelX1 = std::min(x1, (tileX + 1) * static_cast<int>(kTileSize) - 1);
+                int pixelY0 = std::max(y0, tileY * static_cast<int>(kTileSize));
+                int pixelY1 = std::min(y1, (tileY + 1) * static_cast<int>(kTileSize) - 1);
+                for (int y = pixelY0; y <= pixelY1; ++y)
+                {
+                    const float* row = mDepth.data() + y * kWidth;
+                    for (int x = pixelX0; x <= pixelX1; ++x)
+                    {
+                        if (minZ <= row[x])
+                        {
+                            return OcclusionResult::Visible;
+                        }
+                    }
+                }
+            }
+        }
+
+        mStats.mOccluded++;
+        return OcclusionResult::Occluded;
+    }
+}
@@ -0,0 +1,71 @@
+// SoftwareOcclusion.h
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "MathTypes.h"
+
+namespace Vnm
+{
+    // CPU copy of occluder geometry, positions are tightly packed xyz
+    class OccluderMesh
+    {
+    public:
+        std::vector<float>    mPositions;
+        std::vector<uint32_t> mIndices;
+    };
+
+    enum class OcclusionResult
+    {
+        Visible,
+        OutsideFrustum,
+        Occluded
+    };
+
+    class OcclusionStats
+    {
+    public:
+        size_t mOccluderTriangles = 0;
+        size_t mTested = 0;
+        size_t mOutsideFrustum = 0;
+        size_t mOccluded = 0;
+
+        float GetCulledRatio() const { return mTested ? static_cast<float>(mOutsideFrustum + mOccluded) / mTested : 0.0f; }
+    };
+
+    // Low resolution depth buffer that occluders are rasterized into on the CPU, with a max-depth
+    // tile level on top for fast rejection. Depth is post-projection z/w as in D3D, 0 is near.
+    // Coverage is sampled at pixel centers, and TestBox also tests the pixels around the box so that
+    // an occluder edge crossing a pixel cannot cull what shows through the uncovered part of it.
+    class OcclusionBuffer
+    {
+    public:
+        static const uint32_t kWidth = 256;
+        static const uint32_t kHeight = 160;
+        static const uint32_t kTileSize = 8;
+        static const uint32_t kTilesX = kWidth / kTileSize;
+        static const uint32_t kTilesY = kHeight / kTileSize;
+
+        OcclusionBuffer();
+        ~OcclusionBuffer() = default;
+
+        void Clear();
+        void RasterizeMesh(const OccluderMesh& mesh, const Float4x4& worldViewProj);
+        void BuildHierarchy();
+
+        OcclusionResult TestBox(const Aabb& box, const Float4x4& worldViewProj);
+
+        const float*          GetDepth() const { return mDepth.data(); }
+        const OcclusionStats& GetStats() const { return mStats; }
+
+    private:
+        void RasterizeTriangle(const Float4* v);
+
+        std::vector<float>  mDepth;
+        std::vector<float>  mTileMaxDepth;
+        std::vector<Float4> mClipVertices;
+        OcclusionStats      mStats;
+    };
+}
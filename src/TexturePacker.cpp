@@ -0,0 +1,282 @@
+// TexturePacker.cpp
+
+#include "TexturePacker.h"
+#include <algorithm>
+#include <cstring>
+
+namespace Vnm
+{
+    void PlanTextureArrays(const TextureShape* shapes, size_t count, uint32_t maxSlices, TextureArrayPlan* plan)
+    {
+        plan->mGroups.clear();
+        plan->mGroupOfTexture.assign(count, InvalidIndex);
+        plan->mSliceOfTexture.assign(count, InvalidIndex);
+
+        // A handful of groups at most, so a linear search for the open group of a shape is enough
+        std::vector<uint32_t> openGroups;
+        for (size_t i = 0; i < count; ++i)
+        {
+            const TextureShape& shape = shapes[i];
+            if (shape.mWidth == 0 || shape.mHeight == 0)
+            {
+                continue;
+            }
+
+            uint32_t group = InvalidIndex;
+            for (uint32_t open : openGroups)
+            {
+                if (plan->mGroups[open].mShape == shape)
+                {
+                    group = open;
+                    break;
+                }
+            }
+            if (group == InvalidIndex)
+            {
+                group = static_cast<uint32_t>(plan->mGroups.size());
+                plan->mGroups.emplace_back();
+                plan->mGroups.back().mShape = shape;
+                openGroups.push_back(group);
+            }
+
+            TextureArrayGroup& arrayGroup = plan->mGroups[group];
+            plan->mGroupOfTexture[i] = group;
+            plan->mSliceOfTexture[i] = static_cast<uint32_t>(arrayGroup.mTextures.size());
+            arrayGroup.mTextures.push_back(static_cast<uint32_t>(i));
+
+            // Full arrays make way for a new one of the same shape
+            if (arrayGroup.mTextures.size() >= maxSlices)
+            {
+                openGroups.erase(std::find(openGroups.begin(), openGroups.end(), group));
+            }
+        }
+    }
+
+    float AtlasLayout::CalcOccupancy() const
+    {
+        uint64_t area = 0;
+        for (const AtlasRect& rect : mRects)
+        {
+            area += static_cast<uint64_t>(rect.mWidth) * rect.mHeight;
+        }
+        return mWidth > 0 && mHeight > 0 ? static_cast<float>(static_cast<double>(area) / (static_cast<double>(mWidth) * mHeight)) : 0.0f;
+    }
+
+    static uint32_t RoundUp4(uint32_t value)
+    {
+        return (value + 3) & ~3u;
+    }
+
+    // Top of the packed cells over [mX, mX + mWidth), segments are sorted by x and cover the atlas width
+    class SkylineSegment
+    {
+    public:
+        uint32_t mX;
+        uint32_t mY;
+        uint32_t mWidth;
+    };
+
+    static bool PackSkyline(const std::vector<size_t>& order, const std::vector<uint32_t>& cellWidths, const std::vector<uint32_t>& cellHeights,
+        uint32_t atlasWidth, uint32_t atlasHeight, std::vector<AtlasRect>* cells)
+    {
+        std::vector<SkylineSegment> skyline(1, SkylineSegment{ 0, 0, atlasWidth });
+        for (size_t index : order)
+        {
+            const uint32_t width = cellWidths[index];
+            const uint32_t height = cellHeights[index];
+
+            // Lowest top edge of the cell with its left edge on a segment, leftmost on ties
+            size_t bestSegment = SIZE_MAX;
+            uint32_t bestY = 0;
+            uint32_t bestTop = UINT32_MAX;
+            for (size_t i = 0; i < skyline.size() && skyline[i].mX + width <= atlasWidth; ++i)
+            {
+                uint32_t y = 0;
+                for (size_t j = i; j < skyline.size() && skyline[j].mX < skyline[i].mX + width; ++j)
+                {
+                    y = (std::max)(y, skyline[j].mY);
+                }
+                if (y + height <= atlasHeight && y + height < bestTop)
+                {
+                    bestSegment = i;
+                    bestY = y;
+                    bestTop = y + height;
+                }
+            }
+            if (bestSegment == SIZE_MAX)
+            {
+                return false;
+            }
+
+            AtlasRect& cell = (*cells)[index];
+            cell.mX = skyline[bestSegment].mX;
+            cell.mY = bestY;
+            cell.mWidth = width;
+            cell.mHeight = height;
+
+            // The cell replaces the segments under it, and the start of the last one it covers partly
+            const uint32_t right = cell.mX + width;
+            skyline.insert(skyline.begin() + bestSegment, SkylineSegment{ cell.mX, bestTop, width });
+            size_t next = bestSegment + 1;
+            while (next < skyline.size() && skyline[next].mX < right)
+            {
+                const uint32_t segmentRight = skyline[next].mX + skyline[next].mWidth;
+                if (segmentRight <= right)
+                {
+                    skyline.erase(skyline.begin() + next);
+                }
+                else
+                {
+                    skyline[next].mWidth = segmentRight - right;
+                    skyline[next].mX = right;
+                    break;
+                }
+            }
+
+            // Neighbours at the same height merge, so wide cells find room on them
+            for (size_t i = 1; i < skyline.size();)
+            {
+                if (skyline[i - 1].mY == skyline[i].mY)
+                {
+                    skyline[i - 1].mWidth += skyline[i].mWidth;
+                    skyline.erase(skyline.begin() + i);
+                }
+                else
+                {
+                    ++i;
+                }
+            }
+        }
+        return true;
+    }
+
+    bool PackAtlas(const uint32_t* widths, const uint32_t* heights, size_t count, uint32_t padding, uint32_t maxSize, AtlasLayout* layout)
+    {
+        layout->mWidth = 0;
+        layout->mHeight = 0;
+        layout->mPadding = padding;
+        layout->mRects.assign(count, AtlasRect());
+        if (count == 0)
+        {
+            return true;
+        }
+
+        // Cells hold an image and its padding, with the image on a multiple of 4 from the cell start
+        const uint32_t leading = RoundUp4(padding);
+        std::vector<uint32_t> cellWidths(count);
+        std::vector<uint32_t> cellHeights(count);
+        uint64_t cellArea = 0;
+        uint32_t widestCell = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (widths[i] == 0 || heights[i] == 0)
+            {
+                return false;
+            }
+            cellWidths[i] = RoundUp4(leading + widths[i] + padding);
+            cellHeights[i] = RoundUp4(leading + heights[i] + padding);
+            cellArea += static_cast<uint64_t>(cellWidths[i]) * cellHeights[i];
+            widestCell = (std::max)(widestCell, cellWidths[i]);
+        }
+
+        std::vector<size_t> order(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            order[i] = i;
+        }
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+        {
+            return cellHeights[a] != cellHeights[b] ? cellHeights[a] > cellHeights[b] : cellWidths[a] > cellWidths[b];
+        });
+
+        // Every power of two width that can hold the widest image, with the height the images reach
+        // at that width, keeping the smallest area
+        std::vector<AtlasRect> cells(count);
+        uint64_t bestArea = UINT64_MAX;
+        for (uint64_t width = 4; width <= maxSize; width *= 2)
+        {
+            if (width < widestCell || width * maxSize < cellArea ||
+                !PackSkyline(order, cellWidths, cellHeights, static_cast<uint32_t>(width), maxSize, &cells))
+            {
+                continue;
+            }
+
+            uint32_t height = 0;
+            for (const AtlasRect& cell : cells)
+            {
+                height = (std::max)(height, cell.mY + cell.mHeight);
+            }
+            if (width * height >= bestArea)
+            {
+                continue;
+            }
+
+            bestArea = width * height;
+            layout->mWidth = static_cast<uint32_t>(width);
+            layout->mHeight = height;
+            for (size_t i = 0; i < count; ++i)
+            {
+                AtlasRect& rect = layout->mRects[i];
+                rect.mX = cells[i].mX + leading;
+                rect.mY = cells[i].mY + leading;
+                rect.mWidth = widths[i];
+                rect.mHeight = heights[i];
+            }
+        }
+        return layout->mWidth > 0;
+    }
+
+    void BuildAtlasImage(const uint8_t* const* images, const AtlasLayout& layout, std::vector<uint8_t>* atlas)
+    {
+        const size_t atlasPitch = static_cast<size_t>(layout.mWidth) * 4;
+        atlas->assign(atlasPitch * layout.mHeight, 0);
+
+        const int padding = static_cast<int>(layout.mPadding);
+        for (size_t i = 0; i < layout.mRects.size(); ++i)
+        {
+            const AtlasRect& rect = layout.mRects[i];
+            const int width = static_cast<int>(rect.mWidth);
+            const int height = static_cast<int>(rect.mHeight);
+            for (int y = -padding; y < height + padding; ++y)
+            {
+                const int sourceY = (std::min)((std::max)(y, 0), height - 1);
+                const uint8_t* source = images[i] + static_cast<size_t>(sourceY) * width * 4;
+                uint8_t* dest = atlas->data() + (rect.mY + y) * atlasPitch + static_cast<size_t>(rect.mX) * 4;
+
+                memcpy(dest, source, static_cast<size_t>(width) * 4);
+                for (int x = 1; x <= padding; ++x)
+                {
+                    memcpy(dest - x * 4, source, 4);
+                    memcpy(dest + (width - 1 + x) * 4, source + (width - 1) * 4, 4);
+                }
+            }
+        }
+    }
+
+    bool RemapTexcoords(uint8_t* vertices, size_t vertexStride, size_t texcoordOffset, size_t vertexCount, const AtlasLayout& layout, size_t rect)
+    {
+        for (size_t i = 0; i < vertexCount; ++i)
+        {
+            float texcoord[2];
+            memcpy(texcoord, vertices + i * vertexStride + texcoordOffset, sizeof(texcoord));
+            if (!(texcoord[0] >= 0.0f && texcoord[0] <= 1.0f && texcoord[1] >= 0.0f && texcoord[1] <= 1.0f))
+            {
+                return false;
+            }
+        }
+
+        const AtlasRect& area = layout.mRects[rect];
+        const float scale[2] = { static_cast<float>(area.mWidth) / layout.mWidth, static_cast<float>(area.mHeight) / layout.mHeight };
+        const float offset[2] = { static_cast<float>(area.mX) / layout.mWidth, static_cast<float>(area.mY) / layout.mHeight };
+        for (size_t i = 0; i < vertexCount; ++i)
+        {
+            float texcoord[2];
+            uint8_t* vertex = vertices + i * vertexStride + texcoordOffset;
+            memcpy(texcoord, vertex, sizeof(texcoord));
+            texcoord[0] = offset[0] + texcoord[0] * scale[0];
+            texcoord[1] = offset[1] + texcoord[1] * scale[1];
+            memcpy(vertex, texcoord, sizeof(texcoord));
+        }
+        return true;
+    }
+}
@@ -0,0 +1,82 @@
+// TexturePacker.h
+
+#pragma once
+
+#include "Material.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace Vnm
+{
+    // What textures must share to be slices of one Texture2DArray. Shapes are of the whole texture,
+    // as its DDS layout describes it, not of a streamed resource that holds only some of its mips.
+    class TextureShape
+    {
+    public:
+        uint32_t mFormat = 0;               // DXGI_FORMAT
+        uint32_t mWidth = 0;
+        uint32_t mHeight = 0;
+        uint32_t mMipCount = 0;
+
+        bool operator==(const TextureShape& other) const
+        {
+            return mFormat == other.mFormat && mWidth == other.mWidth && mHeight == other.mHeight && mMipCount == other.mMipCount;
+        }
+    };
+
+    class TextureArrayGroup
+    {
+    public:
+        TextureShape          mShape;
+        std::vector<uint32_t> mTextures;    // Slice i holds texture mTextures[i]
+    };
+
+    class TextureArrayPlan
+    {
+    public:
+        std::vector<TextureArrayGroup> mGroups;
+        std::vector<uint32_t>          mGroupOfTexture;     // InvalidIndex for textures left out
+        std::vector<uint32_t>          mSliceOfTexture;
+    };
+
+    // Groups textures of the same shape into arrays of at most maxSlices, in texture order. Textures
+    // with a zero size are left out.
+    void PlanTextureArrays(const TextureShape* shapes, size_t count, uint32_t maxSlices, TextureArrayPlan* plan);
+
+    // Image area of one texture in an atlas, padding around it not included
+    class AtlasRect
+    {
+    public:
+        uint32_t mX = 0;
+        uint32_t mY = 0;
+        uint32_t mWidth = 0;
+        uint32_t mHeight = 0;
+    };
+
+    class AtlasLayout
+    {
+    public:
+        uint32_t               mWidth = 0;
+        uint32_t               mHeight = 0;
+        uint32_t               mPadding = 0;
+        std::vector<AtlasRect> mRects;      // In the order of the sizes passed to PackAtlas
+
+        // Fraction of the atlas covered by images
+        float CalcOccupancy() const;
+    };
+
+    // Skyline bottom-left packing of images, tallest first, into the atlas of least area with a power
+    // of two width and at most maxSize on a side. The height is whatever the images reach, a multiple
+    // of 4. Each image gets padding texels on every side and starts on a multiple of 4, so block
+    // compressed atlases keep whole blocks. Returns false if the images do not fit.
+    bool PackAtlas(const uint32_t* widths, const uint32_t* heights, size_t count, uint32_t padding, uint32_t maxSize, AtlasLayout* layout);
+
+    // Copies RGBA8 images with packed rows into their rects and fills the padding with their edge
+    // texels, so that filtering near an edge does not pick up the neighbouring image
+    void BuildAtlasImage(const uint8_t* const* images, const AtlasLayout& layout, std::vector<uint8_t>* atlas);
+
+    // Moves float2 texcoords of interleaved vertices from [0, 1] into the rect of an image. Returns
+    // false without changing any if a texcoord lies outside, as wrapping cannot be remapped.
+    bool RemapTexcoords(uint8_t* vertices, size_t vertexStride, size_t texcoordOffset, size_t vertexCount, const AtlasLayout& layout, size_t rect);
+}
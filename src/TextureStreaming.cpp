@@ -0,0 +1,314 @@
+// TextureStreaming.cpp
+
+#include "TextureStreaming.h"
+#include "DdsUpload.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <fstream>
+
+namespace Vnm
+{
+    uint32_t CalcTailMip(uint32_t width, uint32_t height, uint32_t mipCount, uint32_t tailSize)
+    {
+        uint32_t mip = 0;
+        while (mip + 1 < mipCount && (std::max)(width >> mip, height >> mip) > tailSize)
+        {
+            mip++;
+        }
+        return mip;
+    }
+
+    void TextureResidency::Init(const TextureStreamingParams& params)
+    {
+        mParams = params;
+        mTextures.clear();
+        mResidentBytes = 0;
+        mLoadingBytes = 0;
+    }
+
+    uint32_t TextureResidency::AddTexture(uint32_t width, uint32_t height, const uint64_t* mipSizes, uint32_t mipCount)
+    {
+        assert(mipCount > 0);
+        Texture texture;
+        texture.mMipSizes.assign(mipSizes, mipSizes + mipCount);
+        texture.mWidth = width;
+        texture.mHeight = height;
+        texture.mTailMip = CalcTailMip(width, height, mipCount, mParams.mTailSize);
+        texture.mResidentMip = texture.mTailMip;
+        texture.mWantedMip = texture.mTailMip;
+
+        mTextures.push_back(texture);
+        return static_cast<uint32_t>(mTextures.size() - 1);
+    }
+
+    void TextureResidency::BeginFrame()
+    {
+        for (Texture& texture : mTextures)
+        {
+            texture.mTexelsNeeded = 0.0f;
+        }
+    }
+
+    void TextureResidency::AddUse(uint32_t texture, float distance, float size)
+    {
+        assert(texture < mTextures.size());
+        float texels = distance > 1e-6f ? size / distance * mParams.mScreenScale : FLT_MAX;
+        mTextures[texture].mTexelsNeeded = (std::max)(mTextures[texture].mTexelsNeeded, texels);
+    }
+
+    // Coarsest mip that still has as many texels as are needed
+    uint32_t TextureResidency::CalcWantedMip(const Texture& texture) const
+    {
+        if (texture.mTexelsNeeded <= 0.0f)
+        {
+            return texture.mTailMip;
+        }
+
+        uint32_t mip = 0;
+        uint32_t size = (std::max)(texture.mWidth, texture.mHeight);
+        while (mip < texture.mTailMip && static_cast<float>((std::max)(size >> (mip + 1), 1u)) >= texture.mTexelsNeeded)
+        {
+            mip++;
+        }
+        return (std::max)(mip, texture.mMinMip);
+    }
+
+    // Evicts mips until bytes more fit the budget. Detail that is not wanted goes first, then
+    // detail of textures less needed than forTexture, in both cases from the farthest texture.
+    bool TextureResidency::MakeRoom(uint64_t bytes, uint32_t forTexture, std::vector<uint32_t>* evicted)
+    {
+        const float need = mTextures[forTexture].mTexelsNeeded;
+        while (mResidentBytes + mLoadingBytes + bytes > mParams.mBudget)
+        {
+            uint32_t victim = UINT32_MAX;
+            bool victimSurplus = false;
+            for (uint32_t i = 0; i < mTextures.size(); ++i)
+            {
+                const Texture& texture = mTextures[i];
+                if (i == forTexture || texture.mLoading || texture.mResidentMip >= texture.mTailMip)
+                {
+                    continue;
+                }
+
+                bool surplus = texture.mResidentMip < texture.mWantedMip;
+                if (!surplus && texture.mTexelsNeeded >= need)
+                {
+                    continue;
+                }
+
+                if (victim == UINT32_MAX ||
+                    (surplus && !victimSurplus) ||
+                    (surplus == victimSurplus && texture.mTexelsNeeded < mTextures[victim].mTexelsNeeded))
+                {
+                    victim = i;
+                    victimSurplus = surplus;
+                }
+            }
+
+            if (victim == UINT32_MAX)
+            {
+                return false;
+            }
+
+            Texture& texture = mTextures[victim];
+            mResidentBytes -= texture.mMipSizes[texture.mResidentMip];
+            texture.mResidentMip++;
+            if (std::find(evicted->begin(), evicted->end(), victim) == evicted->end())
+            {
+                evicted->push_back(victim);
+            }
+        }
+        return true;
+    }
+
+    void TextureResidency::Update(std::vector<StreamingRequest>* loads, std::vector<StreamingRequest>* evictions)
+    {
+        loads->clear();
+        evictions->clear();
+
+        uint32_t loading = 0;
+        std::vector<uint32_t> candidates;
+        for (uint32_t i = 0; i < mTextures.size(); ++i)
+        {
+            Texture& texture = mTextures[i];
+            texture.mWantedMip = CalcWantedMip(texture);
+            if (texture.mLoading)
+            {
+                loading++;
+            }
+            else if (texture.mWantedMip < texture.mResidentMip)
+            {
+                candidates.push_back(i);
+            }
+        }
+
+        // Textures that need the most texels, the closest ones, are refined first
+        std::sort(candidates.begin(), candidates.end(), [this](uint32_t a, uint32_t b)
+        {
+            return mTextures[a].mTexelsNeeded > mTextures[b].mTexelsNeeded;
+        });
+
+        std::vector<uint32_t> evicted;
+        for (uint32_t i : candidates)
+        {
+            if (loading >= mParams.mMaxLoadsInFlight)
+            {
+                break;
+            }
+
+            // Detail taken away in this update is not loaded straight back
+            if (std::find(evicted.begin(), evicted.end(), i) != evicted.end())
+            {
+                continue;
+            }
+
+            Texture& texture = mTextures[i];
+            uint32_t mip = texture.mResidentMip - 1;
+            uint64_t bytes = texture.mMipSizes[mip];
+            if (!MakeRoom(bytes, i, &evicted))
+            {
+                break;
+            }
+
+            texture.mLoading = true;
+            mLoadingBytes += bytes;
+            loads->push_back({ i, mip });
+            loading++;
+        }
+
+        for (uint32_t i : evicted)
+        {
+            evictions->push_back({ i, mTextures[i].mResidentMip });
+        }
+    }
+
+    void TextureResidency::CompleteLoad(const StreamingRequest& load, bool success)
+    {
+        Texture& texture = mTextures[load.mTexture];
+        assert(texture.mLoading && load.mMip + 1 == texture.mResidentMip);
+
+        texture.mLoading = false;
+        mLoadingBytes -= texture.mMipSizes[load.mMip];
+        if (success)
+        {
+            texture.mResidentMip = load.mMip;
+            mResidentBytes += texture.mMipSizes[load.mMip];
+        }
+        else
+        {
+            texture.mMinMip = load.mMip + 1;
+        }
+    }
+
+    void TextureResidency::CancelLoad(const StreamingRequest& load)
+    {
+        Texture& texture = mTextures[load.mTexture];
+        assert(texture.mLoading && load.mMip + 1 == texture.mResidentMip);
+
+        texture.mLoading = false;
+        mLoadingBytes -= texture.mMipSizes[load.mMip];
+    }
+
+    StreamingIoThread::StreamingIoThread()
+    {
+        mThread = std::thread(&StreamingIoThread::ThreadMain, this);
+    }
+
+    StreamingIoThread::~StreamingIoThread()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStop = true;
+        }
+        mWorkAvailable.notify_all();
+        mThread.join();
+    }
+
+    void StreamingIoThread::Submit(StreamingRead&& read)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mQueue.push_back(std::move(read));
+        }
+        mWorkAvailable.notify_one();
+    }
+
+    bool StreamingIoThread::Poll(StreamingRead* read)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mFinished.empty())
+        {
+            return false;
+        }
+        *read = std::move(mFinished.front());
+        mFinished.pop_front();
+        return true;
+    }
+
+    bool StreamingIoThread::Wait(StreamingRead* read)
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        if (mFinished.empty() && mQueue.empty() && mInProgress == 0)
+        {
+            return false;
+        }
+        mWorkDone.wait(lock, [this] { return !mFinished.empty(); });
+        *read = std::move(mFinished.front());
+        mFinished.pop_front();
+        return true;
+    }
+
+    void StreamingIoThread::ThreadMain()
+    {
+        SetProfilerThreadName("Streaming I/O");
+        for (;;)
+        {
+            StreamingRead read;
+            {
+                std::unique_lock<std::mutex> lock(mMutex);
+                mWorkAvailable.wait(lock, [this] { return mStop || !mQueue.empty(); });
+                if (mStop)
+                {
+                    return;
+                }
+                read = std::move(mQueue.front());
+                mQueue.pop_front();
+                mInProgress++;
+            }
+
+            {
+                PROFILE_ZONE("Streaming read");
+                uint8_t* dst = read.mpDestination;
+                if (dst == nullptr)
+                {
+                    read.mData.resize(static_cast<size_t>(read.mSize));
+                    read.mMemory.Reset(MemoryCategory::AssetData, read.mSize);
+                    dst = read.mData.data();
+                }
+
+                std::ifstream file(read.mFileName, std::ios::in | std::ios::binary);
+                file.seekg(static_cast<std::streamoff>(read.mOffset));
+                file.read(reinterpret_cast<char*>(dst), static_cast<std::streamsize>(read.mSize));
+                read.mSuccess = static_cast<bool>(file);
+                if (!read.mSuccess)
+                {
+                    std::vector<uint8_t>().swap(read.mData);
+                    read.mMemory.Release();
+                }
+                else if (read.mpDestination != nullptr)
+                {
+                    ExpandRowPitch(read.mpDestination, read.mNumRows, read.mRowSize, read.mRowPitch);
+                }
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                mInProgress--;
+                mFinished.push_back(std::move(read));
+            }
+            mWorkDone.notify_all();
+        }
+    }
+}
@@ -0,0 +1,146 @@
+// TextureStreaming.h
+
+#pragma once
+
+#include "MemoryTracker.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Vnm
+{
+    class TextureStreamingParams
+    {
+    public:
+        uint64_t mBudget = 256ull << 20;    // Bytes of the mips above the tails of all textures
+        uint32_t mTailSize = 128;           // Mips this size and smaller are loaded up front and always resident
+        uint32_t mMaxLoadsInFlight = 4;
+        float    mScreenScale = 1000.0f;    // Pixels across an object of unit size at unit distance
+    };
+
+    // First mip whose larger side is at most tailSize, or the last mip
+    uint32_t CalcTailMip(uint32_t width, uint32_t height, uint32_t mipCount, uint32_t tailSize);
+
+    // A mip to load, or for an eviction the finest mip that stays resident
+    class StreamingRequest
+    {
+    public:
+        uint32_t mTexture;
+        uint32_t mMip;
+    };
+
+    // Decides which mips of each texture should be resident. Textures start with their mip tail and
+    // are refined one mip at a time, closest first. Mips stay resident until the budget needs room
+    // for a texture that is closer, then the textures with the most detail they do not need lose it.
+    class TextureResidency
+    {
+    public:
+        void Init(const TextureStreamingParams& params);
+
+        // mipSizes holds the bytes of each mip, width and height are those of mip 0
+        uint32_t AddTexture(uint32_t width, uint32_t height, const uint64_t* mipSizes, uint32_t mipCount);
+
+        // Clears what textures are used for this frame, which each use then raises. An object of
+        // size at distance needs about size / distance * mScreenScale texels across.
+        void BeginFrame();
+        void AddUse(uint32_t texture, float distance, float size);
+
+        // Loads to start and evictions to apply now. Evictions come first and are already accounted.
+        void Update(std::vector<StreamingRequest>* loads, std::vector<StreamingRequest>* evictions);
+
+        // A load that failed leaves the texture at its current mip from then on
+        void CompleteLoad(const StreamingRequest& load, bool success);
+
+        // A load that could not start now, e.g. for lack of upload space, is tried again later
+        void CancelLoad(const StreamingRequest& load);
+
+        uint32_t GetResidentMip(uint32_t texture) const { return mTextures[texture].mResidentMip; }
+        uint32_t GetWantedMip(uint32_t texture) const { return mTextures[texture].mWantedMip; }
+        uint32_t GetTailMip(uint32_t texture) const { return mTextures[texture].mTailMip; }
+        bool     IsLoading(uint32_t texture) const { return mTextures[texture].mLoading; }
+        size_t   GetTextureCount() const { return mTextures.size(); }
+        uint64_t GetResidentBytes() const { return mResidentBytes; }
+        uint64_t GetLoadingBytes() const { return mLoadingBytes; }
+        const TextureStreamingParams& GetParams() const { return mParams; }
+
+    private:
+        class Texture
+        {
+        public:
+            std::vector<uint64_t> mMipSizes;
+            uint32_t              mWidth = 0;
+            uint32_t              mHeight = 0;
+            uint32_t              mTailMip = 0;
+            uint32_t              mMinMip = 0;          // Finest mip that can be loaded
+            uint32_t              mResidentMip = 0;
+            uint32_t              mWantedMip = 0;
+            float                 mTexelsNeeded = 0.0f;
+            bool                  mLoading = false;
+        };
+
+        uint32_t CalcWantedMip(const Texture& texture) const;
+        bool MakeRoom(uint64_t bytes, uint32_t forTexture, std::vector<uint32_t>* evicted);
+
+        TextureStreamingParams mParams;
+        std::vector<Texture>   mTextures;
+        uint64_t               mResidentBytes = 0;       // Above the tails
+        uint64_t               mLoadingBytes = 0;
+    };
+
+    // A byte range of a file to read on the I/O thread, into mData or straight into memory the
+    // caller reserved, such as an upload buffer
+    class StreamingRead
+    {
+    public:
+        std::string          mFileName;
+        uint64_t             mOffset = 0;
+        uint64_t             mSize = 0;
+        StreamingRequest     mRequest = {};
+
+        // Rows of mRowSize bytes are spread to mRowPitch apart after the read, see ExpandRowPitch
+        uint8_t*             mpDestination = nullptr;
+        uint64_t             mRowSize = 0;
+        uint64_t             mRowPitch = 0;
+        uint32_t             mNumRows = 0;
+
+        std::vector<uint8_t> mData;                     // Filled by the I/O thread without a destination
+        TrackedAllocation    mMemory;
+        bool                 mSuccess = false;
+    };
+
+    // Background thread that reads file ranges in the order they are submitted
+    class StreamingIoThread
+    {
+    public:
+        StreamingIoThread();
+        ~StreamingIoThread();
+
+        StreamingIoThread(const StreamingIoThread&) = delete;
+        StreamingIoThread& operator=(const StreamingIoThread&) = delete;
+
+        void Submit(StreamingRead&& read);
+
+        // Takes a finished read without waiting, returns false if there is none
+        bool Poll(StreamingRead* read);
+
+        // Waits for the next finished read, returns false if nothing is submitted or in progress
+        bool Wait(StreamingRead* read);
+
+    private:
+        void ThreadMain();
+
+        std::thread               mThread;
+        std::mutex                mMutex;
+        std::condition_variable   mWorkAvailable;
+        std::condition_variable   mWorkDone;
+        std::deque<StreamingRead> mQueue;
+        std::deque<StreamingRead> mFinished;
+        size_t                    mInProgress = 0;
+        bool                      mStop = false;
+    };
+}
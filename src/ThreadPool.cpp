@@ -0,0 +1,119 @@
+// ThreadPool.cpp
+
+#include "ThreadPool.h"
+#include "Profiler.h"
+#include <algorithm>
+
+namespace Vnm
+{
+    ThreadPool::ThreadPool(uint32_t numThreads)
+        : mNextBatch(0)
+    {
+        if (numThreads == 0)
+        {
+            numThreads = (std::max)(std::thread::hardware_concurrency(), 1u);
+        }
+
+        for (uint32_t i = 1; i < numThreads; ++i)
+        {
+            mWorkers.emplace_back(&ThreadPool::WorkerMain, this);
+        }
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStop = true;
+        }
+        mWorkAvailable.notify_all();
+
+        for (auto& worker : mWorkers)
+        {
+            worker.join();
+        }
+    }
+
+    void ThreadPool::ParallelFor(size_t count, size_t batchSize, const std::function<void(size_t, size_t)>& function)
+    {
+        batchSize = (std::max)(batchSize, size_t(1));
+        if (count <= batchSize || mWorkers.empty())
+        {
+            for (size_t begin = 0; begin < count; begin += batchSize)
+            {
+                function(begin, (std::min)(begin + batchSize, count));
+            }
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mpFunction = &function;
+            mCount = count;
+            mBatchSize = batchSize;
+            mNextBatch = 0;
+            mBusyWorkers = mWorkers.size();
+            mGeneration++;
+        }
+        mWorkAvailable.notify_all();
+
+        RunBatches();
+
+        // Every worker has to see this generation before the next one can be posted
+        std::unique_lock<std::mutex> lock(mMutex);
+        mWorkDone.wait(lock, [this] { return mBusyWorkers == 0; });
+        mpFunction = nullptr;
+    }
+
+    void ThreadPool::WorkerMain()
+    {
+        SetProfilerThreadName("ThreadPool worker");
+        uint64_t generation = 0;
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mMutex);
+                mWorkAvailable.wait(lock, [this, generation] { return mStop || mGeneration != generation; });
+                if (mStop)
+                {
+                    return;
+                }
+                generation = mGeneration;
+            }
+
+            RunBatches();
+
+            std::lock_guard<std::mutex> lock(mMutex);
+            if (--mBusyWorkers == 0)
+            {
+                mWorkDone.notify_one();
+            }
+        }
+    }
+
+    void ThreadPool::RunBatches()
+    {
+        PROFILE_ZONE("ParallelFor");
+        for (;;)
+        {
+            size_t begin = mNextBatch.fetch_add(1) * mBatchSize;
+            if (begin >= mCount)
+            {
+                break;
+            }
+            (*mpFunction)(begin, (std::min)(begin + mBatchSize, mCount));
+        }
+    }
+
+    void ParallelFor(ThreadPool* pool, size_t count, size_t batchSize, const std::function<void(size_t, size_t)>& function)
+    {
+        if (pool != nullptr)
+        {
+            pool->ParallelFor(count, batchSize, function);
+        }
+        else if (count > 0)
+        {
+            function(0, count);
+        }
+    }
+}
@@ -0,0 +1,52 @@
+// ThreadPool.h
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+namespace Vnm
+{
+    // Fixed set of worker threads for data parallel loops. ParallelFor blocks until every batch has
+    // run and the calling thread works on batches too. Batches must not call ParallelFor themselves.
+    class ThreadPool
+    {
+    public:
+        // numThreads includes the calling thread, 0 uses one thread per hardware thread
+        explicit ThreadPool(uint32_t numThreads = 0);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        // Calls function(begin, end) for consecutive ranges of [0, count), at most batchSize long
+        void ParallelFor(size_t count, size_t batchSize, const std::function<void(size_t, size_t)>& function);
+
+        uint32_t GetThreadCount() const { return static_cast<uint32_t>(mWorkers.size()) + 1; }
+
+    private:
+        void WorkerMain();
+        void RunBatches();
+
+        std::vector<std::thread>                        mWorkers;
+        std::mutex                                      mMutex;
+        std::condition_variable                         mWorkAvailable;
+        std::condition_variable                         mWorkDone;
+
+        const std::function<void(size_t, size_t)>*     mpFunction = nullptr;
+        size_t                                          mCount = 0;
+        size_t                                          mBatchSize = 0;
+        std::atomic<size_t>                             mNextBatch;
+        size_t                                          mBusyWorkers = 0;
+        uint64_t                                        mGeneration = 0;
+        bool                                            mStop = false;
+    };
+
+    // ParallelFor on pool, or one call on the calling thread if pool is null
+    void ParallelFor(ThreadPool* pool, size_t count, size_t batchSize, const std::function<void(size_t, size_t)>& function);
+}
@@ -0,0 +1,348 @@
+// TreePlacement.cpp
+
+#include "TreePlacement.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cassert>
+
+namespace Vnm
+{
+    enum CandidateStates : uint8_t
+    {
+        candidatePending,
+        candidateMasked,
+        candidateTooClose,
+        candidateAccepted
+    };
+
+    static const size_t kMaxCandidates = size_t(1) << 26;
+    static const size_t kMaxGridCells = size_t(1) << 28;
+    static const int    kCellsPerTile = 3;  // Tiles are at least two minimum distances wide
+
+    // splitmix64 finalizer
+    static uint64_t Mix64(uint64_t x)
+    {
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+        return x ^ (x >> 31);
+    }
+
+    // Random stream of one candidate, independent of the order candidates are generated in
+    class CandidateRandom
+    {
+    public:
+        CandidateRandom(uint32_t seed, size_t index) : mState(Mix64((static_cast<uint64_t>(seed) << 32) ^ Mix64(index))) {}
+
+        double NextDouble()
+        {
+            mState += 0x9e3779b97f4a7c15ull;
+            return static_cast<double>(Mix64(mState) >> 11) * (1.0 / 9007199254740992.0);
+        }
+
+        float NextFloat()
+        {
+            return static_cast<float>(NextDouble());
+        }
+
+    private:
+        uint64_t mState;
+    };
+
+    void TreePlacement::Place(const OccluderMesh* meshes, size_t numMeshes, const TreePlacementParams& params, ThreadPool* pool)
+    {
+        assert(params.mMinDistance > 0.0f);
+        mStats = TreePlacementStats();
+        mPoints.clear();
+
+        BuildTriangles(meshes, numMeshes, params, pool);
+        if (mStats.mSurfaceArea <= 0.0)
+        {
+            return;
+        }
+
+        BuildAliasTable();
+        SampleCandidates(params, pool);
+        RejectCandidates(params, pool);
+
+        for (size_t i = 0; i < mCandidates.size(); ++i)
+        {
+            switch (mCandidateState[i])
+            {
+            case candidateMasked:
+                mStats.mMaskRejected++;
+                break;
+            case candidateTooClose:
+                mStats.mDistanceRejected++;
+                break;
+            case candidateAccepted:
+                mStats.mAccepted++;
+                if (params.mMaxPoints == 0 || mPoints.size() < params.mMaxPoints)
+                {
+                    mPoints.push_back(mCandidates[i]);
+                }
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    void TreePlacement::BuildTriangles(const OccluderMesh* meshes, size_t numMeshes, const TreePlacementParams& params, ThreadPool* pool)
+    {
+        size_t numTriangles = 0;
+        for (size_t i = 0; i < numMeshes; ++i)
+        {
+            numTriangles += meshes[i].mIndices.size() / 3;
+        }
+
+        mTriangles.resize(numTriangles);
+        mAreas.resize(numTriangles);
+        mStats.mTriangles = numTriangles;
+
+        const float minNormalY = cosf((std::min)(params.mMaxSlopeDegrees, 90.0f) * 0.0174532925f) - 1e-6f;
+        size_t firstTriangle = 0;
+        for (size_t iMesh = 0; iMesh < numMeshes; ++iMesh)
+        {
+            const OccluderMesh& mesh = meshes[iMesh];
+            ParallelFor(pool, mesh.mIndices.size() / 3, 4096, [&](size_t begin, size_t end)
+            {
+                for (size_t i = begin; i < end; ++i)
+                {
+                    const float* a = &mesh.mPositions[3 * mesh.mIndices[3 * i + 0]];
+                    const float* b = &mesh.mPositions[3 * mesh.mIndices[3 * i + 1]];
+                    const float* c = &mesh.mPositions[3 * mesh.mIndices[3 * i + 2]];
+
+                    Triangle& triangle = mTriangles[firstTriangle + i];
+                    triangle.mVertex = { a[0], a[1], a[2] };
+                    triangle.mEdge1 = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+                    triangle.mEdge2 = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+
+                    // Slope from the normal, either winding faces up
+                    Float3 normal = Cross(triangle.mEdge1, triangle.mEdge2);
+                    float length = Length(normal);
+                    bool flatEnough = length > 0.0f && fabsf(normal.y) >= minNormalY * length;
+                    mAreas[firstTriangle + i] = flatEnough ? 0.5 * length : -1.0;
+                }
+            });
+            firstTriangle += mesh.mIndices.size() / 3;
+        }
+
+        double area = 0.0;
+        for (double& triangleArea : mAreas)
+        {
+            if (triangleArea < 0.0)
+            {
+                mStats.mSlopeRejectedTriangles++;
+                triangleArea = 0.0;
+            }
+            area += triangleArea;
+        }
+        mStats.mSurfaceArea = area;
+    }
+
+    // Vose's alias method: every entry holds the probability of its own triangle and one alias
+    // triangle that fills it up to the average area, so sampling costs one lookup
+    void TreePlacement::BuildAliasTable()
+    {
+        const size_t n = mAreas.size();
+        const double scale = n / mStats.mSurfaceArea;
+        mAliasTable.resize(n);
+        mSmall.clear();
+        mLarge.clear();
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            mAreas[i] *= scale;
+            (mAreas[i] < 1.0 ? mSmall : mLarge).push_back(static_cast<uint32_t>(i));
+        }
+
+        while (!mSmall.empty() && !mLarge.empty())
+        {
+            uint32_t small = mSmall.back();
+            uint32_t large = mLarge.back();
+            mSmall.pop_back();
+
+            mAliasTable[small].mProbability = static_cast<float>(mAreas[small]);
+            mAliasTable[small].mAlias = large;
+            mAreas[large] -= 1.0 - mAreas[small];
+            if (mAreas[large] < 1.0)
+            {
+                mLarge.pop_back();
+                mSmall.push_back(large);
+            }
+        }
+
+        // Leftovers are 1 up to rounding
+        for (uint32_t i : mLarge)
+        {
+            mAliasTable[i] = { 1.0f, i };
+        }
+        for (uint32_t i : mSmall)
+        {
+            mAliasTable[i] = { 1.0f, i };
+        }
+    }
+
+    void TreePlacement::SampleCandidates(const TreePlacementParams& params, ThreadPool* pool)
+    {
+        size_t numCandidates = params.mCandidateCount;
+        if (numCandidates == 0)
+        {
+            double diskArea = 3.14159265 * params.mMinDistance * params.mMinDistance;
+            numCandidates = static_cast<size_t>((std::min)(8.0 * mStats.mSurfaceArea / diskArea, static_cast<double>(kMaxCandidates)));
+        }
+        numCandidates = (std::min)((std::max)(numCandidates, size_t(1)), kMaxCandidates);
+
+        mCandidates.resize(numCandidates);
+        mCandidateState.assign(numCandidates, candidatePending);
+        mStats.mCandidates = numCandidates;
+
+        const size_t numTriangles = mTriangles.size();
+        ParallelFor(pool, numCandidates, 16384, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                CandidateRandom random(params.mSeed, i);
+
+                // Area weighted triangle, then a uniform point on it
+                size_t entry = (std::min)(static_cast<size_t>(random.NextDouble() * numTriangles), numTriangles - 1);
+                const AliasEntry& alias = mAliasTable[entry];
+                const Triangle& triangle = mTriangles[random.NextFloat() < alias.mProbability ? entry : alias.mAlias];
+
+                float u = random.NextFloat();
+                float v = random.NextFloat();
+                if (u + v > 1.0f)
+                {
+                    u = 1.0f - u;
+                    v = 1.0f - v;
+                }
+
+                Float3 position = triangle.mVertex + triangle.mEdge1 * u + triangle.mEdge2 * v;
+                mCandidates[i] = position;
+
+                float keep = random.NextFloat();
+                if (position.y < params.mMinHeight || position.y > params.mMaxHeight ||
+                    (params.mDensity && keep >= params.mDensity(position)))
+                {
+                    mCandidateState[i] = candidateMasked;
+                }
+            }
+        });
+    }
+
+    void TreePlacement::RejectCandidates(const TreePlacementParams& params, ThreadPool* pool)
+    {
+        Aabb bounds;
+        for (size_t i = 0; i < mCandidates.size(); ++i)
+        {
+            if (mCandidateState[i] == candidatePending)
+            {
+                bounds.Extend(mCandidates[i]);
+            }
+        }
+        if (!bounds.IsValid())
+        {
+            return;
+        }
+
+        // A cell's diagonal is just under the minimum distance, so a cell holds at most one point
+        const float minDistance = params.mMinDistance;
+        const float minDistanceSq = minDistance * minDistance;
+        const float cellSize = minDistance * 0.7071f * 0.999f;
+        const float invCellSize = 1.0f / cellSize;
+        const int tilesX = static_cast<int>((bounds.mMax.x - bounds.mMin.x) * invCellSize) / kCellsPerTile + 1;
+        const int tilesZ = static_cast<int>((bounds.mMax.z - bounds.mMin.z) * invCellSize) / kCellsPerTile + 1;
+        const int gridWidth = tilesX * kCellsPerTile;
+        const int gridHeight = tilesZ * kCellsPerTile;
+        assert(static_cast<size_t>(gridWidth) * gridHeight <= kMaxGridCells && "Minimum distance too small for the mesh extent");
+
+        auto cellX = [&](const Float3& p) { return (std::min)(static_cast<int>((p.x - bounds.mMin.x) * invCellSize), gridWidth - 1); };
+        auto cellZ = [&](const Float3& p) { return (std::min)(static_cast<int>((p.z - bounds.mMin.z) * invCellSize), gridHeight - 1); };
+
+        // Counting sort of the remaining candidates by tile, keeping candidate order within a tile
+        const size_t numTiles = static_cast<size_t>(tilesX) * tilesZ;
+        mTileStarts.assign(numTiles + 1, 0);
+        for (size_t i = 0; i < mCandidates.size(); ++i)
+        {
+            if (mCandidateState[i] == candidatePending)
+            {
+                mTileStarts[(cellZ(mCandidates[i]) / kCellsPerTile) * tilesX + cellX(mCandidates[i]) / kCellsPerTile + 1]++;
+            }
+        }
+        for (size_t i = 0; i < numTiles; ++i)
+        {
+            mTileStarts[i + 1] += mTileStarts[i];
+        }
+
+        mTileCandidates.resize(mTileStarts[numTiles]);
+        mTilePoints.resize(mTileStarts[numTiles]);
+        std::vector<uint32_t> tileFill(mTileStarts.begin(), mTileStarts.end() - 1);
+        for (size_t i = 0; i < mCandidates.size(); ++i)
+        {
+            if (mCandidateState[i] == candidatePending)
+            {
+                size_t tile = (cellZ(mCandidates[i]) / kCellsPerTile) * tilesX + cellX(mCandidates[i]) / kCellsPerTile;
+                mTilePoints[tileFill[tile]] = mCandidates[i];
+                mTileCandidates[tileFill[tile]++] = static_cast<uint32_t>(i);
+            }
+        }
+
+        const GridCell emptyCell = { 1e30f, 1e30f };
+        mGrid.assign(static_cast<size_t>(gridWidth) * gridHeight, emptyCell);
+
+        // Four passes over every other tile in x and z, a candidate only reads cells of its own and
+        // the adjacent tiles, none of which are written during the same pass
+        for (int pass = 0; pass < 4; ++pass)
+        {
+            const int firstX = pass & 1;
+            const int firstZ = pass >> 1;
+            const int passTilesX = (tilesX - firstX + 1) / 2;
+            const int passTilesZ = (tilesZ - firstZ + 1) / 2;
+
+            ParallelFor(pool, static_cast<size_t>(passTilesX) * passTilesZ, 4, [&](size_t begin, size_t end)
+            {
+                for (size_t passTile = begin; passTile < end; ++passTile)
+                {
+                    const int tileX = firstX + 2 * static_cast<int>(passTile % passTilesX);
+                    const int tileZ = firstZ + 2 * static_cast<int>(passTile / passTilesX);
+                    const size_t tile = static_cast<size_t>(tileZ) * tilesX + tileX;
+
+                    for (uint32_t i = mTileStarts[tile]; i < mTileStarts[tile + 1]; ++i)
+                    {
+                        const uint32_t candidate = mTileCandidates[i];
+                        const Float3& p = mTilePoints[i];
+                        const int x = cellX(p);
+                        const int z = cellZ(p);
+
+                        // Empty cells are far away, so whole rows are tested without branching
+                        bool tooClose = false;
+                        const int minX = (std::max)(x - 2, 0);
+                        const int maxX = (std::min)(x + 2, gridWidth - 1);
+                        for (int nz = (std::max)(z - 2, 0); nz <= (std::min)(z + 2, gridHeight - 1); ++nz)
+                        {
+                            const GridCell* row = &mGrid[static_cast<size_t>(nz) * gridWidth];
+                            for (int nx = minX; nx <= maxX; ++nx)
+                            {
+                                float dx = p.x - row[nx].mX;
+                                float dz = p.z - row[nx].mZ;
+                                tooClose |= dx * dx + dz * dz < minDistanceSq;
+                            }
+                        }
+
+                        if (tooClose)
+                        {
+                            mCandidateState[candidate] = candidateTooClose;
+                        }
+                        else
+                        {
+                            GridCell& cell = mGrid[static_cast<size_t>(z) * gridWidth + x];
+                            assert(cell.mX == emptyCell.mX);
+                            cell = { p.x, p.z };
+                            mCandidateState[candidate] = candidateAccepted;
+                        }
+                    }
+                }
+            });
+        }
+    }
+}
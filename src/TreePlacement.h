@@ -0,0 +1,99 @@
+// TreePlacement.h
+
+#pragma once
+
+#include "MathTypes.h"
+#include "SoftwareOcclusion.h"
+#include <functional>
+#include <stdint.h>
+#include <vector>
+
+namespace Vnm
+{
+    class ThreadPool;
+
+    class TreePlacementParams
+    {
+    public:
+        uint32_t mSeed = 1;
+        float    mMinDistance = 1.0f;       // Minimum horizontal (xz) distance between points
+        uint32_t mCandidateCount = 0;       // Points sampled before rejection, 0 for 8 per disk of radius mMinDistance
+        uint32_t mMaxPoints = 0;            // 0 for no limit
+        float    mMinHeight = -1e30f;
+        float    mMaxHeight = 1e30f;
+        float    mMaxSlopeDegrees = 90.0f;  // Steepest triangle points are placed on, y is up
+
+        // Optional probability in [0, 1] of keeping a candidate at a position, called from worker threads
+        std::function<float(const Float3&)> mDensity;
+    };
+
+    class TreePlacementStats
+    {
+    public:
+        size_t mTriangles = 0;
+        size_t mSlopeRejectedTriangles = 0;
+        double mSurfaceArea = 0.0;          // Of the triangles that pass the slope mask
+        size_t mCandidates = 0;
+        size_t mMaskRejected = 0;           // By height or density
+        size_t mDistanceRejected = 0;
+        size_t mAccepted = 0;
+    };
+
+    // Blue noise placement of points on triangle meshes. Candidates are sampled uniformly by area
+    // through an alias table from a counter based random stream, so each one only depends on the
+    // seed and its index, then accepted with Poisson disk rejection against a grid. Rejection runs over
+    // square tiles in four passes such that tiles processed at the same time are at least two
+    // minimum distances apart, which keeps the result identical for any number of threads.
+    class TreePlacement
+    {
+    public:
+        // pool may be null to run on the calling thread
+        void Place(const OccluderMesh* meshes, size_t numMeshes, const TreePlacementParams& params, ThreadPool* pool);
+
+        // Accepted points in candidate order, which is random in space, so any prefix is also blue noise
+        const std::vector<Float3>&  GetPoints() const { return mPoints; }
+        const TreePlacementStats&   GetStats() const { return mStats; }
+
+    private:
+        class Triangle
+        {
+        public:
+            Float3 mVertex;
+            Float3 mEdge1;
+            Float3 mEdge2;
+        };
+
+        void BuildTriangles(const OccluderMesh* meshes, size_t numMeshes, const TreePlacementParams& params, ThreadPool* pool);
+        void BuildAliasTable();
+        void SampleCandidates(const TreePlacementParams& params, ThreadPool* pool);
+        void RejectCandidates(const TreePlacementParams& params, ThreadPool* pool);
+
+        class AliasEntry
+        {
+        public:
+            float    mProbability;                  // Of keeping this triangle rather than taking mAlias
+            uint32_t mAlias;
+        };
+
+        class GridCell
+        {
+        public:
+            float mX;
+            float mZ;
+        };
+
+        std::vector<Triangle>   mTriangles;
+        std::vector<double>     mAreas;
+        std::vector<AliasEntry> mAliasTable;
+        std::vector<Float3>     mCandidates;
+        std::vector<uint8_t>    mCandidateState;
+        std::vector<uint32_t>   mTileStarts;
+        std::vector<uint32_t>   mTileCandidates;
+        std::vector<Float3>     mTilePoints;        // Positions of mTileCandidates, read in order
+        std::vector<GridCell>   mGrid;              // Accepted point per cell, far away if empty
+        std::vector<uint32_t>   mSmall;
+        std::vector<uint32_t>   mLarge;
+        std::vector<Float3>     mPoints;
+        TreePlacementStats      mStats;
+    };
+}
@@ -0,0 +1,360 @@
+// TriangleBvh.cpp
+
+#include "TriangleBvh.h"
+#include "MemoryTracker.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+namespace Vnm
+{
+    static const uint32_t kPacketWidth = 4;
+    static const size_t   kQueryBatchSize = 256;
+
+    static uint32_t PacketCount(uint32_t triangles)
+    {
+        return (triangles + kPacketWidth - 1) / kPacketWidth;
+    }
+
+    void TriangleBvh::Build(const OccluderMesh* meshes, size_t numMeshes, ThreadPool* pool)
+    {
+        mStats = TriangleBvhStats();
+        mBounds = Aabb();
+        mNodes.clear();
+        mPackets.clear();
+        mPacketTriangles.clear();
+        mMeshFirstTriangle.resize(numMeshes);
+
+        size_t numTriangles = 0;
+        for (size_t i = 0; i < numMeshes; ++i)
+        {
+            mMeshFirstTriangle[i] = static_cast<uint32_t>(numTriangles);
+            numTriangles += meshes[i].mIndices.size() / 3;
+        }
+        mStats.mTriangles = numTriangles;
+        if (numTriangles == 0)
+        {
+            return;
+        }
+
+        std::vector<Aabb> triangleBounds(numTriangles);
+        for (size_t iMesh = 0; iMesh < numMeshes; ++iMesh)
+        {
+            const OccluderMesh& mesh = meshes[iMesh];
+            const uint32_t firstTriangle = mMeshFirstTriangle[iMesh];
+            ParallelFor(pool, mesh.mIndices.size() / 3, 4096, [&](size_t begin, size_t end)
+            {
+                for (size_t i = begin; i < end; ++i)
+                {
+                    Aabb& bounds = triangleBounds[firstTriangle + i];
+                    for (size_t corner = 0; corner < 3; ++corner)
+                    {
+                        const float* position = &mesh.mPositions[3 * mesh.mIndices[3 * i + corner]];
+                        bounds.Extend(Float3{ position[0], position[1], position[2] });
+                    }
+                }
+            });
+        }
+
+        // Leaves of up to two packets
+        BvhBuildParams params;
+        params.mGroupSize = kPacketWidth;
+        params.mMaxLeafSize = 2 * kPacketWidth;
+        params.mTraversalCost = 1.0f;
+
+        std::vector<uint32_t> triangleOrder;
+        mStats.mMaxDepth = BuildBvh(triangleBounds.data(), numTriangles, params, pool, &mNodes, &triangleOrder);
+        BuildPackets(meshes, triangleOrder, pool);
+
+        mBounds.mMin = mNodes[0].mMin;
+        mBounds.mMax = mNodes[0].mMax;
+        mStats.mNodes = mNodes.size();
+        mStats.mPackets = mPackets.size();
+    }
+
+    // Leaves of BuildBvh count triangles from an offset into triangleOrder, they are rewritten to count packets
+    void TriangleBvh::BuildPackets(const OccluderMesh* meshes, const std::vector<uint32_t>& triangleOrder, ThreadPool* pool)
+    {
+        std::vector<uint32_t> leaves;
+        uint32_t numPackets = 0;
+        for (size_t i = 0; i < mNodes.size(); ++i)
+        {
+            if (mNodes[i].mCount > 0)
+            {
+                leaves.push_back(static_cast<uint32_t>(i));
+                numPackets += PacketCount(mNodes[i].mCount);
+            }
+        }
+        mStats.mLeaves = leaves.size();
+        mPackets.resize(numPackets);
+        mPacketTriangles.resize(numPackets * kPacketWidth);
+
+        // Packet ranges in node order, then filled in parallel
+        std::vector<uint32_t> leafTriangles(leaves.size());
+        std::vector<uint32_t> leafTriangleCounts(leaves.size());
+        uint32_t firstPacket = 0;
+        for (size_t i = 0; i < leaves.size(); ++i)
+        {
+            BvhNode& leaf = mNodes[leaves[i]];
+            leafTriangles[i] = leaf.mFirst;
+            leafTriangleCounts[i] = leaf.mCount;
+            uint32_t packets = PacketCount(leaf.mCount);
+            leaf.mFirst = firstPacket;
+            leaf.mCount = packets;
+            firstPacket += packets;
+        }
+
+        ParallelFor(pool, leaves.size(), 1024, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                const BvhNode& leaf = mNodes[leaves[i]];
+                for (uint32_t slot = 0; slot < leaf.mCount * kPacketWidth; ++slot)
+                {
+                    TrianglePacket& packet = mPackets[leaf.mFirst + slot / kPacketWidth];
+                    const uint32_t lane = slot % kPacketWidth;
+                    if (slot >= leafTriangleCounts[i])
+                    {
+                        for (int axis = 0; axis < 3; ++axis)
+                        {
+                            packet.mVertex[axis][lane] = 0.0f;
+                            packet.mEdge1[axis][lane] = 0.0f;
+                            packet.mEdge2[axis][lane] = 0.0f;
+                        }
+                        mPacketTriangles[leaf.mFirst * kPacketWidth + slot] = RayHit::kNoHit;
+                        continue;
+                    }
+
+                    const uint32_t triangle = triangleOrder[leafTriangles[i] + slot];
+                    const size_t mesh = std::upper_bound(mMeshFirstTriangle.begin(), mMeshFirstTriangle.end(), triangle) - mMeshFirstTriangle.begin() - 1;
+                    const OccluderMesh& source = meshes[mesh];
+                    const uint32_t* indices = &source.mIndices[3 * (triangle - mMeshFirstTriangle[mesh])];
+                    const float* a = &source.mPositions[3 * indices[0]];
+                    const float* b = &source.mPositions[3 * indices[1]];
+                    const float* c = &source.mPositions[3 * indices[2]];
+                    for (int axis = 0; axis < 3; ++axis)
+                    {
+                        packet.mVertex[axis][lane] = a[axis];
+                        packet.mEdge1[axis][lane] = b[axis] - a[axis];
+                        packet.mEdge2[axis][lane] = c[axis] - a[axis];
+                    }
+                    mPacketTriangles[leaf.mFirst * kPacketWidth + slot] = triangle;
+                }
+            }
+        });
+    }
+
+    class PacketRay
+    {
+    public:
+        __m128 mOrigin[3];
+        __m128 mDirection[3];
+    };
+
+    // Moller-Trumbore against four triangles, returns a lane mask of hits inside (tMin, tMax)
+    static int IntersectPacket(const PacketRay& ray, const float (&vertex)[3][4], const float (&edge1)[3][4], const float (&edge2)[3][4],
+        float tMin, float tMax, float* t, float* u, float* v)
+    {
+        const __m128 e1x = _mm_loadu_ps(edge1[0]);
+        const __m128 e1y = _mm_loadu_ps(edge1[1]);
+        const __m128 e1z = _mm_loadu_ps(edge1[2]);
+        const __m128 e2x = _mm_loadu_ps(edge2[0]);
+        const __m128 e2y = _mm_loadu_ps(edge2[1]);
+        const __m128 e2z = _mm_loadu_ps(edge2[2]);
+        const __m128 dx = ray.mDirection[0];
+        const __m128 dy = ray.mDirection[1];
+        const __m128 dz = ray.mDirection[2];
+
+        __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+        __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+        __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+        __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+        __m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+        __m128 sx = _mm_sub_ps(ray.mOrigin[0], _mm_loadu_ps(vertex[0]));
+        __m128 sy = _mm_sub_ps(ray.mOrigin[1], _mm_loadu_ps(vertex[1]));
+        __m128 sz = _mm_sub_ps(ray.mOrigin[2], _mm_loadu_ps(vertex[2]));
+        __m128 laneU = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), invDet);
+
+        __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+        __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+        __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+        __m128 laneV = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+        __m128 laneT = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+
+        // Degenerate lanes give infinite or NaN results, which fail every comparison
+        const __m128 zero = _mm_setzero_ps();
+        __m128 mask = _mm_cmpneq_ps(det, zero);
+        mask = _mm_and_ps(mask, _mm_cmpge_ps(laneU, zero));
+        mask = _mm_and_ps(mask, _mm_cmpge_ps(laneV, zero));
+        mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(laneU, laneV), _mm_set1_ps(1.0f)));
+        mask = _mm_and_ps(mask, _mm_cmpgt_ps(laneT, _mm_set1_ps(tMin)));
+        mask = _mm_and_ps(mask, _mm_cmplt_ps(laneT, _mm_set1_ps(tMax)));
+
+        _mm_storeu_ps(t, laneT);
+        _mm_storeu_ps(u, laneU);
+        _mm_storeu_ps(v, laneV);
+        return _mm_movemask_ps(mask);
+    }
+
+    template <bool anyHit>
+    bool TriangleBvh::Traverse(const Ray& ray, RayHit* hit) const
+    {
+        PacketRay packetRay;
+        packetRay.mOrigin[0] = _mm_set1_ps(ray.mOrigin.x);
+        packetRay.mOrigin[1] = _mm_set1_ps(ray.mOrigin.y);
+        packetRay.mOrigin[2] = _mm_set1_ps(ray.mOrigin.z);
+        packetRay.mDirection[0] = _mm_set1_ps(ray.mDirection.x);
+        packetRay.mDirection[1] = _mm_set1_ps(ray.mDirection.y);
+        packetRay.mDirection[2] = _mm_set1_ps(ray.mDirection.z);
+
+        const float tMin = ray.mMinDistance;
+        float tMax = ray.mMaxDistance;
+        uint32_t hitSlot = RayHit::kNoHit;
+        float hitU = 0.0f;
+        float hitV = 0.0f;
+
+        bool stopped = TraverseBvh(mNodes, ray, &tMax, [&](const BvhNode& leaf, float* leafMax)
+        {
+            for (uint32_t iPacket = leaf.mFirst; iPacket < leaf.mFirst + leaf.mCount; ++iPacket)
+            {
+                const TrianglePacket& packet = mPackets[iPacket];
+                float t[4];
+                float u[4];
+                float v[4];
+                int mask = IntersectPacket(packetRay, packet.mVertex, packet.mEdge1, packet.mEdge2, tMin, *leafMax, t, u, v);
+                if (mask == 0)
+                {
+                    continue;
+                }
+                if (anyHit)
+                {
+                    return true;
+                }
+
+                for (uint32_t lane = 0; lane < kPacketWidth; ++lane)
+                {
+                    if ((mask & (1 << lane)) != 0 && t[lane] < *leafMax)
+                    {
+                        *leafMax = t[lane];
+                        hitU = u[lane];
+                        hitV = v[lane];
+                        hitSlot = iPacket * kPacketWidth + lane;
+                    }
+                }
+            }
+            return false;
+        });
+
+        if (anyHit || hitSlot == RayHit::kNoHit)
+        {
+            return stopped;
+        }
+
+        if (hit != nullptr)
+        {
+            const uint32_t triangle = mPacketTriangles[hitSlot];
+            const size_t mesh = std::upper_bound(mMeshFirstTriangle.begin(), mMeshFirstTriangle.end(), triangle) - mMeshFirstTriangle.begin() - 1;
+            hit->mDistance = tMax;
+            hit->mMesh = static_cast<uint32_t>(mesh);
+            hit->mTriangle = triangle - mMeshFirstTriangle[mesh];
+            hit->mU = hitU;
+            hit->mV = hitV;
+        }
+        return true;
+    }
+
+    bool TriangleBvh::Raycast(const Ray& ray, RayHit* hit) const
+    {
+        return Traverse<false>(ray, hit);
+    }
+
+    bool TriangleBvh::Occluded(const Ray& ray) const
+    {
+        return Traverse<true>(ray, nullptr);
+    }
+
+    void TriangleBvh::Raycast(const Ray* rays, RayHit* hits, size_t count, ThreadPool* pool) const
+    {
+        ParallelFor(pool, count, kQueryBatchSize, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                hits[i] = RayHit();
+                Traverse<false>(rays[i], &hits[i]);
+            }
+        });
+    }
+
+    void TriangleBvh::Occluded(const Ray* rays, uint8_t* occluded, size_t count, ThreadPool* pool) const
+    {
+        ParallelFor(pool, count, kQueryBatchSize, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                occluded[i] = Traverse<true>(rays[i], nullptr) ? 1 : 0;
+            }
+        });
+    }
+
+    size_t TriangleBvh::SnapToSurface(Float3* points, uint8_t* snapped, size_t count, ThreadPool* pool) const
+    {
+        if (mNodes.empty())
+        {
+            memset(snapped, 0, count);
+            return 0;
+        }
+
+        // Straight down from just above the top of the bounds
+        const float top = mBounds.mMax.y + 1.0f;
+        const float maxDistance = mBounds.mMax.y - mBounds.mMin.y + 2.0f;
+        ParallelFor(pool, count, kQueryBatchSize, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                Ray ray;
+                ray.mOrigin = { points[i].x, top, points[i].z };
+                ray.mDirection = { 0.0f, -1.0f, 0.0f };
+                ray.mMaxDistance = maxDistance;
+
+                RayHit hit;
+                snapped[i] = Traverse<false>(ray, &hit) ? 1 : 0;
+                if (snapped[i] != 0)
+                {
+                    points[i].y = top - hit.mDistance;
+                }
+            }
+        });
+
+        size_t numSnapped = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            numSnapped += snapped[i];
+        }
+        return numSnapped;
+    }
+
+    void TriangleBvh::LineOfSight(const Float3* from, const Float3* to, uint8_t* visible, size_t count, ThreadPool* pool) const
+    {
+        // Endpoints on the surface itself do not block
+        const float kEndpointTolerance = 1e-4f;
+        ParallelFor(pool, count, kQueryBatchSize, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                Ray ray;
+                ray.mOrigin = from[i];
+                ray.mDirection = to[i] - from[i];
+                ray.mMinDistance = kEndpointTolerance;
+                ray.mMaxDistance = 1.0f - kEndpointTolerance;
+                visible[i] = Traverse<true>(ray, nullptr) ? 0 : 1;
+            }
+        });
+    }
+
+    uint64_t TriangleBvh::GetMemorySize() const
+    {
+        return GetVectorBytes(mNodes) + GetVectorBytes(mPackets) + GetVectorBytes(mPacketTriangles) + GetVectorBytes(mMeshFirstTriangle);
+    }
+}
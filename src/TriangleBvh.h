@@ -0,0 +1,90 @@
+// TriangleBvh.h
+
+#pragma once
+
+#include "Bvh.h"
+#include "SoftwareOcclusion.h"
+#include <stdint.h>
+#include <vector>
+
+namespace Vnm
+{
+    class RayHit
+    {
+    public:
+        static const uint32_t kNoHit = 0xffffffff;
+
+        float    mDistance = 1e30f;
+        uint32_t mMesh = kNoHit;
+        uint32_t mTriangle = kNoHit;        // Index of the triangle within mMesh
+        float    mU = 0.0f;                 // Barycentrics of the second and third vertices
+        float    mV = 0.0f;
+
+        bool IsHit() const { return mTriangle != kNoHit; }
+    };
+
+    class TriangleBvhStats
+    {
+    public:
+        size_t mTriangles = 0;
+        size_t mNodes = 0;
+        size_t mLeaves = 0;
+        size_t mPackets = 0;
+        uint32_t mMaxDepth = 0;
+    };
+
+    // Bounding volume hierarchy over static triangle meshes for ray queries, see BuildBvh. Leaves hold
+    // packets of four triangles that are intersected with SSE at once. Triangles are two sided.
+    class TriangleBvh
+    {
+    public:
+        // pool may be null to build on the calling thread
+        void Build(const OccluderMesh* meshes, size_t numMeshes, ThreadPool* pool);
+
+        // Closest hit, returns false and leaves hit untouched on a miss
+        bool Raycast(const Ray& ray, RayHit* hit) const;
+
+        // True if anything is hit closer than mMaxDistance
+        bool Occluded(const Ray& ray) const;
+
+        // Batched queries, split over pool if it is not null
+        void Raycast(const Ray* rays, RayHit* hits, size_t count, ThreadPool* pool) const;
+        void Occluded(const Ray* rays, uint8_t* occluded, size_t count, ThreadPool* pool) const;
+
+        // Moves points vertically onto the highest surface above or below them, returns how many had
+        // surface to snap to. Points outside the surface are left alone and flagged 0 in snapped.
+        size_t SnapToSurface(Float3* points, uint8_t* snapped, size_t count, ThreadPool* pool) const;
+
+        // visible is 1 where nothing lies on the segment between from and to
+        void LineOfSight(const Float3* from, const Float3* to, uint8_t* visible, size_t count, ThreadPool* pool) const;
+
+        const Aabb&             GetBounds() const { return mBounds; }
+        const TriangleBvhStats& GetStats() const { return mStats; }
+
+        // Bytes held by the nodes and packets
+        uint64_t GetMemorySize() const;
+
+    private:
+        // Four triangles as structure of arrays, unused lanes are degenerate and never hit
+        class TrianglePacket
+        {
+        public:
+            float mVertex[3][4];
+            float mEdge1[3][4];
+            float mEdge2[3][4];
+        };
+
+        void BuildPackets(const OccluderMesh* meshes, const std::vector<uint32_t>& triangleOrder, ThreadPool* pool);
+
+        template <bool anyHit>
+        bool Traverse(const Ray& ray, RayHit* hit) const;
+
+        std::vector<BvhNode>        mNodes;             // Leaves count packets
+        std::vector<TrianglePacket> mPackets;
+        std::vector<uint32_t>       mPacketTriangles;   // Global triangle of each packet lane
+        std::vector<uint32_t>       mMeshFirstTriangle; // Global index of the first triangle of each mesh
+
+        Aabb                        mBounds;
+        TriangleBvhStats            mStats;
+    };
+}
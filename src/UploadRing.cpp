@@ -0,0 +1,66 @@
+// UploadRing.cpp
+
+#include "UploadRing.h"
+#include <cassert>
+
+namespace Vnm
+{
+    static uint64_t AlignUp(uint64_t value, uint64_t alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    void UploadRing::Init(uint64_t size)
+    {
+        mSize = size;
+        mHead = 0;
+        mUsedBytes = 0;
+        mAllocations.clear();
+    }
+
+    bool UploadRing::Allocate(uint64_t size, uint64_t alignment, uint64_t* offset)
+    {
+        assert(size > 0 && alignment > 0 && offset != nullptr);
+        if (mAllocations.empty())
+        {
+            mHead = 0;
+        }
+
+        // Used space is [tail, head), or wraps around the end of the buffer if head is below tail
+        const uint64_t tail = mAllocations.empty() ? 0 : mAllocations.front().mBegin;
+        const bool wrapped = !mAllocations.empty() && mHead <= tail;
+        uint64_t begin = AlignUp(mHead, alignment);
+        if (wrapped)
+        {
+            if (begin + size > tail)
+            {
+                return false;
+            }
+        }
+        else if (begin + size > mSize)
+        {
+            // Skip the end of the buffer and start again from the beginning, the start of an empty
+            // buffer is already where begin is
+            if (mAllocations.empty() || size > tail)
+            {
+                return false;
+            }
+            begin = 0;
+        }
+
+        const uint64_t end = begin + size;
+        mUsedBytes += (begin >= mHead ? begin - mHead : mSize - mHead) + size;
+        mAllocations.push_back({ mHead, end });
+        mHead = end;
+        *offset = begin;
+        return true;
+    }
+
+    void UploadRing::FreeOldest()
+    {
+        assert(!mAllocations.empty());
+        const Allocation& oldest = mAllocations.front();
+        mUsedBytes -= oldest.mEnd >= oldest.mBegin ? oldest.mEnd - oldest.mBegin : mSize - oldest.mBegin + oldest.mEnd;
+        mAllocations.pop_front();
+    }
+}
@@ -0,0 +1,40 @@
+// UploadRing.h
+
+#pragma once
+
+#include <deque>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Vnm
+{
+    // Allocates ranges of an upload buffer of fixed size in a ring. Allocations are freed in the
+    // order they were made, once the GPU is done copying from them. Only offsets are managed, the
+    // caller owns the memory.
+    class UploadRing
+    {
+    public:
+        void Init(uint64_t size);
+
+        // Returns false if size bytes do not fit until older allocations are freed
+        bool Allocate(uint64_t size, uint64_t alignment, uint64_t* offset);
+        void FreeOldest();
+
+        uint64_t GetSize() const { return mSize; }
+        uint64_t GetUsedBytes() const { return mUsedBytes; }   // Including alignment padding
+        size_t   GetAllocationCount() const { return mAllocations.size(); }
+
+    private:
+        class Allocation
+        {
+        public:
+            uint64_t mBegin;
+            uint64_t mEnd;
+        };
+
+        uint64_t               mSize = 0;
+        uint64_t               mHead = 0;      // Where the next allocation starts looking
+        uint64_t               mUsedBytes = 0;
+        std::deque<Allocation> mAllocations;   // Oldest first
+    };
+}
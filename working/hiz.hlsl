@@ -0,0 +1,109 @@
+// hiz.hlsl
+
+#include "../src/HiZCulling.h"
+
+// Builds one level of the max-depth pyramid from the level above it, level 1 reads the depth buffer
+cbuffer HiZDownsampleConstants : register(b1)
+{
+    uint2 gSourceSize;
+    uint2 gDestSize;
+};
+
+Texture2D<float>   gSource : register(t0);
+RWTexture2D<float> gDest : register(u0);
+
+[numthreads(8, 8, 1)]
+void CsHiZDownsample(uint3 id : SV_DispatchThreadID)
+{
+    if (id.x >= gDestSize.x || id.y >= gDestSize.y)
+    {
+        return;
+    }
+
+    uint endX = HiZFootprintEnd(id.x, gSourceSize.x, gDestSize.x);
+    uint endY = HiZFootprintEnd(id.y, gSourceSize.y, gDestSize.y);
+
+    float maxDepth = 0.0;
+    for (uint y = 2 * id.y; y <= endY; ++y)
+    {
+        for (uint x = 2 * id.x; x <= endX; ++x)
+        {
+            maxDepth = max(maxDepth, gSource.Load(int3(x, y, 0)));
+        }
+    }
+
+    gDest[id.xy] = maxDepth;
+}
+
+// Tests instance bounding spheres against the pyramid of the previous frame and appends the
+// indices of visible instances
+cbuffer HiZCullConstants : register(b0)
+{
+    float4x4 gView;        // View the pyramid was rendered with
+    float4   gProjection;  // _11, _22, _33 and _43 of the projection matrix
+    float    gNearZ;
+    uint     gDepthWidth;
+    uint     gDepthHeight;
+    uint     gLevelCount;  // Including the depth buffer, texture mip n is pyramid level n + 1. 0 disables the test
+    uint     gInstanceCount;
+};
+
+Texture2D<float>         gHiZ : register(t2);
+StructuredBuffer<float4> gInstanceSpheres : register(t1);  // World space center and radius
+RWStructuredBuffer<uint> gVisibleInstances : register(u1);
+RWByteAddressBuffer      gVisibleCount : register(u2);
+
+[numthreads(64, 1, 1)]
+void CsHiZCull(uint3 id : SV_DispatchThreadID)
+{
+    if (id.x >= gInstanceCount)
+    {
+        return;
+    }
+
+    float4 sphere = gInstanceSpheres[id.x];
+    float3 center = mul(gView, float4(sphere.xyz, 1.0)).xyz;
+
+    bool visible = true;
+    float minU;
+    float minV;
+    float maxU;
+    float maxV;
+    float nearestDepth;
+    if (gLevelCount > 0 && HiZProjectSphere(center.x, center.y, center.z, sphere.w,
+        gProjection.x, gProjection.y, gProjection.z, gProjection.w, gNearZ,
+        minU, minV, maxU, maxV, nearestDepth))
+    {
+        if (HiZRectOffscreen(minU, minV, maxU, maxV))
+        {
+            visible = false;
+        }
+        else
+        {
+            uint x0 = HiZTexelCoord(minU, gDepthWidth);
+            uint y0 = HiZTexelCoord(minV, gDepthHeight);
+            uint x1 = HiZTexelCoord(maxU, gDepthWidth);
+            uint y1 = HiZTexelCoord(maxV, gDepthHeight);
+            uint level = HiZSelectLevel(x0, y0, x1, y1, 1, gLevelCount);
+
+            uint levelX0 = HiZLevelTexel(x0, gDepthWidth, level);
+            uint levelY0 = HiZLevelTexel(y0, gDepthHeight, level);
+            uint levelX1 = HiZLevelTexel(x1, gDepthWidth, level);
+            uint levelY1 = HiZLevelTexel(y1, gDepthHeight, level);
+            int mip = int(level) - 1;
+
+            visible = HiZIsVisible(nearestDepth,
+                gHiZ.Load(int3(levelX0, levelY0, mip)),
+                gHiZ.Load(int3(levelX1, levelY0, mip)),
+                gHiZ.Load(int3(levelX0, levelY1, mip)),
+                gHiZ.Load(int3(levelX1, levelY1, mip)));
+        }
+    }
+
+    if (visible)
+    {
+        uint index;
+        gVisibleCount.InterlockedAdd(0, 1, index);
+        gVisibleInstances[index] = id.x;
+    }
+}
@@ -0,0 +1,102 @@
+// indirect.hlsl
+
+// Compaction of the indirect argument buffer, the GPU side of Vnm::IndirectDrawCompactor
+
+// Must match Vnm::IndirectDrawCommand, 16 uints
+struct IndirectDrawCommand
+{
+    uint  instanceOffset;
+    uint  material;
+    uint2 vertexBufferLocation;
+    uint  vertexBufferSize;
+    uint  vertexBufferStride;
+    uint2 indexBufferLocation;
+    uint  indexBufferSize;
+    uint  indexBufferFormat;
+    uint  indexCountPerInstance;
+    uint  instanceCount;
+    uint  startIndexLocation;
+    int   baseVertexLocation;
+    uint  startInstanceLocation;
+    uint  pad;
+};
+
+// Must match Vnm::IndirectModelRange
+struct IndirectModelRange
+{
+    uint firstInstance;
+    uint endInstance;
+};
+
+// Must match Vnm::IndirectCommandInfo
+struct IndirectCommandInfo
+{
+    uint model;
+    uint pipeline;
+    uint regionBase;
+    uint pad;
+};
+
+cbuffer IndirectCompactConstants : register(b0)
+{
+    uint gInstanceCount;
+    uint gTemplateCount;
+};
+
+StructuredBuffer<uint>                  gVisibleInstances : register(t0);
+ByteAddressBuffer                       gVisibleCount : register(t1);
+StructuredBuffer<uint>                  gInstanceModels : register(t2);  // Model of each instance, ~0 if none
+StructuredBuffer<IndirectModelRange>    gModels : register(t3);
+StructuredBuffer<IndirectDrawCommand>   gTemplates : register(t4);
+StructuredBuffer<IndirectCommandInfo>   gInfos : register(t5);
+
+RWByteAddressBuffer                     gModelCounts : register(u0);
+RWStructuredBuffer<uint>                gInstanceIndices : register(u1);
+RWByteAddressBuffer                     gPipelineCounts : register(u2);
+RWStructuredBuffer<IndirectDrawCommand> gCommands : register(u3);
+
+// Appends each visible instance to its model's region of the instance index buffer
+[numthreads(64, 1, 1)]
+void CsBinInstances(uint3 id : SV_DispatchThreadID)
+{
+    if (id.x >= gVisibleCount.Load(0))
+    {
+        return;
+    }
+
+    uint instance = gVisibleInstances[id.x];
+    uint model = instance < gInstanceCount ? gInstanceModels[instance] : 0xffffffff;
+    if (model == 0xffffffff)
+    {
+        return;
+    }
+
+    uint slot;
+    gModelCounts.InterlockedAdd(model * 4, 1, slot);
+    gInstanceIndices[gModels[model].firstInstance + slot] = instance;
+}
+
+// Copies each template whose model has visible instances to its pipeline's region of the command
+// buffer, with the instance count patched in
+[numthreads(64, 1, 1)]
+void CsCompactCommands(uint3 id : SV_DispatchThreadID)
+{
+    if (id.x >= gTemplateCount)
+    {
+        return;
+    }
+
+    IndirectCommandInfo info = gInfos[id.x];
+    uint instanceCount = gModelCounts.Load(info.model * 4);
+    if (instanceCount == 0)
+    {
+        return;
+    }
+
+    IndirectDrawCommand command = gTemplates[id.x];
+    command.instanceCount = instanceCount;
+
+    uint slot;
+    gPipelineCounts.InterlockedAdd(info.pipeline * 4, 1, slot);
+    gCommands[info.regionBase + slot] = command;
+}
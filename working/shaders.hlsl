@@ -14,6 +14,31 @@ cbuffer OffsetBuffer : register(b1)
 Texture2D gTexture : register(t0);
 SamplerState gSampler : register(s0);
 
+#ifdef INDIRECT
+// Indirect draws read per instance data from buffers, set by the command signature
+cbuffer IndirectConstants : register(b2)
+{
+    uint gInstanceOffset;  // First entry of the model's region in gInstanceIndices
+    uint gMaterial;        // Index into gTextures
+};
+
+// Layout of OffsetBuffer, one 256 byte constant buffer slot per instance
+struct InstanceData
+{
+    float4x4 worldViewProj;
+    float4x4 world;
+    float4   pad[8];
+};
+
+StructuredBuffer<InstanceData> gInstances : register(t1);
+StructuredBuffer<uint> gInstanceIndices : register(t2);
+Texture2D gTextures[MAX_TEXTURES] : register(t3);
+
+#define SAMPLE_TEXTURE(texcoords) gTextures[gMaterial].Sample(gSampler, texcoords)
+#else
+#define SAMPLE_TEXTURE(texcoords) gTexture.Sample(gSampler, texcoords)
+#endif
+
 struct PsInput
 {
     float4 position  : SV_POSITION;
@@ -23,16 +48,16 @@ struct PsInput
 
 static const float4 SkyColor = float4(0.8f, 0.85f, 1.0f, 1.0f);
 
-PsInput VsMain(float3 position : POSITION, float3 normal : NORMAL, float3 tangent : TANGENT, float2 texcoords : TEXCOORD)
+PsInput TransformVertex(float3 position, float3 normal, float2 texcoords, float4x4 worldViewProj, float4x4 world)
 {
     PsInput result;
 
-    result.position = mul(instanceWorldViewProj, float4(position, 1.0));
+    result.position = mul(worldViewProj, float4(position, 1.0));
 
     const float4 SunColor = float4(1.0, 1.0, 1.0, 1.0);
     const float4 AmbientColor = float4(0.25, 0.25, 0.25, 0.25);
  
-    float3 worldNormal = mul(instanceWorld, float4(normal, 0.0)).xyz;
+    float3 worldNormal = mul(world, float4(normal, 0.0)).xyz;
     float4 light = lerp(AmbientColor,
                         SunColor,
                         saturate(dot(worldNormal, normalize(float3(1.0, 1.0, 1.0))).xxxx));
@@ -44,15 +69,53 @@ PsInput VsMain(float3 position : POSITION, float3 normal : NORMAL, float3 tangen
     return result;
 }
 
+#ifdef INDIRECT
+PsInput VsMain(float3 position : POSITION, float3 normal : NORMAL, float3 tangent : TANGENT, float2 texcoords : TEXCOORD, uint instanceId : SV_InstanceID)
+{
+    InstanceData instance = gInstances[gInstanceIndices[gInstanceOffset + instanceId]];
+    return TransformVertex(position, normal, texcoords, instance.worldViewProj, instance.world);
+}
+#else
+PsInput VsMain(float3 position : POSITION, float3 normal : NORMAL, float3 tangent : TANGENT, float2 texcoords : TEXCOORD)
+{
+    return TransformVertex(position, normal, texcoords, instanceWorldViewProj, instanceWorld);
+}
+#endif
+
+static const float AlphaTestThreshold = 0.1;
+
+float4 ApplyLightingAndFog(PsInput input, float4 texCol)
+{
+    float4 output = input.color * texCol;
+    output = lerp(output, SkyColor, pow(input.position.z, 256.0));
+    return output;
+}
+
+// Alpha-tested geometry
 float4 PsMain(PsInput input) : SV_TARGET
 {
-    float4 texCol = gTexture.Sample(gSampler, input.texcoords);
-    if (texCol.a  < 0.1)
+    float4 texCol = SAMPLE_TEXTURE(input.texcoords);
+    if (texCol.a  < AlphaTestThreshold)
     {
         discard;
     }
     
-    float4 output = input.color * texCol;
-    output = lerp(output, SkyColor, pow(input.position.z, 256.0));
-    return output;
+    return ApplyLightingAndFog(input, texCol);
+}
+
+// Opaque geometry, without discard so early depth testing is not disabled
+float4 PsOpaque(PsInput input) : SV_TARGET
+{
+    float4 texCol = SAMPLE_TEXTURE(input.texcoords);
+    return ApplyLightingAndFog(input, texCol);
+}
+
+// Depth pre-pass for alpha-tested geometry
+void PsAlphaTestDepth(PsInput input)
+{
+    float texAlpha = SAMPLE_TEXTURE(input.texcoords).a;
+    if (texAlpha < AlphaTestThreshold)
+    {
+        discard;
+    }
 }